@@ -115,6 +115,12 @@ struct unit_times {
         usec_t time;
 };
 
+struct generator_times {
+        const char *name;
+        usec_t time;
+        int reused;
+};
+
 struct host_info {
         char *hostname;
         char *kernel_name;
@@ -190,6 +196,11 @@ static int compare_unit_time(const void *a, const void *b) {
                        ((struct unit_times *)a)->time);
 }
 
+static int compare_generator_time(const void *a, const void *b) {
+        return compare(((struct generator_times *)b)->time,
+                       ((struct generator_times *)a)->time);
+}
+
 static int compare_unit_start(const void *a, const void *b) {
         return compare(((struct unit_times *)a)->activating,
                        ((struct unit_times *)b)->activating);
@@ -1010,6 +1021,8 @@ static int analyze_blame(sd_bus *bus) {
 
 static int analyze_time(sd_bus *bus) {
         _cleanup_free_ char *buf = NULL;
+        char ts[FORMAT_TIMESPAN_MAX];
+        usec_t saved = 0;
         int r;
 
         r = pretty_boot_time(bus, &buf);
@@ -1017,6 +1030,70 @@ static int analyze_time(sd_bus *bus) {
                 return r;
 
         puts(buf);
+
+        /* Older managers do not know this, hence don't complain */
+        r = sd_bus_get_property_trivial(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "UnitsParseSavedUSec",
+                        NULL,
+                        't', &saved);
+        if (r >= 0 && saved > 0)
+                printf("Reading unit files in parallel saved %s.\n", format_timespan(ts, sizeof(ts), saved, USEC_PER_MSEC));
+
+        return 0;
+}
+
+static int analyze_generators(sd_bus *bus) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *reply = NULL;
+        _cleanup_(sd_bus_error_free) sd_bus_error error = SD_BUS_ERROR_NULL;
+        _cleanup_free_ struct generator_times *times = NULL;
+        size_t n_allocated = 0, n = 0, i;
+        struct generator_times t;
+        int r;
+
+        r = sd_bus_get_property(
+                        bus,
+                        "org.freedesktop.systemd1",
+                        "/org/freedesktop/systemd1",
+                        "org.freedesktop.systemd1.Manager",
+                        "Generators",
+                        &error,
+                        &reply,
+                        "a(stb)");
+        if (r < 0) {
+                log_error("Failed to get generators: %s", bus_error_message(&error, -r));
+                return r;
+        }
+
+        r = sd_bus_message_enter_container(reply, 'a', "(stb)");
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        while ((r = sd_bus_message_read(reply, "(stb)", &t.name, &t.time, &t.reused)) > 0) {
+                if (!GREEDY_REALLOC(times, n_allocated, n + 1))
+                        return log_oom();
+
+                times[n++] = t;
+        }
+        if (r < 0)
+                return bus_log_parse_error(r);
+
+        qsort_safe(times, n, sizeof(struct generator_times), compare_generator_time);
+
+        pager_open_if_enabled();
+
+        for (i = 0; i < n; i++) {
+                char ts[FORMAT_TIMESPAN_MAX];
+
+                if (times[i].reused)
+                        printf("%16s %s\n", "(reused)", times[i].name);
+                else
+                        printf("%16s %s\n", format_timespan(ts, sizeof(ts), times[i].time, USEC_PER_MSEC), times[i].name);
+        }
+
         return 0;
 }
 
@@ -1307,6 +1384,7 @@ static void help(void) {
                "Commands:\n"
                "  time                    Print time spent in the kernel\n"
                "  blame                   Print list of running units ordered by time to init\n"
+               "  generators              Print list of generators ordered by time they ran\n"
                "  critical-chain          Print a tree of the time critical chain of units\n"
                "  plot                    Output SVG graphic showing service initialization\n"
                "  dot                     Output dependency graph in dot(1) format\n"
@@ -1468,6 +1546,8 @@ int main(int argc, char *argv[]) {
                         r = analyze_time(bus);
                 else if (streq(argv[optind], "blame"))
                         r = analyze_blame(bus);
+                else if (streq(argv[optind], "generators"))
+                        r = analyze_generators(bus);
                 else if (streq(argv[optind], "critical-chain"))
                         r = analyze_critical_chain(bus, argv+optind+1);
                 else if (streq(argv[optind], "plot"))
@@ -91,8 +91,6 @@ void mempool_free_tile(struct mempool *mp, void *p) {
         mp->freelist = p;
 }
 
-#ifdef VALGRIND
-
 void mempool_drop(struct mempool *mp) {
         struct pool *p = mp->first_pool;
         while (p) {
@@ -101,6 +99,7 @@ void mempool_drop(struct mempool *mp) {
                 free(p);
                 p = n;
         }
-}
 
-#endif
+        mp->first_pool = NULL;
+        mp->freelist = NULL;
+}
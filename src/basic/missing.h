@@ -50,6 +50,10 @@
 #include <linux/btrfs.h>
 #endif
 
+#ifdef HAVE_SYS_PIDFD_H
+#include <sys/pidfd.h>
+#endif
+
 #include "macro.h"
 
 #ifndef RLIMIT_RTTIME
@@ -217,6 +221,66 @@ static inline int getrandom(void *buffer, size_t count, unsigned flags) {
 #define GRND_RANDOM 0x0002
 #endif
 
+#ifndef __NR_io_uring_setup
+#  if defined __alpha__
+#    define __NR_io_uring_setup 535
+#  elif defined _MIPS_SIM
+#    if _MIPS_SIM == _MIPS_SIM_ABI32
+#      define __NR_io_uring_setup 4425
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_NABI32
+#      define __NR_io_uring_setup 6425
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_ABI64
+#      define __NR_io_uring_setup 5425
+#    endif
+#  else
+#    define __NR_io_uring_setup 425
+#  endif
+#endif
+
+#ifndef __NR_io_uring_enter
+#  if defined __alpha__
+#    define __NR_io_uring_enter 536
+#  elif defined _MIPS_SIM
+#    if _MIPS_SIM == _MIPS_SIM_ABI32
+#      define __NR_io_uring_enter 4426
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_NABI32
+#      define __NR_io_uring_enter 6426
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_ABI64
+#      define __NR_io_uring_enter 5426
+#    endif
+#  else
+#    define __NR_io_uring_enter 426
+#  endif
+#endif
+
+#ifndef __NR_pidfd_open
+#  if defined __alpha__
+#    define __NR_pidfd_open 544
+#  elif defined _MIPS_SIM
+#    if _MIPS_SIM == _MIPS_SIM_ABI32
+#      define __NR_pidfd_open 4434
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_NABI32
+#      define __NR_pidfd_open 6434
+#    endif
+#    if _MIPS_SIM == _MIPS_SIM_ABI64
+#      define __NR_pidfd_open 5434
+#    endif
+#  else
+#    define __NR_pidfd_open 434
+#  endif
+#endif
+
+#if !HAVE_DECL_PIDFD_OPEN
+static inline int pidfd_open(pid_t pid, unsigned flags) {
+        return syscall(__NR_pidfd_open, pid, flags);
+}
+#endif
+
 #ifndef BTRFS_IOCTL_MAGIC
 #define BTRFS_IOCTL_MAGIC 0x94
 #endif
@@ -179,6 +179,20 @@ int files_same(const char *filea, const char *fileb) {
                a.st_ino == b.st_ino;
 }
 
+bool mtime_is_racy(usec_t mtime, usec_t timestamp) {
+
+        /* Whether a file with this mtime, read at the given time, might
+         * have been changed once more afterwards without its mtime
+         * changing, as file systems with coarse timestamps may only
+         * tick once a second. What was read then can't be told apart
+         * from later contents by the mtime. */
+
+        if (timestamp == USEC_INFINITY)
+                return false;
+
+        return mtime == 0 || mtime + USEC_PER_SEC >= timestamp;
+}
+
 bool is_fs_type(const struct statfs *s, statfs_f_type_t magic_value) {
         assert(s);
         assert_cc(sizeof(statfs_f_type_t) >= sizeof(s->f_type));
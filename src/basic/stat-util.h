@@ -29,6 +29,7 @@
 #include <sys/vfs.h>
 
 #include "macro.h"
+#include "time-util.h"
 
 int is_symlink(const char *path);
 int is_dir(const char *path, bool follow);
@@ -53,6 +54,8 @@ int path_is_os_tree(const char *path);
 
 int files_same(const char *filea, const char *fileb);
 
+bool mtime_is_racy(usec_t mtime, usec_t timestamp) _const_;
+
 /* The .f_type field of struct statfs is really weird defined on
  * different archs. Let's give its type a name. */
 typedef typeof(((struct statfs*)NULL)->f_type) statfs_f_type_t;
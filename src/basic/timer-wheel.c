@@ -0,0 +1,310 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+/*
+ * Timer Wheel
+ * A hierarchical timer wheel orders entries by a usec_t key, like a prioq
+ * would, but insertion and removal are O(1). Keys are counted in ticks
+ * relative to the current base tick. Each level has 64 slots, each covering
+ * 64 times the range of a slot on the level below. An entry goes onto the
+ * level of the highest 6-bit group its tick differs from the base in. Since
+ * all entries are at or after the base, the first occupied slot of the
+ * lowest occupied level always holds the smallest keys. Each slot caches
+ * its minimum key, so that peeking is O(1) too, except after the minimum
+ * was removed, where the slot is rescanned once.
+ *
+ * When the base advances, the entries of the slots it moves into or past
+ * are sorted in again relative to the new base, which moves them down a
+ * level or into the first slot, like a clock carrying over. Each entry is
+ * moved at most once per level.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "alloc-util.h"
+#include "timer-wheel.h"
+#include "util.h"
+
+#define LEVEL_BITS 6
+#define LEVEL_SLOTS (1U << LEVEL_BITS)
+#define LEVELS ((64 - TIMER_WHEEL_TICK_BITS + LEVEL_BITS - 1) / LEVEL_BITS)
+
+struct timer_wheel_slot {
+        LIST_HEAD(TimerWheelEntry, entries);
+        usec_t min;
+};
+
+struct TimerWheel {
+        uint64_t base;
+        unsigned n_entries;
+
+        uint64_t occupied[LEVELS];
+
+        /* Slots whose minimum was removed and needs to be looked
+         * for again */
+        uint64_t dirty[LEVELS];
+
+        struct timer_wheel_slot slots[LEVELS][LEVEL_SLOTS];
+};
+
+TimerWheel *timer_wheel_new(void) {
+        return new0(TimerWheel, 1);
+}
+
+TimerWheel *timer_wheel_free(TimerWheel *w) {
+        free(w);
+        return NULL;
+}
+
+int timer_wheel_ensure_allocated(TimerWheel **w) {
+        assert(w);
+
+        if (*w)
+                return 0;
+
+        *w = timer_wheel_new();
+        if (!*w)
+                return -ENOMEM;
+
+        return 0;
+}
+
+static unsigned timer_wheel_locate(TimerWheel *w, usec_t key) {
+        uint64_t tick;
+        unsigned level;
+
+        tick = key >> TIMER_WHEEL_TICK_BITS;
+
+        /* Everything that is already due shares the current slot */
+        if (tick <= w->base)
+                return (unsigned) (w->base & (LEVEL_SLOTS - 1));
+
+        level = u64log2(tick ^ w->base) / LEVEL_BITS;
+
+        return level * LEVEL_SLOTS + (unsigned) ((tick >> (level * LEVEL_BITS)) & (LEVEL_SLOTS - 1));
+}
+
+void timer_wheel_put(TimerWheel *w, TimerWheelEntry *e, usec_t key) {
+        struct timer_wheel_slot *s;
+        unsigned level, idx;
+        uint64_t bit;
+
+        assert(w);
+        assert(e);
+        assert(e->slot == TIMER_WHEEL_SLOT_NULL);
+
+        e->key = key;
+        e->slot = timer_wheel_locate(w, key);
+
+        level = e->slot / LEVEL_SLOTS;
+        idx = e->slot % LEVEL_SLOTS;
+        bit = UINT64_C(1) << idx;
+        s = &w->slots[level][idx];
+
+        if (!(w->occupied[level] & bit)) {
+                w->occupied[level] |= bit;
+                w->dirty[level] &= ~bit;
+                s->min = key;
+        } else if (key < s->min)
+                s->min = key;
+
+        LIST_PREPEND(entries, s->entries, e);
+        w->n_entries++;
+}
+
+void timer_wheel_remove(TimerWheel *w, TimerWheelEntry *e) {
+        struct timer_wheel_slot *s;
+        unsigned level, idx;
+        uint64_t bit;
+
+        assert(e);
+
+        if (e->slot == TIMER_WHEEL_SLOT_NULL)
+                return;
+
+        assert(w);
+
+        level = e->slot / LEVEL_SLOTS;
+        idx = e->slot % LEVEL_SLOTS;
+        bit = UINT64_C(1) << idx;
+        s = &w->slots[level][idx];
+
+        LIST_REMOVE(entries, s->entries, e);
+        e->slot = TIMER_WHEEL_SLOT_NULL;
+
+        assert(w->n_entries > 0);
+        w->n_entries--;
+
+        if (!s->entries) {
+                w->occupied[level] &= ~bit;
+                w->dirty[level] &= ~bit;
+        } else if (e->key <= s->min)
+                w->dirty[level] |= bit;
+}
+
+static struct timer_wheel_slot *timer_wheel_first(TimerWheel *w, unsigned *ret_level, uint64_t *ret_bit) {
+        unsigned level, idx;
+
+        assert(w);
+
+        for (level = 0; level < LEVELS; level++) {
+                if (!w->occupied[level])
+                        continue;
+
+                idx = (unsigned) __builtin_ctzll(w->occupied[level]);
+
+                *ret_level = level;
+                *ret_bit = UINT64_C(1) << idx;
+                return &w->slots[level][idx];
+        }
+
+        return NULL;
+}
+
+usec_t timer_wheel_peek(TimerWheel *w) {
+        struct timer_wheel_slot *s;
+        TimerWheelEntry *e;
+        unsigned level;
+        uint64_t bit;
+
+        if (!w)
+                return USEC_INFINITY;
+
+        s = timer_wheel_first(w, &level, &bit);
+        if (!s)
+                return USEC_INFINITY;
+
+        if (w->dirty[level] & bit) {
+                s->min = USEC_INFINITY;
+                LIST_FOREACH(entries, e, s->entries)
+                        s->min = MIN(s->min, e->key);
+
+                w->dirty[level] &= ~bit;
+        }
+
+        return s->min;
+}
+
+TimerWheelEntry *timer_wheel_first_due(TimerWheel *w, usec_t n) {
+        struct timer_wheel_slot *s;
+        TimerWheelEntry *e;
+        unsigned level;
+        uint64_t bit;
+        usec_t min;
+
+        /* Returns some entry with a key <= n, if there is any. Only
+         * the first slot needs to be looked at, everything in later
+         * slots has larger keys. */
+
+        if (!w)
+                return NULL;
+
+        s = timer_wheel_first(w, &level, &bit);
+        if (!s)
+                return NULL;
+
+        if (!(w->dirty[level] & bit) && s->min > n)
+                return NULL;
+
+        min = USEC_INFINITY;
+        LIST_FOREACH(entries, e, s->entries) {
+                if (e->key <= n)
+                        return e;
+
+                min = MIN(min, e->key);
+        }
+
+        /* We looked at everything anyway */
+        s->min = min;
+        w->dirty[level] &= ~bit;
+
+        return NULL;
+}
+
+void timer_wheel_advance(TimerWheel *w, usec_t n) {
+        LIST_HEAD(TimerWheelEntry, moved) = NULL;
+        TimerWheelEntry *e;
+        uint64_t tick;
+        unsigned level;
+
+        if (!w)
+                return;
+
+        tick = n >> TIMER_WHEEL_TICK_BITS;
+
+        /* If the clock went backwards we stay where we are, new
+         * entries before the base will share its slot */
+        if (tick <= w->base)
+                return;
+
+        /* Take everything out of the slots the base moves past or
+         * into. The slots after the new base stay where they are,
+         * they are on the same level relative to it. */
+        for (level = 0; level < LEVELS; level++) {
+                unsigned shift = level * LEVEL_BITS, idx;
+                uint64_t mask;
+
+                if (!w->occupied[level])
+                        continue;
+
+                if ((tick >> (shift + LEVEL_BITS)) != (w->base >> (shift + LEVEL_BITS)))
+                        mask = UINT64_MAX;
+                else {
+                        idx = (unsigned) ((tick >> shift) & (LEVEL_SLOTS - 1));
+
+                        if (level == 0)
+                                /* The new base's own slot can stay */
+                                mask = (UINT64_C(1) << idx) - 1;
+                        else if (idx == LEVEL_SLOTS - 1)
+                                mask = UINT64_MAX;
+                        else
+                                mask = (UINT64_C(1) << (idx + 1)) - 1;
+                }
+
+                mask &= w->occupied[level];
+
+                while (mask) {
+                        idx = (unsigned) __builtin_ctzll(mask);
+                        mask &= mask - 1;
+
+                        while ((e = w->slots[level][idx].entries)) {
+                                timer_wheel_remove(w, e);
+                                LIST_PREPEND(entries, moved, e);
+                        }
+                }
+        }
+
+        w->base = tick;
+
+        /* And sort it in again, anything due now lands in the first
+         * slot */
+        while ((e = moved)) {
+                LIST_REMOVE(entries, moved, e);
+                timer_wheel_put(w, e, e->key);
+        }
+}
+
+unsigned timer_wheel_size(TimerWheel *w) {
+
+        if (!w)
+                return 0;
+
+        return w->n_entries;
+}
@@ -0,0 +1,54 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include "list.h"
+#include "macro.h"
+#include "time-util.h"
+
+typedef struct TimerWheel TimerWheel;
+typedef struct TimerWheelEntry TimerWheelEntry;
+
+/* Keys are sorted into slots of 2^TIMER_WHEEL_TICK_BITS µs */
+#define TIMER_WHEEL_TICK_BITS 10
+#define TIMER_WHEEL_TICK_USEC (UINT64_C(1) << TIMER_WHEEL_TICK_BITS)
+
+#define TIMER_WHEEL_SLOT_NULL ((unsigned) -1)
+
+/* To be embedded in the object that is queued. The slot must be
+ * initialized to TIMER_WHEEL_SLOT_NULL before first use. */
+struct TimerWheelEntry {
+        usec_t key;
+        unsigned slot;
+        LIST_FIELDS(TimerWheelEntry, entries);
+};
+
+TimerWheel *timer_wheel_new(void);
+TimerWheel *timer_wheel_free(TimerWheel *w);
+int timer_wheel_ensure_allocated(TimerWheel **w);
+
+void timer_wheel_put(TimerWheel *w, TimerWheelEntry *e, usec_t key);
+void timer_wheel_remove(TimerWheel *w, TimerWheelEntry *e);
+
+usec_t timer_wheel_peek(TimerWheel *w);
+TimerWheelEntry *timer_wheel_first_due(TimerWheel *w, usec_t n);
+void timer_wheel_advance(TimerWheel *w, usec_t n);
+
+unsigned timer_wheel_size(TimerWheel *w) _pure_;
@@ -109,6 +109,7 @@ static void unmount_autofs(Automount *a) {
          * around */
         if (a->where &&
             (UNIT(a)->manager->exit_code != MANAGER_RELOAD &&
+             UNIT(a)->manager->exit_code != MANAGER_RELOAD_INCREMENTAL &&
              UNIT(a)->manager->exit_code != MANAGER_REEXECUTE)) {
                 r = repeat_unmount(a->where, MNT_DETACH);
                 if (r < 0)
@@ -22,6 +22,7 @@
 #include "sd-bus.h"
 
 #include "alloc-util.h"
+#include "bus-objects.h"
 #include "dbus-job.h"
 #include "dbus.h"
 #include "job.h"
@@ -165,6 +166,12 @@ static int send_removed_signal(sd_bus *bus, void *userdata) {
         if (!p)
                 return -ENOMEM;
 
+        /* Clients should see the final state of the job before it
+         * is gone */
+        r = bus_process_properties_changed_path(bus, p);
+        if (r < 0)
+                log_debug_errno(r, "Failed to flush property changes of %s, ignoring: %m", p);
+
         r = sd_bus_message_new_signal(
                         bus,
                         &m,
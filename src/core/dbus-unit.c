@@ -22,6 +22,7 @@
 #include "sd-bus.h"
 
 #include "alloc-util.h"
+#include "bus-objects.h"
 #include "bus-common-errors.h"
 #include "cgroup-util.h"
 #include "dbus-unit.h"
@@ -935,6 +936,12 @@ static int send_removed_signal(sd_bus *bus, void *userdata) {
         if (!p)
                 return -ENOMEM;
 
+        /* Don't let coalesced property changes trail behind the
+         * removal */
+        r = bus_process_properties_changed_path(bus, p);
+        if (r < 0)
+                log_debug_errno(r, "Failed to flush property changes of %s, ignoring: %m", p);
+
         r = sd_bus_message_new_signal(
                         bus,
                         &m,
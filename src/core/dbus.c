@@ -692,6 +692,10 @@ static int bus_on_connection(sd_event_source *s, int fd, uint32_t revents, void
                 return 0;
         }
 
+        r = sd_bus_set_coalesce_properties(bus, true);
+        if (r < 0)
+                log_warning_errno(r, "Failed to enable coalescing of property changes on new connection, ignoring: %m");
+
         if (m->running_as == MANAGER_SYSTEM) {
                 /* When we run as system instance we get the Released
                  * signal via a direct connection */
@@ -819,6 +823,12 @@ static int bus_setup_api(Manager *m, sd_bus *bus) {
         if (r < 0)
                 log_warning_errno(r, "Failed to enable credential passing, ignoring: %m");
 
+        /* Units tend to change a number of times in a row, merge
+         * the resulting PropertiesChanged signals */
+        r = sd_bus_set_coalesce_properties(bus, true);
+        if (r < 0)
+                log_warning_errno(r, "Failed to enable coalescing of property changes, ignoring: %m");
+
         r = bus_setup_api_vtables(m, bus);
         if (r < 0)
                 return r;
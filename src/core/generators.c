@@ -0,0 +1,665 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/prctl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "copy.h"
+#include "dirent-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "formats-util.h"
+#include "fs-util.h"
+#include "generators.h"
+#include "io-util.h"
+#include "label.h"
+#include "log.h"
+#include "mkdir.h"
+#include "path-util.h"
+#include "process-util.h"
+#include "rm-rf.h"
+#include "signal-util.h"
+#include "stat-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "util.h"
+
+static const char *const output_names[3] = { "normal", "early", "late" };
+
+/* Sent from the executor to PID 1 for each generator that finished */
+typedef struct GeneratorReport {
+        uint32_t index;
+        int32_t code;
+        int32_t status;
+        uint64_t duration;
+} GeneratorReport;
+
+static void generator_input_done(GeneratorInput *i) {
+        i->path = mfree(i->path);
+}
+
+static void generator_inputs_clear(Generator *g) {
+        size_t k;
+
+        for (k = 0; k < g->n_inputs; k++)
+                generator_input_done(g->inputs + k);
+
+        g->inputs = mfree(g->inputs);
+        g->n_inputs = 0;
+
+        generator_input_done(&g->executable);
+        g->cacheable = false;
+}
+
+Generator *generator_free(Generator *g) {
+        if (!g)
+                return NULL;
+
+        generator_inputs_clear(g);
+
+        free(g->directory);
+        free(g->path);
+        free(g->name);
+        free(g);
+
+        return NULL;
+}
+
+Hashmap *generators_free(Hashmap *h) {
+        Generator *g;
+
+        while ((g = hashmap_steal_first(h)))
+                generator_free(g);
+
+        return hashmap_free(h);
+}
+
+static Generator *generator_new(const char *name, const char *path, const char *directory) {
+        Generator *g;
+
+        g = new0(Generator, 1);
+        if (!g)
+                return NULL;
+
+        g->name = strdup(name);
+        g->path = strdup(path);
+        g->directory = strjoin(directory, "/", name, NULL);
+        if (!g->name || !g->path || !g->directory)
+                return generator_free(g);
+
+        return g;
+}
+
+static int generator_input_record(GeneratorInput *i, const char *path, usec_t timestamp) {
+        struct stat st;
+
+        /* The mode is included, as generators might look at the
+         * executable bit, and changing it does not touch the mtime */
+
+        i->path = strdup(path);
+        if (!i->path)
+                return -ENOMEM;
+
+        if (stat(path, &st) < 0) {
+                if (errno != ENOENT)
+                        return -errno;
+
+                i->exists = false;
+                return 0;
+        }
+
+        /* The generator might have seen it before a change that left
+         * the mtime alone */
+        if (mtime_is_racy(timespec_load(&st.st_mtim), timestamp))
+                return -EAGAIN;
+
+        i->exists = true;
+        i->dev = st.st_dev;
+        i->ino = st.st_ino;
+        i->mode = st.st_mode;
+        i->size = st.st_size;
+        i->mtime = timespec_load(&st.st_mtim);
+
+        return 0;
+}
+
+static bool generator_input_unchanged(const GeneratorInput *i) {
+        struct stat st;
+
+        if (stat(i->path, &st) < 0)
+                return errno == ENOENT && !i->exists;
+
+        return i->exists &&
+                i->dev == st.st_dev &&
+                i->ino == st.st_ino &&
+                i->mode == st.st_mode &&
+                i->size == st.st_size &&
+                i->mtime == timespec_load(&st.st_mtim);
+}
+
+static bool generator_unchanged(const Generator *g) {
+        size_t k;
+
+        if (!g->cacheable)
+                return false;
+
+        if (access(g->directory, F_OK) < 0)
+                return false;
+
+        if (!generator_input_unchanged(&g->executable))
+                return false;
+
+        for (k = 0; k < g->n_inputs; k++)
+                if (!generator_input_unchanged(g->inputs + k))
+                        return false;
+
+        return true;
+}
+
+static int generator_read_inputs(Generator *g, usec_t timestamp) {
+        _cleanup_fclose_ FILE *f = NULL;
+        size_t n_allocated = 0;
+        const char *p;
+        int r;
+
+        /* Records the identity of the files the generator declared
+         * as its inputs, so that it need not be run again as long as
+         * they do not change */
+
+        p = strjoina(g->directory, "/inputs");
+        f = fopen(p, "re");
+        if (!f)
+                return errno == ENOENT ? 0 : -errno;
+
+        r = generator_input_record(&g->executable, g->path, timestamp);
+        if (r < 0)
+                return r;
+
+        for (;;) {
+                char line[LINE_MAX], *l;
+
+                if (!fgets(line, sizeof(line), f)) {
+                        if (ferror(f))
+                                return errno > 0 ? -errno : -EIO;
+
+                        break;
+                }
+
+                l = strstrip(line);
+                if (isempty(l))
+                        continue;
+
+                if (!path_is_absolute(l))
+                        return -EINVAL;
+
+                if (!GREEDY_REALLOC0(g->inputs, n_allocated, g->n_inputs + 1))
+                        return -ENOMEM;
+
+                r = generator_input_record(g->inputs + g->n_inputs, l, timestamp);
+                g->n_inputs++;
+                if (r < 0)
+                        return r;
+        }
+
+        g->cacheable = true;
+        return 0;
+}
+
+static int generator_prepare(Generator *g) {
+        unsigned k;
+        int r;
+
+        /* Start out with empty output directories */
+        (void) rm_rf(g->directory, REMOVE_ROOT|REMOVE_PHYSICAL);
+
+        for (k = 0; k < ELEMENTSOF(output_names); k++) {
+                const char *p;
+
+                p = strjoina(g->directory, "/", output_names[k]);
+                r = mkdir_p_label(p, 0755);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int generator_compare(const void *a, const void *b) {
+        const Generator *x = *(const Generator**) a, *y = *(const Generator**) b;
+
+        return strcmp(x->name, y->name);
+}
+
+noreturn static void generators_execute(Generator **run, size_t n, int fd, usec_t timeout) {
+        _cleanup_free_ pid_t *pids = NULL;
+        _cleanup_free_ usec_t *started = NULL;
+        size_t k;
+
+        /* We fork this all off from a child process so that we can
+         * somewhat cleanly make use of SIGALRM to set a time limit,
+         * and wait for all of our children in the order they finish */
+
+        (void) reset_all_signal_handlers();
+        (void) reset_signal_mask();
+
+        assert_se(prctl(PR_SET_PDEATHSIG, SIGTERM) == 0);
+
+        pids = new0(pid_t, n);
+        started = new0(usec_t, n);
+        if (!pids || !started) {
+                log_oom();
+                _exit(EXIT_FAILURE);
+        }
+
+        for (k = 0; k < n; k++) {
+                pid_t pid;
+
+                started[k] = now(CLOCK_MONOTONIC);
+
+                pid = fork();
+                if (pid < 0) {
+                        log_error_errno(errno, "Failed to fork: %m");
+                        continue;
+                } else if (pid == 0) {
+                        const char *argv[5];
+
+                        assert_se(prctl(PR_SET_PDEATHSIG, SIGTERM) == 0);
+
+                        argv[0] = run[k]->path;
+                        argv[1] = strjoina(run[k]->directory, "/normal");
+                        argv[2] = strjoina(run[k]->directory, "/early");
+                        argv[3] = strjoina(run[k]->directory, "/late");
+                        argv[4] = NULL;
+
+                        if (setenv("SYSTEMD_GENERATOR_INPUTS", strjoina(run[k]->directory, "/inputs"), 1) < 0)
+                                _exit(EXIT_FAILURE);
+
+                        execv(argv[0], (char**) argv);
+                        log_error_errno(errno, "Failed to execute %s: %m", argv[0]);
+                        _exit(EXIT_FAILURE);
+                }
+
+                log_debug("Spawned %s as " PID_FMT ".", run[k]->path, pid);
+                pids[k] = pid;
+        }
+
+        /* Abort execution of this process after the timout. We simply
+         * rely on SIGALRM as default action terminating the process,
+         * and turn on alarm(). */
+
+        if (timeout != USEC_INFINITY)
+                alarm((timeout + USEC_PER_SEC - 1) / USEC_PER_SEC);
+
+        for (;;) {
+                GeneratorReport report = {};
+                siginfo_t si = {};
+
+                if (waitid(P_ALL, 0, &si, WEXITED) < 0) {
+                        if (errno == EINTR)
+                                continue;
+
+                        break;
+                }
+
+                for (k = 0; k < n; k++)
+                        if (pids[k] == si.si_pid)
+                                break;
+                if (k >= n)
+                        continue;
+
+                report.index = k;
+                report.code = si.si_code;
+                report.status = si.si_status;
+                report.duration = now(CLOCK_MONOTONIC) - started[k];
+
+                if (loop_write(fd, &report, sizeof(report), false) < 0)
+                        _exit(EXIT_FAILURE);
+        }
+
+        _exit(EXIT_SUCCESS);
+}
+
+static int generators_spawn(Generator **run, size_t n, const char *name, usec_t timeout) {
+        _cleanup_close_pair_ int pipefd[2] = { -1, -1 };
+        GeneratorReport report;
+        pid_t executor_pid;
+        int r;
+
+        if (pipe2(pipefd, O_CLOEXEC) < 0)
+                return log_error_errno(errno, "Failed to create pipe: %m");
+
+        executor_pid = fork();
+        if (executor_pid < 0)
+                return log_error_errno(errno, "Failed to fork: %m");
+        else if (executor_pid == 0) {
+                pipefd[0] = safe_close(pipefd[0]);
+                generators_execute(run, n, pipefd[1], timeout);
+        }
+
+        pipefd[1] = safe_close(pipefd[1]);
+
+        /* Collect the results until the executor is done, or killed
+         * by the timeout */
+        for (;;) {
+                Generator *g;
+
+                r = loop_read_exact(pipefd[0], &report, sizeof(report), false);
+                if (r < 0)
+                        break;
+
+                if (report.index >= n)
+                        continue;
+
+                g = run[report.index];
+                g->duration = report.duration;
+
+                if (report.code == CLD_EXITED) {
+                        if (report.status != 0) {
+                                log_warning("%s failed with error code %i.", g->path, report.status);
+                                continue;
+                        }
+
+                        log_debug("%s succeeded.", g->path);
+                } else {
+                        log_warning("%s terminated by signal %s.", g->path, signal_to_string(report.status));
+                        continue;
+                }
+
+                /* Only successful runs might be reused */
+                g->cacheable = true;
+        }
+
+        (void) wait_for_terminate_and_warn(name, executor_pid, true);
+
+        return 0;
+}
+
+static int generators_enumerate(Hashmap **generators, char **paths, const char *directory) {
+        _cleanup_(generators_freep) Hashmap *found = NULL;
+        Generator *g;
+        char **p;
+        int r;
+
+        /* Finds the generators to run, keeping what is known about
+         * them from earlier runs. If a file with the same name
+         * exists in more than one directory, the earliest one wins. */
+
+        found = hashmap_new(&string_hash_ops);
+        if (!found)
+                return -ENOMEM;
+
+        STRV_FOREACH(p, paths) {
+                _cleanup_closedir_ DIR *d = NULL;
+                struct dirent *de;
+
+                d = opendir(*p);
+                if (!d) {
+                        if (errno == ENOENT)
+                                continue;
+
+                        log_error_errno(errno, "Failed to open directory %s: %m", *p);
+                        continue;
+                }
+
+                FOREACH_DIRENT(de, d, break) {
+                        _cleanup_free_ char *path = NULL;
+
+                        if (!dirent_is_file(de))
+                                continue;
+
+                        if (hashmap_contains(found, de->d_name)) {
+                                log_debug("%1$s/%2$s skipped (%2$s was already seen).", *p, de->d_name);
+                                continue;
+                        }
+
+                        path = strjoin(*p, "/", de->d_name, NULL);
+                        if (!path)
+                                return -ENOMEM;
+
+                        if (null_or_empty_path(path)) {
+                                log_debug("%s is empty (a mask).", path);
+                                continue;
+                        }
+
+                        g = hashmap_remove(*generators, de->d_name);
+                        if (g && !streq(g->path, path))
+                                g = generator_free(g);
+                        if (!g) {
+                                g = generator_new(de->d_name, path, directory);
+                                if (!g)
+                                        return -ENOMEM;
+                        }
+
+                        r = hashmap_put(found, g->name, g);
+                        if (r < 0) {
+                                generator_free(g);
+                                return r;
+                        }
+                }
+        }
+
+        /* Whatever is left over was removed since */
+        while ((g = hashmap_steal_first(*generators))) {
+                (void) rm_rf(g->directory, REMOVE_ROOT|REMOVE_PHYSICAL);
+                generator_free(g);
+        }
+
+        hashmap_free(*generators);
+        *generators = found;
+        found = NULL;
+
+        return 0;
+}
+
+static int generator_merge_symlink(const Generator *g, const char *from, const char *to, const char *const output[3]) {
+        _cleanup_free_ char *target = NULL, *rewritten = NULL;
+        unsigned k;
+        int r;
+
+        r = readlink_malloc(from, &target);
+        if (r < 0)
+                return r;
+
+        /* Generators create links with absolute targets in the
+         * directories they were passed, which are private ones. Point
+         * those to where the output ends up instead. */
+        for (k = 0; k < ELEMENTSOF(output_names); k++) {
+                const char *e;
+
+                e = path_startswith(target, strjoina(g->directory, "/", output_names[k]));
+                if (!e)
+                        continue;
+
+                rewritten = isempty(e) ? strdup(output[k]) : strjoin(output[k], "/", e, NULL);
+                if (!rewritten)
+                        return -ENOMEM;
+
+                break;
+        }
+
+        return symlink_label(rewritten ?: target, to);
+}
+
+static int generator_merge(const Generator *g, const char *from, const char *to, const char *const output[3]) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+        int r;
+
+        /* Copies the output of a generator into the shared directory,
+         * labelled as if it was written there. What another generator
+         * wrote already is left alone. */
+
+        d = opendir(from);
+        if (!d)
+                return -errno;
+
+        r = mkdir_label(to, 0755);
+        if (r < 0 && r != -EEXIST)
+                return r;
+
+        r = 0;
+
+        FOREACH_DIRENT_ALL(de, d, return -errno) {
+                _cleanup_free_ char *p = NULL, *t = NULL;
+                struct stat st;
+                int q;
+
+                if (STR_IN_SET(de->d_name, ".", ".."))
+                        continue;
+
+                if (fstatat(dirfd(d), de->d_name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+                        r = -errno;
+                        continue;
+                }
+
+                p = strjoin(from, "/", de->d_name, NULL);
+                t = strjoin(to, "/", de->d_name, NULL);
+                if (!p || !t)
+                        return -ENOMEM;
+
+                if (S_ISDIR(st.st_mode))
+                        q = generator_merge(g, p, t, output);
+                else if (S_ISLNK(st.st_mode))
+                        q = generator_merge_symlink(g, p, t, output);
+                else if (S_ISREG(st.st_mode)) {
+                        q = copy_file(p, t, O_EXCL, st.st_mode & 07777, 0);
+                        if (q >= 0)
+                                q = label_fix(t, false, false);
+                } else
+                        q = -EOPNOTSUPP;
+
+                if (q == -EEXIST) {
+                        log_debug("Output %s of %s conflicts with that of another generator, ignoring.", de->d_name, g->path);
+                        q = 0;
+                }
+
+                if (q < 0)
+                        r = q;
+        }
+
+        return r;
+}
+
+int generators_run(Hashmap **generators, char **paths, const char *directory, const char *const output[3], usec_t timeout) {
+        _cleanup_free_ Generator **all = NULL, **run = NULL;
+        size_t n = 0, n_run = 0, k;
+        Generator *g;
+        Iterator i;
+        usec_t ts;
+        int r;
+
+        assert(generators);
+        assert(!strv_isempty(paths));
+        assert(directory);
+        assert(output);
+
+        /* Runs all generators in parallel, each with its own output
+         * directories, which are merged into the output directories
+         * passed in afterwards. The output of generators whose inputs
+         * did not change since their last run is used again instead
+         * of running them. */
+
+        if (!*generators) {
+                *generators = hashmap_new(&string_hash_ops);
+                if (!*generators)
+                        return log_oom();
+        }
+
+        r = generators_enumerate(generators, paths, directory);
+        if (r < 0)
+                return log_error_errno(r, "Failed to enumerate generators: %m");
+
+        all = new(Generator*, hashmap_size(*generators) + 1);
+        run = new(Generator*, hashmap_size(*generators) + 1);
+        if (!all || !run)
+                return log_oom();
+
+        HASHMAP_FOREACH(g, *generators, i)
+                all[n++] = g;
+
+        qsort_safe(all, n, sizeof(Generator*), generator_compare);
+
+        for (k = 0; k < n; k++) {
+                g = all[k];
+
+                if (generator_unchanged(g)) {
+                        log_debug("Inputs of %s did not change, reusing its output.", g->path);
+                        g->reused = true;
+                        g->duration = 0;
+                        continue;
+                }
+
+                generator_inputs_clear(g);
+                g->reused = false;
+                g->duration = 0;
+
+                r = generator_prepare(g);
+                if (r < 0) {
+                        log_error_errno(r, "Failed to create output directory for %s: %m", g->path);
+                        continue;
+                }
+
+                run[n_run++] = g;
+        }
+
+        ts = now(CLOCK_REALTIME);
+
+        if (n_run > 0) {
+                r = generators_spawn(run, n_run, basename(paths[0]), timeout);
+                if (r < 0)
+                        return r;
+        }
+
+        for (k = 0; k < n_run; k++) {
+                g = run[k];
+
+                if (!g->cacheable)
+                        continue;
+
+                g->cacheable = false;
+                r = generator_read_inputs(g, ts);
+                if (r < 0) {
+                        log_debug_errno(r, "Not reusing output of %s: %m", g->path);
+                        generator_inputs_clear(g);
+                }
+        }
+
+        for (k = 0; k < n; k++) {
+                unsigned j;
+
+                for (j = 0; j < ELEMENTSOF(output_names); j++) {
+                        const char *p;
+
+                        p = strjoina(all[k]->directory, "/", output_names[j]);
+                        r = generator_merge(all[k], p, output[j], output);
+                        if (r < 0 && r != -ENOENT)
+                                log_warning_errno(r, "Failed to copy output of %s: %m", all[k]->path);
+                }
+        }
+
+        return 0;
+}
@@ -0,0 +1,68 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "hashmap.h"
+#include "macro.h"
+#include "time-util.h"
+
+typedef struct GeneratorInput GeneratorInput;
+typedef struct Generator Generator;
+
+struct GeneratorInput {
+        char *path;
+        bool exists;
+        dev_t dev;
+        ino_t ino;
+        mode_t mode;
+        off_t size;
+        usec_t mtime;
+};
+
+struct Generator {
+        char *name;
+        char *path;
+
+        /* Private output directory, with normal/, early/ and late/
+         * below, merged into the directories passed to generators_run() */
+        char *directory;
+
+        /* Wall clock time of the last run, 0 if the output of the
+         * previous run was reused */
+        usec_t duration;
+        bool reused;
+
+        /* The files the output was generated from, as declared by the
+         * generator in $SYSTEMD_GENERATOR_INPUTS */
+        bool cacheable;
+        GeneratorInput executable;
+        GeneratorInput *inputs;
+        size_t n_inputs;
+};
+
+Generator *generator_free(Generator *g);
+Hashmap *generators_free(Hashmap *h);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(Hashmap*, generators_free);
+
+int generators_run(Hashmap **generators, char **paths, const char *directory, const char *const output[3], usec_t timeout);
@@ -20,7 +20,6 @@
 ***/
 
 
-#include "conf-parser.h"
 #include "load-dropin.h"
 #include "load-fragment.h"
 #include "log.h"
@@ -69,12 +68,8 @@ int unit_load_dropin(Unit *u) {
         if (r <= 0)
                 return 0;
 
-        STRV_FOREACH(f, u->dropin_paths) {
-                config_parse(u->id, *f, NULL,
-                             UNIT_VTABLE(u)->sections,
-                             config_item_perf_lookup, load_fragment_gperf_lookup,
-                             false, false, false, u);
-        }
+        STRV_FOREACH(f, u->dropin_paths)
+                (void) unit_config_parse(u, *f, NULL, false);
 
         u->dropin_mtime = now(CLOCK_REALTIME);
 
@@ -48,6 +48,7 @@
 #include "fs-util.h"
 #include "ioprio.h"
 #include "load-fragment.h"
+#include "load-prefetch.h"
 #include "log.h"
 #include "missing.h"
 #include "parse-util.h"
@@ -3774,6 +3775,38 @@ static int merge_by_names(Unit **u, Set *names, const char *id) {
         return 0;
 }
 
+int unit_config_parse(Unit *u, const char *filename, FILE *f, bool allow_include) {
+        _cleanup_(config_tokens_freep) ConfigTokens *tokens = NULL;
+        Manager *m;
+        int r;
+
+        assert(u);
+        assert(filename);
+
+        m = u->manager;
+
+        /* The file might have been read by a worker thread already,
+         * or during an earlier boot */
+        if (m->load_prefetch)
+                tokens = load_prefetch_take(m->load_prefetch, filename);
+        if (!tokens && m->unit_cache)
+                tokens = unit_cache_get_tokens(m->unit_cache, filename);
+
+        r = config_parse_tokens(u->id, filename, f, &tokens,
+                                UNIT_VTABLE(u)->sections,
+                                config_item_perf_lookup, load_fragment_gperf_lookup,
+                                false, allow_include, false, u);
+        if (r < 0)
+                return r;
+
+        if (tokens && m->unit_cache) {
+                (void) unit_cache_add_tokens(m->unit_cache, filename, tokens);
+                tokens = NULL;
+        }
+
+        return 0;
+}
+
 static int load_from_path(Unit *u, const char *path) {
         int r;
         _cleanup_set_free_free_ Set *symlink_names = NULL;
@@ -3858,10 +3891,7 @@ static int load_from_path(Unit *u, const char *path) {
                 u->load_state = UNIT_LOADED;
 
                 /* Now, parse the file contents */
-                r = config_parse(u->id, filename, f,
-                                 UNIT_VTABLE(u)->sections,
-                                 config_item_perf_lookup, load_fragment_gperf_lookup,
-                                 false, true, false, u);
+                r = unit_config_parse(u, filename, f, true);
                 if (r < 0)
                         return r;
         }
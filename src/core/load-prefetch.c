@@ -0,0 +1,455 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "dirent-util.h"
+#include "fd-util.h"
+#include "hashmap.h"
+#include "list.h"
+#include "load-prefetch.h"
+#include "path-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "unit-name.h"
+
+#define LOAD_PREFETCH_WORKERS_MAX 4U
+
+typedef enum LoadPrefetchState {
+        LOAD_PREFETCH_QUEUED,
+        LOAD_PREFETCH_RUNNING,
+        LOAD_PREFETCH_DONE,
+        LOAD_PREFETCH_CANCELLED,
+} LoadPrefetchState;
+
+typedef struct LoadPrefetchJob LoadPrefetchJob;
+
+struct LoadPrefetchJob {
+        char *path;
+        bool directory;
+        LoadPrefetchState state;
+
+        /* The result for files, and the time it took to read it */
+        ConfigTokens *tokens;
+        usec_t duration;
+
+        /* The files found in a drop-in directory */
+        LIST_HEAD(LoadPrefetchJob, files);
+        LIST_FIELDS(LoadPrefetchJob, files);
+
+        LIST_FIELDS(LoadPrefetchJob, queue);
+};
+
+struct LoadPrefetch {
+        /* Only accessed from the main thread */
+        Hashmap *jobs;
+        usec_t busy, waited;
+        unsigned served;
+
+        /* Files found in here are not read, only looked up */
+        UnitCache *unit_cache;
+
+        /* Protected by the mutex: the queue, and the state and
+         * results of the jobs. Like the load queue of the manager,
+         * the queue is a stack, so that the workers pick the units
+         * that are loaded next. */
+        pthread_mutex_t mutex;
+        pthread_cond_t work_cond, done_cond;
+        LIST_HEAD(LoadPrefetchJob, queue);
+        bool quit;
+
+        pthread_t workers[LOAD_PREFETCH_WORKERS_MAX];
+        unsigned n_workers;
+};
+
+static LoadPrefetchJob *load_prefetch_job_free(LoadPrefetchJob *j) {
+        LoadPrefetchJob *f;
+
+        if (!j)
+                return NULL;
+
+        while ((f = j->files)) {
+                LIST_REMOVE(files, j->files, f);
+                load_prefetch_job_free(f);
+        }
+
+        config_tokens_free(j->tokens);
+        free(j->path);
+        free(j);
+
+        return NULL;
+}
+
+static void load_prefetch_read_file(LoadPrefetchJob *j) {
+        usec_t ts;
+
+        ts = now(CLOCK_MONOTONIC);
+        (void) config_tokenize(j->path, NULL, &j->tokens);
+        j->duration = now(CLOCK_MONOTONIC) - ts;
+}
+
+static void load_prefetch_read_directory(LoadPrefetch *p, LoadPrefetchJob *j) {
+        _cleanup_closedir_ DIR *d = NULL;
+        struct dirent *de;
+
+        d = opendir(j->path);
+        if (!d)
+                return;
+
+        FOREACH_DIRENT(de, d, return) {
+                LoadPrefetchJob *f;
+
+                if (!dirent_is_file_with_suffix(de, ".conf"))
+                        continue;
+
+                f = new0(LoadPrefetchJob, 1);
+                if (!f)
+                        return;
+
+                f->path = strjoin(j->path, "/", de->d_name, NULL);
+                if (!f->path) {
+                        free(f);
+                        return;
+                }
+
+                if (!p->unit_cache || !unit_cache_has_file(p->unit_cache, f->path))
+                        load_prefetch_read_file(f);
+                f->state = LOAD_PREFETCH_DONE;
+
+                LIST_PREPEND(files, j->files, f);
+        }
+}
+
+static void *load_prefetch_thread(void *userdata) {
+        LoadPrefetch *p = userdata;
+        sigset_t ss;
+
+        /* No signals in this thread please */
+        assert_se(sigfillset(&ss) == 0);
+        assert_se(pthread_sigmask(SIG_BLOCK, &ss, NULL) == 0);
+
+        (void) prctl(PR_SET_NAME, (unsigned long) "sd-prefetch");
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        for (;;) {
+                LoadPrefetchJob *j;
+
+                while (!p->quit && !p->queue)
+                        assert_se(pthread_cond_wait(&p->work_cond, &p->mutex) == 0);
+
+                if (p->quit)
+                        break;
+
+                j = p->queue;
+                LIST_REMOVE(queue, p->queue, j);
+
+                j->state = LOAD_PREFETCH_RUNNING;
+                assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+                /* Only the job itself is touched while reading, it
+                 * is not handed out before it is marked done */
+                if (j->directory)
+                        load_prefetch_read_directory(p, j);
+                else
+                        load_prefetch_read_file(j);
+
+                assert_se(pthread_mutex_lock(&p->mutex) == 0);
+                j->state = LOAD_PREFETCH_DONE;
+                assert_se(pthread_cond_broadcast(&p->done_cond) == 0);
+        }
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        return NULL;
+}
+
+int load_prefetch_new(UnitCache *unit_cache, LoadPrefetch **ret) {
+        LoadPrefetch *p;
+        unsigned n;
+        long k;
+        int r = 0;
+
+        assert(ret);
+
+        /* Keep one CPU for the main thread, which applies the
+         * settings and does the rest of the loading */
+        k = sysconf(_SC_NPROCESSORS_ONLN);
+        if (k <= 1)
+                return -EOPNOTSUPP;
+
+        n = MIN((unsigned) k - 1, LOAD_PREFETCH_WORKERS_MAX);
+
+        p = new0(LoadPrefetch, 1);
+        if (!p)
+                return -ENOMEM;
+
+        p->jobs = hashmap_new(&string_hash_ops);
+        if (!p->jobs) {
+                free(p);
+                return -ENOMEM;
+        }
+
+        p->unit_cache = unit_cache;
+
+        assert_se(pthread_mutex_init(&p->mutex, NULL) == 0);
+        assert_se(pthread_cond_init(&p->work_cond, NULL) == 0);
+        assert_se(pthread_cond_init(&p->done_cond, NULL) == 0);
+
+        while (p->n_workers < n) {
+                r = pthread_create(&p->workers[p->n_workers], NULL, load_prefetch_thread, p);
+                if (r != 0)
+                        break;
+
+                p->n_workers++;
+        }
+
+        if (p->n_workers == 0) {
+                load_prefetch_free(p);
+                return -r;
+        }
+
+        *ret = p;
+        return 0;
+}
+
+LoadPrefetch *load_prefetch_free(LoadPrefetch *p) {
+        LoadPrefetchJob *j;
+        unsigned i;
+
+        if (!p)
+                return NULL;
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+        p->quit = true;
+        assert_se(pthread_cond_broadcast(&p->work_cond) == 0);
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        for (i = 0; i < p->n_workers; i++)
+                assert_se(pthread_join(p->workers[i], NULL) == 0);
+
+        while ((j = hashmap_steal_first(p->jobs)))
+                load_prefetch_job_free(j);
+
+        hashmap_free(p->jobs);
+
+        pthread_cond_destroy(&p->done_cond);
+        pthread_cond_destroy(&p->work_cond);
+        pthread_mutex_destroy(&p->mutex);
+
+        free(p);
+
+        return NULL;
+}
+
+static int load_prefetch_add(LoadPrefetch *p, char *path, bool directory) {
+        LoadPrefetchJob *j;
+        int r;
+
+        assert(p);
+        assert(path);
+
+        /* Takes ownership of path */
+
+        if (hashmap_contains(p->jobs, path)) {
+                free(path);
+                return 0;
+        }
+
+        j = new0(LoadPrefetchJob, 1);
+        if (!j) {
+                free(path);
+                return -ENOMEM;
+        }
+
+        j->path = path;
+        j->directory = directory;
+
+        r = hashmap_put(p->jobs, j->path, j);
+        if (r < 0) {
+                load_prefetch_job_free(j);
+                return r;
+        }
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+        LIST_PREPEND(queue, p->queue, j);
+        assert_se(pthread_cond_signal(&p->work_cond) == 0);
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        return 1;
+}
+
+static int load_prefetch_add_name(LoadPrefetch *p, Manager *m, const char *name) {
+        bool found = false;
+        char **dir;
+        int r;
+
+        /* Like load_from_path(), the first fragment found wins, while
+         * drop-ins are read from all directories */
+
+        STRV_FOREACH(dir, m->lookup_paths.unit_path) {
+                char *path;
+
+                if (!found) {
+                        path = strjoin(*dir, "/", name, NULL);
+                        if (!path)
+                                return -ENOMEM;
+
+                        if (!m->unit_path_cache || set_get(m->unit_path_cache, path)) {
+                                found = true;
+
+                                /* Unchanged files are quicker taken from the cache */
+                                if (p->unit_cache && unit_cache_has_file(p->unit_cache, path))
+                                        free(path);
+                                else {
+                                        r = load_prefetch_add(p, path, false);
+                                        if (r < 0)
+                                                return r;
+                                }
+                        } else
+                                free(path);
+                }
+
+                path = strjoin(*dir, "/", name, ".d", NULL);
+                if (!path)
+                        return -ENOMEM;
+
+                if (!m->unit_path_cache || set_get(m->unit_path_cache, path)) {
+                        r = load_prefetch_add(p, path, true);
+                        if (r < 0)
+                                return r;
+                } else
+                        free(path);
+        }
+
+        return 0;
+}
+
+void load_prefetch_unit(LoadPrefetch *p, Unit *u) {
+        Iterator i;
+        char *t;
+        int r;
+
+        assert(p);
+        assert(u);
+
+        if (u->transient)
+                return;
+
+        SET_FOREACH(t, u->names, i) {
+                _cleanup_free_ char *template = NULL;
+
+                r = load_prefetch_add_name(p, u->manager, t);
+                if (r < 0)
+                        return;
+
+                if (!unit_name_is_valid(t, UNIT_NAME_INSTANCE))
+                        continue;
+
+                r = unit_name_template(t, &template);
+                if (r < 0)
+                        return;
+
+                r = load_prefetch_add_name(p, u->manager, template);
+                if (r < 0)
+                        return;
+        }
+}
+
+ConfigTokens *load_prefetch_take(LoadPrefetch *p, const char *path) {
+        LoadPrefetchJob *j, *f;
+        ConfigTokens *t = NULL;
+        usec_t ts;
+
+        assert(p);
+        assert(path);
+
+        /* Returns the tokens read from the file, if it was read
+         * already. If it is still being read, waits for it. If it was
+         * not picked up yet, returns NULL, as reading it right away
+         * is quicker then. */
+
+        j = hashmap_get(p->jobs, path);
+        if (!j) {
+                _cleanup_free_ char *dir = NULL;
+
+                dir = dirname_malloc(path);
+                if (!dir)
+                        return NULL;
+
+                j = hashmap_get(p->jobs, dir);
+                if (!j || !j->directory)
+                        return NULL;
+        }
+
+        ts = now(CLOCK_MONOTONIC);
+
+        assert_se(pthread_mutex_lock(&p->mutex) == 0);
+
+        if (j->state == LOAD_PREFETCH_QUEUED) {
+                LIST_REMOVE(queue, p->queue, j);
+
+                j->state = LOAD_PREFETCH_CANCELLED;
+                j = NULL;
+        }
+
+        while (j && j->state == LOAD_PREFETCH_RUNNING)
+                assert_se(pthread_cond_wait(&p->done_cond, &p->mutex) == 0);
+
+        assert_se(pthread_mutex_unlock(&p->mutex) == 0);
+
+        p->waited += now(CLOCK_MONOTONIC) - ts;
+
+        if (j && j->directory) {
+                LIST_FOREACH(files, f, j->files)
+                        if (streq(f->path, path))
+                                break;
+                j = f;
+        }
+
+        if (j && j->state == LOAD_PREFETCH_DONE && j->tokens) {
+                t = j->tokens;
+                j->tokens = NULL;
+
+                p->busy += j->duration;
+                p->served++;
+        }
+
+        return t;
+}
+
+usec_t load_prefetch_saved(LoadPrefetch *p) {
+        assert(p);
+
+        /* The time the main thread would have spent reading the files
+         * it used the results for, minus the time it waited for them */
+        return p->busy > p->waited ? p->busy - p->waited : 0;
+}
+
+unsigned load_prefetch_served(LoadPrefetch *p) {
+        assert(p);
+
+        return p->served;
+}
@@ -0,0 +1,39 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+typedef struct LoadPrefetch LoadPrefetch;
+
+#include "conf-parser.h"
+#include "time-util.h"
+#include "unit-cache.h"
+#include "unit.h"
+
+/* Reads and tokenizes the unit files of queued units in worker
+ * threads, ahead of the main thread loading them */
+
+int load_prefetch_new(UnitCache *unit_cache, LoadPrefetch **ret);
+LoadPrefetch *load_prefetch_free(LoadPrefetch *p);
+
+void load_prefetch_unit(LoadPrefetch *p, Unit *u);
+ConfigTokens *load_prefetch_take(LoadPrefetch *p, const char *path);
+
+usec_t load_prefetch_saved(LoadPrefetch *p);
+unsigned load_prefetch_served(LoadPrefetch *p);
@@ -1804,6 +1804,14 @@ int main(int argc, char *argv[]) {
                                 log_error_errno(r, "Failed to reload: %m");
                         break;
 
+                case MANAGER_RELOAD_INCREMENTAL:
+                        log_info("Reloading changed units.");
+
+                        r = manager_reload_incremental(m);
+                        if (r < 0)
+                                log_error_errno(r, "Failed to reload: %m");
+                        break;
+
                 case MANAGER_REEXECUTE:
 
                         if (prepare_reexecute(m, &arg_serialization, &fds, false) < 0) {
@@ -63,6 +63,7 @@
 #include "log.h"
 #include "macro.h"
 #include "manager.h"
+#include "memfd-util.h"
 #include "missing.h"
 #include "mkdir.h"
 #include "parse-util.h"
@@ -93,6 +94,9 @@
 #define JOBS_IN_PROGRESS_PERIOD_USEC (USEC_PER_SEC / 3)
 #define JOBS_IN_PROGRESS_PERIOD_DIVISOR 3
 
+/* Number of units loaded in one go before unit files are read in parallel */
+#define LOAD_PREFETCH_UNITS_MIN 16U
+
 static int manager_dispatch_notify_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 static int manager_dispatch_signal_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
 static int manager_dispatch_time_change_fd(sd_event_source *source, int fd, uint32_t revents, void *userdata);
@@ -101,6 +105,7 @@ static int manager_dispatch_jobs_in_progress(sd_event_source *source, usec_t use
 static int manager_dispatch_run_queue(sd_event_source *source, void *userdata);
 static int manager_run_generators(Manager *m);
 static void manager_undo_generators(Manager *m);
+static void manager_forget_generators(Manager *m);
 
 static void manager_watch_jobs_in_progress(Manager *m) {
         usec_t next;
@@ -594,6 +599,9 @@ int manager_new(ManagerRunningAs running_as, bool test_run, Manager **_m) {
 
         m->current_job_id = 1; /* start as id #1, so that we can leave #0 around as "null-like" value */
 
+        if (running_as == MANAGER_SYSTEM && !test_run && !in_initrd())
+                m->unit_cache_path = UNIT_CACHE_PATH;
+
         m->ask_password_inotify_fd = -1;
         m->have_ask_password = -EINVAL; /* we don't know */
         m->first_boot = -1;
@@ -945,6 +953,7 @@ Manager* manager_free(Manager *m) {
         manager_shutdown_cgroup(m, m->exit_code != MANAGER_REEXECUTE);
 
         manager_undo_generators(m);
+        manager_forget_generators(m);
 
         bus_done(m);
 
@@ -982,6 +991,7 @@ Manager* manager_free(Manager *m) {
 
         hashmap_free(m->cgroup_unit);
         set_free_free(m->unit_path_cache);
+        unit_cache_free(m->unit_cache);
 
         hashmap_free(m->cgroup_netclass_registry);
 
@@ -1041,9 +1051,131 @@ static void manager_coldplug(Manager *m) {
         }
 }
 
+static int manager_add_unit_path(Manager *m, const char *dir, const char *name) {
+        char *p;
+
+        p = strjoin(streq(dir, "/") ? "" : dir, "/", name, NULL);
+        if (!p)
+                return -ENOMEM;
+
+        return set_consume(m->unit_path_cache, p);
+}
+
+static int manager_read_unit_directory(Manager *m, const char *path) {
+        _cleanup_closedir_ DIR *d = NULL;
+        _cleanup_free_ char *entries = NULL;
+        size_t n_allocated = 0, n = 0;
+        const char *cached, *name;
+        struct dirent *de;
+        struct stat st;
+        usec_t ts;
+        int r;
+
+        /* Unless the directory is unchanged since the listing in the
+         * unit cache was taken, read it, and record the listing for
+         * the next time */
+
+        if (m->unit_cache && stat(path, &st) >= 0) {
+                cached = unit_cache_get_directory(m->unit_cache, path, &st);
+                if (cached) {
+                        NULSTR_FOREACH(name, cached) {
+                                r = manager_add_unit_path(m, path, name);
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        return 0;
+                }
+        }
+
+        ts = now(CLOCK_REALTIME);
+
+        d = opendir(path);
+        if (!d) {
+                if (errno != ENOENT)
+                        log_error_errno(errno, "Failed to open directory %s: %m", path);
+                return 0;
+        }
+
+        while ((de = readdir(d))) {
+                size_t l;
+
+                if (hidden_file(de->d_name))
+                        continue;
+
+                r = manager_add_unit_path(m, path, de->d_name);
+                if (r < 0)
+                        return r;
+
+                if (!unit_cache_collecting(m->unit_cache))
+                        continue;
+
+                l = strlen(de->d_name) + 1;
+                if (!GREEDY_REALLOC(entries, n_allocated, n + l + 1))
+                        return -ENOMEM;
+
+                memcpy(entries + n, de->d_name, l);
+                n += l;
+        }
+
+        if (unit_cache_collecting(m->unit_cache) && fstat(dirfd(d), &st) >= 0) {
+                if (!GREEDY_REALLOC(entries, n_allocated, n + 1))
+                        return -ENOMEM;
+
+                entries[n++] = 0;
+
+                r = unit_cache_add_directory(m->unit_cache, path, &st, ts, entries, n);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static void manager_begin_unit_cache(Manager *m) {
+        int r;
+
+        assert(m);
+
+        if (!m->unit_cache_path)
+                return;
+
+        if (!m->unit_cache) {
+                r = unit_cache_open(m->unit_cache_path, &m->unit_cache);
+                if (r < 0) {
+                        log_oom();
+                        return;
+                }
+        }
+
+        /* Remember what is read while loading units, for the next
+         * boot */
+        r = unit_cache_begin(m->unit_cache);
+        if (r < 0)
+                log_oom();
+}
+
+int manager_write_unit_cache(Manager *m) {
+        int r;
+
+        assert(m);
+
+        if (!unit_cache_collecting(m->unit_cache))
+                return 0;
+
+        r = unit_cache_commit(m->unit_cache, m->unit_cache_path);
+        if (r < 0)
+                log_debug_errno(r, "Failed to write unit cache %s, ignoring: %m", m->unit_cache_path);
+
+        /* Units loaded later on can use what was just written */
+        m->unit_cache = unit_cache_free(m->unit_cache);
+        (void) unit_cache_open(m->unit_cache_path, &m->unit_cache);
+
+        return r;
+}
+
 static void manager_build_unit_path_cache(Manager *m) {
         char **i;
-        _cleanup_closedir_ DIR *d = NULL;
         int r;
 
         assert(m);
@@ -1060,33 +1192,9 @@ static void manager_build_unit_path_cache(Manager *m) {
          * we don't always have to go to disk */
 
         STRV_FOREACH(i, m->lookup_paths.unit_path) {
-                struct dirent *de;
-
-                d = opendir(*i);
-                if (!d) {
-                        if (errno != ENOENT)
-                                log_error_errno(errno, "Failed to open directory %s: %m", *i);
-                        continue;
-                }
-
-                while ((de = readdir(d))) {
-                        char *p;
-
-                        if (hidden_file(de->d_name))
-                                continue;
-
-                        p = strjoin(streq(*i, "/") ? "" : *i, "/", de->d_name, NULL);
-                        if (!p) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
-
-                        r = set_consume(m->unit_path_cache, p);
-                        if (r < 0)
-                                goto fail;
-                }
-
-                d = safe_closedir(d);
+                r = manager_read_unit_directory(m, *i);
+                if (r < 0)
+                        goto fail;
         }
 
         return;
@@ -1137,6 +1245,7 @@ int manager_startup(Manager *m, FILE *serialization, FDSet *fds) {
         if (r < 0)
                 return r;
 
+        manager_begin_unit_cache(m);
         manager_build_unit_path_cache(m);
 
         /* If we will deserialize make sure that during enumeration
@@ -1288,6 +1397,42 @@ Unit *manager_get_unit(Manager *m, const char *name) {
         return hashmap_get(m->units, name);
 }
 
+static void manager_start_load_prefetch(Manager *m) {
+        Unit *u;
+        int r;
+
+        assert(m);
+        assert(!m->load_prefetch);
+
+        r = load_prefetch_new(m->unit_cache, &m->load_prefetch);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to start reading unit files in parallel, ignoring: %m");
+                return;
+        }
+
+        /* Units queued from now on are added by
+         * unit_add_to_load_queue(). Add the ones queued already
+         * oldest first, so that the stacks end up in the same
+         * order. */
+        LIST_FIND_TAIL(load_queue, m->load_queue, u);
+        for (; u; u = u->load_queue_prev)
+                load_prefetch_unit(m->load_prefetch, u);
+}
+
+static void manager_stop_load_prefetch(Manager *m) {
+        assert(m);
+
+        if (!m->load_prefetch)
+                return;
+
+        if (!dual_timestamp_is_set(&m->finish_timestamp))
+                m->units_parse_saved_usec += load_prefetch_saved(m->load_prefetch);
+
+        m->n_unit_files_prefetched += load_prefetch_served(m->load_prefetch);
+
+        m->load_prefetch = load_prefetch_free(m->load_prefetch);
+}
+
 unsigned manager_dispatch_load_queue(Manager *m) {
         Unit *u;
         unsigned n = 0;
@@ -1306,10 +1451,18 @@ unsigned manager_dispatch_load_queue(Manager *m) {
         while ((u = m->load_queue)) {
                 assert(u->in_load_queue);
 
+                /* Once it is clear that a larger number of units is
+                 * loaded, read the files of the queued ones in worker
+                 * threads while we keep loading */
+                if (n == LOAD_PREFETCH_UNITS_MIN)
+                        manager_start_load_prefetch(m);
+
                 unit_load(u);
                 n++;
         }
 
+        manager_stop_load_prefetch(m);
+
         m->dispatching_load_queue = false;
         return n;
 }
@@ -1667,7 +1820,10 @@ static int manager_dispatch_sigchld(Manager *m) {
                         _cleanup_free_ char *name = NULL;
                         Unit *u1, *u2, *u3;
 
-                        get_process_comm(si.si_pid, &name);
+                        /* Reading /proc for each child that dies
+                         * is not free, only do it if it is logged */
+                        if (log_get_max_level() >= LOG_DEBUG)
+                                (void) get_process_comm(si.si_pid, &name);
 
                         log_debug("Child "PID_FMT" (%s) died (code=%s, status=%i/%s)",
                                   si.si_pid, strna(name),
@@ -2208,12 +2364,19 @@ int manager_open_serialization(Manager *m, FILE **_f) {
 
         assert(_f);
 
-        path = m->running_as == MANAGER_SYSTEM ? "/run/systemd" : "/tmp";
-        fd = open_tmpfile(path, O_RDWR|O_CLOEXEC);
-        if (fd < 0)
-                return -errno;
+        /* Prefer an anonymous memory file, so that serializing a
+         * large number of units never has to touch a file system */
+        fd = memfd_new("systemd-state");
+        if (fd >= 0)
+                log_debug("Serializing state to memfd");
+        else {
+                path = m->running_as == MANAGER_SYSTEM ? "/run/systemd" : "/tmp";
+                fd = open_tmpfile(path, O_RDWR|O_CLOEXEC);
+                if (fd < 0)
+                        return -errno;
 
-        log_debug("Serializing state to %s", path);
+                log_debug("Serializing state to %s", path);
+        }
 
         f = fdopen(fd, "w+");
         if (!f) {
@@ -2226,19 +2389,36 @@ int manager_open_serialization(Manager *m, FILE **_f) {
         return 0;
 }
 
-int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
-        Iterator i;
-        Unit *u;
-        const char *t;
+/* The binary serialization is only used for daemon-reload, where the
+ * same binary writes and reads the state, so everything is in native
+ * layout. Re-execution always uses the text format, since the new
+ * binary might be a different version. The file starts with this
+ * header, followed by the manager items in the text format, the unit
+ * records, and an index of the unit records. */
+typedef struct SerializationHeader {
+        uint8_t signature[8];
+        uint32_t version;
+        uint32_t n_units;
+        uint64_t index_offset;
+} SerializationHeader;
+
+typedef struct SerializationIndexEntry {
+        uint64_t offset;
+        uint32_t name_size;        /* including the trailing NUL byte */
+        uint32_t reserved;
+} SerializationIndexEntry;
+
+/* The first byte can never start a line of the text format */
+#define SERIALIZATION_SIGNATURE ((const uint8_t[]) { 0x7f, 'S', 'D', 'S', 'T', 'A', 'T', 'E' })
+#define SERIALIZATION_VERSION 1U
+
+static int manager_serialize_items(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
         char **e;
-        int r;
 
         assert(m);
         assert(f);
         assert(fds);
 
-        m->n_reloading ++;
-
         fprintf(f, "current-job-id=%"PRIu32"\n", m->current_job_id);
         fprintf(f, "taint-usr=%s\n", yes_no(m->taint_usr));
         fprintf(f, "n-installed-jobs=%u\n", m->n_installed_jobs);
@@ -2258,6 +2438,7 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
                 dual_timestamp_serialize(f, "generators-finish-timestamp", &m->generators_finish_timestamp);
                 dual_timestamp_serialize(f, "units-load-start-timestamp", &m->units_load_start_timestamp);
                 dual_timestamp_serialize(f, "units-load-finish-timestamp", &m->units_load_finish_timestamp);
+                fprintf(f, "units-parse-saved-usec="USEC_FMT"\n", m->units_parse_saved_usec);
         }
 
         if (!switching_root) {
@@ -2297,6 +2478,27 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
 
         fputc('\n', f);
 
+        return 0;
+}
+
+int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
+        Iterator i;
+        Unit *u;
+        const char *t;
+        int r;
+
+        assert(m);
+        assert(f);
+        assert(fds);
+
+        m->n_reloading ++;
+
+        r = manager_serialize_items(m, f, fds, switching_root);
+        if (r < 0) {
+                m->n_reloading --;
+                return r;
+        }
+
         HASHMAP_FOREACH_KEY(u, t, m->units, i) {
                 if (u->id != t)
                         continue;
@@ -2325,33 +2527,122 @@ int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root) {
         return 0;
 }
 
-int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
-        int r = 0;
+int manager_serialize_binary(Manager *m, FILE *f, FDSet *fds) {
+        SerializationHeader h = {
+                .version = SERIALIZATION_VERSION,
+        };
+        _cleanup_free_ uint64_t *offsets = NULL;
+        _cleanup_free_ Unit **units = NULL;
+        unsigned n = 0, k;
+        Iterator i;
+        Unit *u;
+        const char *t;
+        off_t o;
+        int r;
 
         assert(m);
         assert(f);
+        assert(fds);
 
-        log_debug("Deserializing state...");
+        /* Like manager_serialize(), but writes the units as binary
+         * records with an index at the end, see above. Only suitable
+         * for daemon-reload. */
+
+        units = new(Unit*, hashmap_size(m->units));
+        offsets = new(uint64_t, hashmap_size(m->units));
+        if ((!units || !offsets) && hashmap_size(m->units) > 0)
+                return -ENOMEM;
 
         m->n_reloading ++;
 
+        /* The header is rewritten with the final values below */
+        fwrite(&h, sizeof(h), 1, f);
+
+        r = manager_serialize_items(m, f, fds, false);
+        if (r < 0)
+                goto finish;
+
+        HASHMAP_FOREACH_KEY(u, t, m->units, i) {
+                if (u->id != t)
+                        continue;
+
+                o = ftello(f);
+                if (o < 0) {
+                        r = -errno;
+                        goto finish;
+                }
+
+                units[n] = u;
+                offsets[n] = o;
+                n++;
+
+                r = unit_serialize_binary(u, f, fds, true);
+                if (r < 0)
+                        goto finish;
+        }
+
+        o = ftello(f);
+        if (o < 0) {
+                r = -errno;
+                goto finish;
+        }
+
+        for (k = 0; k < n; k++) {
+                SerializationIndexEntry e = {
+                        .offset = offsets[k],
+                        .name_size = strlen(units[k]->id) + 1,
+                };
+
+                fwrite(&e, sizeof(e), 1, f);
+                fwrite(units[k]->id, 1, e.name_size, f);
+        }
+
+        memcpy(h.signature, SERIALIZATION_SIGNATURE, sizeof(h.signature));
+        h.n_units = n;
+        h.index_offset = o;
+
+        if (fseeko(f, 0, SEEK_SET) < 0 ||
+            fwrite(&h, sizeof(h), 1, f) != 1 ||
+            fseeko(f, 0, SEEK_END) < 0) {
+                r = ferror(f) ? -EIO : -errno;
+                goto finish;
+        }
+
+        r = 0;
+
+finish:
+        assert(m->n_reloading > 0);
+        m->n_reloading --;
+
+        if (r < 0)
+                return r;
+
+        if (ferror(f))
+                return -EIO;
+
+        return bus_fdset_add_all(m, fds);
+}
+
+static int manager_deserialize_items(Manager *m, FILE *f, FDSet *fds) {
+        int r;
+
+        assert(m);
+        assert(f);
+
         for (;;) {
                 char line[LINE_MAX], *l;
 
                 if (!fgets(line, sizeof(line), f)) {
                         if (feof(f))
-                                r = 0;
-                        else
-                                r = -errno;
-
-                        goto finish;
+                                return 0;
+                        return -errno;
                 }
 
                 char_array_0(line);
                 l = strstrip(line);
 
                 if (l[0] == 0)
-                        break;
+                        return 0;
 
                 if (startswith(l, "current-job-id=")) {
                         uint32_t id;
@@ -2410,19 +2701,25 @@ int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
                         dual_timestamp_deserialize(l+27, &m->units_load_start_timestamp);
                 else if (startswith(l, "units-load-finish-timestamp="))
                         dual_timestamp_deserialize(l+28, &m->units_load_finish_timestamp);
-                else if (startswith(l, "env=")) {
+                else if (startswith(l, "units-parse-saved-usec=")) {
+                        usec_t t;
+
+                        if (safe_atou64(l+23, &t) < 0)
+                                log_debug("Failed to parse unit file parsing time saved %s", l+23);
+                        else
+                                m->units_parse_saved_usec = t;
+
+                } else if (startswith(l, "env=")) {
                         _cleanup_free_ char *uce = NULL;
                         char **e;
 
                         r = cunescape(l + 4, UNESCAPE_RELAX, &uce);
                         if (r < 0)
-                                goto finish;
+                                return r;
 
                         e = strv_env_set(m->environment, uce);
-                        if (!e) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+                        if (!e)
+                                return -ENOMEM;
 
                         strv_free(m->environment);
                         m->environment = e;
@@ -2442,10 +2739,8 @@ int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
                         char *n;
 
                         n = strdup(l+14);
-                        if (!n) {
-                                r = -ENOMEM;
-                                goto finish;
-                        }
+                        if (!n)
+                                return -ENOMEM;
 
                         free(m->notify_socket);
                         m->notify_socket = n;
@@ -2470,6 +2765,13 @@ int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
                                 log_debug("Unknown serialization item '%s'", l);
                 }
         }
+}
+
+static int manager_deserialize_units(Manager *m, FILE *f, FDSet *fds) {
+        int r;
+
+        assert(m);
+        assert(f);
 
         for (;;) {
                 Unit *u;
@@ -2478,26 +2780,153 @@ int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
                 /* Start marker */
                 if (!fgets(name, sizeof(name), f)) {
                         if (feof(f))
-                                r = 0;
-                        else
-                                r = -errno;
-
-                        goto finish;
+                                return 0;
+                        return -errno;
                 }
 
                 char_array_0(name);
 
                 r = manager_load_unit(m, strstrip(name), NULL, NULL, &u);
                 if (r < 0)
-                        goto finish;
+                        return r;
 
                 r = unit_deserialize(u, f, fds);
                 if (r < 0)
+                        return r;
+        }
+}
+
+static int manager_deserialize_units_binary(Manager *m, FILE *f, FDSet *fds, const SerializationHeader *h) {
+        _cleanup_free_ uint8_t *buf = NULL;
+        size_t index_size, p;
+        off_t end;
+        unsigned k;
+        int r;
+
+        assert(m);
+        assert(f);
+        assert(h);
+
+        /* Read the whole unit index in one go, then deserialize the
+         * unit records it points to. Since each record is located
+         * through the index, a record that fails to deserialize
+         * doesn't take the records after it down with it. */
+
+        if (fseeko(f, 0, SEEK_END) < 0)
+                return -errno;
+
+        end = ftello(f);
+        if (end < 0)
+                return -errno;
+
+        if (h->index_offset < sizeof(SerializationHeader) || h->index_offset > (uint64_t) end)
+                return -EBADMSG;
+
+        index_size = (size_t) ((uint64_t) end - h->index_offset);
+        if ((uint64_t) h->n_units * (sizeof(SerializationIndexEntry) + 2) > index_size)
+                return -EBADMSG;
+
+        buf = malloc(index_size);
+        if (!buf)
+                return -ENOMEM;
+
+        if (fseeko(f, h->index_offset, SEEK_SET) < 0)
+                return -errno;
+
+        if (fread(buf, 1, index_size, f) != index_size)
+                return -EIO;
+
+        for (k = 0, p = 0; k < h->n_units; k++) {
+                SerializationIndexEntry e;
+                const char *name;
+                Unit *u;
+
+                if (index_size - p < sizeof(e))
+                        return -EBADMSG;
+
+                memcpy(&e, buf + p, sizeof(e));
+                p += sizeof(e);
+
+                if (e.name_size < 2 || e.name_size > index_size - p)
+                        return -EBADMSG;
+
+                name = (const char*) buf + p;
+                p += e.name_size;
+
+                if (name[e.name_size - 1] != 0 ||
+                    e.offset < sizeof(SerializationHeader) ||
+                    e.offset >= h->index_offset)
+                        return -EBADMSG;
+
+                r = manager_load_unit(m, name, NULL, NULL, &u);
+                if (r == -ENOMEM)
+                        return r;
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to load serialized unit %s, skipping: %m", name);
+                        continue;
+                }
+
+                /* The index was read last, so the first record
+                 * always takes a seek. Records are laid out in index
+                 * order though, so the following ones usually start
+                 * right where the previous one ended. */
+                if (ftello(f) != (off_t) e.offset &&
+                    fseeko(f, e.offset, SEEK_SET) < 0)
+                        return -errno;
+
+                r = unit_deserialize_binary(u, f, fds);
+                if (r == -ENOMEM)
+                        return r;
+                if (r < 0) {
+                        log_unit_warning_errno(u, r, "Failed to deserialize unit state, ignoring: %m");
+                        clearerr(f);
+                }
+        }
+
+        return 0;
+}
+
+int manager_deserialize(Manager *m, FILE *f, FDSet *fds) {
+        SerializationHeader h;
+        bool binary;
+        int c, r;
+
+        assert(m);
+        assert(f);
+
+        log_debug("Deserializing state...");
+
+        m->n_reloading ++;
+
+        c = getc(f);
+        if (c != EOF)
+                ungetc(c, f);
+
+        binary = c == SERIALIZATION_SIGNATURE[0];
+        if (binary) {
+                if (fread(&h, sizeof(h), 1, f) != 1) {
+                        r = ferror(f) ? -EIO : -EBADMSG;
+                        goto finish;
+                }
+
+                if (memcmp(h.signature, SERIALIZATION_SIGNATURE, sizeof(h.signature)) != 0 ||
+                    h.version != SERIALIZATION_VERSION) {
+                        r = -EPROTONOSUPPORT;
                         goto finish;
+                }
         }
 
+        r = manager_deserialize_items(m, f, fds);
+        if (r < 0)
+                goto finish;
+
+        if (binary)
+                r = manager_deserialize_units_binary(m, f, fds, &h);
+        else
+                r = manager_deserialize_units(m, f, fds);
+
 finish:
-        if (ferror(f))
+        if (ferror(f) && r >= 0)
                 r = -EIO;
 
         assert(m->n_reloading > 0);
@@ -2526,7 +2955,7 @@ int manager_reload(Manager *m) {
                 return -ENOMEM;
         }
 
-        r = manager_serialize(m, f, fds, false);
+        r = manager_serialize_binary(m, f, fds);
         if (r < 0) {
                 m->n_reloading --;
                 return r;
@@ -2556,6 +2985,7 @@ int manager_reload(Manager *m) {
         if (q < 0 && r >= 0)
                 r = q;
 
+        manager_begin_unit_cache(m);
         manager_build_unit_path_cache(m);
 
         /* First, enumerate what we can from all config files */
@@ -2586,6 +3016,151 @@ int manager_reload(Manager *m) {
 
         m->send_reloading_done = true;
 
+        (void) manager_write_unit_cache(m);
+
+        return r;
+}
+
+static bool manager_has_unit_file(Manager *m, const char *name) {
+        char **p;
+
+        STRV_FOREACH(p, m->lookup_paths.unit_path) {
+                _cleanup_free_ char *path = NULL;
+
+                path = strjoin(*p, "/", name, NULL);
+                if (!path || set_get(m->unit_path_cache, path))
+                        return true;
+        }
+
+        return false;
+}
+
+static bool manager_unit_file_appeared(Manager *m, Unit *u) {
+        Iterator i;
+        const char *t;
+
+        assert(m);
+        assert(u);
+
+        /* Whether a unit that could not be found before can be loaded
+         * now, i.e. whether a fragment shows up in the unit path
+         * cache under one of its names, or that of its template. If
+         * in doubt, we say yes. */
+
+        if (!m->unit_path_cache)
+                return true;
+
+        SET_FOREACH(t, u->names, i) {
+                _cleanup_free_ char *template = NULL;
+
+                if (manager_has_unit_file(m, t))
+                        return true;
+
+                if (!u->instance)
+                        continue;
+
+                if (unit_name_template(t, &template) < 0)
+                        return true;
+
+                if (manager_has_unit_file(m, template))
+                        return true;
+        }
+
+        return false;
+}
+
+int manager_reload_incremental(Manager *m) {
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ Unit **changed = NULL;
+        size_t n_allocated = 0, n = 0, k;
+        Iterator i;
+        const char *t;
+        Unit *u;
+        int r = 0, q;
+
+        assert(m);
+
+        /* Only reloads the units whose configuration changed on disk,
+         * leaving all others untouched. Generators are not rerun, and
+         * the lookup paths stay the same. */
+
+        if (m->load_dependencies_incomplete) {
+                log_debug("Origin of some dependencies unknown, doing a full reload.");
+                return manager_reload(m);
+        }
+
+        manager_dispatch_cleanup_queue(m);
+        manager_build_unit_path_cache(m);
+
+        HASHMAP_FOREACH_KEY(u, t, m->units, i) {
+                if (u->id != t)
+                        continue;
+
+                if (u->load_state == UNIT_NOT_FOUND) {
+                        /* Dangling references stay what they are,
+                         * unless their unit file was added */
+                        if (!manager_unit_file_appeared(m, u))
+                                continue;
+                } else if (u->load_state != UNIT_ERROR &&
+                           !unit_need_daemon_reload(u))
+                        continue;
+
+                if (u->job || u->nop_job) {
+                        log_unit_debug(u, "Changed unit has a job queued, doing a full reload.");
+                        return manager_reload(m);
+                }
+
+                if (!GREEDY_REALLOC(changed, n_allocated, n + 1))
+                        return -ENOMEM;
+
+                changed[n++] = u;
+        }
+
+        log_debug("Reloading %zu changed units.", n);
+
+        r = manager_open_serialization(m, &f);
+        if (r < 0)
+                return r;
+
+        m->n_reloading ++;
+        bus_manager_send_reloading(m, true);
+
+        for (k = 0; k < n; k++) {
+                /* Might have become an alias of a unit reloaded before */
+                if (changed[k]->load_state == UNIT_MERGED) {
+                        changed[k] = NULL;
+                        continue;
+                }
+
+                q = unit_reload_config(changed[k], f, &changed[k]);
+                if (q < 0) {
+                        log_error_errno(q, "Failed to reload unit: %m");
+                        if (r >= 0)
+                                r = q;
+
+                        /* The unit might be gone already */
+                        n = k;
+                        break;
+                }
+        }
+
+        for (k = 0; k < n; k++) {
+                if (!changed[k])
+                        continue;
+
+                q = unit_coldplug(changed[k]);
+                if (q < 0)
+                        log_unit_warning_errno(changed[k], q, "Failed to coldplug unit, proceeding anyway: %m");
+        }
+
+        if (m->api_bus)
+                manager_sync_bus_names(m, m->api_bus);
+
+        assert(m->n_reloading > 0);
+        m->n_reloading--;
+
+        m->send_reloading_done = true;
+
         return r;
 }
 
@@ -2722,6 +3297,10 @@ void manager_check_finished(Manager *m) {
         /* This is no longer the first boot */
         manager_set_first_boot(m, false);
 
+        /* Everything needed for booting is loaded by now, and /var is
+         * mounted */
+        (void) manager_write_unit_cache(m);
+
         if (dual_timestamp_is_set(&m->finish_timestamp))
                 return;
 
@@ -2805,7 +3384,7 @@ static void trim_generator_dir(Manager *m, char **generator) {
 
 static int manager_run_generators(Manager *m) {
         _cleanup_strv_free_ char **paths = NULL;
-        const char *argv[5];
+        const char *output[3];
         char **path;
         int r;
 
@@ -2842,14 +3421,16 @@ static int manager_run_generators(Manager *m) {
         if (r < 0)
                 goto finish;
 
-        argv[0] = NULL; /* Leave this empty, execute_directory() will fill something in */
-        argv[1] = m->generator_unit_path;
-        argv[2] = m->generator_unit_path_early;
-        argv[3] = m->generator_unit_path_late;
-        argv[4] = NULL;
+        r = create_generator_dir(m, &m->generator_private_path, "generator.private");
+        if (r < 0)
+                goto finish;
+
+        output[0] = m->generator_unit_path;
+        output[1] = m->generator_unit_path_early;
+        output[2] = m->generator_unit_path_late;
 
         RUN_WITH_UMASK(0022)
-                execute_directories((const char* const*) paths, DEFAULT_TIMEOUT_USEC, (char**) argv);
+                (void) generators_run(&m->generators, paths, m->generator_private_path, output, DEFAULT_TIMEOUT_USEC);
 
 finish:
         trim_generator_dir(m, &m->generator_unit_path);
@@ -2879,6 +3460,15 @@ static void manager_undo_generators(Manager *m) {
         remove_generator_dir(m, &m->generator_unit_path_late);
 }
 
+static void manager_forget_generators(Manager *m) {
+        assert(m);
+
+        /* Unlike the merged output, the output of the individual
+         * generators is kept over reloads, for reusing it */
+        remove_generator_dir(m, &m->generator_private_path);
+        m->generators = generators_free(m->generators);
+}
+
 int manager_environment_add(Manager *m, char **minus, char **plus) {
         char **a = NULL, **b = NULL, **l;
         assert(m);
@@ -54,6 +54,7 @@ typedef enum ManagerExitCode {
         MANAGER_OK,
         MANAGER_EXIT,
         MANAGER_RELOAD,
+        MANAGER_RELOAD_INCREMENTAL,
         MANAGER_REEXECUTE,
         MANAGER_REBOOT,
         MANAGER_POWEROFF,
@@ -72,6 +73,9 @@ typedef enum StatusType {
 
 #include "execute.h"
 #include "job.h"
+#include "generators.h"
+#include "load-prefetch.h"
+#include "unit-cache.h"
 #include "path-lookup.h"
 #include "show-status.h"
 #include "unit-name.h"
@@ -92,6 +96,14 @@ struct Manager {
         /* Units that need to be loaded */
         LIST_HEAD(Unit, load_queue); /* this is actually more a stack than a queue, but uh. */
 
+        /* The unit whose configuration is being loaded right now, and
+         * whether we failed to record where a dependency came from */
+        Unit *loading_unit;
+        bool load_dependencies_incomplete;
+
+        /* Reads unit files ahead while the load queue is dispatched */
+        LoadPrefetch *load_prefetch;
+
         /* Jobs that need to be run */
         LIST_HEAD(Job, run_queue);   /* more a stack than a queue, too */
 
@@ -145,6 +157,11 @@ struct Manager {
         LookupPaths lookup_paths;
         Set *unit_path_cache;
 
+        /* Directory listings and tokenized unit files of earlier
+         * boots, and where they are stored */
+        UnitCache *unit_cache;
+        const char *unit_cache_path;
+
         char **environment;
 
         usec_t runtime_watchdog;
@@ -164,10 +181,22 @@ struct Manager {
         dual_timestamp units_load_start_timestamp;
         dual_timestamp units_load_finish_timestamp;
 
+        /* Main thread time saved by reading unit files in parallel
+         * during startup */
+        usec_t units_parse_saved_usec;
+
+        /* Unit files read in worker threads, for debugging */
+        unsigned n_unit_files_prefetched;
+
         char *generator_unit_path;
         char *generator_unit_path_early;
         char *generator_unit_path_late;
 
+        /* Where generators write their output before it is merged
+         * into the directories above, and their last runs */
+        char *generator_private_path;
+        Hashmap *generators;
+
         struct udev* udev;
 
         /* Data specific to the device subsystem */
@@ -347,9 +376,13 @@ int manager_loop(Manager *m);
 int manager_open_serialization(Manager *m, FILE **_f);
 
 int manager_serialize(Manager *m, FILE *f, FDSet *fds, bool switching_root);
+int manager_serialize_binary(Manager *m, FILE *f, FDSet *fds);
 int manager_deserialize(Manager *m, FILE *f, FDSet *fds);
 
 int manager_reload(Manager *m);
+int manager_reload_incremental(Manager *m);
+
+int manager_write_unit_cache(Manager *m);
 
 bool manager_is_reloading_or_reexecuting(Manager *m) _pure_;
 
@@ -0,0 +1,798 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fd-util.h"
+#include "fileio.h"
+#include "hashmap.h"
+#include "log.h"
+#include "mkdir.h"
+#include "stat-util.h"
+#include "string-util.h"
+#include "unit-cache.h"
+
+/* The file is only ever read on the machine that wrote it, hence
+ * everything is in host byte order. All records are 8 byte aligned
+ * and the offset tables are sorted by path. */
+
+#define UNIT_CACHE_SIGNATURE ((const uint8_t[]) { 'S', 'D', 'U', 'N', 'I', 'T', 'C', 'A' })
+#define UNIT_CACHE_VERSION 2U
+
+/* Refuse to map anything this big, unit files are small */
+#define UNIT_CACHE_SIZE_MAX (64U*1024U*1024U)
+
+typedef struct UnitCacheHeader {
+        uint8_t signature[8];
+        uint32_t version;
+        uint32_t n_directories;
+        uint32_t n_files;
+        uint32_t reserved;
+        uint64_t directories_offset;
+        uint64_t files_offset;
+} UnitCacheHeader;
+
+typedef struct UnitCacheRecord {
+        uint64_t size;
+        uint64_t dev;
+        uint64_t ino;
+        uint64_t file_size;
+        uint64_t mtime;
+        uint32_t path_size;
+        uint32_t n_items;
+        /* Followed by the path, and aligned to 8 bytes the entries of
+         * a directory as nulstr of n_items bytes, or n_items
+         * UnitCacheToken followed by their strings */
+} UnitCacheRecord;
+
+typedef struct UnitCacheToken {
+        uint32_t type;
+        uint32_t line;
+        uint32_t key;
+        uint32_t value;   /* UINT32_MAX if there is none */
+} UnitCacheToken;
+
+typedef struct UnitCacheEntry {
+        char *path;
+        uint64_t dev, ino, size;
+        usec_t mtime;
+
+        char *entries;
+        size_t entries_size;
+
+        ConfigTokens *tokens;
+} UnitCacheEntry;
+
+struct UnitCache {
+        void *map;
+        size_t size;
+
+        /* What was used while loading units, if collecting */
+        bool collecting;
+        Hashmap *directories;
+        Hashmap *files;
+
+        unsigned n_directory_hits, n_file_hits;
+};
+
+static UnitCacheEntry *unit_cache_entry_free(UnitCacheEntry *e) {
+        if (!e)
+                return NULL;
+
+        config_tokens_free(e->tokens);
+        free(e->entries);
+        free(e->path);
+        free(e);
+
+        return NULL;
+}
+
+static void unit_cache_flush(UnitCache *c) {
+        UnitCacheEntry *e;
+
+        assert(c);
+
+        while ((e = hashmap_steal_first(c->directories)))
+                unit_cache_entry_free(e);
+        while ((e = hashmap_steal_first(c->files)))
+                unit_cache_entry_free(e);
+
+        c->directories = hashmap_free(c->directories);
+        c->files = hashmap_free(c->files);
+        c->collecting = false;
+}
+
+static const UnitCacheRecord *unit_cache_record(UnitCache *c, uint64_t offset, const char **ret_path, uint64_t *ret_data) {
+        const UnitCacheRecord *r;
+        const char *path;
+        uint64_t data;
+
+        /* Everything is checked against the size of the file before
+         * use, so that a corrupted cache cannot make us read beyond
+         * the map */
+
+        if (offset % 8 != 0 ||
+            offset < sizeof(UnitCacheHeader) ||
+            offset > c->size ||
+            c->size - offset < sizeof(UnitCacheRecord))
+                return NULL;
+
+        r = (const UnitCacheRecord*) ((const uint8_t*) c->map + offset);
+        if (r->size < sizeof(UnitCacheRecord) || r->size > c->size - offset)
+                return NULL;
+
+        if (r->path_size == 0)
+                return NULL;
+
+        data = ALIGN8((uint64_t) sizeof(UnitCacheRecord) + r->path_size);
+        if (data > r->size)
+                return NULL;
+
+        path = (const char*) (r + 1);
+        if (memchr(path, 0, r->path_size) != path + r->path_size - 1)
+                return NULL;
+
+        *ret_path = path;
+        *ret_data = data;
+
+        return r;
+}
+
+static bool unit_cache_verify_table(UnitCache *c, uint64_t table, uint32_t n) {
+        const uint64_t *offsets;
+        const char *previous = NULL;
+        uint32_t i;
+
+        /* Every record has to be in bounds, and the table sorted, as
+         * lookups bisect it */
+
+        offsets = (const uint64_t*) ((const uint8_t*) c->map + table);
+
+        for (i = 0; i < n; i++) {
+                const char *p;
+                uint64_t data;
+
+                if (!unit_cache_record(c, offsets[i], &p, &data))
+                        return false;
+
+                if (previous && strcmp(previous, p) >= 0)
+                        return false;
+
+                previous = p;
+        }
+
+        return true;
+}
+
+static int unit_cache_map(UnitCache *c, const char *path) {
+        _cleanup_close_ int fd = -1;
+        const UnitCacheHeader *h;
+        struct stat st;
+        void *map;
+
+        fd = open(path, O_RDONLY|O_CLOEXEC|O_NOCTTY|O_NOFOLLOW);
+        if (fd < 0)
+                return -errno;
+
+        if (fstat(fd, &st) < 0)
+                return -errno;
+
+        /* Whoever can write the cache can make us load anything */
+        if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & 0022))
+                return -EPERM;
+
+        if ((uint64_t) st.st_size < sizeof(UnitCacheHeader) || (uint64_t) st.st_size > UNIT_CACHE_SIZE_MAX)
+                return -EBADMSG;
+
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED)
+                return -errno;
+
+        h = map;
+        if (memcmp(h->signature, UNIT_CACHE_SIGNATURE, sizeof(h->signature)) != 0 ||
+            h->version != UNIT_CACHE_VERSION ||
+            h->directories_offset % 8 != 0 ||
+            h->files_offset % 8 != 0 ||
+            h->directories_offset > (uint64_t) st.st_size ||
+            h->files_offset > (uint64_t) st.st_size ||
+            h->n_directories > ((uint64_t) st.st_size - h->directories_offset) / sizeof(uint64_t) ||
+            h->n_files > ((uint64_t) st.st_size - h->files_offset) / sizeof(uint64_t)) {
+                munmap(map, st.st_size);
+                return -EBADMSG;
+        }
+
+        c->map = map;
+        c->size = st.st_size;
+
+        /* Any inconsistency means the file cannot be trusted at all,
+         * hence drop all of it rather than serving what seems intact */
+        if (!unit_cache_verify_table(c, h->directories_offset, h->n_directories) ||
+            !unit_cache_verify_table(c, h->files_offset, h->n_files)) {
+                munmap(map, st.st_size);
+                c->map = NULL;
+                c->size = 0;
+                return -EBADMSG;
+        }
+
+        return 0;
+}
+
+int unit_cache_open(const char *path, UnitCache **ret) {
+        UnitCache *c;
+        int r;
+
+        assert(path);
+        assert(ret);
+
+        /* A missing or unusable cache is not an error, it is simply
+         * empty then */
+
+        c = new0(UnitCache, 1);
+        if (!c)
+                return -ENOMEM;
+
+        r = unit_cache_map(c, path);
+        if (r < 0 && r != -ENOENT)
+                log_debug_errno(r, "Failed to read unit cache %s, ignoring: %m", path);
+
+        *ret = c;
+        return 0;
+}
+
+UnitCache *unit_cache_free(UnitCache *c) {
+        if (!c)
+                return NULL;
+
+        /* The collected tokens might still point into the map */
+        unit_cache_flush(c);
+
+        if (c->map)
+                munmap(c->map, c->size);
+
+        free(c);
+
+        return NULL;
+}
+
+static const UnitCacheRecord *unit_cache_find(UnitCache *c, uint64_t table, uint32_t n, const char *path, uint64_t *ret_data) {
+        const uint64_t *offsets;
+        uint32_t lo = 0, hi = n;
+
+        if (!c->map)
+                return NULL;
+
+        offsets = (const uint64_t*) ((const uint8_t*) c->map + table);
+
+        while (lo < hi) {
+                const UnitCacheRecord *r;
+                const char *p;
+                uint32_t mid;
+                int k;
+
+                mid = lo + (hi - lo) / 2;
+
+                r = unit_cache_record(c, offsets[mid], &p, ret_data);
+                if (!r)
+                        return NULL;
+
+                k = strcmp(path, p);
+                if (k == 0)
+                        return r;
+                if (k < 0)
+                        hi = mid;
+                else
+                        lo = mid + 1;
+        }
+
+        return NULL;
+}
+
+static const UnitCacheRecord *unit_cache_find_directory(UnitCache *c, const char *path, uint64_t *ret_data) {
+        const UnitCacheHeader *h = c->map;
+
+        return h ? unit_cache_find(c, h->directories_offset, h->n_directories, path, ret_data) : NULL;
+}
+
+static const UnitCacheRecord *unit_cache_find_file(UnitCache *c, const char *path, uint64_t *ret_data) {
+        const UnitCacheHeader *h = c->map;
+
+        return h ? unit_cache_find(c, h->files_offset, h->n_files, path, ret_data) : NULL;
+}
+
+const char *unit_cache_get_directory(UnitCache *c, const char *path, const struct stat *st) {
+        const UnitCacheRecord *r;
+        const char *entries;
+        uint64_t data;
+
+        assert(c);
+        assert(path);
+        assert(st);
+
+        /* Returns the names in the directory as nulstr, if they are
+         * known and the directory did not change since */
+
+        r = unit_cache_find_directory(c, path, &data);
+        if (!r)
+                return NULL;
+
+        if (r->dev != (uint64_t) st->st_dev ||
+            r->ino != (uint64_t) st->st_ino ||
+            r->file_size != (uint64_t) st->st_size ||
+            r->mtime != timespec_load(&st->st_mtim))
+                return NULL;
+
+        /* The list has to end in an empty string within the record */
+        if (r->n_items == 0 || r->n_items > r->size - data)
+                return NULL;
+
+        entries = (const char*) r + data;
+        if (entries[r->n_items - 1] != 0 || (r->n_items > 1 && entries[r->n_items - 2] != 0))
+                return NULL;
+
+        c->n_directory_hits++;
+
+        /* Known good, hence keep it */
+        (void) unit_cache_add_directory(c, path, st, USEC_INFINITY, entries, r->n_items);
+
+        return entries;
+}
+
+static const char *unit_cache_string(const UnitCacheRecord *r, uint64_t offset) {
+        const char *s;
+
+        if (offset >= r->size)
+                return NULL;
+
+        s = (const char*) r + offset;
+        if (!memchr(s, 0, r->size - offset))
+                return NULL;
+
+        return s;
+}
+
+ConfigTokens *unit_cache_get_tokens(UnitCache *c, const char *path) {
+        _cleanup_(config_tokens_freep) ConfigTokens *t = NULL;
+        ConfigTokens *ret;
+        const UnitCacheToken *tokens;
+        const UnitCacheRecord *r;
+        uint64_t data;
+        uint32_t i;
+
+        assert(c);
+        assert(path);
+
+        /* Returns the tokens of the file as read earlier. The strings
+         * point into the cache, hence the result has to be freed
+         * before it. Whether the file still matches is checked by
+         * config_parse_tokens(). */
+
+        r = unit_cache_find_file(c, path, &data);
+        if (!r)
+                return NULL;
+
+        if (r->n_items > (r->size - data) / sizeof(UnitCacheToken))
+                return NULL;
+
+        t = new0(ConfigTokens, 1);
+        if (!t)
+                return NULL;
+
+        t->borrowed = true;
+        t->dev = (dev_t) r->dev;
+        t->ino = (ino_t) r->ino;
+        t->size = (off_t) r->file_size;
+        t->mtime = r->mtime;
+
+        t->tokens = new0(ConfigToken, MAX(r->n_items, 1U));
+        if (!t->tokens)
+                return NULL;
+
+        t->n_allocated = MAX(r->n_items, 1U);
+
+        tokens = (const UnitCacheToken*) ((const uint8_t*) r + data);
+        for (i = 0; i < r->n_items; i++) {
+                ConfigToken *k = t->tokens + i;
+
+                if (tokens[i].type >= _CONFIG_TOKEN_TYPE_MAX)
+                        return NULL;
+
+                k->type = tokens[i].type;
+                k->line = tokens[i].line;
+
+                k->key = (char*) unit_cache_string(r, tokens[i].key);
+                if (!k->key)
+                        return NULL;
+
+                if (tokens[i].value != UINT32_MAX) {
+                        k->value = (char*) unit_cache_string(r, tokens[i].value);
+                        if (!k->value)
+                                return NULL;
+                } else if (k->type == CONFIG_TOKEN_ASSIGNMENT)
+                        return NULL;
+
+                t->n_tokens++;
+        }
+
+        ret = t;
+        t = NULL;
+
+        return ret;
+}
+
+bool unit_cache_has_file(UnitCache *c, const char *path) {
+        uint64_t data;
+
+        assert(c);
+        assert(path);
+
+        return !!unit_cache_find_file(c, path, &data);
+}
+
+int unit_cache_begin(UnitCache *c) {
+        assert(c);
+
+        unit_cache_flush(c);
+
+        c->directories = hashmap_new(&string_hash_ops);
+        c->files = hashmap_new(&string_hash_ops);
+        if (!c->directories || !c->files) {
+                unit_cache_flush(c);
+                return -ENOMEM;
+        }
+
+        c->collecting = true;
+        c->n_directory_hits = c->n_file_hits = 0;
+
+        return 0;
+}
+
+bool unit_cache_collecting(UnitCache *c) {
+        return c && c->collecting;
+}
+
+static UnitCacheEntry *unit_cache_entry_new(const char *path, uint64_t dev, uint64_t ino, uint64_t size, usec_t mtime) {
+        UnitCacheEntry *e;
+
+        e = new0(UnitCacheEntry, 1);
+        if (!e)
+                return NULL;
+
+        e->path = strdup(path);
+        if (!e->path)
+                return mfree(e);
+
+        e->dev = dev;
+        e->ino = ino;
+        e->size = size;
+        e->mtime = mtime;
+
+        return e;
+}
+
+static bool unit_cache_persistent(const char *path) {
+        struct statfs sfs;
+
+        /* On tmpfs, device and inode numbers are handed out anew on
+         * every boot and might well end up the same, and so might
+         * the mtimes on machines without RTC. Hence, a file in /run
+         * could match what was cached for another one in the
+         * previous boot. Only keep what is on disk. */
+
+        if (statfs(path, &sfs) < 0)
+                return false;
+
+        return !is_temporary_fs(&sfs);
+}
+
+int unit_cache_add_directory(UnitCache *c, const char *path, const struct stat *st, usec_t timestamp, const char *entries, size_t size) {
+        UnitCacheEntry *e;
+        usec_t mtime;
+        int r;
+
+        assert(c);
+        assert(path);
+        assert(st);
+        assert(entries);
+
+        /* Records the listing of a directory, taken at timestamp or
+         * later */
+
+        if (!c->collecting || hashmap_contains(c->directories, path))
+                return 0;
+
+        /* Don't keep what might turn out stale, it would be forever */
+        mtime = timespec_load(&st->st_mtim);
+        if (mtime_is_racy(mtime, timestamp))
+                return 0;
+
+        if (!unit_cache_persistent(path))
+                return 0;
+
+        e = unit_cache_entry_new(path, st->st_dev, st->st_ino, st->st_size, mtime);
+        if (!e)
+                return -ENOMEM;
+
+        e->entries = memdup(entries, size);
+        if (!e->entries) {
+                unit_cache_entry_free(e);
+                return -ENOMEM;
+        }
+
+        e->entries_size = size;
+
+        r = hashmap_put(c->directories, e->path, e);
+        if (r < 0) {
+                unit_cache_entry_free(e);
+                return r;
+        }
+
+        return 1;
+}
+
+int unit_cache_add_tokens(UnitCache *c, const char *path, ConfigTokens *tokens) {
+        UnitCacheEntry *e;
+        int r;
+
+        assert(c);
+        assert(path);
+        assert(tokens);
+
+        /* Records the tokens a file was parsed from, and takes
+         * ownership of them. Tokens that came from the cache are
+         * known good. */
+
+        if (tokens->borrowed)
+                c->n_file_hits++;
+
+        if (!c->collecting ||
+            tokens->error < 0 ||
+            hashmap_contains(c->files, path) ||
+            (!tokens->borrowed && mtime_is_racy(tokens->mtime, tokens->timestamp)) ||
+            !unit_cache_persistent(path)) {
+                config_tokens_free(tokens);
+                return 0;
+        }
+
+        e = unit_cache_entry_new(path, tokens->dev, tokens->ino, tokens->size, tokens->mtime);
+        if (!e) {
+                config_tokens_free(tokens);
+                return -ENOMEM;
+        }
+
+        e->tokens = tokens;
+
+        r = hashmap_put(c->files, e->path, e);
+        if (r < 0) {
+                unit_cache_entry_free(e);
+                return r;
+        }
+
+        return 1;
+}
+
+static int unit_cache_entry_compare(const void *a, const void *b) {
+        const UnitCacheEntry *x = *(const UnitCacheEntry**) a, *y = *(const UnitCacheEntry**) b;
+
+        return strcmp(x->path, y->path);
+}
+
+static size_t unit_cache_put_string(uint8_t *p, const char *s) {
+        size_t l;
+
+        l = strlen(s) + 1;
+        memcpy(p, s, l);
+
+        return l;
+}
+
+static int unit_cache_write_record(FILE *f, uint64_t *offset, const UnitCacheEntry *e) {
+        _cleanup_free_ uint8_t *buf = NULL;
+        UnitCacheRecord *r;
+        uint64_t data, size, n_items, strings;
+        size_t path_size, i;
+
+        path_size = strlen(e->path) + 1;
+        data = ALIGN8((uint64_t) sizeof(UnitCacheRecord) + path_size);
+
+        if (e->tokens) {
+                n_items = e->tokens->n_tokens;
+
+                size = data + n_items * sizeof(UnitCacheToken);
+                for (i = 0; i < e->tokens->n_tokens; i++) {
+                        size += strlen(e->tokens->tokens[i].key) + 1;
+                        if (e->tokens->tokens[i].value)
+                                size += strlen(e->tokens->tokens[i].value) + 1;
+                }
+        } else {
+                n_items = e->entries_size;
+                size = data + n_items;
+        }
+
+        size = ALIGN8(size);
+        if (size >= UINT32_MAX)
+                return 0;
+
+        buf = new0(uint8_t, size);
+        if (!buf)
+                return -ENOMEM;
+
+        r = (UnitCacheRecord*) buf;
+        r->size = size;
+        r->dev = e->dev;
+        r->ino = e->ino;
+        r->file_size = e->size;
+        r->mtime = e->mtime;
+        r->path_size = path_size;
+        r->n_items = n_items;
+        memcpy(r + 1, e->path, path_size);
+
+        if (e->tokens) {
+                UnitCacheToken *t = (UnitCacheToken*) (buf + data);
+
+                strings = data + n_items * sizeof(UnitCacheToken);
+                for (i = 0; i < e->tokens->n_tokens; i++) {
+                        const ConfigToken *k = e->tokens->tokens + i;
+
+                        t[i].type = k->type;
+                        t[i].line = k->line;
+
+                        t[i].key = strings;
+                        strings += unit_cache_put_string(buf + strings, k->key);
+
+                        if (k->value) {
+                                t[i].value = strings;
+                                strings += unit_cache_put_string(buf + strings, k->value);
+                        } else
+                                t[i].value = UINT32_MAX;
+                }
+        } else
+                memcpy(buf + data, e->entries, n_items);
+
+        if (fwrite(buf, size, 1, f) != 1)
+                return errno > 0 ? -errno : -EIO;
+
+        *offset += size;
+
+        return 1;
+}
+
+static int unit_cache_write_table(FILE *f, uint64_t *offset, Hashmap *h, uint32_t *ret_n, uint64_t *ret_table) {
+        _cleanup_free_ UnitCacheEntry **entries = NULL;
+        _cleanup_free_ uint64_t *offsets = NULL;
+        UnitCacheEntry *e;
+        Iterator i;
+        size_t n = 0, k;
+        uint32_t m = 0;
+        int r;
+
+        entries = new(UnitCacheEntry*, hashmap_size(h) + 1);
+        offsets = new(uint64_t, hashmap_size(h) + 1);
+        if (!entries || !offsets)
+                return -ENOMEM;
+
+        HASHMAP_FOREACH(e, h, i)
+                entries[n++] = e;
+
+        qsort_safe(entries, n, sizeof(UnitCacheEntry*), unit_cache_entry_compare);
+
+        for (k = 0; k < n; k++) {
+                uint64_t o = *offset;
+
+                r = unit_cache_write_record(f, offset, entries[k]);
+                if (r < 0)
+                        return r;
+                if (r > 0)
+                        offsets[m++] = o;
+        }
+
+        if (m > 0 && fwrite(offsets, sizeof(uint64_t), m, f) != m)
+                return errno > 0 ? -errno : -EIO;
+
+        *ret_table = *offset;
+        *ret_n = m;
+        *offset += m * sizeof(uint64_t);
+
+        return 0;
+}
+
+int unit_cache_commit(UnitCache *c, const char *path) {
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ char *temp = NULL;
+        UnitCacheHeader h = {};
+        uint64_t offset;
+        int r;
+
+        assert(c);
+        assert(path);
+
+        /* Writes what was collected to a new cache file, and stops
+         * collecting */
+
+        if (!c->collecting)
+                return 0;
+
+        log_debug("Unit cache: %u directories and %u files of %u and %u reused.",
+                  c->n_directory_hits, c->n_file_hits,
+                  hashmap_size(c->directories), hashmap_size(c->files));
+
+        (void) mkdir_parents(path, 0755);
+
+        r = fopen_temporary(path, &f, &temp);
+        if (r < 0)
+                goto finish;
+
+        offset = sizeof(h);
+        if (fwrite(&h, sizeof(h), 1, f) != 1) {
+                r = errno > 0 ? -errno : -EIO;
+                goto finish;
+        }
+
+        r = unit_cache_write_table(f, &offset, c->directories, &h.n_directories, &h.directories_offset);
+        if (r < 0)
+                goto finish;
+
+        r = unit_cache_write_table(f, &offset, c->files, &h.n_files, &h.files_offset);
+        if (r < 0)
+                goto finish;
+
+        /* Only mark the file valid once everything else is written */
+        memcpy(h.signature, UNIT_CACHE_SIGNATURE, sizeof(h.signature));
+        h.version = UNIT_CACHE_VERSION;
+
+        if (fseeko(f, 0, SEEK_SET) < 0 ||
+            fwrite(&h, sizeof(h), 1, f) != 1) {
+                r = errno > 0 ? -errno : -EIO;
+                goto finish;
+        }
+
+        r = fflush_and_check(f);
+        if (r < 0)
+                goto finish;
+
+        if (rename(temp, path) < 0) {
+                r = -errno;
+                goto finish;
+        }
+
+        temp = mfree(temp);
+
+finish:
+        if (temp)
+                (void) unlink(temp);
+
+        unit_cache_flush(c);
+
+        return r;
+}
+
+void unit_cache_hits(UnitCache *c, unsigned *ret_directories, unsigned *ret_files) {
+        assert(c);
+
+        if (ret_directories)
+                *ret_directories = c->n_directory_hits;
+        if (ret_files)
+                *ret_files = c->n_file_hits;
+}
@@ -0,0 +1,53 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "conf-parser.h"
+
+typedef struct UnitCache UnitCache;
+
+/* Keeps the listings of the unit directories and the tokenized unit
+ * files across boots, so that unchanged ones need not be read
+ * again. Entries are only used if the inode, size and mtime still
+ * match. Nothing on tmpfs is kept. */
+
+#define UNIT_CACHE_PATH "/var/cache/systemd/unit-cache"
+
+int unit_cache_open(const char *path, UnitCache **ret);
+UnitCache *unit_cache_free(UnitCache *c);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(UnitCache*, unit_cache_free);
+
+const char *unit_cache_get_directory(UnitCache *c, const char *path, const struct stat *st);
+ConfigTokens *unit_cache_get_tokens(UnitCache *c, const char *path);
+bool unit_cache_has_file(UnitCache *c, const char *path);
+
+/* Collects what was read while loading units, for writing a new
+ * cache */
+int unit_cache_begin(UnitCache *c);
+bool unit_cache_collecting(UnitCache *c);
+int unit_cache_add_directory(UnitCache *c, const char *path, const struct stat *st, usec_t timestamp, const char *entries, size_t size);
+int unit_cache_add_tokens(UnitCache *c, const char *path, ConfigTokens *tokens);
+int unit_cache_commit(UnitCache *c, const char *path);
+
+void unit_cache_hits(UnitCache *c, unsigned *ret_directories, unsigned *ret_files);
@@ -41,6 +41,7 @@
 #include "formats-util.h"
 #include "load-dropin.h"
 #include "load-fragment.h"
+#include "load-prefetch.h"
 #include "log.h"
 #include "macro.h"
 #include "missing.h"
@@ -339,6 +340,9 @@ void unit_add_to_load_queue(Unit *u) {
 
         LIST_PREPEND(load_queue, u->manager->load_queue, u);
         u->in_load_queue = true;
+
+        if (u->manager->load_prefetch)
+                load_prefetch_unit(u->manager->load_prefetch, u);
 }
 
 void unit_add_to_cleanup_queue(Unit *u) {
@@ -399,6 +403,8 @@ static void bidi_set_free(Unit *u, Set *s) {
                 for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
                         set_remove(other->dependencies[d], u);
 
+                hashmap_remove(other->load_dependencies, u);
+
                 unit_add_to_gc_queue(other);
         }
 
@@ -516,6 +522,8 @@ void unit_free(Unit *u) {
         for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
                 bidi_set_free(u, u->dependencies[d]);
 
+        hashmap_free(u->load_dependencies);
+
         if (u->type != _UNIT_TYPE_INVALID)
                 LIST_REMOVE(units_by_type, u->manager->units_by_type[u->type], u);
 
@@ -648,6 +656,50 @@ static int reserve_dependencies(Unit *u, Unit *other, UnitDependency d) {
         return set_reserve(u->dependencies[d], n_reserve);
 }
 
+static const UnitDependency inverse_table[_UNIT_DEPENDENCY_MAX] = {
+        [UNIT_REQUIRES] = UNIT_REQUIRED_BY,
+        [UNIT_WANTS] = UNIT_WANTED_BY,
+        [UNIT_REQUISITE] = UNIT_REQUISITE_OF,
+        [UNIT_BINDS_TO] = UNIT_BOUND_BY,
+        [UNIT_PART_OF] = UNIT_CONSISTS_OF,
+        [UNIT_REQUIRED_BY] = UNIT_REQUIRES,
+        [UNIT_REQUISITE_OF] = UNIT_REQUISITE,
+        [UNIT_WANTED_BY] = UNIT_WANTS,
+        [UNIT_BOUND_BY] = UNIT_BINDS_TO,
+        [UNIT_CONSISTS_OF] = UNIT_PART_OF,
+        [UNIT_CONFLICTS] = UNIT_CONFLICTED_BY,
+        [UNIT_CONFLICTED_BY] = UNIT_CONFLICTS,
+        [UNIT_BEFORE] = UNIT_AFTER,
+        [UNIT_AFTER] = UNIT_BEFORE,
+        [UNIT_ON_FAILURE] = _UNIT_DEPENDENCY_INVALID,
+        [UNIT_REFERENCES] = UNIT_REFERENCED_BY,
+        [UNIT_REFERENCED_BY] = UNIT_REFERENCES,
+        [UNIT_TRIGGERS] = UNIT_TRIGGERED_BY,
+        [UNIT_TRIGGERED_BY] = UNIT_TRIGGERS,
+        [UNIT_PROPAGATES_RELOAD_TO] = UNIT_RELOAD_PROPAGATED_FROM,
+        [UNIT_RELOAD_PROPAGATED_FROM] = UNIT_PROPAGATES_RELOAD_TO,
+        [UNIT_JOINS_NAMESPACE_OF] = UNIT_JOINS_NAMESPACE_OF,
+};
+
+static void unit_add_load_dependency(Unit *u, Unit *other, unsigned mask) {
+        unsigned old;
+        int r;
+
+        assert(u);
+        assert(other);
+        assert_cc(_UNIT_DEPENDENCY_MAX <= sizeof(unsigned) * 8);
+
+        r = hashmap_ensure_allocated(&u->load_dependencies, NULL);
+        if (r >= 0) {
+                old = PTR_TO_UINT(hashmap_get(u->load_dependencies, other));
+                r = hashmap_replace(u->load_dependencies, other, UINT_TO_PTR(old | mask));
+        }
+
+        /* Not fatal, but from now on only full reloads are safe */
+        if (r < 0)
+                u->manager->load_dependencies_incomplete = true;
+}
+
 static void merge_dependencies(Unit *u, Unit *other, const char *other_id, UnitDependency d) {
         Iterator i;
         Unit *back;
@@ -660,6 +712,11 @@ static void merge_dependencies(Unit *u, Unit *other, const char *other_id, UnitD
         /* Fix backwards pointers */
         SET_FOREACH(back, other->dependencies[d], i) {
                 UnitDependency k;
+                unsigned mask;
+
+                mask = PTR_TO_UINT(hashmap_remove(back->load_dependencies, other));
+                if (mask != 0 && back != u)
+                        unit_add_load_dependency(back, u, mask);
 
                 for (k = 0; k < _UNIT_DEPENDENCY_MAX; k++) {
                         /* Do not add dependencies between u and itself */
@@ -690,6 +747,9 @@ static void merge_dependencies(Unit *u, Unit *other, const char *other_id, UnitD
 int unit_merge(Unit *u, Unit *other) {
         UnitDependency d;
         const char *other_id = NULL;
+        Iterator i;
+        Unit *back;
+        void *v;
         int r;
 
         assert(u);
@@ -748,6 +808,11 @@ int unit_merge(Unit *u, Unit *other) {
         for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
                 merge_dependencies(u, other, other_id, d);
 
+        HASHMAP_FOREACH_KEY(v, back, other->load_dependencies, i)
+                if (back != u)
+                        unit_add_load_dependency(u, back, PTR_TO_UINT(v));
+        other->load_dependencies = hashmap_free(other->load_dependencies);
+
         other->load_state = UNIT_MERGED;
         other->merged_into = u;
 
@@ -1206,6 +1271,7 @@ static int unit_add_startup_units(Unit *u) {
 }
 
 int unit_load(Unit *u) {
+        Unit *loading;
         int r;
 
         assert(u);
@@ -1221,6 +1287,12 @@ int unit_load(Unit *u) {
         if (u->load_state != UNIT_STUB)
                 return 0;
 
+        /* Remember which dependencies the loading adds, see
+         * unit_add_dependency() */
+        loading = u->manager->loading_unit;
+        u->manager->loading_unit = u;
+        u->load_timestamp = now(CLOCK_REALTIME);
+
         if (UNIT_VTABLE(u)->load) {
                 r = UNIT_VTABLE(u)->load(u);
                 if (r < 0)
@@ -1262,11 +1334,15 @@ int unit_load(Unit *u) {
                  * to restore the net_cls ids that have been set previously */
                 if (u->manager->n_reloading <= 0) {
                         r = unit_add_to_netclass_cgroup(u);
-                        if (r < 0)
+                        if (r < 0) {
+                                u->manager->loading_unit = loading;
                                 return r;
+                        }
                 }
         }
 
+        u->manager->loading_unit = loading;
+
         assert((u->load_state != UNIT_MERGED) == !u->merged_into);
 
         unit_add_to_dbus_queue(unit_follow_merge(u));
@@ -1275,6 +1351,7 @@ int unit_load(Unit *u) {
         return 0;
 
 fail:
+        u->manager->loading_unit = loading;
         u->load_state = u->load_state == UNIT_STUB ? UNIT_NOT_FOUND : UNIT_ERROR;
         u->load_error = r;
         unit_add_to_dbus_queue(u);
@@ -2130,33 +2207,8 @@ static void maybe_warn_about_dependency(Unit *u, const char *other, UnitDependen
 }
 
 int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_reference) {
-
-        static const UnitDependency inverse_table[_UNIT_DEPENDENCY_MAX] = {
-                [UNIT_REQUIRES] = UNIT_REQUIRED_BY,
-                [UNIT_WANTS] = UNIT_WANTED_BY,
-                [UNIT_REQUISITE] = UNIT_REQUISITE_OF,
-                [UNIT_BINDS_TO] = UNIT_BOUND_BY,
-                [UNIT_PART_OF] = UNIT_CONSISTS_OF,
-                [UNIT_REQUIRED_BY] = UNIT_REQUIRES,
-                [UNIT_REQUISITE_OF] = UNIT_REQUISITE,
-                [UNIT_WANTED_BY] = UNIT_WANTS,
-                [UNIT_BOUND_BY] = UNIT_BINDS_TO,
-                [UNIT_CONSISTS_OF] = UNIT_PART_OF,
-                [UNIT_CONFLICTS] = UNIT_CONFLICTED_BY,
-                [UNIT_CONFLICTED_BY] = UNIT_CONFLICTS,
-                [UNIT_BEFORE] = UNIT_AFTER,
-                [UNIT_AFTER] = UNIT_BEFORE,
-                [UNIT_ON_FAILURE] = _UNIT_DEPENDENCY_INVALID,
-                [UNIT_REFERENCES] = UNIT_REFERENCED_BY,
-                [UNIT_REFERENCED_BY] = UNIT_REFERENCES,
-                [UNIT_TRIGGERS] = UNIT_TRIGGERED_BY,
-                [UNIT_TRIGGERED_BY] = UNIT_TRIGGERS,
-                [UNIT_PROPAGATES_RELOAD_TO] = UNIT_RELOAD_PROPAGATED_FROM,
-                [UNIT_RELOAD_PROPAGATED_FROM] = UNIT_PROPAGATES_RELOAD_TO,
-                [UNIT_JOINS_NAMESPACE_OF] = UNIT_JOINS_NAMESPACE_OF,
-        };
         int r, q = 0, v = 0, w = 0;
-        Unit *orig_u = u, *orig_other = other;
+        Unit *orig_u = u, *orig_other = other, *loading;
 
         assert(u);
         assert(d >= 0 && d < _UNIT_DEPENDENCY_MAX);
@@ -2216,6 +2268,14 @@ int unit_add_dependency(Unit *u, UnitDependency d, Unit *other, bool add_referen
                         goto fail;
         }
 
+        /* Record which side's configuration this dependency came
+         * from, if any */
+        loading = u->manager->loading_unit ? unit_follow_merge(u->manager->loading_unit) : NULL;
+        if (loading == u)
+                unit_add_load_dependency(u, other, 1U << d | (add_reference ? 1U << UNIT_REFERENCES : 0));
+        else if (loading == other && inverse_table[d] != _UNIT_DEPENDENCY_INVALID)
+                unit_add_load_dependency(other, u, 1U << inverse_table[d] | (add_reference ? 1U << UNIT_REFERENCED_BY : 0));
+
         unit_add_to_dbus_queue(u);
         return 0;
 
@@ -2528,28 +2588,75 @@ bool unit_can_serialize(Unit *u) {
         return UNIT_VTABLE(u)->serialize && UNIT_VTABLE(u)->deserialize_item;
 }
 
-int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
+/* Fixed-size part of the binary unit record written by
+ * unit_serialize_binary(). It is only ever read back by the same
+ * binary during a reload, hence native layout and endianness. */
+typedef struct UnitSerializedState {
+        dual_timestamp inactive_exit_timestamp;
+        dual_timestamp active_enter_timestamp;
+        dual_timestamp active_exit_timestamp;
+        dual_timestamp inactive_enter_timestamp;
+        dual_timestamp condition_timestamp;
+        dual_timestamp assert_timestamp;
+        uint64_t cpuacct_usage_base;
+        uint32_t netclass_id;
+        uint32_t flags;
+        uint32_t cgroup_path_size;
+        uint32_t reserved;
+} UnitSerializedState;
+
+enum {
+        UNIT_SERIALIZED_CONDITION_RESULT = 1U << 0,
+        UNIT_SERIALIZED_ASSERT_RESULT    = 1U << 1,
+        UNIT_SERIALIZED_TRANSIENT        = 1U << 2,
+        UNIT_SERIALIZED_CGROUP_REALIZED  = 1U << 3,
+};
+
+static int unit_serialize_type_items(Unit *u, FILE *f, FDSet *fds) {
+        ExecRuntime *rt;
         int r;
 
-        assert(u);
-        assert(f);
-        assert(fds);
+        if (!unit_can_serialize(u))
+                return 0;
 
-        if (unit_can_serialize(u)) {
-                ExecRuntime *rt;
+        r = UNIT_VTABLE(u)->serialize(u, f, fds);
+        if (r < 0)
+                return r;
 
-                r = UNIT_VTABLE(u)->serialize(u, f, fds);
+        rt = unit_get_exec_runtime(u);
+        if (rt) {
+                r = exec_runtime_serialize(u, rt, f, fds);
                 if (r < 0)
                         return r;
+        }
 
-                rt = unit_get_exec_runtime(u);
-                if (rt) {
-                        r = exec_runtime_serialize(u, rt, f, fds);
-                        if (r < 0)
-                                return r;
-                }
+        return 0;
+}
+
+static void unit_serialize_jobs(Unit *u, FILE *f, FDSet *fds) {
+
+        if (u->job) {
+                fprintf(f, "job\n");
+                job_serialize(u->job, f, fds);
         }
 
+        if (u->nop_job) {
+                fprintf(f, "job\n");
+                job_serialize(u->nop_job, f, fds);
+        }
+}
+
+int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
+        int r;
+
+        assert(u);
+        assert(f);
+        assert(fds);
+
+        r = unit_serialize_type_items(u, f, fds);
+        if (r < 0)
+                return r;
+
         dual_timestamp_serialize(f, "inactive-exit-timestamp", &u->inactive_exit_timestamp);
         dual_timestamp_serialize(f, "active-enter-timestamp", &u->active_enter_timestamp);
         dual_timestamp_serialize(f, "active-exit-timestamp", &u->active_exit_timestamp);
@@ -2573,17 +2680,59 @@ int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
         if (u->cgroup_netclass_id)
                 unit_serialize_item_format(u, f, "netclass-id", "%" PRIu32, u->cgroup_netclass_id);
 
-        if (serialize_jobs) {
-                if (u->job) {
-                        fprintf(f, "job\n");
-                        job_serialize(u->job, f, fds);
-                }
+        if (serialize_jobs)
+                unit_serialize_jobs(u, f, fds);
 
-                if (u->nop_job) {
-                        fprintf(f, "job\n");
-                        job_serialize(u->nop_job, f, fds);
-                }
-        }
+        /* End marker */
+        fputc('\n', f);
+        return 0;
+}
+
+int unit_serialize_binary(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs) {
+        UnitSerializedState s = {
+                .inactive_exit_timestamp = u->inactive_exit_timestamp,
+                .active_enter_timestamp = u->active_enter_timestamp,
+                .active_exit_timestamp = u->active_exit_timestamp,
+                .inactive_enter_timestamp = u->inactive_enter_timestamp,
+                .condition_timestamp = u->condition_timestamp,
+                .assert_timestamp = u->assert_timestamp,
+                .cpuacct_usage_base = u->cpuacct_usage_base,
+                .netclass_id = u->cgroup_netclass_id,
+        };
+        int r;
+
+        assert(u);
+        assert(f);
+        assert(fds);
+
+        /* Like unit_serialize(), but writes the generic unit state as
+         * a fixed binary record, so that it can be read back without
+         * formatting and parsing each item. The per-type items, the
+         * execution runtime and the jobs follow in the text format
+         * and are terminated by the usual end marker. */
+
+        if (u->condition_result)
+                s.flags |= UNIT_SERIALIZED_CONDITION_RESULT;
+        if (u->assert_result)
+                s.flags |= UNIT_SERIALIZED_ASSERT_RESULT;
+        if (u->transient)
+                s.flags |= UNIT_SERIALIZED_TRANSIENT;
+        if (u->cgroup_realized)
+                s.flags |= UNIT_SERIALIZED_CGROUP_REALIZED;
+
+        if (u->cgroup_path)
+                s.cgroup_path_size = strlen(u->cgroup_path);
+
+        fwrite(&s, sizeof(s), 1, f);
+        if (s.cgroup_path_size > 0)
+                fwrite(u->cgroup_path, 1, s.cgroup_path_size, f);
+
+        r = unit_serialize_type_items(u, f, fds);
+        if (r < 0)
+                return r;
+
+        if (serialize_jobs)
+                unit_serialize_jobs(u, f, fds);
 
         /* End marker */
         fputc('\n', f);
@@ -2664,6 +2813,24 @@ void unit_serialize_item_format(Unit *u, FILE *f, const char *key, const char *f
         fputc('\n', f);
 }
 
+static void unit_deserialize_cgroup_path(Unit *u, const char *path) {
+        int r;
+
+        r = unit_set_cgroup_path(u, path);
+        if (r < 0)
+                log_unit_debug_errno(u, r, "Failed to set cgroup path %s, ignoring: %m", path);
+
+        (void) unit_watch_cgroup(u);
+}
+
+static void unit_deserialize_netclass_id(Unit *u) {
+        int r;
+
+        r = unit_add_to_netclass_cgroup(u);
+        if (r < 0)
+                log_unit_debug_errno(u, r, "Failed to add unit to netclass cgroup, ignoring: %m");
+}
+
 int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
         ExecRuntime **rt = NULL;
         size_t offset;
@@ -2789,13 +2956,7 @@ int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
                         continue;
 
                 } else if (streq(l, "cgroup")) {
-
-                        r = unit_set_cgroup_path(u, v);
-                        if (r < 0)
-                                log_unit_debug_errno(u, r, "Failed to set cgroup path %s, ignoring: %m", v);
-
-                        (void) unit_watch_cgroup(u);
-
+                        unit_deserialize_cgroup_path(u, v);
                         continue;
                 } else if (streq(l, "cgroup-realized")) {
                         int b;
@@ -2811,11 +2972,8 @@ int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
                         r = safe_atou32(v, &u->cgroup_netclass_id);
                         if (r < 0)
                                 log_unit_debug(u, "Failed to parse netclass ID %s, ignoring.", v);
-                        else {
-                                r = unit_add_to_netclass_cgroup(u);
-                                if (r < 0)
-                                        log_unit_debug_errno(u, r, "Failed to add unit to netclass cgroup, ignoring: %m");
-                        }
+                        else
+                                unit_deserialize_netclass_id(u);
 
                         continue;
                 }
@@ -2840,6 +2998,58 @@ int unit_deserialize(Unit *u, FILE *f, FDSet *fds) {
         }
 }
 
+int unit_deserialize_binary(Unit *u, FILE *f, FDSet *fds) {
+        UnitSerializedState s;
+
+        assert(u);
+        assert(f);
+        assert(fds);
+
+        if (fread(&s, sizeof(s), 1, f) != 1)
+                return ferror(f) ? -EIO : -EBADMSG;
+
+        if (s.cgroup_path_size > PATH_MAX)
+                return -EBADMSG;
+
+        if (s.cgroup_path_size > 0) {
+                _cleanup_free_ char *p = NULL;
+
+                p = new(char, s.cgroup_path_size + 1);
+                if (!p)
+                        return -ENOMEM;
+
+                if (fread(p, 1, s.cgroup_path_size, f) != s.cgroup_path_size)
+                        return ferror(f) ? -EIO : -EBADMSG;
+                p[s.cgroup_path_size] = 0;
+
+                unit_deserialize_cgroup_path(u, p);
+        }
+
+        u->inactive_exit_timestamp = s.inactive_exit_timestamp;
+        u->active_enter_timestamp = s.active_enter_timestamp;
+        u->active_exit_timestamp = s.active_exit_timestamp;
+        u->inactive_enter_timestamp = s.inactive_enter_timestamp;
+        u->condition_timestamp = s.condition_timestamp;
+        u->assert_timestamp = s.assert_timestamp;
+
+        if (dual_timestamp_is_set(&u->condition_timestamp))
+                u->condition_result = !!(s.flags & UNIT_SERIALIZED_CONDITION_RESULT);
+        if (dual_timestamp_is_set(&u->assert_timestamp))
+                u->assert_result = !!(s.flags & UNIT_SERIALIZED_ASSERT_RESULT);
+
+        u->transient = !!(s.flags & UNIT_SERIALIZED_TRANSIENT);
+        u->cgroup_realized = !!(s.flags & UNIT_SERIALIZED_CGROUP_REALIZED);
+        u->cpuacct_usage_base = s.cpuacct_usage_base;
+
+        if (s.netclass_id != 0) {
+                u->cgroup_netclass_id = s.netclass_id;
+                unit_deserialize_netclass_id(u);
+        }
+
+        /* The rest of the record is in the text format */
+        return unit_deserialize(u, f, fds);
+}
+
 int unit_add_node_link(Unit *u, const char *what, bool wants, UnitDependency dep) {
         Unit *device;
         _cleanup_free_ char *e = NULL;
@@ -2908,6 +3118,63 @@ int unit_coldplug(Unit *u) {
         return 0;
 }
 
+static bool unit_dependency_dir_changed(Unit *u, const char *unit_path, const char *name) {
+        static const char *const suffixes[] = { ".wants", ".requires" };
+        unsigned k;
+
+        for (k = 0; k < ELEMENTSOF(suffixes); k++) {
+                _cleanup_free_ char *path = NULL;
+                struct stat st;
+
+                path = strjoin(unit_path, "/", name, suffixes[k], NULL);
+                if (!path)
+                        return true;
+
+                if (u->manager->unit_path_cache &&
+                    !set_get(u->manager->unit_path_cache, path))
+                        continue;
+
+                if (stat(path, &st) < 0)
+                        continue;
+
+                if (timespec_load(&st.st_mtim) > u->load_timestamp)
+                        return true;
+        }
+
+        return false;
+}
+
+static bool unit_dependency_dirs_changed(Unit *u) {
+        Iterator i;
+        char *t, **p;
+
+        assert(u);
+
+        /* The .wants/ and .requires/ directories are only read when
+         * the unit is loaded, hence check whether any of them has
+         * been modified since then. */
+
+        if (u->load_timestamp <= 0)
+                return false;
+
+        SET_FOREACH(t, u->names, i) {
+                _cleanup_free_ char *template = NULL;
+
+                if (unit_name_is_valid(t, UNIT_NAME_INSTANCE))
+                        (void) unit_name_template(t, &template);
+
+                STRV_FOREACH(p, u->manager->lookup_paths.unit_path) {
+                        if (unit_dependency_dir_changed(u, *p, t))
+                                return true;
+
+                        if (template && unit_dependency_dir_changed(u, *p, template))
+                                return true;
+                }
+        }
+
+        return false;
+}
+
 bool unit_need_daemon_reload(Unit *u) {
         _cleanup_strv_free_ char **t = NULL;
         char **path;
@@ -2937,6 +3204,9 @@ bool unit_need_daemon_reload(Unit *u) {
                         return true;
         }
 
+        if (unit_dependency_dirs_changed(u))
+                return true;
+
         (void) unit_find_dropin_paths(u, &t);
         loaded_cnt = strv_length(t);
         current_cnt = strv_length(u->dropin_paths);
@@ -2963,6 +3233,135 @@ bool unit_need_daemon_reload(Unit *u) {
                 return true;
 }
 
+typedef struct UnitDependencyItem {
+        Unit *other;
+        UnitDependency d;
+        bool owned_by_other;
+} UnitDependencyItem;
+
+int unit_reload_config(Unit *u, FILE *f, Unit **ret) {
+        _cleanup_free_ UnitDependencyItem *items = NULL;
+        _cleanup_free_ UnitRef **refs = NULL;
+        _cleanup_fdset_free_ FDSet *fds = NULL;
+        _cleanup_free_ char *id = NULL;
+        size_t n_items = 0, n_refs = 0, k;
+        bool fresh;
+        Manager *m;
+        UnitDependency d;
+        UnitRef *ref;
+        Iterator i;
+        Unit *other;
+        int r;
+
+        assert(u);
+        assert(f);
+        assert(ret);
+        assert(!u->job && !u->nop_job);
+
+        /* Replaces the unit by a freshly loaded one, carrying over its
+         * runtime state via the serialization file f and everything
+         * other units hold on it: the dependencies that did not come
+         * from our own configuration and all references. Returns the
+         * new unit, or NULL if the name now refers to another unit
+         * that was loaded before. */
+
+        m = u->manager;
+
+        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                n_items += set_size(u->dependencies[d]);
+
+        items = new(UnitDependencyItem, MAX(n_items, 1U));
+        if (!items)
+                return -ENOMEM;
+
+        n_items = 0;
+        for (d = 0; d < _UNIT_DEPENDENCY_MAX; d++)
+                SET_FOREACH(other, u->dependencies[d], i) {
+                        bool ours, theirs = false;
+
+                        ours = PTR_TO_UINT(hashmap_get(u->load_dependencies, other)) & (1U << d);
+                        if (inverse_table[d] != _UNIT_DEPENDENCY_INVALID)
+                                theirs = PTR_TO_UINT(hashmap_get(other->load_dependencies, u)) & (1U << inverse_table[d]);
+
+                        /* Will be added again when our configuration is loaded */
+                        if (ours && !theirs)
+                                continue;
+
+                        items[n_items++] = (UnitDependencyItem) {
+                                .other = other,
+                                .d = d,
+                                .owned_by_other = theirs,
+                        };
+                }
+
+        LIST_FOREACH(refs, ref, u->refs)
+                n_refs++;
+
+        refs = new(UnitRef*, MAX(n_refs, 1U));
+        if (!refs)
+                return -ENOMEM;
+
+        n_refs = 0;
+        LIST_FOREACH(refs, ref, u->refs)
+                refs[n_refs++] = ref;
+
+        id = strdup(u->id);
+        if (!id)
+                return -ENOMEM;
+
+        fds = fdset_new();
+        if (!fds)
+                return -ENOMEM;
+
+        rewind(f);
+        if (ftruncate(fileno(f), 0) < 0)
+                return -errno;
+
+        r = unit_serialize(u, f, fds, false);
+        if (r < 0)
+                return r;
+
+        if (fflush(f) != 0 || fseeko(f, 0, SEEK_SET) < 0)
+                return -errno;
+
+        /* From here on there is no way back for this unit */
+        unit_free(u);
+
+        r = manager_load_unit_prepare(m, id, NULL, NULL, &u);
+        if (r < 0)
+                return r;
+
+        fresh = r == 0;
+        manager_dispatch_load_queue(m);
+
+        /* The name might have turned into an alias of a unit that is
+         * loaded already, which keeps its own state then */
+        if (u->load_state == UNIT_MERGED)
+                fresh = false;
+        u = unit_follow_merge(u);
+
+        if (fresh) {
+                r = unit_deserialize(u, f, fds);
+                if (r < 0)
+                        log_unit_warning_errno(u, r, "Failed to deserialize unit state, ignoring: %m");
+        }
+
+        for (k = 0; k < n_items; k++) {
+                r = unit_add_dependency(u, items[k].d, items[k].other, false);
+                if (r < 0)
+                        return r;
+
+                if (items[k].owned_by_other)
+                        unit_add_load_dependency(items[k].other, u, 1U << inverse_table[items[k].d]);
+        }
+
+        for (k = 0; k < n_refs; k++)
+                unit_ref_set(refs[k], u);
+
+        *ret = fresh ? u : NULL;
+        return 0;
+}
+
 void unit_reset_failed(Unit *u) {
         assert(u);
 
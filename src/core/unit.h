@@ -84,6 +84,12 @@ struct Unit {
         Set *names;
         Set *dependencies[_UNIT_DEPENDENCY_MAX];
 
+        /* Unit object => mask of the dependency types on it that were
+         * added while our own configuration was loaded. Lets an
+         * incremental reload tell the dependencies that come from our
+         * configuration apart from those other units added. */
+        Hashmap *load_dependencies;
+
         char **requires_mounts_for;
 
         char *description;
@@ -96,6 +102,7 @@ struct Unit {
         usec_t fragment_mtime;
         usec_t source_mtime;
         usec_t dropin_mtime;
+        usec_t load_timestamp;
 
         /* If there is something to do with this unit, then this is the installed job for it */
         Job *job;
@@ -522,6 +529,8 @@ bool unit_can_serialize(Unit *u) _pure_;
 
 int unit_serialize(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs);
 int unit_deserialize(Unit *u, FILE *f, FDSet *fds);
+int unit_serialize_binary(Unit *u, FILE *f, FDSet *fds, bool serialize_jobs);
+int unit_deserialize_binary(Unit *u, FILE *f, FDSet *fds);
 
 int unit_serialize_item(Unit *u, FILE *f, const char *key, const char *value);
 int unit_serialize_item_escaped(Unit *u, FILE *f, const char *key, const char *value);
@@ -536,6 +545,7 @@ void unit_status_printf(Unit *u, const char *status, const char *unit_status_msg
 void unit_status_emit_starting_stopping_reloading(Unit *u, JobType t);
 
 bool unit_need_daemon_reload(Unit *u);
+int unit_reload_config(Unit *u, FILE *f, Unit **ret);
 
 void unit_reset_failed(Unit *u);
 
@@ -26,6 +26,7 @@
 #include <unistd.h>
 
 #include "alloc-util.h"
+#include "extract-word.h"
 #include "fd-util.h"
 #include "fileio.h"
 #include "fstab-util.h"
@@ -54,6 +55,43 @@ static int arg_root_rw = -1;
 static char *arg_usr_what = NULL;
 static char *arg_usr_fstype = NULL;
 static char *arg_usr_options = NULL;
+static char **arg_inputs = NULL;
+
+static int add_fsck_inputs(const char *fstype) {
+        const char *p;
+        int r;
+
+        /* Whether the checker exists decides on the fsck dependency,
+         * hence everywhere it is looked for is an input, too */
+
+        if (isempty(fstype) || streq(fstype, "auto"))
+                return 0;
+
+        p = getenv("PATH");
+        if (!p)
+                p = DEFAULT_PATH;
+
+        for (;;) {
+                _cleanup_free_ char *element = NULL;
+                char *j;
+
+                r = extract_first_word(&p, &element, ":", EXTRACT_RELAX|EXTRACT_DONT_COALESCE_SEPARATORS);
+                if (r < 0)
+                        return log_oom();
+                if (r == 0)
+                        return 0;
+
+                if (!path_is_absolute(element))
+                        continue;
+
+                j = strjoin(element, "/fsck.", fstype, NULL);
+                if (!j)
+                        return log_oom();
+
+                if (strv_consume(&arg_inputs, j) < 0)
+                        return log_oom();
+        }
+}
 
 static int add_swap(
                 const char *what,
@@ -311,6 +349,10 @@ static int add_mount(
         }
 
         if (passno != 0) {
+                r = add_fsck_inputs(fstype);
+                if (r < 0)
+                        return r;
+
                 r = generator_write_fsck_deps(f, arg_dest, what, where, fstype);
                 if (r < 0)
                         return r;
@@ -679,6 +721,14 @@ int main(int argc, char *argv[]) {
         if (arg_fstab_enabled) {
                 int k;
 
+                /* Besides these, only the kernel command line matters,
+                 * which stays the same until the next boot */
+                if (strv_extend(&arg_inputs, "/etc/fstab") < 0 ||
+                    (in_initrd() && strv_extend(&arg_inputs, "/sysroot/etc/fstab") < 0)) {
+                        r = log_oom();
+                        goto finish;
+                }
+
                 log_debug("Parsing /etc/fstab");
 
                 /* Parse the local /etc/fstab, possibly from the initrd */
@@ -696,6 +746,12 @@ int main(int argc, char *argv[]) {
                 }
         }
 
+        if (r >= 0)
+                (void) generator_write_inputs(arg_inputs);
+
+finish:
+        strv_free(arg_inputs);
+
         free(arg_root_what);
         free(arg_root_fstype);
         free(arg_root_options);
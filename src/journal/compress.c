@@ -33,6 +33,12 @@
 #include <lz4frame.h>
 #endif
 
+#ifdef HAVE_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#include <zstd_errors.h>
+#endif
+
 #include "alloc-util.h"
 #include "compress.h"
 #include "fd-util.h"
@@ -49,11 +55,29 @@ DEFINE_TRIVIAL_CLEANUP_FUNC(LZ4F_compressionContext_t, LZ4F_freeCompressionConte
 DEFINE_TRIVIAL_CLEANUP_FUNC(LZ4F_decompressionContext_t, LZ4F_freeDecompressionContext);
 #endif
 
+#ifdef HAVE_ZSTD
+DEFINE_TRIVIAL_CLEANUP_FUNC(ZSTD_CCtx*, ZSTD_freeCCtx);
+DEFINE_TRIVIAL_CLEANUP_FUNC(ZSTD_DCtx*, ZSTD_freeDCtx);
+
+static int zstd_ret_to_errno(size_t ret) {
+        switch (ZSTD_getErrorCode(ret)) {
+        case ZSTD_error_dstSize_tooSmall:
+                return -ENOBUFS;
+        case ZSTD_error_memory_allocation:
+                return -ENOMEM;
+        default:
+                return -EBADMSG;
+        }
+}
+#endif
+
 #define ALIGN_8(l) ALIGN_TO(l, sizeof(size_t))
 
 static const char* const object_compressed_table[_OBJECT_COMPRESSED_MAX] = {
         [OBJECT_COMPRESSED_XZ] = "XZ",
         [OBJECT_COMPRESSED_LZ4] = "LZ4",
+        [OBJECT_COMPRESSED_ZSTD] = "ZSTD",
+        [OBJECT_COMPRESSED_ZSTD_DICTIONARY] = "ZSTD-DICTIONARY",
 };
 
 DEFINE_STRING_TABLE_LOOKUP(object_compressed, int);
@@ -126,6 +150,33 @@ int compress_blob_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
+int compress_blob_zstd(const void *src, uint64_t src_size,
+                       void *dst, size_t dst_alloc_size, size_t *dst_size) {
+#ifdef HAVE_ZSTD
+        size_t k;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size > 0);
+        assert(dst_size);
+
+        /* Returns < 0 if we couldn't compress the data or the
+         * compressed result is longer than the original. The frame
+         * header records the uncompressed size, hence unlike LZ4 we
+         * do not need to prefix it ourselves. */
+
+        k = ZSTD_compress(dst, dst_alloc_size, src, src_size, 0);
+        if (ZSTD_isError(k))
+                return zstd_ret_to_errno(k);
+
+        *dst_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 
 int decompress_blob_xz(const void *src, uint64_t src_size,
                        void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
@@ -227,6 +278,60 @@ int decompress_blob_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
+int decompress_blob_zstd(const void *src, uint64_t src_size,
+                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
+
+#ifdef HAVE_ZSTD
+        _cleanup_(ZSTD_freeDCtxp) ZSTD_DCtx *dctx = NULL;
+        ZSTD_inBuffer input = {
+                .src = src,
+                .size = src_size,
+        };
+        ZSTD_outBuffer output = {};
+        unsigned long long size;
+        size_t k;
+
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size);
+        assert(dst_size);
+        assert(*dst_alloc_size == 0 || *dst);
+
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+                return -EBADMSG;
+
+        if (dst_max > 0 && size > dst_max)
+                size = dst_max;
+        if (size > SIZE_MAX)
+                return -E2BIG;
+
+        if (!greedy_realloc(dst, dst_alloc_size, MAX(ZSTD_DStreamOutSize(), size), 1))
+                return -ENOMEM;
+
+        dctx = ZSTD_createDCtx();
+        if (!dctx)
+                return -ENOMEM;
+
+        output.dst = *dst;
+        output.size = *dst_alloc_size;
+
+        k = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(k)) {
+                log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(k));
+                return zstd_ret_to_errno(k);
+        }
+        if (output.pos < size)
+                return -EBADMSG;
+
+        *dst_size = size;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_blob(int compression,
                     const void *src, uint64_t src_size,
                     void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
@@ -236,6 +341,9 @@ int decompress_blob(int compression,
         else if (compression == OBJECT_COMPRESSED_LZ4)
                 return decompress_blob_lz4(src, src_size,
                                            dst, dst_alloc_size, dst_size, dst_max);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return decompress_blob_zstd(src, src_size,
+                                            dst, dst_alloc_size, dst_size, dst_max);
         else
                 return -EBADMSG;
 }
@@ -349,6 +457,65 @@ int decompress_startswith_lz4(const void *src, uint64_t src_size,
 #endif
 }
 
+int decompress_startswith_zstd(const void *src, uint64_t src_size,
+                               void **buffer, size_t *buffer_size,
+                               const void *prefix, size_t prefix_len,
+                               uint8_t extra) {
+#ifdef HAVE_ZSTD
+        _cleanup_(ZSTD_freeDCtxp) ZSTD_DCtx *dctx = NULL;
+        ZSTD_inBuffer input = {
+                .src = src,
+                .size = src_size,
+        };
+        ZSTD_outBuffer output = {};
+        unsigned long long size;
+        size_t k;
+
+        /* Checks whether the decompressed blob starts with the
+         * mentioned prefix. The byte extra needs to follow the
+         * prefix. Unlike LZ4 the streaming decoder stops as soon
+         * as the output buffer is full, so we only decompress the
+         * prefix, not the whole field. */
+
+        assert(src);
+        assert(src_size > 0);
+        assert(buffer);
+        assert(buffer_size);
+        assert(prefix);
+        assert(*buffer_size == 0 || *buffer);
+
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+                return -EBADMSG;
+
+        if (size < prefix_len + 1)
+                return 0;
+
+        if (!(greedy_realloc(buffer, buffer_size, ALIGN_8(prefix_len + 1), 1)))
+                return -ENOMEM;
+
+        dctx = ZSTD_createDCtx();
+        if (!dctx)
+                return -ENOMEM;
+
+        output.dst = *buffer;
+        output.size = prefix_len + 1;
+
+        k = ZSTD_decompressStream(dctx, &output, &input);
+        if (ZSTD_isError(k)) {
+                log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(k));
+                return zstd_ret_to_errno(k);
+        }
+        if (output.pos < prefix_len + 1)
+                return -EBADMSG;
+
+        return memcmp(*buffer, prefix, prefix_len) == 0 &&
+                ((const uint8_t*) *buffer)[prefix_len] == extra;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_startswith(int compression,
                           const void *src, uint64_t src_size,
                           void **buffer, size_t *buffer_size,
@@ -364,6 +531,11 @@ int decompress_startswith(int compression,
                                                  buffer, buffer_size,
                                                  prefix, prefix_len,
                                                  extra);
+        else if (compression == OBJECT_COMPRESSED_ZSTD)
+                return decompress_startswith_zstd(src, src_size,
+                                                  buffer, buffer_size,
+                                                  prefix, prefix_len,
+                                                  extra);
         else
                 return -EBADMSG;
 }
@@ -537,6 +709,103 @@ int compress_stream_lz4(int fdf, int fdt, uint64_t max_bytes) {
 #endif
 }
 
+int compress_stream_zstd_level(int fdf, int fdt, uint64_t max_bytes, int level) {
+#ifdef HAVE_ZSTD
+        _cleanup_(ZSTD_freeCCtxp) ZSTD_CCtx *cctx = NULL;
+        _cleanup_free_ void *in_buf = NULL, *out_buf = NULL;
+        size_t in_size, out_size, k;
+        uint64_t total_in = 0, total_out = 0;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        in_size = ZSTD_CStreamInSize();
+        out_size = ZSTD_CStreamOutSize();
+
+        in_buf = malloc(in_size);
+        out_buf = malloc(out_size);
+        cctx = ZSTD_createCCtx();
+        if (!in_buf || !out_buf || !cctx)
+                return -ENOMEM;
+
+        k = ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level);
+        if (ZSTD_isError(k)) {
+                log_debug("Failed to set ZSTD compression level %i: %s", level, ZSTD_getErrorName(k));
+                return -EINVAL;
+        }
+
+        k = ZSTD_CCtx_setParameter(cctx, ZSTD_c_checksumFlag, 1);
+        if (ZSTD_isError(k))
+                log_debug("Failed to enable ZSTD checksum, ignoring: %s", ZSTD_getErrorName(k));
+
+        for (;;) {
+                ZSTD_inBuffer input = {
+                        .src = in_buf,
+                };
+                ZSTD_EndDirective mode;
+                bool finished = false;
+                ssize_t n;
+
+                n = loop_read(fdf, in_buf, in_size, true);
+                if (n < 0)
+                        return n;
+
+                input.size = (size_t) n;
+                total_in += n;
+                mode = n == 0 ? ZSTD_e_end : ZSTD_e_continue;
+
+                /* Drain the encoder into the output buffer until all
+                 * input of this chunk is consumed, and, for the last
+                 * chunk, until the frame epilogue is written. */
+                while (!finished) {
+                        ZSTD_outBuffer output = {
+                                .dst = out_buf,
+                                .size = out_size,
+                        };
+                        size_t remaining;
+                        int r;
+
+                        remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+                        if (ZSTD_isError(remaining)) {
+                                log_debug("ZSTD encoder failed: %s", ZSTD_getErrorName(remaining));
+                                return zstd_ret_to_errno(remaining);
+                        }
+
+                        total_out += output.pos;
+                        if (max_bytes != (uint64_t) -1 && total_out > max_bytes) {
+                                log_debug("Compressed stream longer than %"PRIu64" bytes", max_bytes);
+                                return -EFBIG;
+                        }
+
+                        r = loop_write(fdt, output.dst, output.pos, false);
+                        if (r < 0)
+                                return r;
+
+                        finished = mode == ZSTD_e_end ? remaining == 0 : input.pos == input.size;
+                }
+
+                if (mode == ZSTD_e_end)
+                        break;
+        }
+
+        if (total_in > 0)
+                log_debug("ZSTD compression finished (%"PRIu64" -> %"PRIu64" bytes, %.1f%%)",
+                          total_in, total_out,
+                          (double) total_out / total_in * 100);
+        else
+                log_debug("ZSTD compression finished (%"PRIu64" -> %"PRIu64" bytes)",
+                          total_in, total_out);
+
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int compress_stream_zstd(int fdf, int fdt, uint64_t max_bytes) {
+        return compress_stream_zstd_level(fdf, fdt, max_bytes, 0);
+}
+
 int decompress_stream_xz(int fdf, int fdt, uint64_t max_bytes) {
 
 #ifdef HAVE_XZ
@@ -756,12 +1025,348 @@ int decompress_stream_lz4(int fdf, int fdt, uint64_t max_bytes) {
 #endif
 }
 
+int decompress_stream_zstd(int fdf, int fdt, uint64_t max_bytes) {
+#ifdef HAVE_ZSTD
+        _cleanup_(ZSTD_freeDCtxp) ZSTD_DCtx *dctx = NULL;
+        _cleanup_free_ void *in_buf = NULL, *out_buf = NULL;
+        size_t in_size, out_size, last_result = 0;
+        uint64_t total_in = 0, total_out = 0;
+        bool has_input = false;
+
+        assert(fdf >= 0);
+        assert(fdt >= 0);
+
+        in_size = ZSTD_DStreamInSize();
+        out_size = ZSTD_DStreamOutSize();
+
+        in_buf = malloc(in_size);
+        out_buf = malloc(out_size);
+        dctx = ZSTD_createDCtx();
+        if (!in_buf || !out_buf || !dctx)
+                return -ENOMEM;
+
+        for (;;) {
+                ZSTD_inBuffer input = {
+                        .src = in_buf,
+                };
+                ssize_t n;
+
+                n = loop_read(fdf, in_buf, in_size, true);
+                if (n < 0)
+                        return n;
+                if (n == 0)
+                        break;
+
+                has_input = true;
+                input.size = (size_t) n;
+                total_in += n;
+
+                while (input.pos < input.size) {
+                        ZSTD_outBuffer output = {
+                                .dst = out_buf,
+                                .size = out_size,
+                        };
+                        int r;
+
+                        /* A non-zero return merely means the current
+                         * frame is not complete yet, keep feeding it. */
+                        last_result = ZSTD_decompressStream(dctx, &output, &input);
+                        if (ZSTD_isError(last_result)) {
+                                log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(last_result));
+                                return zstd_ret_to_errno(last_result);
+                        }
+
+                        total_out += output.pos;
+                        if (max_bytes != (uint64_t) -1 && total_out > max_bytes) {
+                                log_debug("Decompressed stream longer than %"PRIu64" bytes", max_bytes);
+                                return -EFBIG;
+                        }
+
+                        r = loop_write(fdt, output.dst, output.pos, false);
+                        if (r < 0)
+                                return r;
+                }
+        }
+
+        if (!has_input || last_result != 0) {
+                log_debug("ZSTD decoder failed: stream is truncated.");
+                return -EBADMSG;
+        }
+
+        log_debug("ZSTD decompression finished (%"PRIu64" -> %"PRIu64" bytes, %.1f%%)",
+                  total_in, total_out,
+                  (double) total_out / total_in * 100);
+
+        return 0;
+#else
+        log_debug("Cannot decompress file. Compiled without ZSTD support.");
+        return -EPROTONOSUPPORT;
+#endif
+}
+
 int decompress_stream(const char *filename, int fdf, int fdt, uint64_t max_bytes) {
 
         if (endswith(filename, ".lz4"))
                 return decompress_stream_lz4(fdf, fdt, max_bytes);
+        else if (endswith(filename, ".zst"))
+                return decompress_stream_zstd(fdf, fdt, max_bytes);
         else if (endswith(filename, ".xz"))
                 return decompress_stream_xz(fdf, fdt, max_bytes);
         else
                 return -EPROTONOSUPPORT;
 }
+
+#ifdef HAVE_ZSTD
+struct CompressDictionary {
+        void *data;
+        size_t size;
+
+        /* Created on first use, readers never need the compression
+         * side, and the CDict is considerably larger than the DDict */
+        ZSTD_CDict *cdict;
+        ZSTD_CCtx *cctx;
+
+        ZSTD_DDict *ddict;
+        ZSTD_DCtx *dctx;
+};
+#endif
+
+int compress_dictionary_train(const void *samples, const size_t *sample_sizes, unsigned n_samples,
+                              void *dst, size_t dst_alloc_size, size_t *dst_size) {
+#ifdef HAVE_ZSTD
+        size_t k;
+
+        assert(samples);
+        assert(sample_sizes);
+        assert(dst);
+        assert(dst_alloc_size > 0);
+        assert(dst_size);
+
+        k = ZDICT_trainFromBuffer(dst, dst_alloc_size, samples, sample_sizes, n_samples);
+        if (ZDICT_isError(k)) {
+                log_debug("Failed to train ZSTD dictionary from %u samples: %s", n_samples, ZDICT_getErrorName(k));
+                return -ENODATA;
+        }
+
+        *dst_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int compress_dictionary_new(const void *data, size_t size, CompressDictionary **ret) {
+#ifdef HAVE_ZSTD
+        _cleanup_(compress_dictionary_freep) CompressDictionary *d = NULL;
+        size_t k;
+
+        assert(data);
+        assert(size > 0);
+        assert(ret);
+
+        d = new0(CompressDictionary, 1);
+        if (!d)
+                return -ENOMEM;
+
+        d->data = memdup(data, size);
+        if (!d->data)
+                return -ENOMEM;
+        d->size = size;
+
+        d->ddict = ZSTD_createDDict(d->data, d->size);
+        d->dctx = ZSTD_createDCtx();
+        if (!d->ddict || !d->dctx)
+                return -ENOMEM;
+
+        k = ZSTD_DCtx_refDDict(d->dctx, d->ddict);
+        if (ZSTD_isError(k))
+                return zstd_ret_to_errno(k);
+
+        *ret = d;
+        d = NULL;
+
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+CompressDictionary* compress_dictionary_free(CompressDictionary *d) {
+#ifdef HAVE_ZSTD
+        if (!d)
+                return NULL;
+
+        ZSTD_freeCDict(d->cdict);
+        ZSTD_freeCCtx(d->cctx);
+        ZSTD_freeDDict(d->ddict);
+        ZSTD_freeDCtx(d->dctx);
+        free(d->data);
+        free(d);
+#endif
+        return NULL;
+}
+
+int compress_blob_zstd_dictionary(CompressDictionary *d,
+                                  const void *src, uint64_t src_size,
+                                  void *dst, size_t dst_alloc_size, size_t *dst_size) {
+#ifdef HAVE_ZSTD
+        size_t k;
+
+        assert(d);
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size > 0);
+        assert(dst_size);
+
+        /* Returns < 0 if we couldn't compress the data or the
+         * compressed result is longer than the original */
+
+        if (!d->cdict) {
+                d->cdict = ZSTD_createCDict(d->data, d->size, 0);
+                if (!d->cdict)
+                        return -ENOMEM;
+        }
+
+        if (!d->cctx) {
+                d->cctx = ZSTD_createCCtx();
+                if (!d->cctx)
+                        return -ENOMEM;
+
+                k = ZSTD_CCtx_refCDict(d->cctx, d->cdict);
+                if (ZSTD_isError(k))
+                        return zstd_ret_to_errno(k);
+
+                /* There is only one dictionary per file, don't
+                 * waste four bytes per object on its ID */
+                k = ZSTD_CCtx_setParameter(d->cctx, ZSTD_c_dictIDFlag, 0);
+                if (ZSTD_isError(k))
+                        return zstd_ret_to_errno(k);
+        }
+
+        k = ZSTD_compress2(d->cctx, dst, dst_alloc_size, src, src_size);
+        if (ZSTD_isError(k))
+                return zstd_ret_to_errno(k);
+
+        *dst_size = k;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+#ifdef HAVE_ZSTD
+static int decompress_zstd_dictionary(CompressDictionary *d,
+                                      const void *src, uint64_t src_size,
+                                      void *dst, size_t dst_size,
+                                      size_t *ret_size) {
+        ZSTD_inBuffer input = {
+                .src = src,
+                .size = src_size,
+        };
+        ZSTD_outBuffer output = {
+                .dst = dst,
+                .size = dst_size,
+        };
+        size_t k;
+
+        /* Decodes at most dst_size bytes of the frame. The context is
+         * reused, so drop whatever state a previous, possibly partial,
+         * decode left behind. The dictionary reference is kept. */
+
+        k = ZSTD_DCtx_reset(d->dctx, ZSTD_reset_session_only);
+        if (ZSTD_isError(k))
+                return zstd_ret_to_errno(k);
+
+        k = ZSTD_decompressStream(d->dctx, &output, &input);
+        if (ZSTD_isError(k)) {
+                log_debug("ZSTD decoder failed: %s", ZSTD_getErrorName(k));
+                return zstd_ret_to_errno(k);
+        }
+
+        *ret_size = output.pos;
+        return 0;
+}
+#endif
+
+int decompress_blob_zstd_dictionary(CompressDictionary *d,
+                                    const void *src, uint64_t src_size,
+                                    void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
+#ifdef HAVE_ZSTD
+        unsigned long long size;
+        size_t k;
+        int r;
+
+        assert(d);
+        assert(src);
+        assert(src_size > 0);
+        assert(dst);
+        assert(dst_alloc_size);
+        assert(dst_size);
+        assert(*dst_alloc_size == 0 || *dst);
+
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+                return -EBADMSG;
+
+        if (dst_max > 0 && size > dst_max)
+                size = dst_max;
+        if (size > SIZE_MAX)
+                return -E2BIG;
+
+        if (!greedy_realloc(dst, dst_alloc_size, MAX(size, 1U), 1))
+                return -ENOMEM;
+
+        r = decompress_zstd_dictionary(d, src, src_size, *dst, size, &k);
+        if (r < 0)
+                return r;
+        if (k != size)
+                return -EBADMSG;
+
+        *dst_size = size;
+        return 0;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
+
+int decompress_startswith_zstd_dictionary(CompressDictionary *d,
+                                          const void *src, uint64_t src_size,
+                                          void **buffer, size_t *buffer_size,
+                                          const void *prefix, size_t prefix_len,
+                                          uint8_t extra) {
+#ifdef HAVE_ZSTD
+        unsigned long long size;
+        size_t k;
+        int r;
+
+        assert(d);
+        assert(src);
+        assert(src_size > 0);
+        assert(buffer);
+        assert(buffer_size);
+        assert(prefix);
+        assert(*buffer_size == 0 || *buffer);
+
+        size = ZSTD_getFrameContentSize(src, src_size);
+        if (size == ZSTD_CONTENTSIZE_ERROR || size == ZSTD_CONTENTSIZE_UNKNOWN)
+                return -EBADMSG;
+
+        if (size < prefix_len + 1)
+                return 0;
+
+        if (!(greedy_realloc(buffer, buffer_size, ALIGN_8(prefix_len + 1), 1)))
+                return -ENOMEM;
+
+        r = decompress_zstd_dictionary(d, src, src_size, *buffer, prefix_len + 1, &k);
+        if (r < 0)
+                return r;
+        if (k < prefix_len + 1)
+                return -EBADMSG;
+
+        return memcmp(*buffer, prefix, prefix_len) == 0 &&
+                ((const uint8_t*) *buffer)[prefix_len] == extra;
+#else
+        return -EPROTONOSUPPORT;
+#endif
+}
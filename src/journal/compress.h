@@ -24,6 +24,7 @@
 #include <unistd.h>
 
 #include "journal-def.h"
+#include "macro.h"
 
 const char* object_compressed_to_string(int compression);
 int object_compressed_from_string(const char *compression);
@@ -32,11 +33,17 @@ int compress_blob_xz(const void *src, uint64_t src_size,
                      void *dst, size_t dst_alloc_size, size_t *dst_size);
 int compress_blob_lz4(const void *src, uint64_t src_size,
                       void *dst, size_t dst_alloc_size, size_t *dst_size);
+int compress_blob_zstd(const void *src, uint64_t src_size,
+                       void *dst, size_t dst_alloc_size, size_t *dst_size);
 
 static inline int compress_blob(const void *src, uint64_t src_size,
                                 void *dst, size_t dst_alloc_size, size_t *dst_size) {
         int r;
-#ifdef HAVE_LZ4
+#if defined(HAVE_ZSTD)
+        r = compress_blob_zstd(src, src_size, dst, dst_alloc_size, dst_size);
+        if (r == 0)
+                return OBJECT_COMPRESSED_ZSTD;
+#elif defined(HAVE_LZ4)
         r = compress_blob_lz4(src, src_size, dst, dst_alloc_size, dst_size);
         if (r == 0)
                 return OBJECT_COMPRESSED_LZ4;
@@ -52,6 +59,8 @@ int decompress_blob_xz(const void *src, uint64_t src_size,
                        void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
 int decompress_blob_lz4(const void *src, uint64_t src_size,
                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
+int decompress_blob_zstd(const void *src, uint64_t src_size,
+                         void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
 int decompress_blob(int compression,
                     const void *src, uint64_t src_size,
                     void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
@@ -64,6 +73,10 @@ int decompress_startswith_lz4(const void *src, uint64_t src_size,
                               void **buffer, size_t *buffer_size,
                               const void *prefix, size_t prefix_len,
                               uint8_t extra);
+int decompress_startswith_zstd(const void *src, uint64_t src_size,
+                               void **buffer, size_t *buffer_size,
+                               const void *prefix, size_t prefix_len,
+                               uint8_t extra);
 int decompress_startswith(int compression,
                           const void *src, uint64_t src_size,
                           void **buffer, size_t *buffer_size,
@@ -72,16 +85,47 @@ int decompress_startswith(int compression,
 
 int compress_stream_xz(int fdf, int fdt, uint64_t max_bytes);
 int compress_stream_lz4(int fdf, int fdt, uint64_t max_bytes);
+int compress_stream_zstd(int fdf, int fdt, uint64_t max_bytes);
+int compress_stream_zstd_level(int fdf, int fdt, uint64_t max_bytes, int level);
 
 int decompress_stream_xz(int fdf, int fdt, uint64_t max_size);
 int decompress_stream_lz4(int fdf, int fdt, uint64_t max_size);
-
-#ifdef HAVE_LZ4
-#  define compress_stream compress_stream_lz4
+int decompress_stream_zstd(int fdf, int fdt, uint64_t max_size);
+
+/* Only zstd honours the compression level, the other stream
+ * compressors always use their built-in preset. A level of 0
+ * selects the library default. */
+#if defined(HAVE_ZSTD)
+#  define compress_stream(fdf, fdt, max_bytes, level) compress_stream_zstd_level(fdf, fdt, max_bytes, level)
+#  define COMPRESSED_EXT ".zst"
+#elif defined(HAVE_LZ4)
+#  define compress_stream(fdf, fdt, max_bytes, level) compress_stream_lz4(fdf, fdt, max_bytes)
 #  define COMPRESSED_EXT ".lz4"
 #else
-#  define compress_stream compress_stream_xz
+#  define compress_stream(fdf, fdt, max_bytes, level) compress_stream_xz(fdf, fdt, max_bytes)
 #  define COMPRESSED_EXT ".xz"
 #endif
 
 int decompress_stream(const char *filename, int fdf, int fdt, uint64_t max_bytes);
+
+/* Shared dictionaries, so that even payloads too short for stand-alone
+ * compression can be compressed. Only available with zstd. */
+typedef struct CompressDictionary CompressDictionary;
+
+int compress_dictionary_train(const void *samples, const size_t *sample_sizes, unsigned n_samples,
+                              void *dst, size_t dst_alloc_size, size_t *dst_size);
+int compress_dictionary_new(const void *data, size_t size, CompressDictionary **ret);
+CompressDictionary* compress_dictionary_free(CompressDictionary *d);
+DEFINE_TRIVIAL_CLEANUP_FUNC(CompressDictionary*, compress_dictionary_free);
+
+int compress_blob_zstd_dictionary(CompressDictionary *d,
+                                  const void *src, uint64_t src_size,
+                                  void *dst, size_t dst_alloc_size, size_t *dst_size);
+int decompress_blob_zstd_dictionary(CompressDictionary *d,
+                                    const void *src, uint64_t src_size,
+                                    void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
+int decompress_startswith_zstd_dictionary(CompressDictionary *d,
+                                          const void *src, uint64_t src_size,
+                                          void **buffer, size_t *buffer_size,
+                                          const void *prefix, size_t prefix_len,
+                                          uint8_t extra);
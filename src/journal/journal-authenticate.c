@@ -284,6 +284,16 @@ int journal_file_hmac_put_object(JournalFile *f, ObjectType type, Object *o, uin
                 gcry_md_write(f->hmac, &o->tag.seqnum, sizeof(o->tag.seqnum));
                 gcry_md_write(f->hmac, &o->tag.epoch, sizeof(o->tag.epoch));
                 break;
+
+        case OBJECT_DICTIONARY:
+                /* All */
+                gcry_md_write(f->hmac, o->dictionary.payload, le64toh(o->object.size) - offsetof(DictionaryObject, payload));
+                break;
+
+        case OBJECT_BLOOM_FILTER:
+                /* All */
+                gcry_md_write(f->hmac, &o->bloom_filter.n_hashes, le64toh(o->object.size) - offsetof(BloomFilterObject, n_hashes));
+                break;
         default:
                 return -EINVAL;
         }
@@ -308,7 +318,9 @@ int journal_file_hmac_put_header(JournalFile *f) {
          * tail_entry_seqnum, head_entry_seqnum, entry_array_offset,
          * head_entry_realtime, tail_entry_realtime,
          * tail_entry_monotonic, n_data, n_fields, n_tags,
-         * n_entry_arrays. */
+         * n_entry_arrays, data_hash_chain_depth,
+         * field_hash_chain_depth, dictionary_offset,
+         * bloom_filter_offset. */
 
         gcry_md_write(f->hmac, f->header->signature, offsetof(Header, state) - offsetof(Header, signature));
         gcry_md_write(f->hmac, &f->header->file_id, offsetof(Header, boot_id) - offsetof(Header, file_id));
@@ -484,6 +496,15 @@ int journal_file_append_first_tag(JournalFile *f) {
         if (r < 0)
                 return r;
 
+        /* A dictionary taken over from the previous file follows the
+         * hash tables */
+        p = le64toh(f->header->dictionary_offset);
+        if (p > 0) {
+                r = journal_file_hmac_put_object(f, OBJECT_DICTIONARY, NULL, p);
+                if (r < 0)
+                        return r;
+        }
+
         r = journal_file_append_tag(f);
         if (r < 0)
                 return r;
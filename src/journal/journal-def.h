@@ -44,6 +44,8 @@ typedef struct EntryObject EntryObject;
 typedef struct HashTableObject HashTableObject;
 typedef struct EntryArrayObject EntryArrayObject;
 typedef struct TagObject TagObject;
+typedef struct DictionaryObject DictionaryObject;
+typedef struct BloomFilterObject BloomFilterObject;
 
 typedef struct EntryItem EntryItem;
 typedef struct HashItem HashItem;
@@ -60,6 +62,8 @@ typedef enum ObjectType {
         OBJECT_FIELD_HASH_TABLE,
         OBJECT_ENTRY_ARRAY,
         OBJECT_TAG,
+        OBJECT_DICTIONARY,
+        OBJECT_BLOOM_FILTER,
         _OBJECT_TYPE_MAX
 } ObjectType;
 
@@ -67,10 +71,12 @@ typedef enum ObjectType {
 enum {
         OBJECT_COMPRESSED_XZ = 1 << 0,
         OBJECT_COMPRESSED_LZ4 = 1 << 1,
+        OBJECT_COMPRESSED_ZSTD = 1 << 2,
+        OBJECT_COMPRESSED_ZSTD_DICTIONARY = 1 << 3, /* zstd against the file's dictionary object */
         _OBJECT_COMPRESSED_MAX
 };
 
-#define OBJECT_COMPRESSION_MASK (OBJECT_COMPRESSED_XZ | OBJECT_COMPRESSED_LZ4)
+#define OBJECT_COMPRESSION_MASK (OBJECT_COMPRESSED_XZ | OBJECT_COMPRESSED_LZ4 | OBJECT_COMPRESSED_ZSTD | OBJECT_COMPRESSED_ZSTD_DICTIONARY)
 
 struct ObjectHeader {
         uint8_t type;
@@ -139,6 +145,17 @@ struct TagObject {
         uint8_t tag[TAG_LENGTH]; /* SHA-256 HMAC */
 } _packed_;
 
+struct DictionaryObject {
+        ObjectHeader object;
+        uint8_t payload[]; /* zstd dictionary, trained on the file's own data */
+} _packed_;
+
+struct BloomFilterObject {
+        ObjectHeader object;
+        le64_t n_hashes; /* bits set per data object hash */
+        uint8_t bits[];
+} _packed_;
+
 union Object {
         ObjectHeader object;
         DataObject data;
@@ -147,6 +164,8 @@ union Object {
         HashTableObject hash_table;
         EntryArrayObject entry_array;
         TagObject tag;
+        DictionaryObject dictionary;
+        BloomFilterObject bloom_filter;
 };
 
 enum {
@@ -160,29 +179,43 @@ enum {
 enum {
         HEADER_INCOMPATIBLE_COMPRESSED_XZ = 1 << 0,
         HEADER_INCOMPATIBLE_COMPRESSED_LZ4 = 1 << 1,
+        HEADER_INCOMPATIBLE_COMPRESSED_ZSTD = 1 << 2,
+        HEADER_INCOMPATIBLE_COMPRESSED_DICTIONARY = 1 << 3,
 };
 
-#define HEADER_INCOMPATIBLE_ANY (HEADER_INCOMPATIBLE_COMPRESSED_XZ|HEADER_INCOMPATIBLE_COMPRESSED_LZ4)
+#define HEADER_INCOMPATIBLE_ANY (HEADER_INCOMPATIBLE_COMPRESSED_XZ|HEADER_INCOMPATIBLE_COMPRESSED_LZ4|HEADER_INCOMPATIBLE_COMPRESSED_ZSTD|HEADER_INCOMPATIBLE_COMPRESSED_DICTIONARY)
 
-#if defined(HAVE_XZ) && defined(HAVE_LZ4)
-#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_ANY
-#elif defined(HAVE_XZ)
-#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_COMPRESSED_XZ
-#elif defined(HAVE_LZ4)
-#  define HEADER_INCOMPATIBLE_SUPPORTED HEADER_INCOMPATIBLE_COMPRESSED_LZ4
+#ifdef HAVE_XZ
+#  define HEADER_INCOMPATIBLE_SUPPORTED_XZ HEADER_INCOMPATIBLE_COMPRESSED_XZ
 #else
-#  define HEADER_INCOMPATIBLE_SUPPORTED 0
+#  define HEADER_INCOMPATIBLE_SUPPORTED_XZ 0
 #endif
 
+#ifdef HAVE_LZ4
+#  define HEADER_INCOMPATIBLE_SUPPORTED_LZ4 HEADER_INCOMPATIBLE_COMPRESSED_LZ4
+#else
+#  define HEADER_INCOMPATIBLE_SUPPORTED_LZ4 0
+#endif
+
+#ifdef HAVE_ZSTD
+#  define HEADER_INCOMPATIBLE_SUPPORTED_ZSTD (HEADER_INCOMPATIBLE_COMPRESSED_ZSTD|HEADER_INCOMPATIBLE_COMPRESSED_DICTIONARY)
+#else
+#  define HEADER_INCOMPATIBLE_SUPPORTED_ZSTD 0
+#endif
+
+#define HEADER_INCOMPATIBLE_SUPPORTED                                   \
+        (HEADER_INCOMPATIBLE_SUPPORTED_XZ|HEADER_INCOMPATIBLE_SUPPORTED_LZ4|HEADER_INCOMPATIBLE_SUPPORTED_ZSTD)
+
 enum {
-        HEADER_COMPATIBLE_SEALED = 1
+        HEADER_COMPATIBLE_SEALED = 1 << 0,
+        HEADER_COMPATIBLE_BLOOM_FILTER = 1 << 1,
 };
 
-#define HEADER_COMPATIBLE_ANY HEADER_COMPATIBLE_SEALED
+#define HEADER_COMPATIBLE_ANY (HEADER_COMPATIBLE_SEALED|HEADER_COMPATIBLE_BLOOM_FILTER)
 #ifdef HAVE_GCRYPT
-#  define HEADER_COMPATIBLE_SUPPORTED HEADER_COMPATIBLE_SEALED
+#  define HEADER_COMPATIBLE_SUPPORTED (HEADER_COMPATIBLE_SEALED|HEADER_COMPATIBLE_BLOOM_FILTER)
 #else
-#  define HEADER_COMPATIBLE_SUPPORTED 0
+#  define HEADER_COMPATIBLE_SUPPORTED HEADER_COMPATIBLE_BLOOM_FILTER
 #endif
 
 #define HEADER_SIGNATURE ((char[]) { 'L', 'P', 'K', 'S', 'H', 'H', 'R', 'H' })
@@ -218,8 +251,13 @@ struct Header {
         /* Added in 189 */
         le64_t n_tags;
         le64_t n_entry_arrays;
+        /* Added in 229 */
+        le64_t data_hash_chain_depth;
+        le64_t field_hash_chain_depth;
+        le64_t dictionary_offset;
+        le64_t bloom_filter_offset;
 
-        /* Size: 240 */
+        /* Size: 272 */
 } _packed_;
 
 #define FSS_HEADER_SIGNATURE ((char[]) { 'K', 'S', 'H', 'H', 'R', 'H', 'L', 'P' })
@@ -45,8 +45,30 @@
 #define DEFAULT_DATA_HASH_TABLE_SIZE (2047ULL*sizeof(HashItem))
 #define DEFAULT_FIELD_HASH_TABLE_SIZE (333ULL*sizeof(HashItem))
 
+/* If we ever walk a hash chain longer than this, the hash table is
+ * too small for the data in the file, and we suggest rotation */
+#define HASH_CHAIN_DEPTH_MAX 100
+
 #define COMPRESSION_SIZE_THRESHOLD (512ULL)
 
+/* Payloads below the compression threshold are compressed against a
+ * dictionary trained on the file's own data. Below this size not even
+ * that pays off, the frame overhead eats the savings. */
+#define DICTIONARY_COMPRESSION_SIZE_MIN (32ULL)
+
+/* How much sample data to collect before training, and how large the
+ * trained dictionary may grow at most */
+#define DICTIONARY_TRAINING_SIZE (512ULL*1024ULL)              /* 512 KiB */
+#define DICTIONARY_SIZE_MAX (16ULL*1024ULL)                    /* 16 KiB */
+
+/* Archived files carry a Bloom filter of their data hashes. 10 bits
+ * and 7 probes per data object make for a false positive rate of
+ * below 1%. Files with more data objects than fit into the maximum
+ * size simply don't get one. */
+#define BLOOM_FILTER_BITS_PER_ITEM (10ULL)
+#define BLOOM_FILTER_N_HASHES (7ULL)
+#define BLOOM_FILTER_SIZE_MAX (16ULL*1024ULL*1024ULL)          /* 16 MiB */
+
 /* This is the minimum journal file size */
 #define JOURNAL_FILE_SIZE_MIN (512ULL*1024ULL)                 /* 512 KiB */
 
@@ -87,7 +109,29 @@
 /* The mmap context to use for the header we pick as one above the last defined typed */
 #define CONTEXT_HEADER _OBJECT_TYPE_MAX
 
+static int journal_file_set_offline_thread_join(JournalFile *f) {
+        int r;
+
+        assert(f);
+
+        if (f->offline_state == OFFLINE_JOINED)
+                return 0;
+
+        r = pthread_join(f->offline_thread, NULL);
+        if (r)
+                return -r;
+
+        f->offline_state = OFFLINE_JOINED;
+
+        if (mmap_cache_got_sigbus(f->mmap, f->fd))
+                return -EIO;
+
+        return 0;
+}
+
 static int journal_file_set_online(JournalFile *f) {
+        int r;
+
         assert(f);
 
         if (!f->writable)
@@ -96,6 +140,30 @@ static int journal_file_set_online(JournalFile *f) {
         if (!(f->fd >= 0 && f->header))
                 return -EINVAL;
 
+        /* Take the file back from an offlining thread. As long as it
+         * is only syncing we can simply cancel it and go on writing,
+         * once it started to mark the file offline we have to wait
+         * for it. */
+        for (;;) {
+                OfflineState state = f->offline_state;
+
+                if (state == OFFLINE_JOINED || state == OFFLINE_CANCEL)
+                        break;
+
+                if (state == OFFLINE_SYNCING || state == OFFLINE_AGAIN) {
+                        if (__sync_bool_compare_and_swap(&f->offline_state, state, OFFLINE_CANCEL))
+                                break;
+
+                        continue;
+                }
+
+                r = journal_file_set_offline_thread_join(f);
+                if (r < 0)
+                        return r;
+
+                break;
+        }
+
         if (mmap_cache_got_sigbus(f->mmap, f->fd))
                 return -EIO;
 
@@ -113,7 +181,47 @@ static int journal_file_set_online(JournalFile *f) {
         }
 }
 
-int journal_file_set_offline(JournalFile *f) {
+static void *journal_file_set_offline_thread(void *arg) {
+        JournalFile *f = arg;
+
+        for (;;) {
+                switch (f->offline_state) {
+
+                case OFFLINE_SYNCING:
+                        (void) fsync(f->fd);
+
+                        /* A writer might have cancelled us in the
+                         * meantime, check again */
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_SYNCING, OFFLINE_OFFLINING))
+                                continue;
+
+                        f->header->state = STATE_OFFLINE;
+                        (void) fsync(f->fd);
+
+                        f->offline_state = OFFLINE_DONE;
+                        return NULL;
+
+                case OFFLINE_AGAIN:
+                        /* Data was written after our sync started,
+                         * start over */
+                        (void) __sync_bool_compare_and_swap(&f->offline_state, OFFLINE_AGAIN, OFFLINE_SYNCING);
+                        continue;
+
+                case OFFLINE_CANCEL:
+                        if (!__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_CANCEL, OFFLINE_DONE))
+                                continue;
+
+                        return NULL;
+
+                default:
+                        assert_not_reached("Unexpected offline state");
+                }
+        }
+}
+
+int journal_file_set_offline(JournalFile *f, bool wait) {
+        int r;
+
         assert(f);
 
         if (!f->writable)
@@ -122,9 +230,51 @@ int journal_file_set_offline(JournalFile *f) {
         if (!(f->fd >= 0 && f->header))
                 return -EINVAL;
 
+        /* Deal with a thread from an earlier call first. If it is
+         * still busy it will do the job for us, unless we have to
+         * wait anyway. */
+        for (;;) {
+                OfflineState state = f->offline_state;
+
+                if (state == OFFLINE_JOINED)
+                        break;
+
+                if (!wait) {
+                        if (state == OFFLINE_SYNCING || state == OFFLINE_OFFLINING || state == OFFLINE_AGAIN)
+                                return 0;
+
+                        if (state == OFFLINE_CANCEL) {
+                                if (__sync_bool_compare_and_swap(&f->offline_state, OFFLINE_CANCEL, OFFLINE_AGAIN))
+                                        return 0;
+
+                                continue;
+                        }
+                }
+
+                r = journal_file_set_offline_thread_join(f);
+                if (r < 0)
+                        return r;
+
+                break;
+        }
+
         if (f->header->state != STATE_ONLINE)
                 return 0;
 
+        if (!wait) {
+                /* Leave the two fsync()s to a thread, so that a
+                 * slow disk doesn't stall the caller. The thread
+                 * inherits our signal mask. */
+                f->offline_state = OFFLINE_SYNCING;
+
+                r = pthread_create(&f->offline_thread, NULL, journal_file_set_offline_thread, f);
+                if (r == 0)
+                        return 0;
+
+                f->offline_state = OFFLINE_JOINED;
+                log_debug_errno(r, "Failed to start offlining thread, offlining synchronously: %m");
+        }
+
         fsync(f->fd);
 
         if (mmap_cache_got_sigbus(f->mmap, f->fd))
@@ -140,16 +290,44 @@ int journal_file_set_offline(JournalFile *f) {
         return 0;
 }
 
+static int journal_file_append_bloom_filter(JournalFile *f);
+
 JournalFile* journal_file_close(JournalFile *f) {
+        int r;
+
         assert(f);
 
+        /* A file we archive won't change anymore, hence this is the
+         * time to summarize its contents for readers */
+        if (f->archive && f->writable) {
+                r = journal_file_append_bloom_filter(f);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to append Bloom filter to %s, ignoring: %m", f->path);
+        }
+
 #ifdef HAVE_GCRYPT
         /* Write the final tag */
         if (f->seal && f->writable)
                 journal_file_append_tag(f);
 #endif
 
-        journal_file_set_offline(f);
+        if (f->post_change_timer) {
+                int enabled;
+
+                /* Flush out a change notification that is still
+                 * pending, before we lose the timer. */
+                if (sd_event_source_get_enabled(f->post_change_timer, &enabled) >= 0 &&
+                    enabled == SD_EVENT_ONESHOT)
+                        journal_file_post_change(f);
+
+                (void) sd_event_source_set_enabled(f->post_change_timer, SD_EVENT_OFF);
+                f->post_change_timer = sd_event_source_unref(f->post_change_timer);
+        }
+
+        journal_file_set_offline(f, true);
+
+        if (f->archive && f->writable)
+                f->header->state = STATE_ARCHIVED;
 
         if (f->mmap && f->fd >= 0)
                 mmap_cache_close_fd(f->mmap, f->fd);
@@ -173,10 +351,14 @@ JournalFile* journal_file_close(JournalFile *f) {
 
         ordered_hashmap_free_free(f->chain_cache);
 
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
         free(f->compress_buffer);
 #endif
 
+        compress_dictionary_free(f->dictionary);
+        free(f->dictionary_samples);
+        free(f->dictionary_sample_sizes);
+
 #ifdef HAVE_GCRYPT
         if (f->fss_file)
                 munmap(f->fss_file, PAGE_ALIGN(f->fss_file_size));
@@ -193,6 +375,15 @@ JournalFile* journal_file_close(JournalFile *f) {
         return NULL;
 }
 
+void journal_file_close_set(Set *s) {
+        JournalFile *f;
+
+        assert(s);
+
+        while ((f = set_steal_first(s)))
+                (void) journal_file_close(f);
+}
+
 static int journal_file_init_header(JournalFile *f, JournalFile *template) {
         Header h = {};
         ssize_t k;
@@ -203,12 +394,20 @@ static int journal_file_init_header(JournalFile *f, JournalFile *template) {
         memcpy(h.signature, HEADER_SIGNATURE, 8);
         h.header_size = htole64(ALIGN64(sizeof(h)));
 
+        /* A compression dictionary may be added to any file that
+         * uses zstd, later on, while the flags are covered by the
+         * first seal tag. Readers go by dictionary_offset. */
         h.incompatible_flags |= htole32(
                 f->compress_xz * HEADER_INCOMPATIBLE_COMPRESSED_XZ |
-                f->compress_lz4 * HEADER_INCOMPATIBLE_COMPRESSED_LZ4);
+                f->compress_lz4 * HEADER_INCOMPATIBLE_COMPRESSED_LZ4 |
+                f->compress_zstd * (HEADER_INCOMPATIBLE_COMPRESSED_ZSTD|HEADER_INCOMPATIBLE_COMPRESSED_DICTIONARY));
 
+        /* The Bloom filter is only added when the file is archived,
+         * but the flags are covered by the first seal tag, hence
+         * announce it right away. Readers go by its offset. */
         h.compatible_flags = htole32(
-                f->seal * HEADER_COMPATIBLE_SEALED);
+                f->seal * HEADER_COMPATIBLE_SEALED |
+                HEADER_COMPATIBLE_BLOOM_FILTER);
 
         r = sd_id128_randomize(&h.file_id);
         if (r < 0)
@@ -342,6 +541,7 @@ static int journal_file_verify_header(JournalFile *f) {
 
         f->compress_xz = JOURNAL_HEADER_COMPRESSED_XZ(f->header);
         f->compress_lz4 = JOURNAL_HEADER_COMPRESSED_LZ4(f->header);
+        f->compress_zstd = JOURNAL_HEADER_COMPRESSED_ZSTD(f->header);
 
         f->seal = JOURNAL_HEADER_SEALED(f->header);
 
@@ -476,6 +676,8 @@ static uint64_t minimum_header_size(Object *o) {
                 [OBJECT_FIELD_HASH_TABLE] = sizeof(HashTableObject),
                 [OBJECT_ENTRY_ARRAY] = sizeof(EntryArrayObject),
                 [OBJECT_TAG] = sizeof(TagObject),
+                [OBJECT_DICTIONARY] = sizeof(DictionaryObject),
+                [OBJECT_BLOOM_FILTER] = sizeof(BloomFilterObject),
         };
 
         if (o->object.type >= ELEMENTSOF(table) || table[o->object.type] <= 0)
@@ -604,7 +806,35 @@ int journal_file_append_object(JournalFile *f, ObjectType type, uint64_t size, O
         return 0;
 }
 
-static int journal_file_setup_data_hash_table(JournalFile *f) {
+static bool journal_file_data_hash_table_exhausted(JournalFile *f) {
+        assert(f);
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, n_data) &&
+            le64toh(f->header->n_data) * 4ULL > (le64toh(f->header->data_hash_table_size) / sizeof(HashItem)) * 3ULL)
+                return true;
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth) &&
+            le64toh(f->header->data_hash_chain_depth) > HASH_CHAIN_DEPTH_MAX)
+                return true;
+
+        return false;
+}
+
+static bool journal_file_field_hash_table_exhausted(JournalFile *f) {
+        assert(f);
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, n_fields) &&
+            le64toh(f->header->n_fields) * 4ULL > (le64toh(f->header->field_hash_table_size) / sizeof(HashItem)) * 3ULL)
+                return true;
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth) &&
+            le64toh(f->header->field_hash_chain_depth) > HASH_CHAIN_DEPTH_MAX)
+                return true;
+
+        return false;
+}
+
+static int journal_file_setup_data_hash_table(JournalFile *f, JournalFile *template) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -620,6 +850,19 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         if (s < DEFAULT_DATA_HASH_TABLE_SIZE)
                 s = DEFAULT_DATA_HASH_TABLE_SIZE;
 
+        /* If the file we replace ran out of hash table space, the
+         * estimate above was too low for the data logged here, hence
+         * double the size of its table, but don't let the table take
+         * up more than a quarter of the file. */
+        if (template && journal_file_data_hash_table_exhausted(template)) {
+                uint64_t t;
+
+                t = MIN(le64toh(template->header->data_hash_table_size) * 2,
+                        f->metrics.max_size / 4 / sizeof(HashItem) * sizeof(HashItem));
+                if (t > s)
+                        s = t;
+        }
+
         log_debug("Reserving %"PRIu64" entries in hash table.", s / sizeof(HashItem));
 
         r = journal_file_append_object(f,
@@ -637,7 +880,7 @@ static int journal_file_setup_data_hash_table(JournalFile *f) {
         return 0;
 }
 
-static int journal_file_setup_field_hash_table(JournalFile *f) {
+static int journal_file_setup_field_hash_table(JournalFile *f, JournalFile *template) {
         uint64_t s, p;
         Object *o;
         int r;
@@ -648,6 +891,21 @@ static int journal_file_setup_field_hash_table(JournalFile *f) {
          * number should grow very slowly only */
 
         s = DEFAULT_FIELD_HASH_TABLE_SIZE;
+
+        /* Unless the file we replace ran out of it, in which case we
+         * double its size, as for the data hash table. Otherwise the
+         * new file would be rotated for the same reason right away. */
+        if (template && journal_file_field_hash_table_exhausted(template)) {
+                uint64_t t;
+
+                t = MIN(le64toh(template->header->field_hash_table_size) * 2,
+                        f->metrics.max_size / 4 / sizeof(HashItem) * sizeof(HashItem));
+                if (t > s)
+                        s = t;
+        }
+
+        log_debug("Reserving %"PRIu64" entries in field hash table.", s / sizeof(HashItem));
+
         r = journal_file_append_object(f,
                                        OBJECT_FIELD_HASH_TABLE,
                                        offsetof(Object, hash_table.items) + s,
@@ -805,12 +1063,29 @@ static int journal_file_link_data(
         return 0;
 }
 
+static void journal_file_update_chain_depth(JournalFile *f, le64_t *field, uint64_t depth) {
+        assert(f);
+        assert(field);
+
+        /* Remember the longest hash chain we walked, so that we can
+         * rotate when the hash table turns out to be too small */
+
+        if (!f->writable)
+                return;
+
+        if (!JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth))
+                return;
+
+        if (depth > le64toh(*field))
+                *field = htole64(depth);
+}
+
 int journal_file_find_field_object_with_hash(
                 JournalFile *f,
                 const void *field, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h, m;
+        uint64_t p, osize, h, m, depth = 0;
         int r;
 
         assert(f);
@@ -845,6 +1120,8 @@ int journal_file_find_field_object_with_hash(
                     le64toh(o->object.size) == osize &&
                     memcmp(o->field.payload, field, size) == 0) {
 
+                        journal_file_update_chain_depth(f, &f->header->field_hash_chain_depth, depth);
+
                         if (ret)
                                 *ret = o;
                         if (offset)
@@ -854,8 +1131,11 @@ int journal_file_find_field_object_with_hash(
                 }
 
                 p = le64toh(o->field.next_hash_offset);
+                depth++;
         }
 
+        journal_file_update_chain_depth(f, &f->header->field_hash_chain_depth, depth);
+
         return 0;
 }
 
@@ -881,7 +1161,7 @@ int journal_file_find_data_object_with_hash(
                 const void *data, uint64_t size, uint64_t hash,
                 Object **ret, uint64_t *offset) {
 
-        uint64_t p, osize, h, m;
+        uint64_t p, osize, h, m, depth = 0;
         int r;
 
         assert(f);
@@ -916,7 +1196,7 @@ int journal_file_find_data_object_with_hash(
                         goto next;
 
                 if (o->object.flags & OBJECT_COMPRESSION_MASK) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
                         uint64_t l;
                         size_t rsize = 0;
 
@@ -926,14 +1206,16 @@ int journal_file_find_data_object_with_hash(
 
                         l -= offsetof(Object, data.payload);
 
-                        r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
-                                            o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, 0);
+                        r = journal_file_decompress_blob(f, o->object.flags & OBJECT_COMPRESSION_MASK,
+                                                         o->data.payload, l, &f->compress_buffer, &f->compress_buffer_size, &rsize, 0);
                         if (r < 0)
                                 return r;
 
                         if (rsize == size &&
                             memcmp(f->compress_buffer, data, size) == 0) {
 
+                                journal_file_update_chain_depth(f, &f->header->data_hash_chain_depth, depth);
+
                                 if (ret)
                                         *ret = o;
 
@@ -948,6 +1230,8 @@ int journal_file_find_data_object_with_hash(
                 } else if (le64toh(o->object.size) == osize &&
                            memcmp(o->data.payload, data, size) == 0) {
 
+                        journal_file_update_chain_depth(f, &f->header->data_hash_chain_depth, depth);
+
                         if (ret)
                                 *ret = o;
 
@@ -959,8 +1243,11 @@ int journal_file_find_data_object_with_hash(
 
         next:
                 p = le64toh(o->data.next_hash_offset);
+                depth++;
         }
 
+        journal_file_update_chain_depth(f, &f->header->data_hash_chain_depth, depth);
+
         return 0;
 }
 
@@ -1043,6 +1330,146 @@ static int journal_file_append_field(
         return 0;
 }
 
+static int journal_file_append_dictionary(JournalFile *f, const void *data, size_t size) {
+        _cleanup_(compress_dictionary_freep) CompressDictionary *d = NULL;
+        Object *o;
+        uint64_t p;
+        int r;
+
+        assert(f);
+        assert(data);
+        assert(size > 0);
+
+        if (!JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset))
+                return -EOPNOTSUPP;
+
+        if (f->header->dictionary_offset != 0)
+                return -EEXIST;
+
+        r = compress_dictionary_new(data, size, &d);
+        if (r < 0)
+                return r;
+
+        r = journal_file_append_object(f, OBJECT_DICTIONARY, offsetof(Object, dictionary.payload) + size, &o, &p);
+        if (r < 0)
+                return r;
+
+        memcpy(o->dictionary.payload, data, size);
+
+#ifdef HAVE_GCRYPT
+        /* A dictionary appended before the first tag is covered by
+         * it, see journal_file_append_first_tag() */
+        if (le64toh(f->header->n_tags) > 0) {
+                r = journal_file_hmac_put_object(f, OBJECT_DICTIONARY, o, p);
+                if (r < 0)
+                        return r;
+        }
+#endif
+
+        f->header->dictionary_offset = htole64(p);
+
+        f->dictionary = d;
+        d = NULL;
+
+        log_debug("Added %zu byte compression dictionary to %s.", size, f->path);
+        return 0;
+}
+
+static int journal_file_inherit_dictionary(JournalFile *f, JournalFile *template) {
+        _cleanup_free_ void *data = NULL;
+        Object *o;
+        uint64_t p, l;
+        int r;
+
+        assert(f);
+        assert(template);
+
+        /* When rotating, start the new file off with the dictionary
+         * of the old one, so that we don't have to wait for a fresh
+         * one to be trained before small payloads are compressed
+         * again. */
+
+        r = journal_file_enable_dictionary(f);
+        if (r < 0)
+                return r;
+
+        if (!JOURNAL_HEADER_CONTAINS(template->header, dictionary_offset))
+                return 0;
+
+        p = le64toh(template->header->dictionary_offset);
+        if (p == 0)
+                return 0;
+
+        r = journal_file_move_to_object(template, OBJECT_DICTIONARY, p, &o);
+        if (r < 0)
+                return r;
+
+        l = le64toh(o->object.size) - offsetof(Object, dictionary.payload);
+        if (l <= 0 || l > DICTIONARY_SIZE_MAX)
+                return -EBADMSG;
+
+        /* Both files share the mmap cache, appending to the new file
+         * might detach the window we are looking at */
+        data = memdup(o->dictionary.payload, l);
+        if (!data)
+                return -ENOMEM;
+
+        return journal_file_append_dictionary(f, data, l);
+}
+
+static void journal_file_sample_dictionary(JournalFile *f, const void *data, uint64_t size) {
+        _cleanup_free_ void *dictionary = NULL;
+        size_t dictionary_size;
+        int r;
+
+        assert(f);
+        assert(data);
+        assert(size > 0);
+
+        /* Collects the payload as training sample, and once we have
+         * enough of them trains the dictionary and adds it to the
+         * file. Any failure simply turns dictionary compression off
+         * for this file, it is an optimization after all. */
+
+        if (!GREEDY_REALLOC(f->dictionary_samples, f->dictionary_samples_allocated, f->dictionary_samples_size + size) ||
+            !GREEDY_REALLOC(f->dictionary_sample_sizes, f->dictionary_sample_sizes_allocated, f->n_dictionary_samples + 1)) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        memcpy((uint8_t*) f->dictionary_samples + f->dictionary_samples_size, data, size);
+        f->dictionary_samples_size += size;
+        f->dictionary_sample_sizes[f->n_dictionary_samples++] = size;
+
+        if (f->dictionary_samples_size < DICTIONARY_TRAINING_SIZE)
+                return;
+
+        dictionary = malloc(DICTIONARY_SIZE_MAX);
+        if (!dictionary) {
+                r = -ENOMEM;
+                goto finish;
+        }
+
+        r = compress_dictionary_train(f->dictionary_samples, f->dictionary_sample_sizes, f->n_dictionary_samples,
+                                      dictionary, DICTIONARY_SIZE_MAX, &dictionary_size);
+        if (r < 0)
+                goto finish;
+
+        r = journal_file_append_dictionary(f, dictionary, dictionary_size);
+
+finish:
+        if (r < 0) {
+                log_debug_errno(r, "Failed to set up compression dictionary for %s, not using one: %m", f->path);
+                f->compress_dictionary = false;
+        }
+
+        f->dictionary_samples = mfree(f->dictionary_samples);
+        f->dictionary_samples_size = f->dictionary_samples_allocated = 0;
+        f->dictionary_sample_sizes = mfree(f->dictionary_sample_sizes);
+        f->dictionary_sample_sizes_allocated = 0;
+        f->n_dictionary_samples = 0;
+}
+
 static int journal_file_append_data(
                 JournalFile *f,
                 const void *data, uint64_t size,
@@ -1073,6 +1500,20 @@ static int journal_file_append_data(
                 return 0;
         }
 
+        if (f->compress_dictionary &&
+            size >= DICTIONARY_COMPRESSION_SIZE_MIN && size < COMPRESSION_SIZE_THRESHOLD) {
+
+                /* Make sure the dictionary is loaded before we
+                 * allocate the object, or train it if there is none
+                 * yet. */
+                r = journal_file_load_dictionary(f);
+                if (r < 0) {
+                        log_debug_errno(r, "Failed to load compression dictionary of %s, not using it: %m", f->path);
+                        f->compress_dictionary = false;
+                } else if (r == 0)
+                        journal_file_sample_dictionary(f, data, size);
+        }
+
         osize = offsetof(Object, data.payload) + size;
         r = journal_file_append_object(f, OBJECT_DATA, osize, &o, &p);
         if (r < 0)
@@ -1080,7 +1521,7 @@ static int journal_file_append_data(
 
         o->data.hash = htole64(hash);
 
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
         if (JOURNAL_FILE_COMPRESS(f) && size >= COMPRESSION_SIZE_THRESHOLD) {
                 size_t rsize = 0;
 
@@ -1098,6 +1539,19 @@ static int journal_file_append_data(
         }
 #endif
 
+        if (f->compress_dictionary && f->dictionary &&
+            size >= DICTIONARY_COMPRESSION_SIZE_MIN && size < COMPRESSION_SIZE_THRESHOLD) {
+                size_t rsize = 0;
+
+                r = compress_blob_zstd_dictionary(f->dictionary, data, size, o->data.payload, size - 1, &rsize);
+                if (r >= 0) {
+                        compression = OBJECT_COMPRESSED_ZSTD_DICTIONARY;
+
+                        o->object.size = htole64(offsetof(Object, data.payload) + rsize);
+                        o->object.flags |= compression;
+                }
+        }
+
         if (compression == 0 && size > 0)
                 memcpy(o->data.payload, data, size);
 
@@ -1111,6 +1565,15 @@ static int journal_file_append_data(
         if (r < 0)
                 return r;
 
+#ifdef HAVE_GCRYPT
+        /* Hash the data object before the field object we might
+         * append below, which follows it in the file. Verification
+         * goes by the file order. */
+        r = journal_file_hmac_put_object(f, OBJECT_DATA, o, p);
+        if (r < 0)
+                return r;
+#endif
+
         if (!data)
                 eq = NULL;
         else
@@ -1129,12 +1592,6 @@ static int journal_file_append_data(
                 fo->field.head_data_offset = le64toh(p);
         }
 
-#ifdef HAVE_GCRYPT
-        r = journal_file_hmac_put_object(f, OBJECT_DATA, o, p);
-        if (r < 0)
-                return r;
-#endif
-
         if (ret)
                 *ret = o;
 
@@ -1400,6 +1857,181 @@ void journal_file_post_change(JournalFile *f) {
                 log_error_errno(errno, "Failed to truncate file to its own size: %m");
 }
 
+static int post_change_thunk(sd_event_source *timer, uint64_t usec, void *userdata) {
+        assert(userdata);
+
+        journal_file_post_change(userdata);
+
+        return 1;
+}
+
+static void schedule_post_change(JournalFile *f) {
+        sd_event_source *timer;
+        int enabled, r;
+        uint64_t now;
+
+        assert(f);
+        assert(f->post_change_timer);
+
+        /* Instead of triggering IN_MODIFY after each entry we
+         * append, do it at most once per timer period, so that its
+         * cost is amortized over all entries written in between. */
+
+        timer = f->post_change_timer;
+
+        r = sd_event_source_get_enabled(timer, &enabled);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to get ftruncate timer state: %m");
+                goto fail;
+        }
+
+        if (enabled == SD_EVENT_ONESHOT)
+                return;
+
+        r = sd_event_now(sd_event_source_get_event(timer), CLOCK_MONOTONIC, &now);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to get clock's now for scheduling ftruncate: %m");
+                goto fail;
+        }
+
+        r = sd_event_source_set_time(timer, now + f->post_change_timer_period);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to set time for scheduling ftruncate: %m");
+                goto fail;
+        }
+
+        r = sd_event_source_set_enabled(timer, SD_EVENT_ONESHOT);
+        if (r < 0) {
+                log_debug_errno(r, "Failed to enable scheduled ftruncate: %m");
+                goto fail;
+        }
+
+        return;
+
+fail:
+        /* On failure, let's simply post the change immediately. */
+        journal_file_post_change(f);
+}
+
+int journal_file_enable_post_change_timer(JournalFile *f, sd_event *e, usec_t t) {
+        _cleanup_(sd_event_source_unrefp) sd_event_source *timer = NULL;
+        int r;
+
+        assert(f);
+        assert(e);
+        assert(t > 0);
+        assert_return(!f->post_change_timer, -EINVAL);
+
+        r = sd_event_add_time(e, &timer, CLOCK_MONOTONIC, 0, 0, post_change_thunk, f);
+        if (r < 0)
+                return r;
+
+        r = sd_event_source_set_enabled(timer, SD_EVENT_OFF);
+        if (r < 0)
+                return r;
+
+        f->post_change_timer = timer;
+        timer = NULL;
+        f->post_change_timer_period = t;
+
+        return 0;
+}
+
+int journal_file_enable_dictionary(JournalFile *f) {
+        assert(f);
+
+        /* Turns on compression of short payloads against a trained
+         * dictionary. The dictionary is trained from the first data
+         * written to the file, unless the file already has one. */
+
+        if (!f->writable)
+                return -EINVAL;
+
+        if (!f->compress_zstd)
+                return -EOPNOTSUPP;
+
+        if (!JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset))
+                return -EOPNOTSUPP;
+
+        f->compress_dictionary = true;
+        return 0;
+}
+
+int journal_file_load_dictionary(JournalFile *f) {
+        Object *o;
+        uint64_t p, l;
+        int r;
+
+        assert(f);
+
+        /* Returns > 0 if the dictionary is loaded, 0 if the file has
+         * none (yet). */
+
+        if (f->dictionary)
+                return 1;
+
+        if (!JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset))
+                return 0;
+
+        p = le64toh(f->header->dictionary_offset);
+        if (p == 0)
+                return 0;
+
+        r = journal_file_move_to_object(f, OBJECT_DICTIONARY, p, &o);
+        if (r < 0)
+                return r;
+
+        l = le64toh(o->object.size) - offsetof(Object, dictionary.payload);
+        if (l <= 0 || l > DICTIONARY_SIZE_MAX)
+                return -EBADMSG;
+
+        r = compress_dictionary_new(o->dictionary.payload, l, &f->dictionary);
+        if (r < 0)
+                return r;
+
+        return 1;
+}
+
+int journal_file_decompress_blob(JournalFile *f, int compression,
+                                 const void *src, uint64_t src_size,
+                                 void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max) {
+        int r;
+
+        assert(f);
+
+        if (compression != OBJECT_COMPRESSED_ZSTD_DICTIONARY)
+                return decompress_blob(compression, src, src_size, dst, dst_alloc_size, dst_size, dst_max);
+
+        r = journal_file_load_dictionary(f);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                return -EBADMSG;
+
+        return decompress_blob_zstd_dictionary(f->dictionary, src, src_size, dst, dst_alloc_size, dst_size, dst_max);
+}
+
+int journal_file_decompress_startswith(JournalFile *f, int compression,
+                                       const void *src, uint64_t src_size,
+                                       void **buffer, size_t *buffer_size,
+                                       const void *prefix, size_t prefix_len,
+                                       uint8_t extra) {
+        int r;
+
+        assert(f);
+
+        if (compression != OBJECT_COMPRESSED_ZSTD_DICTIONARY)
+                return decompress_startswith(compression, src, src_size, buffer, buffer_size, prefix, prefix_len, extra);
+
+        r = journal_file_load_dictionary(f);
+        if (r < 0)
+                return r;
+        if (r == 0)
+                return -EBADMSG;
+
+        return decompress_startswith_zstd_dictionary(f->dictionary, src, src_size, buffer, buffer_size, prefix, prefix_len, extra);
+}
+
 static int entry_item_cmp(const void *_a, const void *_b) {
         const EntryItem *a = _a, *b = _b;
 
@@ -1465,7 +2097,10 @@ int journal_file_append_entry(JournalFile *f, const dual_timestamp *ts, const st
         if (mmap_cache_got_sigbus(f->mmap, f->fd))
                 r = -EIO;
 
-        journal_file_post_change(f);
+        if (f->post_change_timer)
+                schedule_post_change(f);
+        else
+                journal_file_post_change(f);
 
         return r;
 }
@@ -2447,6 +3082,17 @@ void journal_file_dump(JournalFile *f) {
                                le64toh(o->tag.epoch));
                         break;
 
+                case OBJECT_DICTIONARY:
+                        printf("Type: OBJECT_DICTIONARY size=%"PRIu64"\n",
+                               le64toh(o->object.size) - offsetof(Object, dictionary.payload));
+                        break;
+
+                case OBJECT_BLOOM_FILTER:
+                        printf("Type: OBJECT_BLOOM_FILTER bits=%"PRIu64" hashes=%"PRIu64"\n",
+                               (le64toh(o->object.size) - offsetof(Object, bloom_filter.bits)) * 8,
+                               le64toh(o->bloom_filter.n_hashes));
+                        break;
+
                 default:
                         printf("Type: unknown (%i)\n", o->object.type);
                         break;
@@ -2490,8 +3136,8 @@ void journal_file_print_header(JournalFile *f) {
                "Boot ID: %s\n"
                "Sequential Number ID: %s\n"
                "State: %s\n"
-               "Compatible Flags:%s%s\n"
-               "Incompatible Flags:%s%s%s\n"
+               "Compatible Flags:%s%s%s\n"
+               "Incompatible Flags:%s%s%s%s%s\n"
                "Header size: %"PRIu64"\n"
                "Arena size: %"PRIu64"\n"
                "Data Hash Table Size: %"PRIu64"\n"
@@ -2513,9 +3159,12 @@ void journal_file_print_header(JournalFile *f) {
                f->header->state == STATE_ONLINE ? "ONLINE" :
                f->header->state == STATE_ARCHIVED ? "ARCHIVED" : "UNKNOWN",
                JOURNAL_HEADER_SEALED(f->header) ? " SEALED" : "",
+               JOURNAL_HEADER_BLOOM_FILTER(f->header) ? " BLOOM-FILTER" : "",
                (le32toh(f->header->compatible_flags) & ~HEADER_COMPATIBLE_ANY) ? " ???" : "",
                JOURNAL_HEADER_COMPRESSED_XZ(f->header) ? " COMPRESSED-XZ" : "",
                JOURNAL_HEADER_COMPRESSED_LZ4(f->header) ? " COMPRESSED-LZ4" : "",
+               JOURNAL_HEADER_COMPRESSED_ZSTD(f->header) ? " COMPRESSED-ZSTD" : "",
+               JOURNAL_HEADER_COMPRESSED_DICTIONARY(f->header) ? " COMPRESSED-DICTIONARY" : "",
                (le32toh(f->header->incompatible_flags) & ~HEADER_INCOMPATIBLE_ANY) ? " ???" : "",
                le64toh(f->header->header_size),
                le64toh(f->header->arena_size),
@@ -2549,6 +3198,22 @@ void journal_file_print_header(JournalFile *f) {
                 printf("Entry Array Objects: %"PRIu64"\n",
                        le64toh(f->header->n_entry_arrays));
 
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth))
+                printf("Deepest Data Hash Chain: %"PRIu64"\n"
+                       "Deepest Field Hash Chain: %"PRIu64"\n",
+                       le64toh(f->header->data_hash_chain_depth),
+                       le64toh(f->header->field_hash_chain_depth));
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset) &&
+            le64toh(f->header->dictionary_offset) != 0)
+                printf("Dictionary Offset: %"PRIu64"\n",
+                       le64toh(f->header->dictionary_offset));
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset) &&
+            le64toh(f->header->bloom_filter_offset) != 0)
+                printf("Bloom Filter Offset: %"PRIu64"\n",
+                       le64toh(f->header->bloom_filter_offset));
+
         if (fstat(f->fd, &st) >= 0)
                 printf("Disk usage: %s\n", format_bytes(bytes, sizeof(bytes), (uint64_t) st.st_blocks * 512ULL));
 }
@@ -2625,7 +3290,9 @@ int journal_file_open(
         f->flags = flags;
         f->prot = prot_from_flags(flags);
         f->writable = (flags & O_ACCMODE) != O_RDONLY;
-#if defined(HAVE_LZ4)
+#if defined(HAVE_ZSTD)
+        f->compress_zstd = compress;
+#elif defined(HAVE_LZ4)
         f->compress_lz4 = compress;
 #elif defined(HAVE_XZ)
         f->compress_xz = compress;
@@ -2747,14 +3414,20 @@ int journal_file_open(
 #endif
 
         if (newly_created) {
-                r = journal_file_setup_field_hash_table(f);
+                r = journal_file_setup_field_hash_table(f, template);
                 if (r < 0)
                         goto fail;
 
-                r = journal_file_setup_data_hash_table(f);
+                r = journal_file_setup_data_hash_table(f, template);
                 if (r < 0)
                         goto fail;
 
+                if (template && template->compress_dictionary) {
+                        r = journal_file_inherit_dictionary(f, template);
+                        if (r < 0)
+                                log_debug_errno(r, "Failed to take over compression dictionary of %s, ignoring: %m", template->path);
+                }
+
 #ifdef HAVE_GCRYPT
                 r = journal_file_append_first_tag(f);
                 if (r < 0)
@@ -2779,7 +3452,138 @@ fail:
         return r;
 }
 
-int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
+static void bloom_filter_bits(uint64_t hash, uint64_t n_bits, uint64_t i, uint64_t *byte, uint8_t *mask) {
+        uint64_t a, b, k;
+
+        /* Derive the probes from the two halves of the data hash we
+         * already have (Kirsch-Mitzenmacher), instead of hashing the
+         * payload again. */
+        a = hash & 0xffffffffULL;
+        b = (hash >> 32) | 1;
+        k = (a + i * b) % n_bits;
+
+        *byte = k / 8;
+        *mask = 1U << (k % 8);
+}
+
+static int journal_file_append_bloom_filter(JournalFile *f) {
+        _cleanup_free_ uint8_t *bits = NULL;
+        uint64_t n_data, n_bits, size, n_seen = 0, m, i, p;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        if (!JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset))
+                return -EOPNOTSUPP;
+
+        if (f->header->bloom_filter_offset != 0)
+                return -EEXIST;
+
+        n_data = le64toh(f->header->n_data);
+        if (n_data <= 0)
+                return 0;
+
+        if (n_data > BLOOM_FILTER_SIZE_MAX * 8 / BLOOM_FILTER_BITS_PER_ITEM)
+                return -E2BIG;
+
+        size = DIV_ROUND_UP(n_data * BLOOM_FILTER_BITS_PER_ITEM, 8);
+        n_bits = size * 8;
+
+        bits = new0(uint8_t, size);
+        if (!bits)
+                return -ENOMEM;
+
+        r = journal_file_map_data_hash_table(f);
+        if (r < 0)
+                return r;
+
+        m = le64toh(f->header->data_hash_table_size) / sizeof(HashItem);
+        for (i = 0; i < m; i++) {
+                p = le64toh(f->data_hash_table[i].head_hash_offset);
+
+                while (p > 0) {
+                        uint64_t h, b, k;
+                        uint8_t mask;
+
+                        /* Don't loop forever on a corrupted chain */
+                        if (++n_seen > n_data)
+                                return -EBADMSG;
+
+                        r = journal_file_move_to_object(f, OBJECT_DATA, p, &o);
+                        if (r < 0)
+                                return r;
+
+                        h = le64toh(o->data.hash);
+                        for (k = 0; k < BLOOM_FILTER_N_HASHES; k++) {
+                                bloom_filter_bits(h, n_bits, k, &b, &mask);
+                                bits[b] |= mask;
+                        }
+
+                        p = le64toh(o->data.next_hash_offset);
+                }
+        }
+
+        r = journal_file_append_object(f, OBJECT_BLOOM_FILTER, offsetof(Object, bloom_filter.bits) + size, &o, &p);
+        if (r < 0)
+                return r;
+
+        o->bloom_filter.n_hashes = htole64(BLOOM_FILTER_N_HASHES);
+        memcpy(o->bloom_filter.bits, bits, size);
+
+#ifdef HAVE_GCRYPT
+        r = journal_file_hmac_put_object(f, OBJECT_BLOOM_FILTER, o, p);
+        if (r < 0)
+                return r;
+#endif
+
+        f->header->bloom_filter_offset = htole64(p);
+
+        log_debug("Added %"PRIu64" bit Bloom filter to %s.", n_bits, f->path);
+        return 0;
+}
+
+int journal_file_bloom_filter_test(JournalFile *f, uint64_t hash) {
+        uint64_t p, n_bits, n_hashes, k, b;
+        uint8_t mask;
+        Object *o;
+        int r;
+
+        assert(f);
+
+        /* Returns 0 if the file definitely contains no data object
+         * with the specified hash, > 0 if it might. The filter is
+         * only trusted on archived files, which cannot be appended
+         * to anymore. */
+
+        if (f->header->state != STATE_ARCHIVED ||
+            !JOURNAL_HEADER_BLOOM_FILTER(f->header) ||
+            !JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset))
+                return 1;
+
+        p = le64toh(f->header->bloom_filter_offset);
+        if (p == 0)
+                return 1;
+
+        r = journal_file_move_to_object(f, OBJECT_BLOOM_FILTER, p, &o);
+        if (r < 0)
+                return r;
+
+        n_bits = (le64toh(o->object.size) - offsetof(Object, bloom_filter.bits)) * 8;
+        n_hashes = le64toh(o->bloom_filter.n_hashes);
+        if (n_bits <= 0 || n_hashes <= 0 || n_hashes > 64)
+                return -EBADMSG;
+
+        for (k = 0; k < n_hashes; k++) {
+                bloom_filter_bits(hash, n_bits, k, &b, &mask);
+                if (!(o->bloom_filter.bits[b] & mask))
+                        return 0;
+        }
+
+        return 1;
+}
+
+int journal_file_rotate(JournalFile **f, bool compress, bool seal, Set *deferred_closes) {
         _cleanup_free_ char *p = NULL;
         size_t l;
         JournalFile *old_file, *new_file = NULL;
@@ -2796,6 +3600,12 @@ int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         if (!endswith(old_file->path, ".journal"))
                 return -EINVAL;
 
+        /* Make sure no offlining thread touches the header behind
+         * our back anymore */
+        r = journal_file_set_offline_thread_join(old_file);
+        if (r < 0)
+                return r;
+
         l = strlen(old_file->path);
         r = asprintf(&p, "%.*s@" SD_ID128_FORMAT_STR "-%016"PRIx64"-%016"PRIx64".journal",
                      (int) l - 8, old_file->path,
@@ -2812,7 +3622,9 @@ int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         if (r < 0 && errno != ENOENT)
                 return -errno;
 
-        old_file->header->state = STATE_ARCHIVED;
+        /* The file is marked archived when it is closed, after its
+         * Bloom filter was added */
+        old_file->archive = true;
 
         /* Currently, btrfs is not very good with out write patterns
          * and fragments heavily. Let's defrag our journal files when
@@ -2820,7 +3632,15 @@ int journal_file_rotate(JournalFile **f, bool compress, bool seal) {
         old_file->defrag_on_close = true;
 
         r = journal_file_open(old_file->path, old_file->flags, old_file->mode, compress, seal, NULL, old_file->mmap, old_file, &new_file);
-        journal_file_close(old_file);
+
+        /* Building the Bloom filter walks all data objects, callers
+         * that don't want to wait for that right now may close the
+         * old file later on. In the meantime it is offline. */
+        if (deferred_closes &&
+            set_put(deferred_closes, old_file) >= 0)
+                (void) journal_file_set_offline(old_file, false);
+        else
+                journal_file_close(old_file);
 
         *f = new_file;
         return r;
@@ -2932,11 +3752,11 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
                         return -E2BIG;
 
                 if (o->object.flags & OBJECT_COMPRESSION_MASK) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
                         size_t rsize = 0;
 
-                        r = decompress_blob(o->object.flags & OBJECT_COMPRESSION_MASK,
-                                            o->data.payload, l, &from->compress_buffer, &from->compress_buffer_size, &rsize, 0);
+                        r = journal_file_decompress_blob(from, o->object.flags & OBJECT_COMPRESSION_MASK,
+                                                         o->data.payload, l, &from->compress_buffer, &from->compress_buffer_size, &rsize, 0);
                         if (r < 0)
                                 return r;
 
@@ -3177,6 +3997,23 @@ bool journal_file_rotate_suggested(JournalFile *f, usec_t max_file_usec) {
                         return true;
                 }
 
+        /* If we had to walk overly long hash chains, the hash
+         * functions don't distribute the data well enough over the
+         * tables, and lookups get slow. Rotate, too. */
+        if (JOURNAL_HEADER_CONTAINS(f->header, data_hash_chain_depth) &&
+            le64toh(f->header->data_hash_chain_depth) > HASH_CHAIN_DEPTH_MAX) {
+                log_debug("Data hash table of %s has deepest hash chain of length %"PRIu64", suggesting rotation.",
+                          f->path, le64toh(f->header->data_hash_chain_depth));
+                return true;
+        }
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, field_hash_chain_depth) &&
+            le64toh(f->header->field_hash_chain_depth) > HASH_CHAIN_DEPTH_MAX) {
+                log_debug("Field hash table of %s has deepest hash chain of length %"PRIu64", suggesting rotation.",
+                          f->path, le64toh(f->header->field_hash_chain_depth));
+                return true;
+        }
+
         /* Are the data objects properly indexed by field objects? */
         if (JOURNAL_HEADER_CONTAINS(f->header, n_data) &&
             JOURNAL_HEADER_CONTAINS(f->header, n_fields) &&
@@ -22,17 +22,21 @@
 ***/
 
 #include <inttypes.h>
+#include <pthread.h>
 
 #ifdef HAVE_GCRYPT
 #include <gcrypt.h>
 #endif
 
+#include "sd-event.h"
 #include "sd-id128.h"
 
+#include "compress.h"
 #include "hashmap.h"
 #include "journal-def.h"
 #include "macro.h"
 #include "mmap-cache.h"
+#include "set.h"
 #include "sparse-endian.h"
 
 typedef struct JournalMetrics {
@@ -64,6 +68,15 @@ typedef enum LocationType {
         LOCATION_SEEK
 } LocationType;
 
+typedef enum OfflineState {
+        OFFLINE_JOINED,    /* no offlining thread around */
+        OFFLINE_SYNCING,   /* thread is syncing, writers may cancel it */
+        OFFLINE_OFFLINING, /* thread is marking the file offline, writers have to wait */
+        OFFLINE_CANCEL,    /* a writer took the file back while it was syncing */
+        OFFLINE_AGAIN,     /* offlining was requested again after a cancel */
+        OFFLINE_DONE,      /* thread finished, needs to be joined */
+} OfflineState;
+
 typedef struct JournalFile {
         int fd;
 
@@ -74,14 +87,18 @@ typedef struct JournalFile {
         bool writable:1;
         bool compress_xz:1;
         bool compress_lz4:1;
+        bool compress_zstd:1;
+        bool compress_dictionary:1;
         bool seal:1;
         bool defrag_on_close:1;
+        bool archive:1;
 
         bool tail_entry_monotonic_valid:1;
 
         direction_t last_direction;
         LocationType location_type;
         uint64_t last_n_entries;
+        unsigned location_prioq_idx;
 
         char *path;
         struct stat last_stat;
@@ -103,11 +120,27 @@ typedef struct JournalFile {
 
         OrderedHashmap *chain_cache;
 
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+        sd_event_source *post_change_timer;
+        usec_t post_change_timer_period;
+
+        pthread_t offline_thread;
+        volatile OfflineState offline_state;
+
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
         void *compress_buffer;
         size_t compress_buffer_size;
 #endif
 
+        CompressDictionary *dictionary;
+
+        /* Payloads collected to train the dictionary from, until
+         * the file has one */
+        void *dictionary_samples;
+        size_t dictionary_samples_size, dictionary_samples_allocated;
+        size_t *dictionary_sample_sizes;
+        size_t dictionary_sample_sizes_allocated;
+        unsigned n_dictionary_samples;
+
 #ifdef HAVE_GCRYPT
         gcry_md_hd_t hmac;
         bool hmac_running;
@@ -137,8 +170,9 @@ int journal_file_open(
                 JournalFile *template,
                 JournalFile **ret);
 
-int journal_file_set_offline(JournalFile *f);
+int journal_file_set_offline(JournalFile *f, bool wait);
 JournalFile* journal_file_close(JournalFile *j);
+void journal_file_close_set(Set *s);
 
 int journal_file_open_reliably(
                 const char *fname,
@@ -179,12 +213,21 @@ static inline bool VALID_EPOCH(uint64_t u) {
 #define JOURNAL_HEADER_SEALED(h) \
         (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_SEALED))
 
+#define JOURNAL_HEADER_BLOOM_FILTER(h) \
+        (!!(le32toh((h)->compatible_flags) & HEADER_COMPATIBLE_BLOOM_FILTER))
+
 #define JOURNAL_HEADER_COMPRESSED_XZ(h) \
         (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_XZ))
 
 #define JOURNAL_HEADER_COMPRESSED_LZ4(h) \
         (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_LZ4))
 
+#define JOURNAL_HEADER_COMPRESSED_ZSTD(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_ZSTD))
+
+#define JOURNAL_HEADER_COMPRESSED_DICTIONARY(h) \
+        (!!(le32toh((h)->incompatible_flags) & HEADER_INCOMPATIBLE_COMPRESSED_DICTIONARY))
+
 int journal_file_move_to_object(JournalFile *f, ObjectType type, uint64_t offset, Object **ret);
 
 uint64_t journal_file_entry_n_items(Object *o) _pure_;
@@ -221,9 +264,24 @@ int journal_file_copy_entry(JournalFile *from, JournalFile *to, Object *o, uint6
 void journal_file_dump(JournalFile *f);
 void journal_file_print_header(JournalFile *f);
 
-int journal_file_rotate(JournalFile **f, bool compress, bool seal);
+int journal_file_rotate(JournalFile **f, bool compress, bool seal, Set *deferred_closes);
 
 void journal_file_post_change(JournalFile *f);
+int journal_file_enable_post_change_timer(JournalFile *f, sd_event *e, usec_t t);
+
+int journal_file_enable_dictionary(JournalFile *f);
+int journal_file_load_dictionary(JournalFile *f);
+
+int journal_file_bloom_filter_test(JournalFile *f, uint64_t hash);
+
+int journal_file_decompress_blob(JournalFile *f, int compression,
+                                 const void *src, uint64_t src_size,
+                                 void **dst, size_t *dst_alloc_size, size_t* dst_size, size_t dst_max);
+int journal_file_decompress_startswith(JournalFile *f, int compression,
+                                       const void *src, uint64_t src_size,
+                                       void **buffer, size_t *buffer_size,
+                                       const void *prefix, size_t prefix_len,
+                                       uint8_t extra);
 
 void journal_reset_metrics(JournalMetrics *m);
 void journal_default_metrics(JournalMetrics *m, int fd);
@@ -238,5 +296,5 @@ int journal_file_map_field_hash_table(JournalFile *f);
 
 static inline bool JOURNAL_FILE_COMPRESS(JournalFile *f) {
         assert(f);
-        return f->compress_xz || f->compress_lz4;
+        return f->compress_xz || f->compress_lz4 || f->compress_zstd;
 }
@@ -32,6 +32,7 @@
 #include "journal-def.h"
 #include "journal-file.h"
 #include "list.h"
+#include "prioq.h"
 #include "set.h"
 
 typedef struct Match Match;
@@ -95,6 +96,15 @@ struct sd_journal {
         JournalFile *current_file;
         uint64_t current_field;
 
+        /* Files with a candidate entry, ordered by that entry in the
+         * direction we are iterating in, plus online files that ran
+         * out of entries but might still grow. Only valid as long as
+         * nothing seeks, changes the matches or the set of files. */
+        Prioq *files_by_location;
+        Set *files_exhausted;
+        direction_t files_by_location_direction;
+        bool files_by_location_valid;
+
         Match *level0, *level1, *level2;
 
         pid_t original_pid;
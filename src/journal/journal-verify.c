@@ -125,7 +125,7 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
          * possible field values. It does not follow any references to
          * other objects. */
 
-        if ((o->object.flags & OBJECT_COMPRESSED_XZ) &&
+        if ((o->object.flags & OBJECT_COMPRESSION_MASK) &&
             o->object.type != OBJECT_DATA) {
                 error(offset, "Found compressed object that isn't of type DATA, which is not allowed.");
                 return -EBADMSG;
@@ -159,10 +159,10 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
                         _cleanup_free_ void *b = NULL;
                         size_t alloc = 0, b_size;
 
-                        r = decompress_blob(compression,
-                                            o->data.payload,
-                                            le64toh(o->object.size) - offsetof(Object, data.payload),
-                                            &b, &alloc, &b_size, 0);
+                        r = journal_file_decompress_blob(f, compression,
+                                                         o->data.payload,
+                                                         le64toh(o->object.size) - offsetof(Object, data.payload),
+                                                         &b, &alloc, &b_size, 0);
                         if (r < 0) {
                                 error(offset, "%s decompression failed: %s",
                                       object_compressed_to_string(compression), strerror(-r));
@@ -350,6 +350,35 @@ static int journal_file_object_verify(JournalFile *f, uint64_t offset, Object *o
                         return -EBADMSG;
                 }
 
+                break;
+
+        case OBJECT_DICTIONARY:
+                if (le64toh(o->object.size) - offsetof(DictionaryObject, payload) <= 0) {
+                        error(offset,
+                              "Bad dictionary size (<= %zu): %"PRIu64,
+                              offsetof(DictionaryObject, payload),
+                              le64toh(o->object.size));
+                        return -EBADMSG;
+                }
+
+                break;
+
+        case OBJECT_BLOOM_FILTER:
+                if (le64toh(o->object.size) - offsetof(BloomFilterObject, bits) <= 0) {
+                        error(offset,
+                              "Bad Bloom filter size (<= %zu): %"PRIu64,
+                              offsetof(BloomFilterObject, bits),
+                              le64toh(o->object.size));
+                        return -EBADMSG;
+                }
+
+                if (le64toh(o->bloom_filter.n_hashes) <= 0 ||
+                    le64toh(o->bloom_filter.n_hashes) > 64) {
+                        error(offset, "Invalid Bloom filter hash count: %"PRIu64,
+                              le64toh(o->bloom_filter.n_hashes));
+                        return -EBADMSG;
+                }
+
                 break;
         }
 
@@ -810,14 +839,14 @@ int journal_file_verify(
                 const char *key,
                 usec_t *first_contained, usec_t *last_validated, usec_t *last_contained,
                 bool show_progress) {
-        int r;
+        int r, compression;
         Object *o;
         uint64_t p = 0, last_epoch = 0, last_tag_realtime = 0, last_sealed_realtime = 0;
 
         uint64_t entry_seqnum = 0, entry_monotonic = 0, entry_realtime = 0;
         sd_id128_t entry_boot_id;
         bool entry_seqnum_set = false, entry_monotonic_set = false, entry_realtime_set = false, found_main_entry_array = false;
-        uint64_t n_weird = 0, n_objects = 0, n_entries = 0, n_data = 0, n_fields = 0, n_data_hash_tables = 0, n_field_hash_tables = 0, n_entry_arrays = 0, n_tags = 0;
+        uint64_t n_weird = 0, n_objects = 0, n_entries = 0, n_data = 0, n_fields = 0, n_data_hash_tables = 0, n_field_hash_tables = 0, n_entry_arrays = 0, n_tags = 0, n_dictionaries = 0, n_bloom_filters = 0;
         usec_t last_usec = 0;
         int data_fd = -1, entry_fd = -1, entry_array_fd = -1;
         unsigned i;
@@ -904,8 +933,8 @@ int journal_file_verify(
                         goto fail;
                 }
 
-                if ((o->object.flags & OBJECT_COMPRESSED_XZ) &&
-                    (o->object.flags & OBJECT_COMPRESSED_LZ4)) {
+                compression = o->object.flags & OBJECT_COMPRESSION_MASK;
+                if ((compression & (compression - 1)) != 0) {
                         error(p, "Objected with double compression");
                         r = -EINVAL;
                         goto fail;
@@ -923,6 +952,18 @@ int journal_file_verify(
                         goto fail;
                 }
 
+                if ((o->object.flags & OBJECT_COMPRESSED_ZSTD) && !JOURNAL_HEADER_COMPRESSED_ZSTD(f->header)) {
+                        error(p, "ZSTD compressed object in file without ZSTD compression");
+                        r = -EBADMSG;
+                        goto fail;
+                }
+
+                if ((o->object.flags & OBJECT_COMPRESSED_ZSTD_DICTIONARY) && !JOURNAL_HEADER_COMPRESSED_DICTIONARY(f->header)) {
+                        error(p, "Dictionary compressed object in file without compression dictionary");
+                        r = -EBADMSG;
+                        goto fail;
+                }
+
                 switch (o->object.type) {
 
                 case OBJECT_DATA:
@@ -930,6 +971,15 @@ int journal_file_verify(
                         if (r < 0)
                                 goto fail;
 
+                        /* Readers skip the file for matches the
+                         * filter rejects, a false negative would
+                         * hide this object from them */
+                        if (journal_file_bloom_filter_test(f, le64toh(o->data.hash)) == 0) {
+                                error(p, "Data object missing from Bloom filter");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
                         n_data++;
                         break;
 
@@ -1136,6 +1186,40 @@ int journal_file_verify(
                         n_tags ++;
                         break;
 
+                case OBJECT_DICTIONARY:
+                        if (n_dictionaries > 0) {
+                                error(p, "More than one dictionary");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        if (!JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset) ||
+                            le64toh(f->header->dictionary_offset) != p) {
+                                error(p, "Header field for dictionary invalid");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        n_dictionaries++;
+                        break;
+
+                case OBJECT_BLOOM_FILTER:
+                        if (n_bloom_filters > 0) {
+                                error(p, "More than one Bloom filter");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        if (!JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset) ||
+                            le64toh(f->header->bloom_filter_offset) != p) {
+                                error(p, "Header field for Bloom filter invalid");
+                                r = -EBADMSG;
+                                goto fail;
+                        }
+
+                        n_bloom_filters++;
+                        break;
+
                 default:
                         n_weird ++;
                 }
@@ -1154,6 +1238,20 @@ int journal_file_verify(
                 goto fail;
         }
 
+        if (JOURNAL_HEADER_CONTAINS(f->header, dictionary_offset) &&
+            le64toh(f->header->dictionary_offset) != 0 && n_dictionaries == 0) {
+                error(offsetof(Header, dictionary_offset), "Dictionary pointer dead");
+                r = -EBADMSG;
+                goto fail;
+        }
+
+        if (JOURNAL_HEADER_CONTAINS(f->header, bloom_filter_offset) &&
+            le64toh(f->header->bloom_filter_offset) != 0 && n_bloom_filters == 0) {
+                error(offsetof(Header, bloom_filter_offset), "Bloom filter pointer dead");
+                r = -EBADMSG;
+                goto fail;
+        }
+
         if (n_objects != le64toh(f->header->n_objects)) {
                 error(offsetof(Header, n_objects), "Object number mismatch");
                 r = -EBADMSG;
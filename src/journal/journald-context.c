@@ -0,0 +1,237 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#ifdef HAVE_SELINUX
+#include <selinux/selinux.h>
+#endif
+
+#include "alloc-util.h"
+#include "audit-util.h"
+#include "cgroup-util.h"
+#include "hashmap.h"
+#include "journald-context.h"
+#include "process-util.h"
+#include "selinux-util.h"
+#include "string-util.h"
+#include "user-util.h"
+
+/* How many processes to keep metadata around for at max */
+#define CLIENT_CONTEXTS_MAX 1024
+
+/* Whether a process is still the same one is checked for each
+ * message, by comparing its start time and cgroup. Everything else
+ * (which might change through execve() or prctl()) is reread at
+ * least this often. */
+#define CLIENT_CONTEXT_REFRESH_USEC (1*USEC_PER_SEC)
+
+static void client_context_reset(ClientContext *c) {
+        assert(c);
+
+        c->comm = mfree(c->comm);
+        c->exe = mfree(c->exe);
+        c->cmdline = mfree(c->cmdline);
+        c->capeff = mfree(c->capeff);
+
+        c->auditid = AUDIT_SESSION_INVALID;
+        c->loginuid = UID_INVALID;
+
+        c->cgroup = mfree(c->cgroup);
+        c->session = mfree(c->session);
+        c->owner_uid = UID_INVALID;
+        c->unit = mfree(c->unit);
+        c->user_unit = mfree(c->user_unit);
+        c->slice = mfree(c->slice);
+
+        c->label = mfree(c->label);
+}
+
+static void client_context_lru_unlink(Server *s, ClientContext *c) {
+        if (s->client_contexts_lru_tail == c)
+                s->client_contexts_lru_tail = c->lru_prev;
+
+        LIST_REMOVE(lru, s->client_contexts_lru, c);
+}
+
+static void client_context_lru_prepend(Server *s, ClientContext *c) {
+        LIST_PREPEND(lru, s->client_contexts_lru, c);
+
+        if (!c->lru_next)
+                s->client_contexts_lru_tail = c;
+}
+
+static ClientContext* client_context_free(Server *s, ClientContext *c) {
+        assert(s);
+
+        if (!c)
+                return NULL;
+
+        hashmap_remove(s->client_contexts, PID_TO_PTR(c->pid));
+        client_context_lru_unlink(s, c);
+
+        assert(s->n_client_contexts > 0);
+        s->n_client_contexts--;
+
+        client_context_reset(c);
+        free(c);
+
+        return NULL;
+}
+
+static int client_context_new(Server *s, pid_t pid, ClientContext **ret) {
+        ClientContext *c;
+        int r;
+
+        assert(s);
+        assert(pid > 0);
+        assert(ret);
+
+        r = hashmap_ensure_allocated(&s->client_contexts, NULL);
+        if (r < 0)
+                return r;
+
+        /* Make room by dropping the least recently used process */
+        while (s->n_client_contexts >= CLIENT_CONTEXTS_MAX)
+                client_context_free(s, s->client_contexts_lru_tail);
+
+        c = new0(ClientContext, 1);
+        if (!c)
+                return -ENOMEM;
+
+        c->pid = pid;
+        c->auditid = AUDIT_SESSION_INVALID;
+        c->loginuid = UID_INVALID;
+        c->owner_uid = UID_INVALID;
+
+        r = hashmap_put(s->client_contexts, PID_TO_PTR(pid), c);
+        if (r < 0) {
+                free(c);
+                return r;
+        }
+
+        client_context_lru_prepend(s, c);
+        s->n_client_contexts++;
+
+        *ret = c;
+        return 0;
+}
+
+static void client_context_read(Server *s, ClientContext *c, char *cgroup) {
+        assert(s);
+        assert(c);
+
+        /* Takes possession of cgroup. Anything we fail to read stays
+         * unset, like it would be without the cache. */
+
+        client_context_reset(c);
+
+        (void) get_process_comm(c->pid, &c->comm);
+        (void) get_process_exe(c->pid, &c->exe);
+        (void) get_process_cmdline(c->pid, 0, false, &c->cmdline);
+        (void) get_process_capeff(c->pid, &c->capeff);
+
+        (void) audit_session_from_pid(c->pid, &c->auditid);
+        (void) audit_loginuid_from_pid(c->pid, &c->loginuid);
+
+        c->cgroup = cgroup;
+        if (c->cgroup) {
+                (void) cg_path_get_session(c->cgroup, &c->session);
+                (void) cg_path_get_owner_uid(c->cgroup, &c->owner_uid);
+                (void) cg_path_get_unit(c->cgroup, &c->unit);
+                (void) cg_path_get_user_unit(c->cgroup, &c->user_unit);
+                (void) cg_path_get_slice(c->cgroup, &c->slice);
+        }
+
+#ifdef HAVE_SELINUX
+        if (mac_selinux_have()) {
+                security_context_t con;
+
+                if (getpidcon(c->pid, &con) >= 0) {
+                        c->label = strdup(con);
+                        freecon(con);
+                }
+        }
+#endif
+}
+
+int client_context_get(Server *s, pid_t pid, ClientContext **ret) {
+        _cleanup_free_ char *cgroup = NULL;
+        unsigned long long starttime;
+        ClientContext *c;
+        usec_t n;
+        int r;
+
+        assert(s);
+        assert(ret);
+
+        if (pid <= 0)
+                return -EINVAL;
+
+        c = hashmap_get(s->client_contexts, PID_TO_PTR(pid));
+
+        /* Never hand out what we know about a process that is gone:
+         * the PID might have been someone else's back then. */
+        r = get_process_starttime(pid, &starttime);
+        if (r < 0) {
+                client_context_free(s, c);
+                return r;
+        }
+
+        (void) cg_pid_get_path_shifted(pid, s->cgroup_root, &cgroup);
+
+        n = now(CLOCK_MONOTONIC);
+
+        if (c &&
+            c->starttime == starttime &&
+            streq_ptr(c->cgroup, cgroup) &&
+            c->timestamp + CLIENT_CONTEXT_REFRESH_USEC > n) {
+
+                s->n_client_context_hits++;
+
+                client_context_lru_unlink(s, c);
+                client_context_lru_prepend(s, c);
+
+                *ret = c;
+                return 0;
+        }
+
+        s->n_client_context_misses++;
+
+        if (!c) {
+                r = client_context_new(s, pid, &c);
+                if (r < 0)
+                        return r;
+        }
+
+        c->starttime = starttime;
+        c->timestamp = n;
+        client_context_read(s, c, cgroup);
+        cgroup = NULL;
+
+        *ret = c;
+        return 0;
+}
+
+void client_context_flush_all(Server *s) {
+        assert(s);
+
+        while (s->client_contexts_lru)
+                client_context_free(s, s->client_contexts_lru);
+
+        s->client_contexts = hashmap_free(s->client_contexts);
+}
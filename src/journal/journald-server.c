@@ -52,6 +52,7 @@
 #include "journal-internal.h"
 #include "journal-vacuum.h"
 #include "journald-audit.h"
+#include "journald-context.h"
 #include "journald-kmsg.h"
 #include "journald-native.h"
 #include "journald-rate-limit.h"
@@ -82,6 +83,10 @@
 
 #define NOTIFY_SNDBUF_SIZE (8*1024*1024)
 
+/* How often to trigger IN_MODIFY for readers at most, while we keep
+ * appending to a journal file */
+#define POST_CHANGE_TIMER_INTERVAL_USEC (250*USEC_PER_MSEC)
+
 static int determine_space_for(
                 Server *s,
                 JournalMetrics *metrics,
@@ -220,6 +225,44 @@ static void server_add_acls(JournalFile *f, uid_t uid) {
 #endif
 }
 
+static int open_journal(
+                Server *s,
+                bool reliably,
+                const char *fname,
+                int flags,
+                bool seal,
+                JournalMetrics *metrics,
+                JournalFile **ret) {
+        int r;
+        JournalFile *f;
+
+        assert(s);
+        assert(fname);
+        assert(ret);
+
+        if (reliably)
+                r = journal_file_open_reliably(fname, flags, 0640, s->compress, seal, metrics, s->mmap, NULL, &f);
+        else
+                r = journal_file_open(fname, flags, 0640, s->compress, seal, metrics, s->mmap, NULL, &f);
+        if (r < 0)
+                return r;
+
+        if (s->compress && s->compress_dictionary) {
+                r = journal_file_enable_dictionary(f);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to enable compression dictionary for %s, ignoring: %m", f->path);
+        }
+
+        r = journal_file_enable_post_change_timer(f, s->event, POST_CHANGE_TIMER_INTERVAL_USEC);
+        if (r < 0) {
+                journal_file_close(f);
+                return r;
+        }
+
+        *ret = f;
+        return r;
+}
+
 static JournalFile* find_journal(Server *s, uid_t uid) {
         _cleanup_free_ char *p = NULL;
         int r;
@@ -258,7 +301,7 @@ static JournalFile* find_journal(Server *s, uid_t uid) {
                 journal_file_close(f);
         }
 
-        r = journal_file_open_reliably(p, O_RDWR|O_CREAT, 0640, s->compress, s->seal, &s->system_metrics, s->mmap, NULL, &f);
+        r = open_journal(s, true, p, O_RDWR|O_CREAT, s->seal, &s->system_metrics, &f);
         if (r < 0)
                 return s->system_journal;
 
@@ -286,16 +329,23 @@ static int do_rotate(
         if (!*f)
                 return -EINVAL;
 
-        r = journal_file_rotate(f, s->compress, seal);
-        if (r < 0)
+        r = journal_file_rotate(f, s->compress, seal, s->deferred_closes);
+        if (r < 0) {
                 if (*f)
                         log_error_errno(r, "Failed to rotate %s: %m", (*f)->path);
                 else
                         log_error_errno(r, "Failed to create new %s journal: %m", name);
-        else
-                server_add_acls(*f, uid);
 
-        return r;
+                return r;
+        }
+
+        server_add_acls(*f, uid);
+
+        r = journal_file_enable_post_change_timer(*f, s->event, POST_CHANGE_TIMER_INTERVAL_USEC);
+        if (r < 0)
+                log_warning_errno(r, "Failed to enable post change timer on %s, ignoring: %m", (*f)->path);
+
+        return 0;
 }
 
 void server_rotate(Server *s) {
@@ -319,23 +369,38 @@ void server_rotate(Server *s) {
         }
 }
 
-void server_sync(Server *s) {
+void server_sync(Server *s, bool wait) {
         JournalFile *f;
         Iterator i;
         int r;
 
+        if (s->n_audit_overruns > 0) {
+                server_driver_message(s, SD_MESSAGE_JOURNAL_MISSED,
+                                      "Audit socket overran %u times, audit messages have been lost",
+                                      s->n_audit_overruns);
+                s->n_audit_overruns = 0;
+        }
+
+        /* Unless asked to wait, the actual syncing happens in a
+         * thread, so that a slow disk doesn't hold up logging */
+
         if (s->system_journal) {
-                r = journal_file_set_offline(s->system_journal);
+                r = journal_file_set_offline(s->system_journal, wait);
                 if (r < 0)
                         log_warning_errno(r, "Failed to sync system journal, ignoring: %m");
         }
 
         ORDERED_HASHMAP_FOREACH(f, s->user_journals, i) {
-                r = journal_file_set_offline(f);
+                r = journal_file_set_offline(f, wait);
                 if (r < 0)
                         log_warning_errno(r, "Failed to sync user journal, ignoring: %m");
         }
 
+        /* Archiving rotated files includes adding their Bloom
+         * filter, which is left to this point so that it doesn't
+         * hold up the logging that triggered the rotation */
+        journal_file_close_set(s->deferred_closes);
+
         if (s->sync_event_source) {
                 r = sd_event_source_set_enabled(s->sync_event_source, SD_EVENT_OFF);
                 if (r < 0)
@@ -547,6 +612,7 @@ static void dispatch_message_real(
         char *t, *c;
         uid_t realuid = 0, owner = 0, journal_uid;
         bool owner_valid = false;
+        ClientContext *context = NULL;
 #ifdef HAVE_AUDIT
         char    audit_session[sizeof("_AUDIT_SESSION=") + DECIMAL_STR_MAX(uint32_t)],
                 audit_loginuid[sizeof("_AUDIT_LOGINUID=") + DECIMAL_STR_MAX(uid_t)],
@@ -574,94 +640,78 @@ static void dispatch_message_real(
                 sprintf(gid, "_GID="GID_FMT, ucred->gid);
                 IOVEC_SET_STRING(iovec[n++], gid);
 
-                r = get_process_comm(ucred->pid, &t);
+                r = client_context_get(s, ucred->pid, &context);
                 if (r >= 0) {
-                        x = strjoina("_COMM=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
+                        if (context->comm) {
+                                x = strjoina("_COMM=", context->comm);
+                                IOVEC_SET_STRING(iovec[n++], x);
+                        }
 
-                r = get_process_exe(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strjoina("_EXE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
+                        if (context->exe) {
+                                x = strjoina("_EXE=", context->exe);
+                                IOVEC_SET_STRING(iovec[n++], x);
+                        }
 
-                r = get_process_cmdline(ucred->pid, 0, false, &t);
-                if (r >= 0) {
-                        x = strjoina("_CMDLINE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
+                        if (context->cmdline) {
+                                x = strjoina("_CMDLINE=", context->cmdline);
+                                IOVEC_SET_STRING(iovec[n++], x);
+                        }
 
-                r = get_process_capeff(ucred->pid, &t);
-                if (r >= 0) {
-                        x = strjoina("_CAP_EFFECTIVE=", t);
-                        free(t);
-                        IOVEC_SET_STRING(iovec[n++], x);
-                }
+                        if (context->capeff) {
+                                x = strjoina("_CAP_EFFECTIVE=", context->capeff);
+                                IOVEC_SET_STRING(iovec[n++], x);
+                        }
 
 #ifdef HAVE_AUDIT
-                r = audit_session_from_pid(ucred->pid, &audit);
-                if (r >= 0) {
-                        sprintf(audit_session, "_AUDIT_SESSION=%"PRIu32, audit);
-                        IOVEC_SET_STRING(iovec[n++], audit_session);
-                }
+                        if (context->auditid != AUDIT_SESSION_INVALID) {
+                                sprintf(audit_session, "_AUDIT_SESSION=%"PRIu32, context->auditid);
+                                IOVEC_SET_STRING(iovec[n++], audit_session);
+                        }
 
-                r = audit_loginuid_from_pid(ucred->pid, &loginuid);
-                if (r >= 0) {
-                        sprintf(audit_loginuid, "_AUDIT_LOGINUID="UID_FMT, loginuid);
-                        IOVEC_SET_STRING(iovec[n++], audit_loginuid);
-                }
+                        if (uid_is_valid(context->loginuid)) {
+                                sprintf(audit_loginuid, "_AUDIT_LOGINUID="UID_FMT, context->loginuid);
+                                IOVEC_SET_STRING(iovec[n++], audit_loginuid);
+                        }
 #endif
+                }
 
-                r = cg_pid_get_path_shifted(ucred->pid, s->cgroup_root, &c);
-                if (r >= 0) {
-                        char *session = NULL;
-
-                        x = strjoina("_SYSTEMD_CGROUP=", c);
+                if (context && context->cgroup) {
+                        x = strjoina("_SYSTEMD_CGROUP=", context->cgroup);
                         IOVEC_SET_STRING(iovec[n++], x);
 
-                        r = cg_path_get_session(c, &t);
-                        if (r >= 0) {
-                                session = strjoina("_SYSTEMD_SESSION=", t);
-                                free(t);
-                                IOVEC_SET_STRING(iovec[n++], session);
+                        if (context->session) {
+                                x = strjoina("_SYSTEMD_SESSION=", context->session);
+                                IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_owner_uid(c, &owner) >= 0) {
+                        if (uid_is_valid(context->owner_uid)) {
+                                owner = context->owner_uid;
                                 owner_valid = true;
 
                                 sprintf(owner_uid, "_SYSTEMD_OWNER_UID="UID_FMT, owner);
                                 IOVEC_SET_STRING(iovec[n++], owner_uid);
                         }
 
-                        if (cg_path_get_unit(c, &t) >= 0) {
-                                x = strjoina("_SYSTEMD_UNIT=", t);
-                                free(t);
+                        if (context->unit) {
+                                x = strjoina("_SYSTEMD_UNIT=", context->unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
-                        } else if (unit_id && !session) {
+                        } else if (unit_id && !context->session) {
                                 x = strjoina("_SYSTEMD_UNIT=", unit_id);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_user_unit(c, &t) >= 0) {
-                                x = strjoina("_SYSTEMD_USER_UNIT=", t);
-                                free(t);
+                        if (context->user_unit) {
+                                x = strjoina("_SYSTEMD_USER_UNIT=", context->user_unit);
                                 IOVEC_SET_STRING(iovec[n++], x);
-                        } else if (unit_id && session) {
+                        } else if (unit_id && context->session) {
                                 x = strjoina("_SYSTEMD_USER_UNIT=", unit_id);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
 
-                        if (cg_path_get_slice(c, &t) >= 0) {
-                                x = strjoina("_SYSTEMD_SLICE=", t);
-                                free(t);
+                        if (context->slice) {
+                                x = strjoina("_SYSTEMD_SLICE=", context->slice);
                                 IOVEC_SET_STRING(iovec[n++], x);
                         }
-
-                        free(c);
                 } else if (unit_id) {
                         x = strjoina("_SYSTEMD_UNIT=", unit_id);
                         IOVEC_SET_STRING(iovec[n++], x);
@@ -674,15 +724,9 @@ static void dispatch_message_real(
 
                                 *((char*) mempcpy(stpcpy(x, "_SELINUX_CONTEXT="), label, label_len)) = 0;
                                 IOVEC_SET_STRING(iovec[n++], x);
-                        } else {
-                                security_context_t con;
-
-                                if (getpidcon(ucred->pid, &con) >= 0) {
-                                        x = strjoina("_SELINUX_CONTEXT=", con);
-
-                                        freecon(con);
-                                        IOVEC_SET_STRING(iovec[n++], x);
-                                }
+                        } else if (context && context->label) {
+                                x = strjoina("_SELINUX_CONTEXT=", context->label);
+                                IOVEC_SET_STRING(iovec[n++], x);
                         }
                 }
 #endif
@@ -930,7 +974,7 @@ static int system_journal_open(Server *s, bool flush_requested) {
                 (void) mkdir(fn, 0755);
 
                 fn = strjoina(fn, "/system.journal");
-                r = journal_file_open_reliably(fn, O_RDWR|O_CREAT, 0640, s->compress, s->seal, &s->system_metrics, s->mmap, NULL, &s->system_journal);
+                r = open_journal(s, true, fn, O_RDWR|O_CREAT, s->seal, &s->system_metrics, &s->system_journal);
                 if (r >= 0) {
                         server_add_acls(s->system_journal, 0);
                         (void) determine_space_for(s, &s->system_metrics, "/var/log/journal/", "System journal", true, true, NULL, NULL);
@@ -953,7 +997,7 @@ static int system_journal_open(Server *s, bool flush_requested) {
                          * if it already exists, so that we can flush
                          * it into the system journal */
 
-                        r = journal_file_open(fn, O_RDWR, 0640, s->compress, false, &s->runtime_metrics, s->mmap, NULL, &s->runtime_journal);
+                        r = open_journal(s, false, fn, O_RDWR, false, &s->runtime_metrics, &s->runtime_journal);
                         if (r < 0) {
                                 if (r != -ENOENT)
                                         log_warning_errno(r, "Failed to open runtime journal: %m");
@@ -970,7 +1014,7 @@ static int system_journal_open(Server *s, bool flush_requested) {
                         (void) mkdir("/run/log/journal", 0755);
                         (void) mkdir_parents(fn, 0750);
 
-                        r = journal_file_open_reliably(fn, O_RDWR|O_CREAT, 0640, s->compress, false, &s->runtime_metrics, s->mmap, NULL, &s->runtime_journal);
+                        r = open_journal(s, true, fn, O_RDWR|O_CREAT, false, &s->runtime_metrics, &s->runtime_journal);
                         if (r < 0)
                                 return log_error_errno(r, "Failed to open runtime journal: %m");
                 }
@@ -1146,6 +1190,14 @@ int server_process_datagram(sd_event_source *es, int fd, uint32_t revents, void
                 if (errno == EINTR || errno == EAGAIN)
                         return 0;
 
+                /* The kernel had to drop audit messages as we
+                 * didn't keep up. Take note, but don't give up on
+                 * the socket. */
+                if (errno == ENOBUFS && fd == s->audit_fd) {
+                        s->n_audit_overruns++;
+                        return 0;
+                }
+
                 return log_error_errno(errno, "recvmsg() failed: %m");
         }
 
@@ -1209,7 +1261,7 @@ static int dispatch_sigusr1(sd_event_source *es, const struct signalfd_siginfo *
         log_info("Received request to flush runtime journal from PID " PID_FMT, si->ssi_pid);
 
         server_flush_to_var(s);
-        server_sync(s);
+        server_sync(s, true);
         server_vacuum(s, false, false);
 
         r = touch("/run/systemd/journal/flushed");
@@ -1255,8 +1307,10 @@ static int dispatch_sigrtmin1(sd_event_source *es, const struct signalfd_siginfo
         assert(s);
 
         log_debug("Received request to sync from PID " PID_FMT, si->ssi_pid);
+        log_debug("Client metadata cache: %u processes, %"PRIu64" hits, %"PRIu64" misses.",
+                  s->n_client_contexts, s->n_client_context_hits, s->n_client_context_misses);
 
-        server_sync(s);
+        server_sync(s, true);
 
         /* Let clients know when the most recent sync happened. */
         r = write_timestamp_file_atomic("/run/systemd/journal/synced", now(CLOCK_MONOTONIC));
@@ -1386,7 +1440,7 @@ static int server_dispatch_sync(sd_event_source *es, usec_t t, void *userdata) {
 
         assert(s);
 
-        server_sync(s);
+        server_sync(s, false);
         return 0;
 }
 
@@ -1397,7 +1451,7 @@ int server_schedule_sync(Server *s, int priority) {
 
         if (priority <= LOG_CRIT) {
                 /* Immediately sync to disk when this is of priority CRIT, ALERT, EMERG */
-                server_sync(s);
+                server_sync(s, true);
                 return 0;
         }
 
@@ -1690,6 +1744,10 @@ int server_init(Server *s) {
         if (!s->user_journals)
                 return log_oom();
 
+        s->deferred_closes = set_new(NULL);
+        if (!s->deferred_closes)
+                return log_oom();
+
         s->mmap = mmap_cache_new();
         if (!s->mmap)
                 return log_oom();
@@ -1698,6 +1756,10 @@ int server_init(Server *s) {
         if (r < 0)
                 return log_error_errno(r, "Failed to create event loop: %m");
 
+        /* Many stdout streams tend to be ready at the same time, don't
+         * poll again for each of them */
+        (void) sd_event_set_dispatch_batch(s->event, true);
+
         n = sd_listen_fds(true);
         if (n < 0)
                 return log_error_errno(n, "Failed to read listening file descriptors from environment: %m");
@@ -1850,6 +1912,11 @@ void server_done(Server *s) {
         while (s->stdout_streams)
                 stdout_stream_free(s->stdout_streams);
 
+        if (s->deferred_closes) {
+                journal_file_close_set(s->deferred_closes);
+                set_free(s->deferred_closes);
+        }
+
         if (s->system_journal)
                 journal_file_close(s->system_journal);
 
@@ -1888,6 +1955,8 @@ void server_done(Server *s) {
         if (s->rate_limit)
                 journal_rate_limit_free(s->rate_limit);
 
+        client_context_flush_all(s);
+
         if (s->kernel_seqnum)
                 munmap(s->kernel_seqnum, sizeof(uint64_t));
 
@@ -30,6 +30,7 @@ typedef struct Server Server;
 
 #include "hashmap.h"
 #include "journal-file.h"
+#include "journald-context.h"
 #include "journald-rate-limit.h"
 #include "journald-stream.h"
 #include "list.h"
@@ -81,6 +82,9 @@ struct Server {
         JournalFile *system_journal;
         OrderedHashmap *user_journals;
 
+        /* Rotated files that are yet to be archived and closed */
+        Set *deferred_closes;
+
         uint64_t seqnum;
 
         char *buffer;
@@ -95,6 +99,7 @@ struct Server {
         JournalMetrics system_metrics;
 
         bool compress;
+        bool compress_dictionary;
         bool seal;
 
         bool forward_to_kmsg;
@@ -105,6 +110,9 @@ struct Server {
         unsigned n_forward_syslog_missed;
         usec_t last_warn_forward_syslog_missed;
 
+        /* How often the audit socket overran since we last told */
+        unsigned n_audit_overruns;
+
         uint64_t cached_space_available;
         uint64_t cached_space_limit;
         usec_t cached_space_timestamp;
@@ -148,6 +156,14 @@ struct Server {
         /* Cached cgroup root, so that we don't have to query that all the time */
         char *cgroup_root;
 
+        /* Cached metadata of logging processes, most recently used first */
+        Hashmap *client_contexts;
+        LIST_HEAD(ClientContext, client_contexts_lru);
+        ClientContext *client_contexts_lru_tail;
+        unsigned n_client_contexts;
+        uint64_t n_client_context_hits;
+        uint64_t n_client_context_misses;
+
         usec_t watchdog_usec;
 };
 
@@ -176,7 +192,7 @@ SplitMode split_mode_from_string(const char *s) _pure_;
 
 int server_init(Server *s);
 void server_done(Server *s);
-void server_sync(Server *s);
+void server_sync(Server *s, bool wait);
 int server_vacuum(Server *s, bool verbose, bool patch_min_use);
 void server_rotate(Server *s);
 int server_schedule_sync(Server *s, int priority);
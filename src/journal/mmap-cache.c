@@ -69,6 +69,13 @@ struct FileDescriptor {
         MMapCache *cache;
         int fd;
         bool sigbus;
+
+        /* Access pattern tracking, used to size new windows */
+        bool sequential;
+        uint64_t window_size;
+        uint64_t last_window_offset;
+        uint64_t last_window_end;
+
         LIST_HEAD(Window, windows);
 };
 
@@ -76,8 +83,10 @@ struct MMapCache {
         int n_ref;
         unsigned n_windows;
 
-        unsigned n_hit, n_missed;
+        unsigned n_hit, n_missed, n_evicted;
 
+        uint64_t mapped_size;
+        uint64_t budget;
 
         Hashmap *fds;
         Context *contexts[MMAP_CACHE_MAX_CONTEXTS];
@@ -86,15 +95,22 @@ struct MMapCache {
         Window *last_unused;
 };
 
-#define WINDOWS_MIN 64
-
 #ifdef ENABLE_DEBUG_MMAP_CACHE
 /* Tiny windows increase mmap activity and the chance of exposing unsafe use. */
 # define WINDOW_SIZE (page_size())
+# define WINDOW_SIZE_MIN (page_size())
+# define WINDOW_SIZE_MAX (page_size())
 #else
 # define WINDOW_SIZE (8ULL*1024ULL*1024ULL)
+# define WINDOW_SIZE_MIN (1ULL*1024ULL*1024ULL)
+# define WINDOW_SIZE_MAX (64ULL*1024ULL*1024ULL)
 #endif
 
+/* How much address space we keep mapped before we start recycling
+ * unused windows. This corresponds to the 64 windows of the default
+ * size we used to keep around at minimum. */
+#define MAPPED_BUDGET_DEFAULT (64ULL*WINDOW_SIZE)
+
 MMapCache* mmap_cache_new(void) {
         MMapCache *m;
 
@@ -103,6 +119,7 @@ MMapCache* mmap_cache_new(void) {
                 return NULL;
 
         m->n_ref = 1;
+        m->budget = MAPPED_BUDGET_DEFAULT;
         return m;
 }
 
@@ -119,9 +136,13 @@ static void window_unlink(Window *w) {
 
         assert(w);
 
-        if (w->ptr)
+        if (w->ptr) {
                 munmap(w->ptr, w->size);
 
+                assert(w->cache->mapped_size >= w->size);
+                w->cache->mapped_size -= w->size;
+        }
+
         if (w->fd)
                 LIST_REMOVE(by_fd, w->fd->windows, w);
 
@@ -179,7 +200,7 @@ static Window *window_add(MMapCache *m) {
 
         assert(m);
 
-        if (!m->last_unused || m->n_windows <= WINDOWS_MIN) {
+        if (!m->last_unused || m->mapped_size <= m->budget) {
 
                 /* Allocate a new window */
                 w = new0(Window, 1);
@@ -192,6 +213,15 @@ static Window *window_add(MMapCache *m) {
                 w = m->last_unused;
                 window_unlink(w);
                 zero(*w);
+                m->n_evicted++;
+
+                /* If the windows we map are larger than those we
+                 * recycle, drop more unused ones until we are within
+                 * our budget again. */
+                while (m->last_unused && m->mapped_size > m->budget) {
+                        window_free(m->last_unused);
+                        m->n_evicted++;
+                }
         }
 
         w->cache = m;
@@ -316,6 +346,7 @@ static FileDescriptor* fd_add(MMapCache *m, int fd) {
 
         f->cache = m;
         f->fd = fd;
+        f->window_size = WINDOW_SIZE;
 
         r = hashmap_put(m->fds, FD_TO_PTR(fd), f);
         if (r < 0) {
@@ -368,9 +399,32 @@ static int make_room(MMapCache *m) {
                 return 0;
 
         window_free(m->last_unused);
+        m->n_evicted++;
         return 1;
 }
 
+static void fd_update_access_pattern(FileDescriptor *f, uint64_t offset) {
+        assert(f);
+
+        /* Adjust the size of the next window we map for this file
+         * to how it is accessed: when we continue at or right after
+         * the end of the previous window, the caller is most likely
+         * scanning forward, hence grow the windows. If we jump around
+         * (for example when bisecting an entry array), shrink them
+         * again, so that we don't map large regions we never look
+         * at. */
+
+        if (f->last_window_end > 0 &&
+            offset >= f->last_window_offset &&
+            offset < f->last_window_end + f->window_size) {
+                f->sequential = true;
+                f->window_size = MIN(f->window_size * 2, WINDOW_SIZE_MAX);
+        } else {
+                f->sequential = false;
+                f->window_size = MAX(f->window_size / 2, WINDOW_SIZE_MIN);
+        }
+}
+
 static int try_context(
                 MMapCache *m,
                 int fd,
@@ -484,21 +538,33 @@ static int add_mmap(
         assert(size > 0);
         assert(ret);
 
+        f = fd_add(m, fd);
+        if (!f)
+                return -ENOMEM;
+
+        fd_update_access_pattern(f, offset);
+
         woffset = offset & ~((uint64_t) page_size() - 1ULL);
         wsize = size + (offset - woffset);
         wsize = PAGE_ALIGN(wsize);
 
-        if (wsize < WINDOW_SIZE) {
+        if (wsize < f->window_size) {
                 uint64_t delta;
 
-                delta = PAGE_ALIGN((WINDOW_SIZE - wsize) / 2);
+                /* When reading sequentially, map ahead of the
+                 * requested offset only, otherwise center the window
+                 * around it. */
+                if (f->sequential)
+                        delta = 0;
+                else
+                        delta = PAGE_ALIGN((f->window_size - wsize) / 2);
 
                 if (delta > offset)
                         woffset = 0;
                 else
                         woffset -= delta;
 
-                wsize = WINDOW_SIZE;
+                wsize = f->window_size;
         }
 
         if (st) {
@@ -527,14 +593,15 @@ static int add_mmap(
                         return -ENOMEM;
         }
 
+        if (f->sequential) {
+                (void) madvise(d, wsize, MADV_SEQUENTIAL);
+                (void) madvise(d, wsize, MADV_WILLNEED);
+        }
+
         c = context_add(m, context);
         if (!c)
                 goto outofmem;
 
-        f = fd_add(m, fd);
-        if (!f)
-                goto outofmem;
-
         w = window_add(m);
         if (!w)
                 goto outofmem;
@@ -546,6 +613,10 @@ static int add_mmap(
         w->size = wsize;
         w->fd = f;
 
+        m->mapped_size += wsize;
+        f->last_window_offset = woffset;
+        f->last_window_end = woffset + wsize;
+
         LIST_PREPEND(by_fd, f->windows, w);
 
         context_detach_window(c);
@@ -612,6 +683,24 @@ unsigned mmap_cache_get_missed(MMapCache *m) {
         return m->n_missed;
 }
 
+unsigned mmap_cache_get_evicted(MMapCache *m) {
+        assert(m);
+
+        return m->n_evicted;
+}
+
+uint64_t mmap_cache_get_mapped_size(MMapCache *m) {
+        assert(m);
+
+        return m->mapped_size;
+}
+
+void mmap_cache_set_budget(MMapCache *m, uint64_t budget) {
+        assert(m);
+
+        m->budget = budget;
+}
+
 static void mmap_cache_process_sigbus(MMapCache *m) {
         bool found = false;
         FileDescriptor *f;
@@ -25,7 +25,7 @@
 #include <sys/stat.h>
 
 /* One context per object type, plus one of the header, plus one "additional" one */
-#define MMAP_CACHE_MAX_CONTEXTS 9
+#define MMAP_CACHE_MAX_CONTEXTS 11
 
 typedef struct MMapCache MMapCache;
 
@@ -47,5 +47,9 @@ void mmap_cache_close_fd(MMapCache *m, int fd);
 
 unsigned mmap_cache_get_hit(MMapCache *m);
 unsigned mmap_cache_get_missed(MMapCache *m);
+unsigned mmap_cache_get_evicted(MMapCache *m);
+uint64_t mmap_cache_get_mapped_size(MMapCache *m);
+
+void mmap_cache_set_budget(MMapCache *m, uint64_t budget);
 
 bool mmap_cache_got_sigbus(MMapCache *m, int fd);
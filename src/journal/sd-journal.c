@@ -47,6 +47,7 @@
 #include "list.h"
 #include "lookup3.h"
 #include "missing.h"
+#include "parse-util.h"
 #include "path-util.h"
 #include "replace-var.h"
 #include "stat-util.h"
@@ -123,6 +124,7 @@ static void detach_location(sd_journal *j) {
 
         j->current_file = NULL;
         j->current_field = 0;
+        j->files_by_location_valid = false;
 
         ORDERED_HASHMAP_FOREACH(f, j->files, i)
                 journal_file_reset_location(f);
@@ -692,6 +694,79 @@ static int find_location_for_match(
         }
 }
 
+static bool file_may_contain_match(JournalFile *f, Match *m) {
+        Match *i;
+
+        assert(f);
+        assert(m);
+
+        /* Consults the Bloom filter of the file, without touching its
+         * hash tables. Errors are treated as "maybe", the real lookup
+         * will deal with them. */
+
+        switch (m->type) {
+
+        case MATCH_DISCRETE:
+                return journal_file_bloom_filter_test(f, le64toh(m->le_hash)) != 0;
+
+        case MATCH_OR_TERM:
+                if (!m->matches)
+                        return true;
+
+                LIST_FOREACH(matches, i, m->matches)
+                        if (file_may_contain_match(f, i))
+                                return true;
+
+                return false;
+
+        case MATCH_AND_TERM:
+                LIST_FOREACH(matches, i, m->matches)
+                        if (!file_may_contain_match(f, i))
+                                return false;
+
+                return true;
+
+        default:
+                assert_not_reached("Unknown match type");
+        }
+}
+
+static bool file_may_contain_location(sd_journal *j, JournalFile *f, direction_t direction) {
+        Location *l;
+
+        assert(j);
+        assert(f);
+
+        /* Check the header of the file whether it can contain any
+         * entries beyond the location we are seeking to, so that we
+         * don't have to look into the hash table and bisect the entry
+         * arrays of files that cover a different time range. This
+         * follows the same order of checks as the seeking logic
+         * below. Note that, just like the bisection, this assumes
+         * that the entries of a file are ordered by their timestamps
+         * and sequence numbers. */
+
+        l = &j->current_location;
+
+        if (IN_SET(l->type, LOCATION_HEAD, LOCATION_TAIL))
+                return true;
+
+        if (l->seqnum_set && sd_id128_equal(l->seqnum_id, f->header->seqnum_id))
+                return direction == DIRECTION_DOWN ?
+                        le64toh(f->header->tail_entry_seqnum) >= l->seqnum :
+                        le64toh(f->header->head_entry_seqnum) <= l->seqnum;
+
+        if (l->monotonic_set)
+                return true;
+
+        if (l->realtime_set)
+                return direction == DIRECTION_DOWN ?
+                        le64toh(f->header->tail_entry_realtime) >= l->realtime :
+                        le64toh(f->header->head_entry_realtime) <= l->realtime;
+
+        return true;
+}
+
 static int find_location_with_matches(
                 sd_journal *j,
                 JournalFile *f,
@@ -706,6 +781,9 @@ static int find_location_with_matches(
         assert(ret);
         assert(offset);
 
+        if (!file_may_contain_location(j, f, direction))
+                return 0;
+
         if (!j->level0) {
                 /* No matches is simple */
 
@@ -724,8 +802,12 @@ static int find_location_with_matches(
                         return journal_file_move_to_entry_by_realtime(f, j->current_location.realtime, direction, ret, offset);
 
                 return journal_file_next_entry(f, 0, direction, ret, offset);
-        } else
+        } else {
+                if (!file_may_contain_match(f, j->level0))
+                        return 0;
+
                 return find_location_for_match(j, j->level0, f, direction, ret, offset);
+        }
 }
 
 static int next_with_matches(
@@ -821,42 +903,169 @@ static int next_beyond_location(sd_journal *j, JournalFile *f, direction_t direc
         }
 }
 
-static int real_journal_next(sd_journal *j, direction_t direction) {
-        JournalFile *f, *new_file = NULL;
+static int file_location_compare_down(const void *a, const void *b) {
+        return journal_file_compare_locations((JournalFile*) a, (JournalFile*) b);
+}
+
+static int file_location_compare_up(const void *a, const void *b) {
+        return journal_file_compare_locations((JournalFile*) b, (JournalFile*) a);
+}
+
+static void forget_file_location(sd_journal *j, JournalFile *f) {
+        assert(j);
+        assert(f);
+
+        if (f->location_prioq_idx != PRIOQ_IDX_NULL) {
+                prioq_remove(j->files_by_location, f, &f->location_prioq_idx);
+                f->location_prioq_idx = PRIOQ_IDX_NULL;
+        }
+
+        set_remove(j->files_exhausted, f);
+}
+
+static int update_file_location(sd_journal *j, JournalFile *f, direction_t direction) {
+        int r;
+
+        assert(j);
+        assert(f);
+
+        /* Moves f to the next entry beyond the current location, and
+         * files it accordingly in the priority queue or the set of
+         * exhausted files. */
+
+        r = next_beyond_location(j, f, direction);
+        if (r < 0) {
+                log_debug_errno(r, "Can't iterate through %s, ignoring: %m", f->path);
+                remove_file_real(j, f);
+                return 0;
+        }
+        if (r == 0) {
+                f->location_type = LOCATION_TAIL;
+
+                /* prioq_remove() leaves the index alone, reset it
+                 * so that we put the file back in later on */
+                if (f->location_prioq_idx != PRIOQ_IDX_NULL) {
+                        prioq_remove(j->files_by_location, f, &f->location_prioq_idx);
+                        f->location_prioq_idx = PRIOQ_IDX_NULL;
+                }
+
+                /* Archived files will never grow, no need to look at
+                 * them again until we seek elsewhere. Offline ones
+                 * might, journald offlines its active files on every
+                 * sync. */
+                if (f->header->state != STATE_ARCHIVED)
+                        return set_put(j->files_exhausted, f);
+
+                return 0;
+        }
+
+        set_remove(j->files_exhausted, f);
+
+        if (f->location_prioq_idx != PRIOQ_IDX_NULL)
+                return prioq_reshuffle(j->files_by_location, f, &f->location_prioq_idx);
+
+        return prioq_put(j->files_by_location, f, &f->location_prioq_idx);
+}
+
+static int rebuild_files_by_location(sd_journal *j, direction_t direction) {
+        JournalFile *f;
         Iterator i;
-        Object *o;
         int r;
 
-        assert_return(j, -EINVAL);
-        assert_return(!journal_pid_changed(j), -ECHILD);
+        assert(j);
+
+        j->files_by_location = prioq_free(j->files_by_location);
+        j->files_by_location = prioq_new(direction == DIRECTION_DOWN ? file_location_compare_down : file_location_compare_up);
+        if (!j->files_by_location)
+                return -ENOMEM;
+
+        r = set_ensure_allocated(&j->files_exhausted, NULL);
+        if (r < 0)
+                return r;
+
+        set_clear(j->files_exhausted);
+
+        ORDERED_HASHMAP_FOREACH(f, j->files, i)
+                f->location_prioq_idx = PRIOQ_IDX_NULL;
 
         ORDERED_HASHMAP_FOREACH(f, j->files, i) {
-                bool found;
+                r = update_file_location(j, f, direction);
+                if (r < 0)
+                        return r;
+        }
 
-                r = next_beyond_location(j, f, direction);
-                if (r < 0) {
-                        log_debug_errno(r, "Can't iterate through %s, ignoring: %m", f->path);
-                        remove_file_real(j, f);
-                        continue;
-                } else if (r == 0) {
-                        f->location_type = LOCATION_TAIL;
-                        continue;
-                }
+        j->files_by_location_direction = direction;
+        j->files_by_location_valid = true;
 
-                if (!new_file)
-                        found = true;
-                else {
-                        int k;
+        return 0;
+}
 
-                        k = journal_file_compare_locations(f, new_file);
+static int advance_files_by_location(sd_journal *j, direction_t direction) {
+        JournalFile *f;
+        Iterator i;
+        int r;
 
-                        found = direction == DIRECTION_DOWN ? k < 0 : k > 0;
-                }
+        assert(j);
+        assert(j->current_file);
 
-                if (found)
-                        new_file = f;
+        /* Only the file whose entry we returned last moved, all other
+         * files still point to their candidate entry. Hence advance
+         * that one, and recheck the online files that ran dry
+         * earlier. */
+
+        r = update_file_location(j, j->current_file, direction);
+        if (r < 0)
+                return r;
+
+        SET_FOREACH(f, j->files_exhausted, i) {
+                r = update_file_location(j, f, direction);
+                if (r < 0)
+                        return r;
+        }
+
+        /* Now skip over entries that also exist in the file we just
+         * returned an entry from. */
+        while ((f = prioq_peek(j->files_by_location))) {
+                if (j->current_location.type != LOCATION_DISCRETE)
+                        break;
+
+                r = compare_with_location(f, &j->current_location);
+                if (direction == DIRECTION_DOWN ? r > 0 : r < 0)
+                        break;
+
+                r = update_file_location(j, f, direction);
+                if (r < 0)
+                        return r;
+        }
+
+        return 0;
+}
+
+static int real_journal_next(sd_journal *j, direction_t direction) {
+        JournalFile *new_file;
+        Object *o;
+        int r;
+
+        assert_return(j, -EINVAL);
+        assert_return(!journal_pid_changed(j), -ECHILD);
+
+        /* Instead of comparing the candidate entries of all files on
+         * each step, keep the files in a priority queue ordered by
+         * their candidate entry, and only move the file we took the
+         * last entry from. */
+
+        if (j->files_by_location_valid &&
+            j->files_by_location_direction == direction &&
+            j->current_file)
+                r = advance_files_by_location(j, direction);
+        else
+                r = rebuild_files_by_location(j, direction);
+        if (r < 0) {
+                j->files_by_location_valid = false;
+                return r;
         }
 
+        new_file = prioq_peek(j->files_by_location);
         if (!new_file)
                 return 0;
 
@@ -1258,12 +1467,16 @@ static int add_any_file(sd_journal *j, const char *path) {
 
         /* journal_file_dump(f); */
 
+        f->location_prioq_idx = PRIOQ_IDX_NULL;
+
         r = ordered_hashmap_put(j->files, f->path, f);
         if (r < 0) {
                 journal_file_close(f);
                 goto fail;
         }
 
+        j->files_by_location_valid = false;
+
         log_debug("File %s added.", f->path);
 
         check_network(j, f->fd);
@@ -1317,6 +1530,9 @@ static void remove_file_real(sd_journal *j, JournalFile *f) {
 
         ordered_hashmap_remove(j->files, f->path);
 
+        forget_file_location(j, f);
+        j->files_by_location_valid = false;
+
         log_debug("File %s removed.", f->path);
 
         if (j->current_file == f) {
@@ -1786,10 +2002,17 @@ _public_ void sd_journal_close(sd_journal *j) {
         hashmap_free(j->directories_by_path);
         hashmap_free(j->directories_by_wd);
 
+        prioq_free(j->files_by_location);
+        set_free(j->files_exhausted);
+
         safe_close(j->inotify_fd);
 
         if (j->mmap) {
-                log_debug("mmap cache statistics: %u hit, %u miss", mmap_cache_get_hit(j->mmap), mmap_cache_get_missed(j->mmap));
+                char sz[FORMAT_BYTES_MAX];
+
+                log_debug("mmap cache statistics: %u hit, %u miss, %u evicted, %s mapped",
+                          mmap_cache_get_hit(j->mmap), mmap_cache_get_missed(j->mmap), mmap_cache_get_evicted(j->mmap),
+                          format_bytes(sz, sizeof(sz), mmap_cache_get_mapped_size(j->mmap)));
                 mmap_cache_unref(j->mmap);
         }
 
@@ -1939,11 +2162,11 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
 
                 compression = o->object.flags & OBJECT_COMPRESSION_MASK;
                 if (compression) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
-                        r = decompress_startswith(compression,
-                                                  o->data.payload, l,
-                                                  &f->compress_buffer, &f->compress_buffer_size,
-                                                  field, field_length, '=');
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
+                        r = journal_file_decompress_startswith(f, compression,
+                                                               o->data.payload, l,
+                                                               &f->compress_buffer, &f->compress_buffer_size,
+                                                               field, field_length, '=');
                         if (r < 0)
                                 log_debug_errno(r, "Cannot decompress %s object of length %zu at offset "OFSfmt": %m",
                                                 object_compressed_to_string(compression), l, p);
@@ -1951,10 +2174,10 @@ _public_ int sd_journal_get_data(sd_journal *j, const char *field, const void **
 
                                 size_t rsize;
 
-                                r = decompress_blob(compression,
-                                                    o->data.payload, l,
-                                                    &f->compress_buffer, &f->compress_buffer_size, &rsize,
-                                                    j->data_threshold);
+                                r = journal_file_decompress_blob(f, compression,
+                                                                 o->data.payload, l,
+                                                                 &f->compress_buffer, &f->compress_buffer_size, &rsize,
+                                                                 j->data_threshold);
                                 if (r < 0)
                                         return r;
 
@@ -2003,13 +2226,13 @@ static int return_data(sd_journal *j, JournalFile *f, Object *o, const void **da
 
         compression = o->object.flags & OBJECT_COMPRESSION_MASK;
         if (compression) {
-#if defined(HAVE_XZ) || defined(HAVE_LZ4)
+#if defined(HAVE_XZ) || defined(HAVE_LZ4) || defined(HAVE_ZSTD)
                 size_t rsize;
                 int r;
 
-                r = decompress_blob(compression,
-                                    o->data.payload, l, &f->compress_buffer,
-                                    &f->compress_buffer_size, &rsize, j->data_threshold);
+                r = journal_file_decompress_blob(f, compression,
+                                                 o->data.payload, l, &f->compress_buffer,
+                                                 &f->compress_buffer_size, &rsize, j->data_threshold);
                 if (r < 0)
                         return r;
 
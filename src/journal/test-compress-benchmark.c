@@ -86,19 +86,18 @@ static char* make_buf(size_t count, const char *type) {
         return buf;
 }
 
-static void test_compress_decompress(const char* label, const char* type,
+static void test_compress_decompress(const char* label, const char* type, const char *text,
                                      compress_t compress, decompress_t decompress) {
         usec_t n, n2 = 0;
         float dt;
 
-        _cleanup_free_ char *text, *buf;
+        _cleanup_free_ char *buf;
         _cleanup_free_ void *buf2 = NULL;
         size_t buf2_allocated = 0;
         size_t skipped = 0, compressed = 0, total = 0;
 
-        text = make_buf(MAX_SIZE, type);
         buf = calloc(MAX_SIZE + 1, 1);
-        assert_se(text && buf);
+        assert_se(buf);
 
         n = now(CLOCK_MONOTONIC);
 
@@ -169,11 +168,20 @@ int main(int argc, char *argv[]) {
                 arg_start = getpid();
 
         NULSTR_FOREACH(i, "zeros\0simple\0random\0") {
+                _cleanup_free_ char *text = NULL;
+
+                /* Generate the corpus once, so that all codecs are
+                 * compared on exactly the same input */
+                text = make_buf(MAX_SIZE, i);
+
 #ifdef HAVE_XZ
-                test_compress_decompress("XZ", i, compress_blob_xz, decompress_blob_xz);
+                test_compress_decompress("XZ", i, text, compress_blob_xz, decompress_blob_xz);
 #endif
 #ifdef HAVE_LZ4
-                test_compress_decompress("LZ4", i, compress_blob_lz4, decompress_blob_lz4);
+                test_compress_decompress("LZ4", i, text, compress_blob_lz4, decompress_blob_lz4);
+#endif
+#ifdef HAVE_ZSTD
+                test_compress_decompress("ZSTD", i, text, compress_blob_zstd, decompress_blob_zstd);
 #endif
         }
         return 0;
@@ -304,5 +304,27 @@ int main(int argc, char *argv[]) {
         log_info("/* LZ4 test skipped */");
 #endif
 
+#ifdef HAVE_ZSTD
+        test_compress_decompress(OBJECT_COMPRESSED_ZSTD, compress_blob_zstd, decompress_blob_zstd,
+                                 text, sizeof(text), false);
+        test_compress_decompress(OBJECT_COMPRESSED_ZSTD, compress_blob_zstd, decompress_blob_zstd,
+                                 data, sizeof(data), true);
+
+        test_decompress_startswith(OBJECT_COMPRESSED_ZSTD,
+                                   compress_blob_zstd, decompress_startswith_zstd,
+                                   text, sizeof(text), false);
+        test_decompress_startswith(OBJECT_COMPRESSED_ZSTD,
+                                   compress_blob_zstd, decompress_startswith_zstd,
+                                   data, sizeof(data), true);
+        test_decompress_startswith(OBJECT_COMPRESSED_ZSTD,
+                                   compress_blob_zstd, decompress_startswith_zstd,
+                                   huge, sizeof(huge), true);
+
+        test_compress_stream(OBJECT_COMPRESSED_ZSTD, "zstdcat",
+                             compress_stream_zstd, decompress_stream_zstd, argv[0]);
+#else
+        log_info("/* ZSTD test skipped */");
+#endif
+
         return 0;
 }
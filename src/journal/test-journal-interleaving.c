@@ -195,6 +195,81 @@ static void test_skip(void (*setup)(void)) {
         test_check_numbers_up(j, 4);
         sd_journal_close(j);
 
+        /* Seek beyond the time range covered by the files.
+         */
+        assert_ret(sd_journal_open_directory(&j, t, 0));
+        assert_ret(sd_journal_seek_realtime_usec(j, now(CLOCK_REALTIME) + USEC_PER_HOUR));
+        assert_se(sd_journal_next(j) == 0);
+        assert_ret(sd_journal_seek_realtime_usec(j, 1));
+        assert_se(sd_journal_previous(j) == 0);
+        assert_ret(sd_journal_seek_realtime_usec(j, 1));
+        assert_ret(sd_journal_next(j));
+        test_check_numbers_down(j, 4);
+        sd_journal_close(j);
+
+        log_info("Done...");
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else {
+                journal_directory_vacuum(".", 3000000, 0, 0, NULL, true);
+
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+        }
+
+        puts("------------------------------------------------------------");
+}
+
+static void test_exhausted(void) {
+        char t[] = "/tmp/journal-exhausted-XXXXXX";
+        JournalFile *one, *two;
+        sd_journal *j;
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        /* Iterating beyond the end of a single online file, more
+         * than once */
+        one = test_open("one.journal");
+        append_number(one, 1, NULL);
+
+        assert_ret(sd_journal_open_directory(&j, t, 0));
+        assert_ret(sd_journal_seek_head(j));
+        assert_se(sd_journal_next(j) == 1);
+        test_check_number(j, 1);
+        assert_se(sd_journal_next(j) == 0);
+        assert_se(sd_journal_next(j) == 0);
+
+        append_number(one, 2, NULL);
+        assert_se(sd_journal_next(j) == 1);
+        test_check_number(j, 2);
+        assert_se(sd_journal_next(j) == 0);
+        sd_journal_close(j);
+
+        /* A file that ran dry while offline, but is written to again
+         * afterwards, while the entry returned last came from another
+         * file */
+        two = test_open("two.journal");
+        append_number(two, 3, NULL);
+        append_number(one, 4, NULL);
+        append_number(two, 5, NULL);
+        assert_ret(journal_file_set_offline(one, true));
+        assert_se(one->header->state == STATE_OFFLINE);
+
+        assert_ret(sd_journal_open_directory(&j, t, 0));
+        assert_ret(sd_journal_seek_head(j));
+        assert_se(sd_journal_next(j) == 1);
+        test_check_numbers_down(j, 5);
+
+        append_number(one, 6, NULL);
+        assert_se(sd_journal_next(j) == 1);
+        test_check_number(j, 6);
+        assert_se(sd_journal_next(j) == 0);
+        sd_journal_close(j);
+
+        test_close(one);
+        test_close(two);
+
         log_info("Done...");
 
         if (arg_keep)
@@ -303,6 +378,8 @@ int main(int argc, char *argv[]) {
         test_skip(setup_sequential);
         test_skip(setup_interleaved);
 
+        test_exhausted();
+
         test_sequence_numbers();
 
         return 0;
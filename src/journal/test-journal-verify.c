@@ -20,14 +20,23 @@
 ***/
 
 #include <fcntl.h>
+#include <sched.h>
 #include <stdio.h>
+#include <sys/mount.h>
 #include <unistd.h>
 
+#include "alloc-util.h"
+#include "dirent-util.h"
 #include "fd-util.h"
+#include "fsprg.h"
+#include "io-util.h"
 #include "journal-file.h"
 #include "journal-verify.h"
 #include "log.h"
+#include "mkdir.h"
+#include "process-util.h"
 #include "rm-rf.h"
+#include "string-util.h"
 #include "terminal-util.h"
 #include "util.h"
 
@@ -67,6 +76,156 @@ static int raw_verify(const char *fn, const char *verification_key) {
         return r;
 }
 
+#ifdef HAVE_GCRYPT
+#define FSS_INTERVAL_USEC (15 * USEC_PER_MINUTE)
+
+/* Writes a sealing key to where journal_file_open() looks for it,
+ * derived from a fixed seed, and returns the matching verification
+ * key */
+static char *setup_keys(void) {
+        uint8_t seed[FSPRG_RECOMMENDED_SEEDLEN], *mpk, *state;
+        size_t mpk_size, state_size, i;
+        char machine_string[33], *p, *key;
+        _cleanup_close_ int fd = -1;
+        sd_id128_t machine;
+        FSSHeader h = {};
+        uint64_t n;
+
+        for (i = 0; i < sizeof(seed); i++)
+                seed[i] = i;
+
+        mpk_size = FSPRG_mpkinbytes(FSPRG_RECOMMENDED_SECPAR);
+        mpk = alloca(mpk_size);
+
+        state_size = FSPRG_stateinbytes(FSPRG_RECOMMENDED_SECPAR);
+        state = alloca(state_size);
+
+        FSPRG_GenMK(NULL, mpk, seed, sizeof(seed), FSPRG_RECOMMENDED_SECPAR);
+        FSPRG_GenState0(state, mpk, seed, sizeof(seed));
+
+        assert_se(sd_id128_get_machine(&machine) >= 0);
+        n = now(CLOCK_REALTIME) / FSS_INTERVAL_USEC;
+
+        memcpy(h.signature, "KSHHRHLP", 8);
+        h.machine_id = machine;
+        assert_se(sd_id128_get_boot(&h.boot_id) >= 0);
+        h.header_size = htole64(sizeof(h));
+        h.start_usec = htole64(n * FSS_INTERVAL_USEC);
+        h.interval_usec = htole64(FSS_INTERVAL_USEC);
+        h.fsprg_secpar = htole16(FSPRG_RECOMMENDED_SECPAR);
+        h.fsprg_state_size = htole64(state_size);
+
+        p = strjoina("/var/log/journal/", sd_id128_to_string(machine, machine_string));
+        assert_se(mkdir_p(p, 0755) >= 0);
+
+        fd = open(strjoina(p, "/fss"), O_WRONLY|O_CREAT|O_EXCL|O_CLOEXEC, 0600);
+        assert_se(fd >= 0);
+        assert_se(loop_write(fd, &h, sizeof(h), false) >= 0);
+        assert_se(loop_write(fd, state, state_size, false) >= 0);
+
+        assert_se(asprintf(&key, "000102-030405-060708-090a0b/%"PRIx64"-%"PRIx64, n, (uint64_t) FSS_INTERVAL_USEC) >= 0);
+        return key;
+}
+
+static void append_entries(JournalFile *f, unsigned n) {
+        unsigned i;
+
+        /* Unique payloads of a size that is compressed against a
+         * dictionary, if the file uses one */
+        for (i = 0; i < n; i++) {
+                struct iovec iovec;
+                struct dual_timestamp ts;
+                char *test;
+
+                dual_timestamp_get(&ts);
+
+                assert_se(asprintf(&test, "MESSAGE=Started session %u of user systemd-test, reporting a rather chatty status", i) >= 0);
+
+                iovec.iov_base = (void*) test;
+                iovec.iov_len = strlen(test);
+
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+
+                free(test);
+        }
+}
+
+static void test_seal_rotate(void) {
+        char t[] = "/tmp/journal-seal-XXXXXX";
+        siginfo_t si;
+        pid_t pid;
+
+        /* Everything added to a sealed file after its header, also
+         * at rotation, must keep it verifiable. The sealing key goes
+         * to /var/log/journal, hence work in a mount namespace of
+         * our own, with a tmpfs over /var/log. */
+
+        assert_se(mkdtemp(t));
+
+        pid = fork();
+        assert_se(pid >= 0);
+
+        if (pid == 0) {
+                _cleanup_closedir_ DIR *d = NULL;
+                _cleanup_free_ char *key = NULL;
+                JournalFile *f;
+                struct dirent *de;
+                unsigned n = 0;
+                int r;
+
+                if (unshare(CLONE_NEWNS) < 0 ||
+                    mount(NULL, "/", NULL, MS_PRIVATE|MS_REC, NULL) < 0 ||
+                    mount("tmpfs", "/var/log", "tmpfs", 0, "mode=755") < 0) {
+                        log_info_errno(errno, "Cannot set up a private sealing key, skipping seal test: %m");
+                        _exit(EXIT_TEST_SKIP);
+                }
+
+                key = setup_keys();
+
+                assert_se(chdir(t) >= 0);
+                assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, true, NULL, NULL, NULL, &f) == 0);
+                assert_se(JOURNAL_HEADER_SEALED(f->header));
+
+                r = journal_file_enable_dictionary(f);
+                assert_se(r >= 0 || r == -EOPNOTSUPP);
+
+                /* Enough to train a dictionary, which the successor
+                 * then takes over */
+                append_entries(f, 8000);
+                assert_se(r < 0 || f->header->dictionary_offset != 0);
+
+                assert_se(journal_file_rotate(&f, true, true, NULL) >= 0);
+                assert_se(JOURNAL_HEADER_SEALED(f->header));
+                assert_se(r < 0 || f->header->dictionary_offset != 0);
+
+                append_entries(f, 100);
+                journal_file_close(f);
+
+                /* Both the archived file and its successor verify */
+                d = opendir(".");
+                assert_se(d);
+
+                FOREACH_DIRENT(de, d, assert_not_reached("Failed to read directory")) {
+                        if (!endswith(de->d_name, ".journal"))
+                                continue;
+
+                        log_info("Verifying sealed %s...", de->d_name);
+                        assert_se(raw_verify(de->d_name, key) >= 0);
+                        n++;
+                }
+
+                assert_se(n == 2);
+                _exit(EXIT_SUCCESS);
+        }
+
+        assert_se(wait_for_terminate(pid, &si) >= 0);
+        assert_se(si.si_code == CLD_EXITED);
+        assert_se(IN_SET(si.si_status, EXIT_SUCCESS, EXIT_TEST_SKIP));
+
+        assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+#endif
+
 int main(int argc, char *argv[]) {
         char t[] = "/tmp/journal-XXXXXX";
         unsigned n;
@@ -144,6 +303,10 @@ int main(int argc, char *argv[]) {
                 }
         }
 
+#ifdef HAVE_GCRYPT
+        test_seal_rotate();
+#endif
+
         log_info("Exiting...");
 
         assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
@@ -22,11 +22,17 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include "sd-journal.h"
+
 #include "journal-authenticate.h"
 #include "journal-file.h"
+#include "journal-internal.h"
 #include "journal-vacuum.h"
+#include "journal-verify.h"
 #include "log.h"
+#include "lookup3.h"
 #include "rm-rf.h"
+#include "stdio-util.h"
 
 static bool arg_keep = false;
 
@@ -106,8 +112,8 @@ static void test_non_empty(void) {
 
         assert_se(journal_file_move_to_entry_by_seqnum(f, 10, DIRECTION_DOWN, &o, NULL) == 0);
 
-        journal_file_rotate(&f, true, true);
-        journal_file_rotate(&f, true, true);
+        journal_file_rotate(&f, true, true, NULL);
+        journal_file_rotate(&f, true, true, NULL);
 
         journal_file_close(f);
 
@@ -166,6 +172,264 @@ static void test_empty(void) {
         journal_file_close(f4);
 }
 
+static void test_offline_thread(void) {
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec;
+        static const char test[] = "TEST=offline";
+        char t[] = "/tmp/journal-XXXXXX";
+        unsigned i;
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+
+        dual_timestamp_get(&ts);
+        iovec.iov_base = (void*) test;
+        iovec.iov_len = strlen(test);
+
+        /* Writers take the file back from the offlining thread,
+         * whatever state it is in */
+        for (i = 0; i < 100; i++) {
+                assert_se(journal_file_set_offline(f, false) >= 0);
+                if (i % 3 == 0)
+                        assert_se(journal_file_set_offline(f, false) >= 0);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+                assert_se(f->header->state == STATE_ONLINE);
+        }
+
+        assert_se(journal_file_set_offline(f, false) >= 0);
+        journal_file_close(f);
+
+        assert_se(journal_file_open("test.journal", O_RDONLY, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+        assert_se(f->header->state == STATE_OFFLINE);
+        assert_se(le64toh(f->header->n_entries) == 100);
+        journal_file_close(f);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+static void test_hash_table_resize(void) {
+        dual_timestamp ts;
+        JournalFile *f;
+        struct iovec iovec;
+        static const char test[] = "TEST1=1";
+        char t[] = "/tmp/journal-XXXXXX";
+        uint64_t data_size, field_size;
+
+        log_set_max_level(LOG_DEBUG);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+
+        dual_timestamp_get(&ts);
+        iovec.iov_base = (void*) test;
+        iovec.iov_len = strlen(test);
+        assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        assert_se(!journal_file_rotate_suggested(f, 0));
+
+        data_size = le64toh(f->header->data_hash_table_size);
+        field_size = le64toh(f->header->field_hash_table_size);
+
+        /* Pretend both tables grew overly long chains: the successor
+         * gets tables twice as large, as far as the maximum file size
+         * permits, and isn't rotated right away again */
+        f->metrics.max_size = 1024 * 1024;
+        f->header->data_hash_chain_depth = htole64(1000);
+        f->header->field_hash_chain_depth = htole64(1000);
+        assert_se(journal_file_rotate_suggested(f, 0));
+
+        assert_se(journal_file_rotate(&f, true, false, NULL) >= 0);
+        assert_se(le64toh(f->header->data_hash_table_size) == data_size * 2);
+        assert_se(le64toh(f->header->field_hash_table_size) == field_size * 2);
+        assert_se(!journal_file_rotate_suggested(f, 0));
+
+        journal_file_close(f);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+#define N_DICTIONARY_ENTRIES 10000
+
+static void test_dictionary(void) {
+        dual_timestamp ts;
+        JournalFile *f;
+        sd_journal *j;
+        struct iovec iovec;
+        char t[] = "/tmp/journal-XXXXXX";
+        char buf[128];
+        Object *o;
+        unsigned i;
+        int r;
+
+        log_set_max_level(LOG_INFO);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+
+        r = journal_file_enable_dictionary(f);
+        if (r == -EOPNOTSUPP) {
+                log_info("/* dictionary test skipped */");
+                goto finish;
+        }
+        assert_se(r == 0);
+
+        dual_timestamp_get(&ts);
+
+        /* Short, unique, but similar payloads, the typical case of
+         * data below the regular compression threshold */
+        for (i = 0; i < N_DICTIONARY_ENTRIES; i++) {
+                xsprintf(buf, "MESSAGE=Started session %u of user systemd-test, reporting a rather chatty status", i);
+                iovec.iov_base = buf;
+                iovec.iov_len = strlen(buf);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+
+        assert_se(JOURNAL_HEADER_COMPRESSED_DICTIONARY(f->header));
+        assert_se(f->dictionary);
+
+        assert_se(journal_file_find_data_object(f, buf, strlen(buf), &o, NULL) == 1);
+        assert_se(o->object.flags & OBJECT_COMPRESSED_ZSTD_DICTIONARY);
+        assert_se(le64toh(o->object.size) - offsetof(Object, data.payload) < strlen(buf));
+
+        journal_file_print_header(f);
+        assert_se(journal_file_verify(f, NULL, NULL, NULL, NULL, false) >= 0);
+
+        /* Read everything back through the public API */
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+        i = 0;
+        SD_JOURNAL_FOREACH(j) {
+                const void *d;
+                size_t l;
+
+                assert_se(sd_journal_get_data(j, "MESSAGE", &d, &l) >= 0);
+                xsprintf(buf, "MESSAGE=Started session %u of user systemd-test, reporting a rather chatty status", i);
+                assert_se(l == strlen(buf));
+                assert_se(memcmp(d, buf, l) == 0);
+                i++;
+        }
+        assert_se(i == N_DICTIONARY_ENTRIES);
+        sd_journal_close(j);
+
+        /* The successor takes over the dictionary */
+        assert_se(journal_file_rotate(&f, true, false, NULL) >= 0);
+        assert_se(f->compress_dictionary);
+        assert_se(JOURNAL_HEADER_COMPRESSED_DICTIONARY(f->header));
+        assert_se(journal_file_load_dictionary(f) > 0);
+
+finish:
+        journal_file_close(f);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
+#define N_BLOOM_FILTER_ENTRIES 1000
+
+static void test_bloom_filter(void) {
+        dual_timestamp ts;
+        JournalFile *f, *archived = NULL;
+        Set *deferred;
+        sd_journal *j;
+        struct iovec iovec;
+        char t[] = "/tmp/journal-XXXXXX";
+        char buf[64];
+        Iterator it;
+        unsigned i, n_false_positives = 0;
+
+        log_set_max_level(LOG_INFO);
+
+        assert_se(mkdtemp(t));
+        assert_se(chdir(t) >= 0);
+
+        assert_se(journal_file_open("test.journal", O_RDWR|O_CREAT, 0666, true, false, NULL, NULL, NULL, &f) == 0);
+
+        dual_timestamp_get(&ts);
+
+        for (i = 0; i < N_BLOOM_FILTER_ENTRIES; i++) {
+                xsprintf(buf, "BLOOM=%u", i);
+                iovec.iov_base = buf;
+                iovec.iov_len = strlen(buf);
+                assert_se(journal_file_append_entry(f, &ts, &iovec, 1, NULL, NULL, NULL) == 0);
+        }
+
+        /* Online files carry no filter yet */
+        assert_se(JOURNAL_HEADER_BLOOM_FILTER(f->header));
+        assert_se(f->header->bloom_filter_offset == 0);
+        assert_se(journal_file_bloom_filter_test(f, hash64("BLOOM=nope", 10)) > 0);
+
+        /* The rotated file is only archived, and gets its filter,
+         * once it is closed */
+        deferred = set_new(NULL);
+        assert_se(deferred);
+        assert_se(journal_file_rotate(&f, true, false, deferred) >= 0);
+        assert_se(set_size(deferred) == 1);
+        archived = set_first(deferred);
+        assert_se(archived->header->state != STATE_ARCHIVED);
+        assert_se(archived->header->bloom_filter_offset == 0);
+        archived = NULL;
+
+        journal_file_close_set(deferred);
+        set_free(deferred);
+        journal_file_close(f);
+
+        assert_se(sd_journal_open_directory(&j, t, 0) >= 0);
+
+        ORDERED_HASHMAP_FOREACH(f, j->files, it)
+                if (f->header->state == STATE_ARCHIVED)
+                        archived = f;
+        assert_se(archived);
+        assert_se(JOURNAL_HEADER_BLOOM_FILTER(archived->header));
+
+        journal_file_print_header(archived);
+        assert_se(journal_file_verify(archived, NULL, NULL, NULL, NULL, false) >= 0);
+
+        /* No false negatives, and few false positives */
+        for (i = 0; i < N_BLOOM_FILTER_ENTRIES; i++) {
+                xsprintf(buf, "BLOOM=%u", i);
+                assert_se(journal_file_bloom_filter_test(archived, hash64(buf, strlen(buf))) > 0);
+
+                xsprintf(buf, "BLOOM=x%u", i);
+                if (journal_file_bloom_filter_test(archived, hash64(buf, strlen(buf))) > 0)
+                        n_false_positives++;
+        }
+
+        log_info("Bloom filter false positives: %u/%u", n_false_positives, N_BLOOM_FILTER_ENTRIES);
+        assert_se(n_false_positives < N_BLOOM_FILTER_ENTRIES / 20);
+
+        /* Matches find what's there, and nothing else */
+        assert_se(sd_journal_add_match(j, "BLOOM=42", 0) >= 0);
+        assert_se(sd_journal_next(j) > 0);
+        assert_se(sd_journal_next(j) == 0);
+
+        sd_journal_flush_matches(j);
+        assert_se(sd_journal_add_match(j, "BLOOM=x42", 0) >= 0);
+        assert_se(sd_journal_seek_head(j) >= 0);
+        assert_se(sd_journal_next(j) == 0);
+
+        sd_journal_close(j);
+
+        if (arg_keep)
+                log_info("Not removing %s", t);
+        else
+                assert_se(rm_rf(t, REMOVE_ROOT|REMOVE_PHYSICAL) >= 0);
+}
+
 int main(int argc, char *argv[]) {
         arg_keep = argc > 1;
 
@@ -175,6 +439,10 @@ int main(int argc, char *argv[]) {
 
         test_non_empty();
         test_empty();
+        test_offline_thread();
+        test_hash_table_resize();
+        test_dictionary();
+        test_bloom_filter();
 
         return 0;
 }
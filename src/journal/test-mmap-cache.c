@@ -71,6 +71,20 @@ int main(int argc, char *argv[]) {
 
         assert_se((uint8_t*) p + 1 == (uint8_t*) q);
 
+        assert_se(mmap_cache_get_mapped_size(m) > 0);
+        assert_se(mmap_cache_get_evicted(m) == 0);
+
+        /* With no budget left, unused windows are recycled right away */
+        mmap_cache_set_budget(m, 0);
+
+        r = mmap_cache_get(m, y, PROT_READ, 0, false, 1, 2, NULL, &p);
+        assert_se(r >= 0);
+
+        r = mmap_cache_get(m, y, PROT_READ, 0, false, 256ULL*1024ULL*1024ULL, 2, NULL, &p);
+        assert_se(r >= 0);
+
+        assert_se(mmap_cache_get_evicted(m) > 0);
+
         mmap_cache_unref(m);
 
         safe_close(x);
@@ -32,6 +32,7 @@
 #include "hashmap.h"
 #include "kdbus.h"
 #include "list.h"
+#include "mempool.h"
 #include "prioq.h"
 #include "refcnt.h"
 #include "socket-util.h"
@@ -116,7 +117,7 @@ struct node_vtable {
 };
 
 struct vtable_member {
-        const char *path;
+        struct node *node;
         const char *interface;
         const char *member;
         struct node_vtable *parent;
@@ -211,6 +212,9 @@ struct sd_bus {
         bool is_system:1;
         bool is_user:1;
         bool allow_interactive_authorization:1;
+        bool coalesce_properties:1;
+        bool accept_memfd:1;
+        bool can_memfd:1;
 
         int use_memfd;
 
@@ -240,6 +244,9 @@ struct sd_bus {
         Hashmap *vtable_methods;
         Hashmap *vtable_properties;
 
+        /* PropertiesChanged signals queued for coalescing */
+        Hashmap *properties_changed;
+
         union sockaddr_union sockaddr;
         socklen_t sockaddr_size;
 
@@ -286,6 +293,10 @@ struct sd_bus {
         struct memfd_cache memfd_cache[MEMFD_CACHE_MAX];
         unsigned n_memfd_cache;
 
+        /* Same for the pool messages are allocated from */
+        pthread_mutex_t message_pool_mutex;
+        struct mempool message_pool;
+
         pid_t original_pid;
 
         uint64_t hello_flags;
@@ -297,6 +308,7 @@ struct sd_bus {
         sd_event_source *output_io_event_source;
         sd_event_source *time_event_source;
         sd_event_source *quit_event_source;
+        sd_event_source *properties_changed_event_source;
         sd_event *event;
         int event_priority;
 
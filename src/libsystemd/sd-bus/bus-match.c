@@ -70,7 +70,7 @@ static inline bool BUS_MATCH_IS_COMPARE(enum bus_match_node_type t) {
         return t >= BUS_MATCH_SENDER && t <= BUS_MATCH_ARG_HAS_LAST;
 }
 
-static inline bool BUS_MATCH_CAN_HASH(enum bus_match_node_type t) {
+static inline bool BUS_MATCH_IS_EXACT(enum bus_match_node_type t) {
         return (t >= BUS_MATCH_MESSAGE_TYPE && t <= BUS_MATCH_PATH) ||
                 (t >= BUS_MATCH_ARG && t <= BUS_MATCH_ARG_LAST) ||
                 (t >= BUS_MATCH_ARG_HAS && t <= BUS_MATCH_ARG_HAS_LAST);
@@ -104,7 +104,7 @@ static void bus_match_node_free(struct bus_match_node *node) {
 
                 if (node->parent->type == BUS_MATCH_MESSAGE_TYPE)
                         hashmap_remove(node->parent->compare.children, UINT_TO_PTR(node->value.u8));
-                else if (BUS_MATCH_CAN_HASH(node->parent->type) && node->value.str)
+                else if (node->value.str)
                         hashmap_remove(node->parent->compare.children, node->value.str);
 
                 free(node->value.str);
@@ -222,39 +222,151 @@ static bool value_node_test(
         }
 }
 
-static bool value_node_same(
+static int bus_match_run_value(
+                sd_bus *bus,
                 struct bus_match_node *node,
-                enum bus_match_node_type parent_type,
-                uint8_t value_u8,
-                const char *value_str) {
+                const void *value,
+                sd_bus_message *m) {
 
-        /* Tests parameters against this value node, not doing prefix
-         * magic and stuff, i.e. this one actually compares the match
-         * itself. */
+        struct bus_match_node *found;
 
-        assert(node);
-        assert(node->type == BUS_MATCH_VALUE);
+        found = hashmap_get(node->compare.children, value);
+        if (!found)
+                return 0;
 
-        switch (parent_type) {
+        return bus_match_run(bus, found, m);
+}
 
-        case BUS_MATCH_MESSAGE_TYPE:
-                return node->value.u8 == value_u8;
+static int bus_match_run_all(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *value_str,
+                char **value_strv,
+                sd_bus_message *m) {
 
-        case BUS_MATCH_SENDER:
-        case BUS_MATCH_DESTINATION:
-        case BUS_MATCH_INTERFACE:
-        case BUS_MATCH_MEMBER:
-        case BUS_MATCH_PATH:
-        case BUS_MATCH_ARG ... BUS_MATCH_ARG_LAST:
-        case BUS_MATCH_ARG_HAS ... BUS_MATCH_ARG_HAS_LAST:
-        case BUS_MATCH_ARG_NAMESPACE ... BUS_MATCH_ARG_NAMESPACE_LAST:
-        case BUS_MATCH_PATH_NAMESPACE:
-        case BUS_MATCH_ARG_PATH ... BUS_MATCH_ARG_PATH_LAST:
-                return streq(node->value.str, value_str);
+        struct bus_match_node *c;
+        int r;
 
-        default:
-                assert_not_reached("Invalid node type");
+        for (c = node->child; c; c = c->next) {
+                if (!value_node_test(c, node->type, 0, value_str, value_strv, m))
+                        continue;
+
+                r = bus_match_run(bus, c, m);
+                if (r != 0)
+                        return r;
+
+                if (bus && bus->match_callbacks_modified)
+                        return 0;
+        }
+
+        return 0;
+}
+
+static int bus_match_run_sender(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *value_str,
+                sd_bus_message *m) {
+
+        char **i;
+        int r;
+
+        if (!value_str)
+                return 0;
+
+        /* Without the list of well-known names, a unique sender
+         * matches every well-known name, see value_node_test() */
+        if (value_str[0] == ':' && !(m->creds.mask & SD_BUS_CREDS_WELL_KNOWN_NAMES))
+                return bus_match_run_all(bus, node, value_str, NULL, m);
+
+        r = bus_match_run_value(bus, node, value_str, m);
+        if (r != 0 || (bus && bus->match_callbacks_modified))
+                return r;
+
+        if (m->creds.mask & SD_BUS_CREDS_WELL_KNOWN_NAMES)
+                STRV_FOREACH(i, m->creds.well_known_names) {
+                        r = bus_match_run_value(bus, node, *i, m);
+                        if (r != 0 || (bus && bus->match_callbacks_modified))
+                                return r;
+                }
+
+        return 0;
+}
+
+static int bus_match_run_prefix(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *prefix,
+                size_t l,
+                sd_bus_message *m) {
+
+        if (!(node->compare.lengths & (UINT64_C(1) << (l % 64))))
+                return 0;
+
+        return bus_match_run_value(bus, node, prefix, m);
+}
+
+static int bus_match_run_prefixes(
+                sd_bus *bus,
+                struct bus_match_node *node,
+                const char *value_str,
+                char separator,
+                bool simple,
+                sd_bus_message *m) {
+
+        _cleanup_free_ char *prefix = NULL;
+        unsigned n_prefixes = 1;
+        const char *q;
+        char *p;
+        int r;
+
+        if (!value_str)
+                return 0;
+
+        /* A namespace or path pattern matches if it equals the value,
+         * or is a prefix of it ending right after a separator. Simple
+         * patterns may also end right before one. Hence, rather than
+         * testing every pattern, look up each such prefix, unless
+         * there are fewer patterns than prefixes. */
+
+        for (q = value_str; *q; q++)
+                if (*q == separator)
+                        n_prefixes += simple ? 2 : 1;
+
+        if (hashmap_size(node->compare.children) <= n_prefixes)
+                return bus_match_run_all(bus, node, value_str, NULL, m);
+
+        prefix = strdup(value_str);
+        if (!prefix)
+                return -ENOMEM;
+
+        for (p = prefix; *p; p++) {
+                char c;
+
+                if (*p != separator)
+                        continue;
+
+                if (simple) {
+                        *p = 0;
+                        r = bus_match_run_prefix(bus, node, prefix, p - prefix, m);
+                        *p = separator;
+                        if (r != 0 || (bus && bus->match_callbacks_modified))
+                                return r;
+                }
+
+                /* The full value is looked up below */
+                if (p[1] == 0)
+                        break;
+
+                c = p[1];
+                p[1] = 0;
+                r = bus_match_run_prefix(bus, node, prefix, p + 1 - prefix, m);
+                p[1] = c;
+                if (r != 0 || (bus && bus->match_callbacks_modified))
+                        return r;
         }
+
+        return bus_match_run_prefix(bus, node, value_str, strlen(value_str), m);
 }
 
 int bus_match_run(
@@ -389,50 +501,57 @@ int bus_match_run(
                 assert_not_reached("Unknown match type.");
         }
 
-        if (BUS_MATCH_CAN_HASH(node->type)) {
-                struct bus_match_node *found;
+        /* All value nodes are indexed by their value, so whatever
+         * the number of matches, we only look up the few values that
+         * could possibly match. */
 
-                /* Lookup via hash table, nice! So let's jump directly. */
+        switch (node->type) {
 
-                if (test_str)
-                        found = hashmap_get(node->compare.children, test_str);
-                else if (test_strv) {
-                        char **i;
+        case BUS_MATCH_MESSAGE_TYPE:
+                r = bus_match_run_value(bus, node, UINT_TO_PTR(test_u8), m);
+                break;
 
-                        STRV_FOREACH(i, test_strv) {
-                                found = hashmap_get(node->compare.children, *i);
-                                if (found) {
-                                        r = bus_match_run(bus, found, m);
-                                        if (r != 0)
-                                                return r;
-                                }
-                        }
+        case BUS_MATCH_SENDER:
+                r = bus_match_run_sender(bus, node, test_str, m);
+                break;
 
-                        found = NULL;
-                } else if (node->type == BUS_MATCH_MESSAGE_TYPE)
-                        found = hashmap_get(node->compare.children, UINT_TO_PTR(test_u8));
-                else
-                        found = NULL;
+        case BUS_MATCH_PATH_NAMESPACE:
+                r = bus_match_run_prefixes(bus, node, test_str, '/', true, m);
+                break;
 
-                if (found) {
-                        r = bus_match_run(bus, found, m);
-                        if (r != 0)
-                                return r;
-                }
-        } else {
-                struct bus_match_node *c;
+        case BUS_MATCH_ARG_NAMESPACE ... BUS_MATCH_ARG_NAMESPACE_LAST:
+                r = bus_match_run_prefixes(bus, node, test_str, '.', true, m);
+                break;
+
+        case BUS_MATCH_ARG_PATH ... BUS_MATCH_ARG_PATH_LAST:
 
-                /* No hash table, so let's iterate manually... */
+                /* If the argument ends in a slash, it also matches
+                 * all the patterns it is a prefix of. There's no
+                 * index for that, so let's test them all. */
+                if (test_str && endswith(test_str, "/"))
+                        r = bus_match_run_all(bus, node, test_str, NULL, m);
+                else
+                        r = bus_match_run_prefixes(bus, node, test_str, '/', false, m);
+                break;
 
-                for (c = node->child; c; c = c->next) {
-                        if (!value_node_test(c, node->type, test_u8, test_str, test_strv, m))
-                                continue;
+        case BUS_MATCH_ARG_HAS ... BUS_MATCH_ARG_HAS_LAST: {
+                char **i;
 
-                        r = bus_match_run(bus, c, m);
-                        if (r != 0)
-                                return r;
+                r = 0;
+                STRV_FOREACH(i, test_strv) {
+                        r = bus_match_run_value(bus, node, *i, m);
+                        if (r != 0 || (bus && bus->match_callbacks_modified))
+                                break;
                 }
+                break;
+        }
+
+        default:
+                r = test_str ? bus_match_run_value(bus, node, test_str, m) : 0;
+                break;
         }
+        if (r != 0)
+                return r;
 
         if (bus && bus->match_callbacks_modified)
                 return 0;
@@ -465,12 +584,8 @@ static int bus_match_add_compare_value(
 
                 if (t == BUS_MATCH_MESSAGE_TYPE)
                         n = hashmap_get(c->compare.children, UINT_TO_PTR(value_u8));
-                else if (BUS_MATCH_CAN_HASH(t))
+                else
                         n = hashmap_get(c->compare.children, value_str);
-                else {
-                        for (n = c->child; n && !value_node_same(n, t, value_u8, value_str); n = n->next)
-                                ;
-                }
 
                 if (n) {
                         *ret = n;
@@ -493,18 +608,13 @@ static int bus_match_add_compare_value(
                         c->next->prev = c;
                 where->child = c;
 
-                if (t == BUS_MATCH_MESSAGE_TYPE) {
+                if (t == BUS_MATCH_MESSAGE_TYPE)
                         c->compare.children = hashmap_new(NULL);
-                        if (!c->compare.children) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
-                } else if (BUS_MATCH_CAN_HASH(t)) {
+                else
                         c->compare.children = hashmap_new(&string_hash_ops);
-                        if (!c->compare.children) {
-                                r = -ENOMEM;
-                                goto fail;
-                        }
+                if (!c->compare.children) {
+                        r = -ENOMEM;
+                        goto fail;
                 }
         }
 
@@ -525,16 +635,17 @@ static int bus_match_add_compare_value(
         }
 
         n->parent = c;
-        if (c->compare.children) {
 
-                if (t == BUS_MATCH_MESSAGE_TYPE)
-                        r = hashmap_put(c->compare.children, UINT_TO_PTR(value_u8), n);
-                else
-                        r = hashmap_put(c->compare.children, n->value.str, n);
+        if (t == BUS_MATCH_MESSAGE_TYPE)
+                r = hashmap_put(c->compare.children, UINT_TO_PTR(value_u8), n);
+        else
+                r = hashmap_put(c->compare.children, n->value.str, n);
+        if (r < 0)
+                goto fail;
+
+        if (!BUS_MATCH_IS_EXACT(t)) {
+                c->compare.lengths |= UINT64_C(1) << (strlen(value_str) % 64);
 
-                if (r < 0)
-                        goto fail;
-        } else {
                 n->next = c->child;
                 if (n->next)
                         n->next->prev = n;
@@ -578,12 +689,8 @@ static int bus_match_find_compare_value(
 
         if (t == BUS_MATCH_MESSAGE_TYPE)
                 n = hashmap_get(c->compare.children, UINT_TO_PTR(value_u8));
-        else if (BUS_MATCH_CAN_HASH(t))
+        else
                 n = hashmap_get(c->compare.children, value_str);
-        else {
-                for (n = c->child; n && !value_node_same(n, t, value_u8, value_str); n = n->next)
-                        ;
-        }
 
         if (n) {
                 *ret = n;
@@ -1078,7 +1185,7 @@ void bus_match_free(struct bus_match_node *node) {
         if (!node)
                 return;
 
-        if (BUS_MATCH_CAN_HASH(node->type)) {
+        if (BUS_MATCH_IS_EXACT(node->type)) {
                 Iterator i;
 
                 HASHMAP_FOREACH(c, node->compare.children, i)
@@ -1171,7 +1278,7 @@ void bus_match_dump(struct bus_match_node *node, unsigned level) {
         else
                 putchar('\n');
 
-        if (BUS_MATCH_CAN_HASH(node->type)) {
+        if (BUS_MATCH_IS_EXACT(node->type)) {
                 Iterator i;
 
                 HASHMAP_FOREACH(c, node->compare.children, i)
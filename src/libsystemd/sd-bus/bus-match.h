@@ -63,8 +63,14 @@ struct bus_match_node {
                         struct match_callback *callback;
                 } leaf;
                 struct {
-                        /* If this is set, then the child is NULL */
+                        /* The value nodes, keyed by value. Only values that
+                         * need to be tested one by one are in the child
+                         * list, too */
                         Hashmap *children;
+                        /* Bit n is set if there is a value of length n
+                         * modulo 64. Never cleared, it's just a hint for
+                         * which prefixes are worth looking up */
+                        uint64_t lengths;
                 } compare;
         };
 };
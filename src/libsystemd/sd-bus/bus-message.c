@@ -117,13 +117,62 @@ static void message_reset_containers(sd_bus_message *m) {
                 free(m->containers[i].offsets);
         }
 
-        m->containers = mfree(m->containers);
+        if (m->containers != m->containers_fixed)
+                free(m->containers);
+        m->containers = NULL;
 
         m->n_containers = m->containers_allocated = 0;
         m->root_container.index = 0;
 }
 
+static sd_bus_message *message_alloc0(sd_bus *bus, size_t size) {
+        sd_bus_message *m;
+
+        assert(bus);
+        assert(size >= sizeof(sd_bus_message));
+
+        if (size > bus->message_pool.tile_size)
+                return malloc0(size);
+
+        assert_se(pthread_mutex_lock(&bus->message_pool_mutex) == 0);
+        m = mempool_alloc_tile(&bus->message_pool);
+        assert_se(pthread_mutex_unlock(&bus->message_pool_mutex) == 0);
+        if (!m)
+                return NULL;
+
+        memzero(m, size);
+        m->from_pool = true;
+
+        return m;
+}
+
+static void message_release(sd_bus *bus, sd_bus_message *m) {
+        assert(bus);
+
+        if (!m)
+                return;
+
+        if (!m->from_pool) {
+                free(m);
+                return;
+        }
+
+        assert_se(pthread_mutex_lock(&bus->message_pool_mutex) == 0);
+        mempool_free_tile(&bus->message_pool, m);
+        assert_se(pthread_mutex_unlock(&bus->message_pool_mutex) == 0);
+}
+
+static void *message_inline_header(sd_bus_message *m) {
+        return (uint8_t*) m + ALIGN(sizeof(sd_bus_message));
+}
+
+static void *message_inline_body(sd_bus_message *m) {
+        return (uint8_t*) m + ALIGN(sizeof(sd_bus_message)) + BUS_MESSAGE_INLINE_HEADER;
+}
+
 static void message_free(sd_bus_message *m) {
+        sd_bus *bus;
+
         assert(m);
 
         if (m->free_header)
@@ -137,8 +186,6 @@ static void message_free(sd_bus_message *m) {
         if (m->free_kdbus)
                 free(m->kdbus);
 
-        sd_bus_unref(m->bus);
-
         if (m->free_fds) {
                 close_many(m->fds, m->n_fds);
                 free(m->fds);
@@ -147,6 +194,9 @@ static void message_free(sd_bus_message *m) {
         if (m->iovec != m->iovec_fixed)
                 free(m->iovec);
 
+        free(m->wire_header);
+        free(m->wire_fds);
+
         m->destination_ptr = mfree(m->destination_ptr);
         message_reset_containers(m);
         free(m->root_container.signature);
@@ -155,7 +205,12 @@ static void message_free(sd_bus_message *m) {
         free(m->root_container.peeked_signature);
 
         bus_creds_done(&m->creds);
-        free(m);
+
+        /* The message goes back to the pool of the bus first, the bus
+         * might go away with our reference */
+        bus = m->bus;
+        message_release(bus, m);
+        sd_bus_unref(bus);
 }
 
 static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, bool add_offset) {
@@ -182,16 +237,19 @@ static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, b
                 np = realloc(m->header, ALIGN8(new_size));
                 if (!np)
                         goto poison;
-        } else {
-                /* Initially, the header is allocated as part of of
-                 * the sd_bus_message itself, let's replace it by
-                 * dynamic data */
+        } else if (m->has_inline && ALIGN8(new_size) <= BUS_MESSAGE_INLINE_HEADER)
+                /* Initially, the header is allocated as part of
+                 * the sd_bus_message itself, and there's still
+                 * room left there */
+                np = m->header;
+        else {
+                /* Let's replace it by dynamic data */
 
                 np = malloc(ALIGN8(new_size));
                 if (!np)
                         goto poison;
 
-                memcpy(np, m->header, sizeof(struct bus_header));
+                memcpy(np, m->header, old_size);
         }
 
         /* Zero out padding */
@@ -210,7 +268,8 @@ static void *message_extend_fields(sd_bus_message *m, size_t align, size_t sz, b
         m->sender = adjust_pointer(m->sender, op, old_size, m->header);
         m->error.name = adjust_pointer(m->error.name, op, old_size, m->header);
 
-        m->free_header = true;
+        if (np != op)
+                m->free_header = true;
 
         if (add_offset) {
                 if (m->n_header_offsets >= ELEMENTSOF(m->header_offsets))
@@ -438,9 +497,10 @@ int bus_message_from_header(
                 size_t extra,
                 sd_bus_message **ret) {
 
-        _cleanup_free_ sd_bus_message *m = NULL;
+        sd_bus_message *m;
         struct bus_header *h;
         size_t a, label_sz;
+        int r;
 
         assert(bus);
         assert(header || header_accessible <= 0);
@@ -475,7 +535,7 @@ int bus_message_from_header(
                 a += label_sz + 1;
         }
 
-        m = malloc0(a);
+        m = message_alloc0(bus, a);
         if (!m)
                 return -ENOMEM;
 
@@ -489,8 +549,10 @@ int bus_message_from_header(
         if (BUS_MESSAGE_IS_GVARIANT(m)) {
                 size_t ws;
 
-                if (h->dbus2.cookie == 0)
-                        return -EBADMSG;
+                if (h->dbus2.cookie == 0) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
 
                 /* dbus2 derives the sizes from the message size and
                 the offset table at the end, since it is formatted as
@@ -500,27 +562,34 @@ int bus_message_from_header(
                 end of the fields array. */
 
                 ws = bus_gvariant_determine_word_size(message_size, 0);
-                if (footer_accessible < ws)
-                        return -EBADMSG;
+                if (footer_accessible < ws) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
 
                 m->fields_size = bus_gvariant_read_word_le((uint8_t*) footer + footer_accessible - ws, ws);
-                if (ALIGN8(m->fields_size) > message_size - ws)
-                        return -EBADMSG;
-                if (m->fields_size < sizeof(struct bus_header))
-                        return -EBADMSG;
+                if (ALIGN8(m->fields_size) > message_size - ws ||
+                    m->fields_size < sizeof(struct bus_header)) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
 
                 m->fields_size -= sizeof(struct bus_header);
                 m->body_size = message_size - (sizeof(struct bus_header) + ALIGN8(m->fields_size));
         } else {
-                if (h->dbus1.serial == 0)
-                        return -EBADMSG;
+                if (h->dbus1.serial == 0) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
 
                 /* dbus1 has the sizes in the header */
                 m->fields_size = BUS_MESSAGE_BSWAP32(m, h->dbus1.fields_size);
                 m->body_size = BUS_MESSAGE_BSWAP32(m, h->dbus1.body_size);
 
-                if (sizeof(struct bus_header) + ALIGN8(m->fields_size) + m->body_size != message_size)
-                        return -EBADMSG;
+                if (sizeof(struct bus_header) + ALIGN8(m->fields_size) + m->body_size != message_size) {
+                        r = -EBADMSG;
+                        goto fail;
+                }
         }
 
         m->fds = fds;
@@ -535,9 +604,12 @@ int bus_message_from_header(
 
         m->bus = sd_bus_ref(bus);
         *ret = m;
-        m = NULL;
 
         return 0;
+
+fail:
+        message_release(bus, m);
+        return r;
 }
 
 int bus_message_from_malloc(
@@ -599,12 +671,15 @@ static sd_bus_message *message_new(sd_bus *bus, uint8_t type) {
 
         assert(bus);
 
-        m = malloc0(ALIGN(sizeof(sd_bus_message)) + sizeof(struct bus_header));
+        m = message_alloc0(bus, ALIGN(sizeof(sd_bus_message)) + sizeof(struct bus_header));
         if (!m)
                 return NULL;
 
+        assert(m->from_pool);
+
         m->n_ref = 1;
-        m->header = (struct bus_header*) ((uint8_t*) m + ALIGN(sizeof(struct sd_bus_message)));
+        m->has_inline = true;
+        m->header = message_inline_header(m);
         m->header->endian = BUS_NATIVE_ENDIAN;
         m->header->type = type;
         m->header->version = bus->message_version;
@@ -1280,15 +1355,28 @@ static int part_make_space(
                         size_t new_allocated;
 
                         new_allocated = sz > 0 ? 2 * sz : 64;
-                        n = realloc(part->data, new_allocated);
-                        if (!n) {
-                                m->poisoned = true;
-                                return -ENOMEM;
-                        }
 
-                        part->data = n;
-                        part->allocated = new_allocated;
-                        part->free_this = true;
+                        if (!part->data && part == &m->body && m->has_inline && sz <= BUS_MESSAGE_INLINE_BODY) {
+                                /* Small bodies fit in the sd_bus_message allocation itself */
+                                part->data = message_inline_body(m);
+                                part->allocated = BUS_MESSAGE_INLINE_BODY;
+                        } else {
+                                if (part->data && !part->free_this) {
+                                        /* Outgrown the inline space */
+                                        n = malloc(new_allocated);
+                                        if (n)
+                                                memcpy(n, part->data, part->size);
+                                } else
+                                        n = realloc(part->data, new_allocated);
+                                if (!n) {
+                                        m->poisoned = true;
+                                        return -ENOMEM;
+                                }
+
+                                part->data = n;
+                                part->allocated = new_allocated;
+                                part->free_this = true;
+                        }
                 }
         }
 
@@ -1320,6 +1408,42 @@ static int message_add_offset(sd_bus_message *m, size_t offset) {
         return 0;
 }
 
+static int message_grow_containers(sd_bus_message *m) {
+        struct bus_container *n;
+        size_t a;
+
+        assert(m);
+
+        /* The first few containers are within the message itself */
+
+        if (m->n_containers < m->containers_allocated)
+                return 0;
+
+        if (!m->containers) {
+                m->containers = m->containers_fixed;
+                m->containers_allocated = ELEMENTSOF(m->containers_fixed);
+                return 0;
+        }
+
+        if (m->containers != m->containers_fixed) {
+                if (!GREEDY_REALLOC(m->containers, m->containers_allocated, m->n_containers + 1))
+                        return -ENOMEM;
+
+                return 0;
+        }
+
+        a = m->containers_allocated * 2;
+        n = new(struct bus_container, a);
+        if (!n)
+                return -ENOMEM;
+
+        memcpy(n, m->containers, m->n_containers * sizeof(struct bus_container));
+        m->containers = n;
+        m->containers_allocated = a;
+
+        return 0;
+}
+
 static void message_extend_containers(sd_bus_message *m, size_t expand) {
         struct bus_container *c;
 
@@ -2055,7 +2179,7 @@ _public_ int sd_bus_message_open_container(
         assert_return(!m->poisoned, -ESTALE);
 
         /* Make sure we have space for one more container */
-        if (!GREEDY_REALLOC(m->containers, m->containers_allocated, m->n_containers + 1)) {
+        if (message_grow_containers(m) < 0) {
                 m->poisoned = true;
                 return -ENOMEM;
         }
@@ -4116,7 +4240,7 @@ _public_ int sd_bus_message_enter_container(sd_bus_message *m,
         if (m->n_containers >= BUS_CONTAINER_DEPTH)
                 return -EBADMSG;
 
-        if (!GREEDY_REALLOC(m->containers, m->containers_allocated, m->n_containers + 1))
+        if (message_grow_containers(m) < 0)
                 return -ENOMEM;
 
         if (message_end_of_signature(m))
@@ -5093,12 +5217,13 @@ static int message_skip_fields(
 
                         assert(l >= 1);
                         {
-                                char sig[l-1], *s;
+                                char sig[l+1], *s;
                                 uint32_t nas;
+                                size_t begin;
                                 int alignment;
 
-                                strncpy(sig, *signature + 1, l-1);
-                                s = sig;
+                                strncpy(sig, *signature + 1, l);
+                                sig[l] = 0;
 
                                 alignment = bus_type_get_alignment(sig[0]);
                                 if (alignment < 0)
@@ -5114,9 +5239,18 @@ static int message_skip_fields(
                                 if (r < 0)
                                         return r;
 
-                                r = message_skip_fields(m, ri, nas, (const char**) &s);
-                                if (r < 0)
-                                        return r;
+                                /* Skip element by element, until
+                                 * the array size is used up */
+                                begin = *ri;
+                                while (*ri - begin < nas) {
+                                        s = sig;
+                                        r = message_skip_fields(m, ri, (uint32_t) -1, (const char**) &s);
+                                        if (r < 0)
+                                                return r;
+                                }
+
+                                if (*ri - begin != nas)
+                                        return -EBADMSG;
                         }
 
                         (*signature) += 1 + l;
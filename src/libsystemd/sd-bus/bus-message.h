@@ -98,6 +98,8 @@ struct sd_bus_message {
         bool free_fds:1;
         bool release_kdbus:1;
         bool poisoned:1;
+        bool from_pool:1;
+        bool has_inline:1;
 
         /* The first and last bytes of the message */
         struct bus_header *header;
@@ -125,11 +127,20 @@ struct sd_bus_message {
         struct bus_container root_container, *containers;
         size_t n_containers;
         size_t containers_allocated;
+        struct bus_container containers_fixed[2];
 
         struct iovec *iovec;
         struct iovec iovec_fixed[2];
         unsigned n_iovec;
 
+        /* If memfds are passed on the socket instead of their
+         * contents, the header and the fds as they are sent */
+        void *wire_header;
+        size_t wire_header_size;
+        size_t wire_size;
+        int *wire_fds;
+        unsigned n_wire_fds;
+
         struct kdbus_msg *kdbus;
 
         char *peeked_signature;
@@ -149,6 +160,13 @@ struct sd_bus_message {
         unsigned n_header_offsets;
 };
 
+/* Messages are allocated from a pool of each bus. The messages we
+ * build ourselves keep their header and the first part of their body
+ * in the same allocation, as long as they fit these. */
+#define BUS_MESSAGE_INLINE_HEADER 256
+#define BUS_MESSAGE_INLINE_BODY 256
+#define BUS_MESSAGE_TILE_SIZE (ALIGN(sizeof(sd_bus_message)) + BUS_MESSAGE_INLINE_HEADER + BUS_MESSAGE_INLINE_BODY)
+
 static inline bool BUS_MESSAGE_NEED_BSWAP(sd_bus_message *m) {
         return m->header->endian != BUS_NATIVE_ENDIAN;
 }
@@ -179,6 +197,14 @@ static inline size_t BUS_MESSAGE_SIZE(sd_bus_message *m) {
                 m->body_size;
 }
 
+static inline size_t BUS_MESSAGE_WIRE_SIZE(sd_bus_message *m) {
+        return m->wire_header ? m->wire_size : BUS_MESSAGE_SIZE(m);
+}
+
+static inline unsigned BUS_MESSAGE_N_WIRE_FDS(sd_bus_message *m) {
+        return m->wire_header ? m->n_wire_fds : m->n_fds;
+}
+
 static inline size_t BUS_MESSAGE_BODY_BEGIN(sd_bus_message *m) {
         return
                 sizeof(struct bus_header) +
@@ -1248,7 +1248,7 @@ static int object_find_and_run(
                 return 0;
 
         /* Then, look for a known method */
-        vtable_key.path = (char*) p;
+        vtable_key.node = n;
         vtable_key.interface = m->interface;
         vtable_key.member = m->member;
 
@@ -1273,7 +1273,7 @@ static int object_find_and_run(
                         if (r < 0)
                                 return r;
 
-                        vtable_key.path = (char*) p;
+                        vtable_key.node = n;
 
                         r = sd_bus_message_read(m, "ss", &vtable_key.interface, &vtable_key.member);
                         if (r < 0)
@@ -1585,7 +1585,9 @@ static void vtable_member_hash_func(const void *a, struct siphash *state) {
 
         assert(m);
 
-        string_hash_func(m->path, state);
+        /* We already know the node when looking up a member, hence
+         * use it instead of hashing the path once more */
+        trivial_hash_func(m->node, state);
         string_hash_func(m->interface, state);
         string_hash_func(m->member, state);
 }
@@ -1597,7 +1599,7 @@ static int vtable_member_compare_func(const void *a, const void *b) {
         assert(x);
         assert(y);
 
-        r = strcmp(x->path, y->path);
+        r = trivial_compare_func(x->node, y->node);
         if (r != 0)
                 return r;
 
@@ -1709,7 +1711,7 @@ static int add_object_vtable_internal(
                         }
 
                         m->parent = &s->node_vtable;
-                        m->path = n->path;
+                        m->node = n;
                         m->interface = s->node_vtable.interface;
                         m->member = v->x.method.member;
                         m->vtable = v;
@@ -1758,7 +1760,7 @@ static int add_object_vtable_internal(
                         }
 
                         m->parent = &s->node_vtable;
-                        m->path = n->path;
+                        m->node = n;
                         m->interface = s->node_vtable.interface;
                         m->member = v->x.property.member;
                         m->vtable = v;
@@ -1913,7 +1915,7 @@ static int emit_properties_changed_on_interface(
         if (r < 0)
                 return r;
 
-        key.path = prefix;
+        key.node = n;
         key.interface = interface;
 
         LIST_FOREACH(vtables, c, n->vtables) {
@@ -2079,7 +2081,7 @@ static int emit_properties_changed_on_interface(
         return 1;
 }
 
-_public_ int sd_bus_emit_properties_changed_strv(
+static int emit_properties_changed(
                 sd_bus *bus,
                 const char *path,
                 const char *interface,
@@ -2090,20 +2092,9 @@ _public_ int sd_bus_emit_properties_changed_strv(
         char *prefix;
         int r;
 
-        assert_return(bus, -EINVAL);
-        assert_return(object_path_is_valid(path), -EINVAL);
-        assert_return(interface_name_is_valid(interface), -EINVAL);
-        assert_return(!bus_pid_changed(bus), -ECHILD);
-
-        if (!BUS_IS_OPEN(bus->state))
-                return -ENOTCONN;
-
-        /* A non-NULL but empty names list means nothing needs to be
-           generated. A NULL list OTOH indicates that all properties
-           that are set to EMITS_CHANGE or EMITS_INVALIDATION shall be
-           included in the PropertiesChanged message. */
-        if (names && names[0] == NULL)
-                return 0;
+        assert(bus);
+        assert(path);
+        assert(interface);
 
         do {
                 bus->nodes_modified = false;
@@ -2128,6 +2119,243 @@ _public_ int sd_bus_emit_properties_changed_strv(
         return found_interface ? 0 : -ENOENT;
 }
 
+struct properties_changed {
+        char *path;
+        char *interface;
+
+        /* NULL if all properties changed */
+        char **names;
+};
+
+static void properties_changed_hash_func(const void *a, struct siphash *state) {
+        const struct properties_changed *p = a;
+
+        assert(p);
+
+        string_hash_func(p->path, state);
+        string_hash_func(p->interface, state);
+}
+
+static int properties_changed_compare_func(const void *a, const void *b) {
+        const struct properties_changed *x = a, *y = b;
+        int r;
+
+        assert(x);
+        assert(y);
+
+        r = strcmp(x->path, y->path);
+        if (r != 0)
+                return r;
+
+        return strcmp(x->interface, y->interface);
+}
+
+static const struct hash_ops properties_changed_hash_ops = {
+        .hash = properties_changed_hash_func,
+        .compare = properties_changed_compare_func
+};
+
+static void properties_changed_free(struct properties_changed *p) {
+        if (!p)
+                return;
+
+        free(p->path);
+        free(p->interface);
+        strv_free(p->names);
+        free(p);
+}
+
+int bus_process_properties_changed(sd_bus *bus) {
+        struct properties_changed *p;
+        int r = 0, k;
+
+        assert(bus);
+
+        while ((p = hashmap_steal_first(bus->properties_changed))) {
+                k = emit_properties_changed(bus, p->path, p->interface, p->names);
+                properties_changed_free(p);
+
+                /* The object might have gone away in the meantime */
+                if (k < 0 && k != -ENOENT && r == 0)
+                        r = k;
+        }
+
+        return r;
+}
+
+int bus_process_properties_changed_path(sd_bus *bus, const char *path) {
+        struct properties_changed *p;
+        Iterator i;
+        int r = 0, k;
+
+        assert(bus);
+        assert(path);
+
+        /* Emits what is queued for one object right away, for
+         * example before announcing that it goes away. Emitting
+         * might queue more, hence restart the iteration each time. */
+
+        for (;;) {
+                bool found = false;
+
+                HASHMAP_FOREACH(p, bus->properties_changed, i)
+                        if (streq(p->path, path)) {
+                                found = true;
+                                break;
+                        }
+
+                if (!found)
+                        return r;
+
+                assert_se(hashmap_remove(bus->properties_changed, p) == p);
+
+                k = emit_properties_changed(bus, p->path, p->interface, p->names);
+                properties_changed_free(p);
+
+                if (k < 0 && k != -ENOENT && r == 0)
+                        r = k;
+        }
+}
+
+void bus_drop_properties_changed(sd_bus *bus) {
+        struct properties_changed *p;
+
+        assert(bus);
+
+        while ((p = hashmap_steal_first(bus->properties_changed)))
+                properties_changed_free(p);
+
+        bus->properties_changed = hashmap_free(bus->properties_changed);
+}
+
+static int properties_changed_callback(sd_event_source *s, void *userdata) {
+        sd_bus *bus = userdata;
+        int r;
+
+        assert(bus);
+
+        r = bus_process_properties_changed(bus);
+        if (r < 0)
+                log_debug_errno(r, "Failed to emit coalesced PropertiesChanged signals: %m");
+
+        return 0;
+}
+
+static int queue_properties_changed(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                char **names) {
+
+        struct properties_changed key = {
+                .path = (char*) path,
+                .interface = (char*) interface,
+        }, *p;
+        int r;
+
+        assert(bus);
+        assert(bus->event);
+
+        p = hashmap_get(bus->properties_changed, &key);
+        if (p) {
+                /* Merge with what is already queued for this
+                 * interface, unless that covers everything anyway */
+                if (!p->names)
+                        return 0;
+
+                if (!names) {
+                        p->names = strv_free(p->names);
+                        return 0;
+                }
+
+                return strv_extend_strv(&p->names, names, true);
+        }
+
+        r = hashmap_ensure_allocated(&bus->properties_changed, &properties_changed_hash_ops);
+        if (r < 0)
+                return r;
+
+        if (!bus->properties_changed_event_source) {
+                r = sd_event_add_defer(bus->event, &bus->properties_changed_event_source, properties_changed_callback, bus);
+                if (r < 0)
+                        return r;
+
+                r = sd_event_source_set_priority(bus->properties_changed_event_source, bus->event_priority);
+                if (r < 0)
+                        return r;
+
+                (void) sd_event_source_set_description(bus->properties_changed_event_source, "bus-properties-changed");
+        }
+
+        p = new0(struct properties_changed, 1);
+        if (!p)
+                return -ENOMEM;
+
+        p->path = strdup(path);
+        p->interface = strdup(interface);
+        if (!p->path || !p->interface) {
+                properties_changed_free(p);
+                return -ENOMEM;
+        }
+
+        if (names) {
+                p->names = strv_copy(names);
+                if (!p->names) {
+                        properties_changed_free(p);
+                        return -ENOMEM;
+                }
+        }
+
+        r = hashmap_put(bus->properties_changed, p, p);
+        if (r < 0) {
+                properties_changed_free(p);
+                return r;
+        }
+
+        r = sd_event_source_set_enabled(bus->properties_changed_event_source, SD_EVENT_ONESHOT);
+        if (r < 0)
+                return r;
+
+        return 0;
+}
+
+_public_ int sd_bus_emit_properties_changed_strv(
+                sd_bus *bus,
+                const char *path,
+                const char *interface,
+                char **names) {
+
+        char **property;
+
+        assert_return(bus, -EINVAL);
+        assert_return(object_path_is_valid(path), -EINVAL);
+        assert_return(interface_name_is_valid(interface), -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        if (!BUS_IS_OPEN(bus->state))
+                return -ENOTCONN;
+
+        /* A non-NULL but empty names list means nothing needs to be
+           generated. A NULL list OTOH indicates that all properties
+           that are set to EMITS_CHANGE or EMITS_INVALIDATION shall be
+           included in the PropertiesChanged message. */
+        if (names && names[0] == NULL)
+                return 0;
+
+        /* When coalescing, the signal is generated later on from the
+         * event loop, with the values current at that time. Whether
+         * the object and properties actually exist is only checked
+         * then, too. */
+        if (bus->coalesce_properties && bus->event) {
+                STRV_FOREACH(property, names)
+                        assert_return(member_name_is_valid(*property), -EINVAL);
+
+                return queue_properties_changed(bus, path, interface, names);
+        }
+
+        return emit_properties_changed(bus, path, interface, names);
+}
+
 _public_ int sd_bus_emit_properties_changed(
                 sd_bus *bus,
                 const char *path,
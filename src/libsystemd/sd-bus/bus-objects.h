@@ -25,3 +25,7 @@
 
 int bus_process_object(sd_bus *bus, sd_bus_message *m);
 void bus_node_gc(sd_bus *b, struct node *n);
+
+int bus_process_properties_changed(sd_bus *bus);
+int bus_process_properties_changed_path(sd_bus *bus, const char *path);
+void bus_drop_properties_changed(sd_bus *bus);
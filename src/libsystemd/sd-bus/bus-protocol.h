@@ -95,6 +95,16 @@ enum {
         _BUS_MESSAGE_HEADER_MAX
 };
 
+/* Not part of the D-Bus specification. Only used on socket
+ * connections on which both sides agreed to EXTENSION_NEGOTIATE_MEMFD
+ * during authentication. If a message comes with sealed memfds in
+ * place of some of its body, this field, with signature "at", is the
+ * first one of the header. For each memfd it carries three numbers:
+ * the offset in the body it is inserted at, the offset in the memfd
+ * and the size. The memfds follow the other fds of the message, the
+ * body size in the header only counts the bytes actually sent. */
+#define BUS_MESSAGE_HEADER_SOCKET_MEMFDS 0x80
+
 /* RequestName parameters */
 
 enum  {
@@ -150,7 +150,7 @@ void bus_slot_disconnect(sd_bus_slot *slot) {
                                 case _SD_BUS_VTABLE_METHOD: {
                                         struct vtable_member key;
 
-                                        key.path = slot->node_vtable.node->path;
+                                        key.node = slot->node_vtable.node;
                                         key.interface = slot->node_vtable.interface;
                                         key.member = v->x.method.member;
 
@@ -162,7 +162,7 @@ void bus_slot_disconnect(sd_bus_slot *slot) {
                                 case _SD_BUS_VTABLE_WRITABLE_PROPERTY: {
                                         struct vtable_member key;
 
-                                        key.path = slot->node_vtable.node->path;
+                                        key.node = slot->node_vtable.node;
                                         key.interface = slot->node_vtable.interface;
                                         key.member = v->x.method.member;
 
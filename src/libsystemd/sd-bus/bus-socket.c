@@ -20,6 +20,7 @@
 ***/
 
 #include <endian.h>
+#include <limits.h>
 #include <poll.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -29,23 +30,29 @@
 
 #include "alloc-util.h"
 #include "bus-internal.h"
+#include "bus-kernel.h"
 #include "bus-message.h"
 #include "bus-socket.h"
 #include "fd-util.h"
 #include "formats-util.h"
 #include "hexdecoct.h"
 #include "macro.h"
+#include "memfd-util.h"
 #include "missing.h"
 #include "selinux-util.h"
 #include "signal-util.h"
 #include "stdio-util.h"
 #include "string-util.h"
+#include "unaligned.h"
 #include "user-util.h"
 #include "utf8.h"
 #include "util.h"
 
 #define SNDBUF_SIZE (8*1024*1024)
 
+/* How much to read beyond the message we are waiting for */
+#define READ_AHEAD_SIZE (4*1024)
+
 static void iovec_advance(struct iovec iov[], unsigned *idx, size_t size) {
 
         while (size > 0) {
@@ -78,6 +85,94 @@ static int append_iovec(sd_bus_message *m, const void *p, size_t sz) {
         return 0;
 }
 
+static bool bus_body_part_pass_memfd(sd_bus_message *m, struct bus_body_part *part) {
+        assert(m);
+        assert(part);
+
+        if (!m->bus->can_memfd)
+                return false;
+
+        /* Only sealed memfds can be handed out, the receiver must be
+         * sure the data doesn't change underneath it */
+        if (part->memfd < 0 || !part->sealed)
+                return false;
+
+        return part->size >= MEMFD_MIN_SIZE || m->bus->use_memfd < 0;
+}
+
+static int bus_message_setup_wire_header(sd_bus_message *m) {
+        struct bus_body_part *part;
+        struct bus_header *h;
+        uint64_t offset = 0, *entry;
+        size_t field_size, passed = 0;
+        unsigned n = 0, i;
+        uint8_t *f;
+
+        assert(m);
+
+        if (BUS_MESSAGE_IS_GVARIANT(m))
+                return 0;
+
+        MESSAGE_FOREACH_PART(part, i, m)
+                if (bus_body_part_pass_memfd(m, part))
+                        n++;
+
+        if (n == 0)
+                return 0;
+
+        if (m->n_fds + n > BUS_FDS_MAX)
+                return 0;
+
+        /* The field goes first, so that the fields following it stay
+         * aligned as they are. It's a multiple of 8 bytes long. */
+        field_size = 16 + n * 3 * sizeof(uint64_t);
+
+        m->wire_header = malloc0(sizeof(struct bus_header) + field_size);
+        if (!m->wire_header)
+                return -ENOMEM;
+
+        m->wire_fds = new(int, m->n_fds + n);
+        if (!m->wire_fds) {
+                m->wire_header = mfree(m->wire_header);
+                return -ENOMEM;
+        }
+
+        if (m->n_fds > 0)
+                memcpy(m->wire_fds, m->fds, sizeof(int) * m->n_fds);
+        m->n_wire_fds = m->n_fds;
+
+        f = (uint8_t*) m->wire_header + sizeof(struct bus_header);
+        f[0] = BUS_MESSAGE_HEADER_SOCKET_MEMFDS;
+        f[1] = 2;
+        f[2] = SD_BUS_TYPE_ARRAY;
+        f[3] = SD_BUS_TYPE_UINT64;
+        *(uint32_t*) (f + 8) = BUS_MESSAGE_BSWAP32(m, n * 3 * sizeof(uint64_t));
+
+        entry = (uint64_t*) (f + 16);
+        MESSAGE_FOREACH_PART(part, i, m) {
+                if (bus_body_part_pass_memfd(m, part)) {
+                        *(entry++) = BUS_MESSAGE_BSWAP64(m, offset);
+                        *(entry++) = BUS_MESSAGE_BSWAP64(m, part->memfd_offset);
+                        *(entry++) = BUS_MESSAGE_BSWAP64(m, part->size);
+
+                        m->wire_fds[m->n_wire_fds++] = part->memfd;
+                        passed += part->size;
+                }
+
+                offset += part->size;
+        }
+
+        h = m->wire_header;
+        memcpy(h, m->header, sizeof(struct bus_header));
+        h->dbus1.fields_size = BUS_MESSAGE_BSWAP32(m, field_size + m->fields_size);
+        h->dbus1.body_size = BUS_MESSAGE_BSWAP32(m, m->body_size - passed);
+
+        m->wire_header_size = sizeof(struct bus_header) + field_size;
+        m->wire_size = BUS_MESSAGE_SIZE(m) + field_size - passed;
+
+        return 0;
+}
+
 static int bus_message_setup_iovec(sd_bus_message *m) {
         struct bus_body_part *part;
         unsigned n, i;
@@ -91,7 +186,11 @@ static int bus_message_setup_iovec(sd_bus_message *m) {
 
         assert(!m->iovec);
 
-        n = 1 + m->n_body_parts;
+        r = bus_message_setup_wire_header(m);
+        if (r < 0)
+                goto fail;
+
+        n = 1 + m->n_body_parts + !!m->wire_header;
         if (n < ELEMENTSOF(m->iovec_fixed))
                 m->iovec = m->iovec_fixed;
         else {
@@ -102,11 +201,25 @@ static int bus_message_setup_iovec(sd_bus_message *m) {
                 }
         }
 
-        r = append_iovec(m, m->header, BUS_MESSAGE_BODY_BEGIN(m));
+        if (m->wire_header) {
+                /* Our own copy of the fixed header and the memfd
+                 * field, then the rest of the fields as they are */
+                r = append_iovec(m, m->wire_header, m->wire_header_size);
+                if (r < 0)
+                        goto fail;
+
+                r = append_iovec(m, BUS_MESSAGE_FIELDS(m), BUS_MESSAGE_BODY_BEGIN(m) - sizeof(struct bus_header));
+        } else
+                r = append_iovec(m, m->header, BUS_MESSAGE_BODY_BEGIN(m));
         if (r < 0)
                 goto fail;
 
         MESSAGE_FOREACH_PART(part, i, m)  {
+                if (m->wire_header && bus_body_part_pass_memfd(m, part)) {
+                        n--;
+                        continue;
+                }
+
                 r = bus_body_part_map(part);
                 if (r < 0)
                         goto fail;
@@ -175,15 +288,15 @@ static int bus_socket_write_auth(sd_bus *b) {
 }
 
 static int bus_socket_auth_verify_client(sd_bus *b) {
-        char *e, *f, *start;
+        char *e, *f, *g, *start;
         sd_id128_t peer;
         unsigned i;
         int r;
 
         assert(b);
 
-        /* We expect two response lines: "OK" and possibly
-         * "AGREE_UNIX_FD" */
+        /* We expect up to three response lines: "OK", possibly
+         * "AGREE_UNIX_FD" and possibly "EXTENSION_AGREE_MEMFD" */
 
         e = memmem_safe(b->rbuffer, b->rbuffer_size, "\r\n", 2);
         if (!e)
@@ -200,6 +313,15 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
                 start = e + 2;
         }
 
+        if (f && b->accept_memfd) {
+                g = memmem(f + 2, b->rbuffer_size - (f - (char*) b->rbuffer) - 2, "\r\n", 2);
+                if (!g)
+                        return 0;
+
+                start = g + 2;
+        } else
+                g = NULL;
+
         /* Nice! We got all the lines we need. First check the OK
          * line */
 
@@ -236,6 +358,14 @@ static int bus_socket_auth_verify_client(sd_bus *b) {
                         (f - e == strlen("\r\nAGREE_UNIX_FD")) &&
                         memcmp(e + 2, "AGREE_UNIX_FD", strlen("AGREE_UNIX_FD")) == 0;
 
+        /* A peer that doesn't know the extension will answer with an
+         * ERROR, which is fine */
+        if (g)
+                b->can_memfd =
+                        b->can_fds &&
+                        (g - f == strlen("\r\nEXTENSION_AGREE_MEMFD")) &&
+                        memcmp(f + 2, "EXTENSION_AGREE_MEMFD", strlen("EXTENSION_AGREE_MEMFD")) == 0;
+
         b->rbuffer_size -= (start - (char*) b->rbuffer);
         memmove(b->rbuffer, start, b->rbuffer_size);
 
@@ -481,6 +611,13 @@ static int bus_socket_auth_verify_server(sd_bus *b) {
                                 b->can_fds = true;
                                 r = bus_socket_auth_write(b, "AGREE_UNIX_FD\r\n");
                         }
+                } else if (line_equals(line, l, "EXTENSION_NEGOTIATE_MEMFD")) {
+                        if (b->auth == _BUS_AUTH_INVALID || !b->can_fds || !b->accept_memfd)
+                                r = bus_socket_auth_write(b, "ERROR\r\n");
+                        else {
+                                b->can_memfd = true;
+                                r = bus_socket_auth_write(b, "EXTENSION_AGREE_MEMFD\r\n");
+                        }
                 } else
                         r = bus_socket_auth_write(b, "ERROR\r\n");
 
@@ -642,7 +779,9 @@ static int bus_socket_start_auth_client(sd_bus *b) {
         if (!b->auth_buffer)
                 return -ENOMEM;
 
-        if (b->hello_flags & KDBUS_HELLO_ACCEPT_FD)
+        if ((b->hello_flags & KDBUS_HELLO_ACCEPT_FD) && b->accept_memfd)
+                auth_suffix = "\r\nNEGOTIATE_UNIX_FD\r\nEXTENSION_NEGOTIATE_MEMFD\r\nBEGIN\r\n";
+        else if (b->hello_flags & KDBUS_HELLO_ACCEPT_FD)
                 auth_suffix = "\r\nNEGOTIATE_UNIX_FD\r\nBEGIN\r\n";
         else
                 auth_suffix = "\r\nBEGIN\r\n";
@@ -768,54 +907,82 @@ int bus_socket_take_fd(sd_bus *b) {
         return bus_socket_start_auth(b);
 }
 
-int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+int bus_socket_write_messages(sd_bus *bus, sd_bus_message **messages, unsigned n_messages, size_t *idx) {
         struct iovec *iov;
         ssize_t k;
-        size_t n;
-        unsigned j;
+        unsigned i, j, n_iovec = 0;
+        sd_bus_message *m;
         int r;
 
         assert(bus);
-        assert(m);
+        assert(messages);
+        assert(n_messages > 0);
         assert(idx);
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
-        if (*idx >= BUS_MESSAGE_SIZE(m))
-                return 0;
+        m = messages[0];
 
         r = bus_message_setup_iovec(m);
         if (r < 0)
                 return r;
 
-        n = m->n_iovec * sizeof(struct iovec);
-        iov = alloca(n);
-        memcpy(iov, m->iovec, n);
+        if (*idx >= BUS_MESSAGE_WIRE_SIZE(m))
+                return 0;
+
+        /* Gather as many of the messages as we can into a single
+         * syscall. File descriptors are attached to the first byte we
+         * write, hence a message that carries some may only start a
+         * batch, never continue one. */
+        for (i = 0; i < n_messages; i++) {
+                r = bus_message_setup_iovec(messages[i]);
+                if (r < 0)
+                        return r;
+
+                if (i > 0 && BUS_MESSAGE_N_WIRE_FDS(messages[i]) > 0)
+                        break;
+
+                if (i > 0 && n_iovec + messages[i]->n_iovec > IOV_MAX)
+                        break;
+
+                n_iovec += messages[i]->n_iovec;
+        }
+
+        n_messages = i;
+
+        iov = newa(struct iovec, n_iovec);
+        for (i = 0, j = 0; i < n_messages; i++) {
+                memcpy(iov + j, messages[i]->iovec, messages[i]->n_iovec * sizeof(struct iovec));
+                j += messages[i]->n_iovec;
+        }
 
         j = 0;
         iovec_advance(iov, &j, *idx);
 
         if (bus->prefer_writev)
-                k = writev(bus->output_fd, iov, m->n_iovec);
+                k = writev(bus->output_fd, iov, n_iovec);
         else {
                 struct msghdr mh = {
                         .msg_iov = iov,
-                        .msg_iovlen = m->n_iovec,
+                        .msg_iovlen = n_iovec,
                 };
 
-                if (m->n_fds > 0) {
+                /* Only pass the fds along with the beginning of the
+                 * message, not again when we continue a partial write */
+                if (BUS_MESSAGE_N_WIRE_FDS(m) > 0 && *idx == 0) {
                         struct cmsghdr *control;
+                        unsigned n_fds = BUS_MESSAGE_N_WIRE_FDS(m);
 
-                        mh.msg_control = control = alloca(CMSG_SPACE(sizeof(int) * m->n_fds));
-                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * m->n_fds);
+                        mh.msg_control = control = alloca(CMSG_SPACE(sizeof(int) * n_fds));
+                        mh.msg_controllen = control->cmsg_len = CMSG_LEN(sizeof(int) * n_fds);
                         control->cmsg_level = SOL_SOCKET;
                         control->cmsg_type = SCM_RIGHTS;
-                        memcpy(CMSG_DATA(control), m->fds, sizeof(int) * m->n_fds);
+                        memcpy(CMSG_DATA(control), m->wire_header ? m->wire_fds : m->fds, sizeof(int) * n_fds);
                 }
 
                 k = sendmsg(bus->output_fd, &mh, MSG_DONTWAIT|MSG_NOSIGNAL);
                 if (k < 0 && errno == ENOTSOCK) {
                         bus->prefer_writev = true;
-                        k = writev(bus->output_fd, iov, m->n_iovec);
+                        k = writev(bus->output_fd, iov, n_iovec);
                 }
         }
 
@@ -826,6 +993,10 @@ int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
         return 1;
 }
 
+int bus_socket_write_message(sd_bus *bus, sd_bus_message *m, size_t *idx) {
+        return bus_socket_write_messages(bus, &m, 1, idx);
+}
+
 static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         uint32_t a, b;
         uint8_t e;
@@ -878,8 +1049,353 @@ static int bus_socket_read_message_need(sd_bus *bus, size_t *need) {
         return 0;
 }
 
+static uint32_t bus_socket_read_uint32(uint8_t endian, const void *p) {
+        return endian == BUS_LITTLE_ENDIAN ? unaligned_read_le32(p) : unaligned_read_be32(p);
+}
+
+static uint64_t bus_socket_read_uint64(uint8_t endian, const void *p) {
+        return endian == BUS_LITTLE_ENDIAN ? unaligned_read_le64(p) : unaligned_read_be64(p);
+}
+
+static void bus_socket_write_uint32(uint8_t endian, void *p, uint32_t u) {
+        if (endian == BUS_LITTLE_ENDIAN)
+                unaligned_write_le32(p, u);
+        else
+                unaligned_write_be32(p, u);
+}
+
+static int bus_socket_peek_memfds(const void *p, size_t size, size_t *ret_field_size) {
+        const struct bus_header *h = p;
+        const uint8_t *f;
+        size_t fields_size;
+        uint32_t l;
+
+        assert(p);
+        assert(size >= sizeof(struct bus_header));
+        assert(ret_field_size);
+
+        /* Returns how many memfds a dbus1 message carries in place
+         * of parts of its body, and how long the field is that
+         * describes them. See BUS_MESSAGE_HEADER_SOCKET_MEMFDS. */
+
+        if (h->version != 1)
+                return -EOPNOTSUPP;
+        if (!IN_SET(h->endian, BUS_LITTLE_ENDIAN, BUS_BIG_ENDIAN))
+                return -EBADMSG;
+
+        fields_size = bus_socket_read_uint32(h->endian, &h->dbus1.fields_size);
+        if (fields_size > size - sizeof(struct bus_header))
+                return -EBADMSG;
+
+        f = (const uint8_t*) p + sizeof(struct bus_header);
+
+        if (fields_size < 16 || f[0] != BUS_MESSAGE_HEADER_SOCKET_MEMFDS) {
+                *ret_field_size = 0;
+                return 0;
+        }
+
+        if (f[1] != 2 || f[2] != SD_BUS_TYPE_ARRAY || f[3] != SD_BUS_TYPE_UINT64 || f[4] != 0)
+                return -EBADMSG;
+
+        l = bus_socket_read_uint32(h->endian, f + 8);
+        if (l == 0 || l % (3 * sizeof(uint64_t)) != 0 || l > fields_size - 16)
+                return -EBADMSG;
+
+        *ret_field_size = 16 + l;
+        return (int) (l / (3 * sizeof(uint64_t)));
+}
+
+static int bus_socket_peek_unix_fds(const void *p, size_t size, bool memfds, unsigned *ret) {
+        const struct bus_header *h = p;
+        const uint8_t *f;
+        size_t fields_size, i = 0;
+        unsigned n_memfds = 0;
+        int r;
+
+        assert(p);
+        assert(size >= sizeof(struct bus_header));
+        assert(ret);
+
+        /* Determines how many fds a dbus1 message wants, without
+         * fully parsing it, so that we can tell which of the fds we
+         * received belong to it. */
+
+        if (h->version != 1)
+                return -EOPNOTSUPP;
+        if (!IN_SET(h->endian, BUS_LITTLE_ENDIAN, BUS_BIG_ENDIAN))
+                return -EBADMSG;
+
+        fields_size = bus_socket_read_uint32(h->endian, &h->dbus1.fields_size);
+        if (fields_size > size - sizeof(struct bus_header))
+                return -EBADMSG;
+
+        f = (const uint8_t*) p + sizeof(struct bus_header);
+
+        /* Passed memfds come on top of the ones the message itself
+         * carries, but only if we agreed on passing them. Otherwise
+         * the field is just one we don't know. */
+        if (memfds) {
+                r = bus_socket_peek_memfds(p, size, &i);
+                if (r < 0)
+                        return r;
+                n_memfds = r;
+        }
+
+        while (i < fields_size) {
+                uint8_t code;
+                uint32_t l;
+
+                /* Each field is a struct of a code byte and a
+                 * variant, whose signature is a single type char for
+                 * all the fields dbus1 defines */
+                i = ALIGN_TO(i, 8);
+                if (i + 4 > fields_size)
+                        return -EBADMSG;
+
+                code = f[i];
+
+                /* Arrays of fixed size elements, like the memfd
+                 * field, are easy enough to skip too */
+                if (f[i+1] == 2 && f[i+2] == SD_BUS_TYPE_ARRAY && bus_type_is_trivial(f[i+3])) {
+                        size_t align;
+
+                        if (i + 5 > fields_size || f[i+4] != 0)
+                                return -EBADMSG;
+
+                        align = bus_type_get_alignment(f[i+3]);
+
+                        i = ALIGN_TO(i + 5, 4);
+                        if (i + 4 > fields_size)
+                                return -EBADMSG;
+
+                        l = bus_socket_read_uint32(h->endian, f + i);
+                        i = ALIGN_TO(i + 4, align);
+                        if (i > fields_size || l > fields_size - i)
+                                return -EBADMSG;
+
+                        i += l;
+                        continue;
+                }
+
+                if (f[i+1] != 1 || f[i+3] != 0)
+                        return -EOPNOTSUPP;
+
+                switch (f[i+2]) {
+
+                case SD_BUS_TYPE_UINT32:
+                        i = ALIGN_TO(i + 4, 4);
+                        if (i + 4 > fields_size)
+                                return -EBADMSG;
+
+                        if (code == BUS_MESSAGE_HEADER_UNIX_FDS) {
+                                *ret = bus_socket_read_uint32(h->endian, f + i) + n_memfds;
+                                return 0;
+                        }
+
+                        i += 4;
+                        break;
+
+                case SD_BUS_TYPE_STRING:
+                case SD_BUS_TYPE_OBJECT_PATH:
+                        i = ALIGN_TO(i + 4, 4);
+                        if (i + 4 > fields_size)
+                                return -EBADMSG;
+
+                        l = bus_socket_read_uint32(h->endian, f + i);
+                        if ((uint64_t) l + 1 > fields_size - i - 4)
+                                return -EBADMSG;
+
+                        i += 4 + l + 1;
+                        break;
+
+                case SD_BUS_TYPE_SIGNATURE:
+                        i += 4;
+                        if (i + 1 > fields_size)
+                                return -EBADMSG;
+
+                        l = f[i];
+                        if ((uint64_t) l + 1 > fields_size - i - 1)
+                                return -EBADMSG;
+
+                        i += 1 + l + 1;
+                        break;
+
+                default:
+                        return -EOPNOTSUPP;
+                }
+        }
+
+        *ret = n_memfds;
+        return 0;
+}
+
+static int bus_socket_make_memfd_message(
+                sd_bus *bus,
+                void *buffer,
+                size_t size,
+                size_t field_size,
+                int *fds,
+                unsigned n_fds,
+                unsigned n_memfds,
+                sd_bus_message **ret) {
+
+        struct bus_header *h = buffer;
+        struct bus_body_part *part;
+        sd_bus_message *m = NULL;
+        const uint8_t *entry;
+        uint64_t pos = 0, passed = 0, inline_size = 0;
+        uint64_t *offsets, *memfd_offsets, *sizes;
+        size_t fields_size, body_size;
+        uint8_t *p, *end;
+        unsigned i;
+        int r;
+
+        assert(bus);
+        assert(buffer);
+        assert(field_size > 0);
+        assert(ret);
+
+        /* Turns a message that came with memfds in place of parts of
+         * its body back into what the sender had: the field is
+         * dropped from the header, and each memfd becomes a body
+         * part of its own, which is only mapped when read from. */
+
+        if (n_memfds > n_fds)
+                return -EBADMSG;
+
+        fields_size = bus_socket_read_uint32(h->endian, &h->dbus1.fields_size);
+        body_size = bus_socket_read_uint32(h->endian, &h->dbus1.body_size);
+
+        offsets = newa(uint64_t, n_memfds);
+        memfd_offsets = newa(uint64_t, n_memfds);
+        sizes = newa(uint64_t, n_memfds);
+
+        entry = (const uint8_t*) buffer + sizeof(struct bus_header) + 16;
+        for (i = 0; i < n_memfds; i++, entry += 3 * sizeof(uint64_t)) {
+                uint64_t memfd_size;
+                int fd = fds[n_fds - n_memfds + i];
+
+                offsets[i] = bus_socket_read_uint64(h->endian, entry);
+                memfd_offsets[i] = bus_socket_read_uint64(h->endian, entry + 8);
+                sizes[i] = bus_socket_read_uint64(h->endian, entry + 16);
+
+                if (sizes[i] == 0 || sizes[i] >= BUS_MESSAGE_SIZE_MAX ||
+                    offsets[i] < pos || offsets[i] >= BUS_MESSAGE_SIZE_MAX)
+                        return -EBADMSG;
+
+                /* Only take sealed memfds, nobody may change them
+                 * underneath us */
+                r = memfd_get_sealed(fd);
+                if (r <= 0)
+                        return -EBADMSG;
+
+                r = memfd_get_size(fd, &memfd_size);
+                if (r < 0)
+                        return r;
+
+                if (memfd_offsets[i] > memfd_size || sizes[i] > memfd_size - memfd_offsets[i])
+                        return -EBADMSG;
+
+                inline_size += offsets[i] - pos;
+                passed += sizes[i];
+                pos = offsets[i] + sizes[i];
+        }
+
+        if (inline_size > body_size)
+                return -EBADMSG;
+        if (body_size + passed >= BUS_MESSAGE_SIZE_MAX)
+                return -EBADMSG;
+
+        /* Drop the field, the fields following it are 8 byte aligned
+         * as before */
+        memmove((uint8_t*) buffer + sizeof(struct bus_header),
+                (uint8_t*) buffer + sizeof(struct bus_header) + field_size,
+                size - sizeof(struct bus_header) - field_size);
+        size -= field_size;
+        fields_size -= field_size;
+
+        bus_socket_write_uint32(h->endian, &h->dbus1.fields_size, fields_size);
+        bus_socket_write_uint32(h->endian, &h->dbus1.body_size, body_size + passed);
+
+        r = bus_message_from_header(
+                        bus,
+                        buffer, size,
+                        buffer, size,
+                        size + passed,
+                        fds, n_fds - n_memfds,
+                        NULL,
+                        0, &m);
+        if (r < 0)
+                return r;
+
+        p = (uint8_t*) buffer + BUS_MESSAGE_BODY_BEGIN(m);
+        end = (uint8_t*) buffer + size;
+        pos = 0;
+
+        for (i = 0; i <= n_memfds; i++) {
+                uint64_t n;
+
+                /* What was sent inline before the memfd, or after
+                 * the last one */
+                n = i < n_memfds ? offsets[i] - pos : (uint64_t) (end - p);
+                if (n > 0) {
+                        part = message_append_part(m);
+                        if (!part) {
+                                r = -ENOMEM;
+                                goto fail;
+                        }
+
+                        part->data = p;
+                        part->size = n;
+                        part->sealed = true;
+                        p += n;
+                }
+
+                if (i == n_memfds)
+                        break;
+
+                part = message_append_part(m);
+                if (!part) {
+                        r = -ENOMEM;
+                        goto fail;
+                }
+
+                part->memfd = fds[n_fds - n_memfds + i];
+                part->memfd_offset = memfd_offsets[i];
+                part->size = sizes[i];
+                part->sealed = true;
+
+                pos = offsets[i] + sizes[i];
+        }
+
+        r = bus_message_parse_fields(m);
+        if (r < 0)
+                goto fail;
+
+        /* We take possession of the memory and fds now */
+        m->free_header = true;
+        m->free_fds = true;
+
+        *ret = m;
+        return 0;
+
+fail:
+        /* The memfds are still the caller's */
+        MESSAGE_FOREACH_PART(part, i, m)
+                if (part->memfd >= 0) {
+                        bus_body_part_unmap(part);
+                        part->memfd = -1;
+                }
+
+        sd_bus_message_unref(m);
+        return r;
+}
+
 static int bus_socket_make_message(sd_bus *bus, size_t size) {
         sd_bus_message *t;
+        unsigned n_fds, n_memfds = 0;
+        size_t field_size = 0;
+        int *fds;
         void *b;
         int r;
 
@@ -891,20 +1407,61 @@ static int bus_socket_make_message(sd_bus *bus, size_t size) {
         if (r < 0)
                 return r;
 
+        if (bus->can_memfd) {
+                r = bus_socket_peek_memfds(bus->rbuffer, size, &field_size);
+                if (r < 0)
+                        return r;
+
+                n_memfds = r;
+        }
+
+        /* Since we read ahead, the fds we got so far might partly
+         * belong to the messages following this one. If we cannot
+         * tell, hand all of them to this one, as we always did. */
+        n_fds = bus->n_fds;
+        if (n_fds > 0) {
+                unsigned n;
+
+                r = bus_socket_peek_unix_fds(bus->rbuffer, size, bus->can_memfd, &n);
+                if (r >= 0 && n < n_fds)
+                        n_fds = n;
+        }
+
+        if (n_fds < bus->n_fds) {
+                if (n_fds > 0) {
+                        fds = newdup(int, bus->fds, n_fds);
+                        if (!fds)
+                                return -ENOMEM;
+                } else
+                        fds = NULL;
+        } else
+                fds = bus->fds;
+
         if (bus->rbuffer_size > size) {
                 b = memdup((const uint8_t*) bus->rbuffer + size,
                            bus->rbuffer_size - size);
-                if (!b)
+                if (!b) {
+                        if (fds != bus->fds)
+                                free(fds);
                         return -ENOMEM;
+                }
         } else
                 b = NULL;
 
-        r = bus_message_from_malloc(bus,
-                                    bus->rbuffer, size,
-                                    bus->fds, bus->n_fds,
-                                    NULL,
-                                    &t);
+        if (n_memfds > 0)
+                r = bus_socket_make_memfd_message(bus,
+                                                  bus->rbuffer, size, field_size,
+                                                  fds, n_fds, n_memfds,
+                                                  &t);
+        else
+                r = bus_message_from_malloc(bus,
+                                            bus->rbuffer, size,
+                                            fds, n_fds,
+                                            NULL,
+                                            &t);
         if (r < 0) {
+                if (fds != bus->fds)
+                        free(fds);
                 free(b);
                 return r;
         }
@@ -912,8 +1469,13 @@ static int bus_socket_make_message(sd_bus *bus, size_t size) {
         bus->rbuffer = b;
         bus->rbuffer_size -= size;
 
-        bus->fds = NULL;
-        bus->n_fds = 0;
+        if (fds == bus->fds) {
+                bus->fds = NULL;
+                bus->n_fds = 0;
+        } else {
+                memmove(bus->fds, bus->fds + n_fds, sizeof(int) * (bus->n_fds - n_fds));
+                bus->n_fds -= n_fds;
+        }
 
         bus->rqueue[bus->rqueue_size++] = t;
 
@@ -943,14 +1505,16 @@ int bus_socket_read_message(sd_bus *bus) {
         if (bus->rbuffer_size >= need)
                 return bus_socket_make_message(bus, need);
 
-        b = realloc(bus->rbuffer, need);
+        /* Read a bit more than we need, so that a series of small
+         * messages is picked up with a single syscall */
+        b = realloc(bus->rbuffer, need + READ_AHEAD_SIZE);
         if (!b)
                 return -ENOMEM;
 
         bus->rbuffer = b;
 
         iov.iov_base = (uint8_t*) bus->rbuffer + bus->rbuffer_size;
-        iov.iov_len = need - bus->rbuffer_size;
+        iov.iov_len = need + READ_AHEAD_SIZE - bus->rbuffer_size;
 
         if (bus->prefer_readv)
                 k = readv(bus->input_fd, &iov, 1);
@@ -1008,14 +1572,21 @@ int bus_socket_read_message(sd_bus *bus) {
                                           cmsg->cmsg_level, cmsg->cmsg_type);
         }
 
-        r = bus_socket_read_message_need(bus, &need);
-        if (r < 0)
-                return r;
+        /* Queue everything complete we read ahead right away. The fd
+         * won't be readable anymore for it, hence if we left it in
+         * the buffer nobody would come back for it. */
+        for (;;) {
+                r = bus_socket_read_message_need(bus, &need);
+                if (r < 0)
+                        return r;
 
-        if (bus->rbuffer_size >= need)
-                return bus_socket_make_message(bus, need);
+                if (bus->rbuffer_size < need)
+                        return 1;
 
-        return 1;
+                r = bus_socket_make_message(bus, need);
+                if (r < 0)
+                        return r;
+        }
 }
 
 int bus_socket_process_opening(sd_bus *b) {
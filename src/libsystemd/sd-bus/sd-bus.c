@@ -163,6 +163,8 @@ static void bus_free(sd_bus *b) {
         hashmap_free_free(b->vtable_methods);
         hashmap_free_free(b->vtable_properties);
 
+        bus_drop_properties_changed(b);
+
         assert(hashmap_isempty(b->nodes));
         hashmap_free(b->nodes);
 
@@ -170,6 +172,9 @@ static void bus_free(sd_bus *b) {
 
         assert_se(pthread_mutex_destroy(&b->memfd_cache_mutex) == 0);
 
+        mempool_drop(&b->message_pool);
+        assert_se(pthread_mutex_destroy(&b->message_pool_mutex) == 0);
+
         free(b);
 }
 
@@ -192,6 +197,10 @@ _public_ int sd_bus_new(sd_bus **ret) {
 
         assert_se(pthread_mutex_init(&r->memfd_cache_mutex, NULL) == 0);
 
+        assert_se(pthread_mutex_init(&r->message_pool_mutex, NULL) == 0);
+        r->message_pool.tile_size = BUS_MESSAGE_TILE_SIZE;
+        r->message_pool.at_least = 16;
+
         /* We guarantee that wqueue always has space for at least one
          * entry */
         if (!GREEDY_REALLOC(r->wqueue, r->wqueue_allocated, 1)) {
@@ -288,6 +297,15 @@ _public_ int sd_bus_negotiate_fds(sd_bus *bus, int b) {
         return 0;
 }
 
+_public_ int sd_bus_negotiate_memfd(sd_bus *bus, int b) {
+        assert_return(bus, -EINVAL);
+        assert_return(bus->state == BUS_UNSET, -EPERM);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        bus->accept_memfd = b;
+        return 0;
+}
+
 _public_ int sd_bus_negotiate_timestamp(sd_bus *bus, int b) {
         uint64_t new_flags;
         assert_return(bus, -EINVAL);
@@ -387,6 +405,30 @@ _public_ int sd_bus_get_allow_interactive_authorization(sd_bus *bus) {
         return bus->allow_interactive_authorization;
 }
 
+_public_ int sd_bus_set_coalesce_properties(sd_bus *bus, int b) {
+        int r;
+
+        assert_return(bus, -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        /* Don't leave anything behind when turning this off */
+        if (!b && bus->coalesce_properties && BUS_IS_OPEN(bus->state)) {
+                r = bus_process_properties_changed(bus);
+                if (r < 0)
+                        return r;
+        }
+
+        bus->coalesce_properties = !!b;
+        return 0;
+}
+
+_public_ int sd_bus_get_coalesce_properties(sd_bus *bus) {
+        assert_return(bus, -EINVAL);
+        assert_return(!bus_pid_changed(bus), -ECHILD);
+
+        return bus->coalesce_properties;
+}
+
 static int hello_callback(sd_bus_message *reply, void *userdata, sd_bus_error *error) {
         const char *s;
         sd_bus *bus;
@@ -1616,6 +1658,21 @@ int bus_seal_synthetic_message(sd_bus *b, sd_bus_message *m) {
         return bus_message_seal(m, 0xFFFFFFFFULL, 0);
 }
 
+static void bus_log_sent_message(sd_bus_message *m) {
+        assert(m);
+
+        log_debug("Sent message type=%s sender=%s destination=%s object=%s interface=%s member=%s cookie=%" PRIu64 " reply_cookie=%" PRIu64 " error=%s",
+                  bus_message_type_to_string(m->header->type),
+                  strna(sd_bus_message_get_sender(m)),
+                  strna(sd_bus_message_get_destination(m)),
+                  strna(sd_bus_message_get_path(m)),
+                  strna(sd_bus_message_get_interface(m)),
+                  strna(sd_bus_message_get_member(m)),
+                  BUS_MESSAGE_COOKIE(m),
+                  m->reply_cookie,
+                  strna(m->error.message));
+}
+
 static int bus_write_message(sd_bus *bus, sd_bus_message *m, bool hint_sync_call, size_t *idx) {
         int r;
 
@@ -1630,17 +1687,8 @@ static int bus_write_message(sd_bus *bus, sd_bus_message *m, bool hint_sync_call
         if (r <= 0)
                 return r;
 
-        if (bus->is_kernel || *idx >= BUS_MESSAGE_SIZE(m))
-                log_debug("Sent message type=%s sender=%s destination=%s object=%s interface=%s member=%s cookie=%" PRIu64 " reply_cookie=%" PRIu64 " error=%s",
-                          bus_message_type_to_string(m->header->type),
-                          strna(sd_bus_message_get_sender(m)),
-                          strna(sd_bus_message_get_destination(m)),
-                          strna(sd_bus_message_get_path(m)),
-                          strna(sd_bus_message_get_interface(m)),
-                          strna(sd_bus_message_get_member(m)),
-                          BUS_MESSAGE_COOKIE(m),
-                          m->reply_cookie,
-                          strna(m->error.message));
+        if (bus->is_kernel || *idx >= BUS_MESSAGE_WIRE_SIZE(m))
+                bus_log_sent_message(m);
 
         return r;
 }
@@ -1652,15 +1700,37 @@ static int dispatch_wqueue(sd_bus *bus) {
         assert(bus->state == BUS_RUNNING || bus->state == BUS_HELLO);
 
         while (bus->wqueue_size > 0) {
+                unsigned n;
 
-                r = bus_write_message(bus, bus->wqueue[0], false, &bus->windex);
-                if (r < 0)
-                        return r;
-                else if (r == 0)
-                        /* Didn't do anything this time */
-                        return ret;
-                else if (bus->is_kernel || bus->windex >= BUS_MESSAGE_SIZE(bus->wqueue[0])) {
-                        /* Fully written. Let's drop the entry from
+                if (bus->is_kernel) {
+                        r = bus_write_message(bus, bus->wqueue[0], false, &bus->windex);
+                        if (r < 0)
+                                return r;
+                        else if (r == 0)
+                                /* Didn't do anything this time */
+                                return ret;
+
+                        n = 1;
+                        bus->windex = 0;
+                } else {
+                        /* On sockets, flush as much of the queue as
+                         * we can with a single syscall */
+                        r = bus_socket_write_messages(bus, bus->wqueue, bus->wqueue_size, &bus->windex);
+                        if (r < 0)
+                                return r;
+                        else if (r == 0)
+                                return ret;
+
+                        for (n = 0; n < bus->wqueue_size && bus->windex >= BUS_MESSAGE_WIRE_SIZE(bus->wqueue[n]); n++) {
+                                bus->windex -= BUS_MESSAGE_WIRE_SIZE(bus->wqueue[n]);
+                                bus_log_sent_message(bus->wqueue[n]);
+                        }
+                }
+
+                if (n > 0) {
+                        unsigned i;
+
+                        /* Fully written. Let's drop the entries from
                          * the queue.
                          *
                          * This isn't particularly optimized, but
@@ -1670,10 +1740,11 @@ static int dispatch_wqueue(sd_bus *bus) {
                          * it got full, then all bets are off
                          * anyway. */
 
-                        bus->wqueue_size --;
-                        sd_bus_message_unref(bus->wqueue[0]);
-                        memmove(bus->wqueue, bus->wqueue + 1, sizeof(sd_bus_message*) * bus->wqueue_size);
-                        bus->windex = 0;
+                        for (i = 0; i < n; i++)
+                                sd_bus_message_unref(bus->wqueue[i]);
+
+                        bus->wqueue_size -= n;
+                        memmove(bus->wqueue, bus->wqueue + n, sizeof(sd_bus_message*) * bus->wqueue_size);
 
                         ret = 1;
                 }
@@ -1791,7 +1862,7 @@ static int bus_send_internal(sd_bus *bus, sd_bus_message *_m, uint64_t *cookie,
                         return r;
                 }
 
-                if (!bus->is_kernel && idx < BUS_MESSAGE_SIZE(m))  {
+                if (!bus->is_kernel && idx < BUS_MESSAGE_WIRE_SIZE(m))  {
                         /* Wasn't fully written. So let's remember how
                          * much was written. Note that the first entry
                          * of the wqueue array is always allocated so
@@ -2913,6 +2984,10 @@ _public_ int sd_bus_flush(sd_bus *bus) {
         if (r < 0)
                 return r;
 
+        r = bus_process_properties_changed(bus);
+        if (r < 0)
+                return r;
+
         if (bus->wqueue_size <= 0)
                 return 0;
 
@@ -3297,6 +3372,18 @@ _public_ int sd_bus_detach_event(sd_bus *bus) {
                 bus->quit_event_source = sd_event_source_unref(bus->quit_event_source);
         }
 
+        if (bus->properties_changed_event_source) {
+                /* Without an event loop there's nobody to flush the
+                 * queued signals later, hence do so now */
+                if (BUS_IS_OPEN(bus->state))
+                        (void) bus_process_properties_changed(bus);
+                else
+                        bus_drop_properties_changed(bus);
+
+                sd_event_source_set_enabled(bus->properties_changed_event_source, SD_EVENT_OFF);
+                bus->properties_changed_event_source = sd_event_source_unref(bus->properties_changed_event_source);
+        }
+
         bus->event = sd_event_unref(bus->event);
         return 1;
 }
@@ -19,6 +19,7 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <sys/resource.h>
 #include <sys/wait.h>
 
 #include "sd-bus.h"
@@ -26,6 +27,8 @@
 #include "alloc-util.h"
 #include "bus-internal.h"
 #include "bus-kernel.h"
+#include "bus-message.h"
+#include "bus-objects.h"
 #include "bus-util.h"
 #include "def.h"
 #include "fd-util.h"
@@ -34,6 +37,8 @@
 
 #define MAX_SIZE (2*1024*1024)
 
+#define N_PIPELINED 64
+
 static usec_t arg_loop_usec = 100 * USEC_PER_MSEC;
 
 typedef enum Type {
@@ -79,7 +84,7 @@ static void server(sd_bus *b, size_t *result) {
         }
 }
 
-static void transaction(sd_bus *b, size_t sz, const char *server_name) {
+static unsigned transaction(sd_bus *b, size_t sz, const char *server_name) {
         _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL, *reply = NULL;
         uint8_t *p;
 
@@ -89,6 +94,125 @@ static void transaction(sd_bus *b, size_t sz, const char *server_name) {
         memset(p, 0x80, sz);
 
         assert_se(sd_bus_call(b, m, 0, NULL, &reply) >= 0);
+
+        /* Returns how many of the two messages came from the message
+         * pool of the bus, rather than from the heap */
+        return m->from_pool + reply->from_pool;
+}
+
+static uint64_t wakeups(void) {
+        struct rusage ru;
+
+        /* The client runs in a process of its own. Each time it has
+         * to wait for the socket it is switched out voluntarily, so
+         * this counts the round trips to the kernel that blocked */
+        assert_se(getrusage(RUSAGE_SELF, &ru) >= 0);
+
+        return (uint64_t) ru.ru_nvcsw;
+}
+
+static int pipeline_reply(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        unsigned *n_replies = userdata;
+
+        assert_se(!sd_bus_message_is_method_error(m, NULL));
+        (*n_replies)++;
+
+        return 0;
+}
+
+static void client_pipeline(sd_bus *b, const char *server_name) {
+        unsigned n_sent = 0, n_replies = 0, i;
+        uint64_t n_wakeups;
+        usec_t t;
+        int r;
+
+        /* Keep a number of calls in flight, so that messages queue
+         * up and the socket transport can batch them */
+
+        n_wakeups = wakeups();
+
+        t = now(CLOCK_MONOTONIC);
+        while (now(CLOCK_MONOTONIC) < t + arg_loop_usec) {
+                for (i = 0; i < N_PIPELINED; i++, n_sent++)
+                        assert_se(sd_bus_call_method_async(b, NULL, server_name, "/", "benchmark.server", "Ping", pipeline_reply, &n_replies, NULL) >= 0);
+
+                while (n_replies < n_sent) {
+                        r = sd_bus_process(b, NULL);
+                        assert_se(r >= 0);
+
+                        if (r == 0)
+                                assert_se(sd_bus_wait(b, USEC_INFINITY) >= 0);
+                }
+        }
+
+        n_wakeups = wakeups() - n_wakeups;
+
+        printf("PIPELINED\t%u\t%.2f wakeups/message\n",
+               (unsigned) ((n_sent * USEC_PER_SEC) / arg_loop_usec),
+               (double) n_wakeups / (2 * n_sent));
+}
+
+static int dispatch_handler(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        unsigned *n = userdata;
+
+        (*n)++;
+
+        return 1;
+}
+
+static const sd_bus_vtable dispatch_vtable[] = {
+        SD_BUS_VTABLE_START(0),
+        SD_BUS_METHOD("Start", "s", "o", dispatch_handler, 0),
+        SD_BUS_METHOD("Stop", "s", "o", dispatch_handler, 0),
+        SD_BUS_METHOD("Reload", "s", "o", dispatch_handler, 0),
+        SD_BUS_METHOD("Restart", "s", "o", dispatch_handler, 0),
+        SD_BUS_METHOD("Kill", "si", NULL, dispatch_handler, 0),
+        SD_BUS_METHOD("ResetFailed", NULL, NULL, dispatch_handler, 0),
+        SD_BUS_METHOD("Ping", NULL, NULL, dispatch_handler, 0),
+        SD_BUS_PROPERTY("Id", "s", NULL, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_PROPERTY("Description", "s", NULL, 0, SD_BUS_VTABLE_PROPERTY_CONST),
+        SD_BUS_VTABLE_END
+};
+
+static void benchmark_dispatch(void) {
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        unsigned n = 0, i;
+        int pair[2];
+        usec_t t, d;
+        sd_bus *b;
+
+        /* Measures the object dispatching only, looking up a method
+         * of a fallback vtable the way PID 1 has them for units */
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) >= 0);
+
+        assert_se(sd_bus_new(&b) >= 0);
+        assert_se(sd_bus_set_fd(b, pair[0], pair[0]) >= 0);
+        assert_se(sd_bus_set_trusted(b, true) >= 0);
+        assert_se(sd_bus_start(b) >= 0);
+
+        assert_se(sd_bus_add_fallback_vtable(b, NULL, "/org/freedesktop/benchmark/unit", "benchmark.Unit", dispatch_vtable, NULL, &n) >= 0);
+
+        assert_se(sd_bus_message_new_method_call(b, &m, NULL, "/org/freedesktop/benchmark/unit/foo_2eservice", "benchmark.Unit", "Ping") >= 0);
+        assert_se(bus_message_seal(m, 1, 0) >= 0);
+
+        t = now(CLOCK_MONOTONIC);
+        do {
+                for (i = 0; i < 1000; i++) {
+                        /* Every message is dispatched only once per iteration */
+                        b->iteration_counter++;
+                        assert_se(bus_process_object(b, m) > 0);
+                }
+
+                d = now(CLOCK_MONOTONIC) - t;
+        } while (d < arg_loop_usec);
+
+        printf("DISPATCH\t%u\t%.1f ns/call\n",
+               (unsigned) ((n * USEC_PER_SEC) / d),
+               (double) d * NSEC_PER_USEC / n);
+
+        sd_bus_unref(b);
+        safe_close(pair[1]);
 }
 
 static void client_bisect(const char *address, const char *server_name) {
@@ -196,16 +320,17 @@ static void client_chart(Type type, const char *address, const char *server_name
                 printf("SIZE\tCOPY\tMEMFD\n");
                 break;
         case TYPE_LEGACY:
-                printf("SIZE\tLEGACY\n");
+                printf("SIZE\tLEGACY\tWAKEUPS/MSG\tPOOLED/CALL\n");
                 break;
         case TYPE_DIRECT:
-                printf("SIZE\tDIRECT\n");
+                printf("SIZE\tDIRECT\tWAKEUPS/MSG\tPOOLED/CALL\n");
                 break;
         }
 
         for (csize = 1; csize <= MAX_SIZE; csize *= 2) {
                 usec_t t;
                 unsigned n_copying, n_memfd;
+                uint64_t n_wakeups, n_pooled = 0;
 
                 printf("%zu\t", csize);
 
@@ -224,16 +349,30 @@ static void client_chart(Type type, const char *address, const char *server_name
                         b->use_memfd = -1;
                 }
 
+                n_wakeups = wakeups();
+
                 t = now(CLOCK_MONOTONIC);
                 for (n_memfd = 0;; n_memfd++) {
-                        transaction(b, csize, server_name);
+                        n_pooled += transaction(b, csize, server_name);
                         if (now(CLOCK_MONOTONIC) >= t + arg_loop_usec)
                                 break;
                 }
 
-                printf("%u\n", (unsigned) ((n_memfd * USEC_PER_SEC) / arg_loop_usec));
+                printf("%u", (unsigned) ((n_memfd * USEC_PER_SEC) / arg_loop_usec));
+
+                /* Each transaction is one call and one reply */
+                if (type != TYPE_KDBUS) {
+                        n_wakeups = wakeups() - n_wakeups;
+                        printf("\t%.2f", (double) n_wakeups / (2 * (n_memfd + 1)));
+                        printf("\t%.2f", (double) n_pooled / (n_memfd + 1));
+                }
+
+                printf("\n");
         }
 
+        if (type != TYPE_KDBUS)
+                client_pipeline(b, server_name);
+
         b->use_memfd = 1;
         assert_se(sd_bus_message_new_method_call(b, &x, server_name, "/", "benchmark.server", "Exit") >= 0);
         assert_se(sd_bus_message_append(x, "t", csize) >= 0);
@@ -246,6 +385,7 @@ int main(int argc, char *argv[]) {
         enum {
                 MODE_BISECT,
                 MODE_CHART,
+                MODE_DISPATCH,
         } mode = MODE_BISECT;
         Type type = TYPE_KDBUS;
         int i, pair[2] = { -1, -1 };
@@ -262,6 +402,9 @@ int main(int argc, char *argv[]) {
                 if (streq(argv[i], "chart")) {
                         mode = MODE_CHART;
                         continue;
+                } else if (streq(argv[i], "dispatch")) {
+                        mode = MODE_DISPATCH;
+                        continue;
                 } else if (streq(argv[i], "legacy")) {
                         type = TYPE_LEGACY;
                         continue;
@@ -277,6 +420,11 @@ int main(int argc, char *argv[]) {
 
         assert_se(arg_loop_usec > 0);
 
+        if (mode == MODE_DISPATCH) {
+                benchmark_dispatch();
+                return 0;
+        }
+
         if (type == TYPE_KDBUS) {
                 assert_se(asprintf(&name, "deine-mutter-%u", (unsigned) getpid()) >= 0);
 
@@ -350,6 +498,9 @@ int main(int argc, char *argv[]) {
                 case MODE_CHART:
                         client_chart(type, address, server_name, pair[1]);
                         break;
+
+                default:
+                        assert_not_reached("Unexpected mode");
                 }
 
                 _exit(0);
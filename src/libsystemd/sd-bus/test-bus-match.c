@@ -19,12 +19,15 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include "alloc-util.h"
 #include "bus-match.h"
 #include "bus-message.h"
 #include "bus-slot.h"
 #include "bus-util.h"
 #include "log.h"
 #include "macro.h"
+#include "stdio-util.h"
+#include "time-util.h"
 
 static bool mask[32];
 
@@ -85,6 +88,124 @@ static void test_match_scope(const char *match, enum bus_match_scope scope) {
         bus_match_parse_free(components, n_components);
 }
 
+static void test_match_prefixes(sd_bus *bus) {
+        struct bus_match_node root = {
+                .type = BUS_MATCH_ROOT,
+        };
+
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *m = NULL;
+        sd_bus_slot slots[21];
+
+        /* More patterns than prefixes, so that these are looked up
+         * rather than tested one by one */
+        assert_se(match_add(slots, &root, "path_namespace='/'", 1) >= 0);
+        assert_se(match_add(slots, &root, "path_namespace='/foo'", 2) >= 0);
+        assert_se(match_add(slots, &root, "path_namespace='/foo/bar'", 3) >= 0);
+        assert_se(match_add(slots, &root, "path_namespace='/foo/ba'", 4) >= 0);
+        assert_se(match_add(slots, &root, "path_namespace='/foo/bar/baz'", 5) >= 0);
+        assert_se(match_add(slots, &root, "path_namespace='/quux'", 6) >= 0);
+        assert_se(match_add(slots, &root, "path_namespace='/foo/bar/xx'", 7) >= 0);
+        assert_se(match_add(slots, &root, "path_namespace='/fo'", 8) >= 0);
+        assert_se(match_add(slots, &root, "arg0namespace='org'", 9) >= 0);
+        assert_se(match_add(slots, &root, "arg0namespace='org.example'", 10) >= 0);
+        assert_se(match_add(slots, &root, "arg0namespace='org.examp'", 11) >= 0);
+        assert_se(match_add(slots, &root, "arg0namespace='org.example.Foo.Bar'", 12) >= 0);
+        assert_se(match_add(slots, &root, "arg0namespace='com'", 13) >= 0);
+        assert_se(match_add(slots, &root, "arg0namespace='org.example.Fo'", 14) >= 0);
+        assert_se(match_add(slots, &root, "arg1path='/'", 15) >= 0);
+        assert_se(match_add(slots, &root, "arg1path='/a/'", 16) >= 0);
+        assert_se(match_add(slots, &root, "arg1path='/a/b'", 17) >= 0);
+        assert_se(match_add(slots, &root, "arg1path='/a/b/'", 18) >= 0);
+        assert_se(match_add(slots, &root, "arg1path='/a'", 19) >= 0);
+        assert_se(match_add(slots, &root, "arg1path='/a/bc'", 20) >= 0);
+
+        assert_se(sd_bus_message_new_signal(bus, &m, "/foo/bar/x", "bar.x", "waldo") >= 0);
+        assert_se(sd_bus_message_append(m, "ss", "org.example.Foo", "/a/b") >= 0);
+        assert_se(bus_message_seal(m, 1, 0) >= 0);
+
+        zero(mask);
+        assert_se(bus_match_run(NULL, &root, m) == 0);
+        assert_se(mask_contains((unsigned[]) { 1, 2, 3, 9, 10, 15, 16, 17 }, 8));
+
+        m = sd_bus_message_unref(m);
+
+        assert_se(sd_bus_message_new_signal(bus, &m, "/", "bar.x", "waldo") >= 0);
+        assert_se(sd_bus_message_append(m, "ss", "org.example.Foo.Bar", "/a/") >= 0);
+        assert_se(bus_message_seal(m, 2, 0) >= 0);
+
+        zero(mask);
+        assert_se(bus_match_run(NULL, &root, m) == 0);
+        assert_se(mask_contains((unsigned[]) { 1, 9, 10, 12, 15, 16, 17, 18, 20 }, 9));
+
+        bus_match_free(&root);
+}
+
+static int count_filter(sd_bus_message *m, void *userdata, sd_bus_error *ret_error) {
+        (*(unsigned*) userdata)++;
+        return 0;
+}
+
+static void test_match_benchmark(sd_bus *bus, unsigned n_matches) {
+        struct bus_match_node root = {
+                .type = BUS_MATCH_ROOT,
+        };
+
+        _cleanup_(sd_bus_message_unrefp) sd_bus_message *name_owner_changed = NULL, *properties_changed = NULL;
+        _cleanup_free_ sd_bus_slot *slots = NULL;
+        unsigned i, n_calls = 0;
+        usec_t t;
+
+        /* Installs matches the way PID 1 does for each unit, and
+         * measures how long dispatching a signal to the one match
+         * that wants it takes, depending on the number of matches */
+
+        slots = new0(sd_bus_slot, n_matches * 2);
+        assert_se(slots);
+
+        for (i = 0; i < n_matches * 2; i++) {
+                struct bus_match_component *components = NULL;
+                unsigned n_components = 0;
+                char match[256];
+
+                if (i % 2 == 0)
+                        xsprintf(match,
+                                 "type='signal',sender='org.freedesktop.DBus',path='/org/freedesktop/DBus',"
+                                 "interface='org.freedesktop.DBus',member='NameOwnerChanged',arg0='unit%u.service'", i / 2);
+                else
+                        xsprintf(match,
+                                 "type='signal',path_namespace='/org/freedesktop/systemd1/unit/unit%u_2eservice'", i / 2);
+
+                assert_se(bus_match_parse(match, &components, &n_components) >= 0);
+
+                slots[i].userdata = &n_calls;
+                slots[i].match_callback.callback = count_filter;
+                assert_se(bus_match_add(&root, components, n_components, &slots[i].match_callback) >= 0);
+                bus_match_parse_free(components, n_components);
+        }
+
+        assert_se(sd_bus_message_new_signal(bus, &name_owner_changed, "/org/freedesktop/DBus", "org.freedesktop.DBus", "NameOwnerChanged") >= 0);
+        assert_se(sd_bus_message_append(name_owner_changed, "sss", "unit0.service", "", ":1.1") >= 0);
+        assert_se(bus_message_seal(name_owner_changed, 1, 0) >= 0);
+        bus_message_set_sender_driver(bus, name_owner_changed);
+
+        assert_se(sd_bus_message_new_signal(bus, &properties_changed, "/org/freedesktop/systemd1/unit/unit0_2eservice", "org.freedesktop.DBus.Properties", "PropertiesChanged") >= 0);
+        assert_se(sd_bus_message_append(properties_changed, "sa{sv}as", "org.freedesktop.systemd1.Unit", 0, 0) >= 0);
+        assert_se(bus_message_seal(properties_changed, 2, 0) >= 0);
+
+        t = now(CLOCK_MONOTONIC);
+        for (i = 0; i < 5000; i++) {
+                assert_se(bus_match_run(NULL, &root, name_owner_changed) == 0);
+                assert_se(bus_match_run(NULL, &root, properties_changed) == 0);
+        }
+        t = now(CLOCK_MONOTONIC) - t;
+
+        assert_se(n_calls == 2 * 5000);
+
+        log_info("%5u matches: %6.1f ns/message", n_matches * 2, (double) t * NSEC_PER_USEC / (2 * 5000));
+
+        bus_match_free(&root);
+}
+
 int main(int argc, char *argv[]) {
         struct bus_match_node root = {
                 .type = BUS_MATCH_ROOT,
@@ -157,5 +278,13 @@ int main(int argc, char *argv[]) {
         test_match_scope("member='gurke',path='/org/freedesktop/DBus/Local'", BUS_MATCH_LOCAL);
         test_match_scope("arg2='piep',sender='org.freedesktop.DBus',member='waldo'", BUS_MATCH_DRIVER);
 
+        test_match_prefixes(bus);
+
+        test_match_benchmark(bus, 1);
+        test_match_benchmark(bus, 10);
+        test_match_benchmark(bus, 100);
+        test_match_benchmark(bus, 1000);
+        test_match_benchmark(bus, 10000);
+
         return 0;
 }
@@ -23,6 +23,7 @@
 #include <stdlib.h>
 
 #include "sd-bus.h"
+#include "sd-event.h"
 
 #include "alloc-util.h"
 #include "bus-dump.h"
@@ -521,6 +522,92 @@ static int client(struct context *c) {
         return 0;
 }
 
+static int properties_changed_filter(sd_bus_message *m, void *userdata, sd_bus_error *error) {
+        unsigned *n = userdata;
+        const char *interface, *name;
+        unsigned n_changed = 0, n_invalidated = 0;
+
+        if (!sd_bus_message_is_signal(m, "org.freedesktop.DBus.Properties", "PropertiesChanged"))
+                return 0;
+
+        (*n)++;
+
+        assert_se(sd_bus_message_read(m, "s", &interface) > 0);
+        assert_se(streq(interface, "org.freedesktop.systemd.ValueTest"));
+
+        assert_se(sd_bus_message_enter_container(m, 'a', "{sv}") > 0);
+        while (sd_bus_message_enter_container(m, 'e', "sv") > 0) {
+                assert_se(sd_bus_message_read(m, "s", &name) > 0);
+                assert_se(streq(name, "Value"));
+                assert_se(sd_bus_message_skip(m, "v") > 0);
+                assert_se(sd_bus_message_exit_container(m) > 0);
+                n_changed++;
+        }
+        assert_se(sd_bus_message_exit_container(m) > 0);
+
+        assert_se(sd_bus_message_enter_container(m, 'a', "s") > 0);
+        while (sd_bus_message_read(m, "s", &name) > 0)
+                n_invalidated++;
+        assert_se(sd_bus_message_exit_container(m) > 0);
+
+        /* Duplicates are merged, and "all" covers the named ones */
+        assert_se(n_changed == 1);
+        assert_se(n_invalidated == (streq(m->path, "/value/a") ? 1 : 2));
+
+        return 0;
+}
+
+static void test_coalesce_properties(void) {
+        _cleanup_(sd_event_unrefp) sd_event *e = NULL;
+        sd_bus *a, *b;
+        sd_id128_t id;
+        unsigned n = 0, i;
+        int fds[2];
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) >= 0);
+        assert_se(sd_event_new(&e) >= 0);
+
+        assert_se(sd_id128_randomize(&id) >= 0);
+        assert_se(sd_bus_new(&a) >= 0);
+        assert_se(sd_bus_set_fd(a, fds[0], fds[0]) >= 0);
+        assert_se(sd_bus_set_server(a, 1, id) >= 0);
+        assert_se(sd_bus_add_fallback_vtable(a, NULL, "/value", "org.freedesktop.systemd.ValueTest", vtable2, NULL, UINT_TO_PTR(20)) >= 0);
+        assert_se(sd_bus_set_coalesce_properties(a, true) >= 0);
+        assert_se(sd_bus_attach_event(a, e, 0) >= 0);
+        assert_se(sd_bus_start(a) >= 0);
+
+        assert_se(sd_bus_new(&b) >= 0);
+        assert_se(sd_bus_set_fd(b, fds[1], fds[1]) >= 0);
+        assert_se(sd_bus_add_filter(b, NULL, properties_changed_filter, &n) >= 0);
+        assert_se(sd_bus_attach_event(b, e, 0) >= 0);
+        assert_se(sd_bus_start(b) >= 0);
+
+        /* Get through authentication first */
+        while (a->state != BUS_RUNNING || b->state != BUS_RUNNING) {
+                assert_se(sd_bus_process(a, NULL) >= 0);
+                assert_se(sd_bus_process(b, NULL) >= 0);
+        }
+
+        assert_se(sd_bus_emit_properties_changed(a, "/value/a", "org.freedesktop.systemd.ValueTest", "Value", NULL) >= 0);
+        assert_se(sd_bus_emit_properties_changed(a, "/value/a", "org.freedesktop.systemd.ValueTest", "Value2", NULL) >= 0);
+        assert_se(sd_bus_emit_properties_changed(a, "/value/a", "org.freedesktop.systemd.ValueTest", "Value", "Value2", NULL) >= 0);
+
+        assert_se(sd_bus_emit_properties_changed(a, "/value/b", "org.freedesktop.systemd.ValueTest", "Value", NULL) >= 0);
+        assert_se(sd_bus_emit_properties_changed_strv(a, "/value/b", "org.freedesktop.systemd.ValueTest", NULL) >= 0);
+        assert_se(sd_bus_emit_properties_changed(a, "/value/b", "org.freedesktop.systemd.ValueTest", "Value2", NULL) >= 0);
+
+        /* Nothing is sent before the event loop runs */
+        assert_se(hashmap_size(a->properties_changed) == 2);
+
+        for (i = 0; i < 20; i++)
+                assert_se(sd_event_run(e, USEC_PER_MSEC) >= 0);
+
+        assert_se(n == 2);
+
+        sd_bus_flush_close_unref(a);
+        sd_bus_flush_close_unref(b);
+}
+
 int main(int argc, char *argv[]) {
         struct context c = {};
         pthread_t s;
@@ -553,5 +640,7 @@ int main(int argc, char *argv[]) {
         free(c.something);
         free(c.automatic_string_property);
 
+        test_coalesce_properties();
+
         return EXIT_SUCCESS;
 }
@@ -20,11 +20,14 @@
 ***/
 
 #include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
 
 #include "sd-bus.h"
 
 #include "alloc-util.h"
 #include "bus-dump.h"
+#include "bus-internal.h"
 #include "bus-kernel.h"
 #include "bus-message.h"
 #include "fd-util.h"
@@ -38,7 +41,250 @@
 
 #define STRING_SIZE 123
 
-int main(int argc, char *argv[]) {
+#define SOCKET_ARRAY (MEMFD_MIN_SIZE + 4711)
+
+static unsigned count_memfd_parts(sd_bus_message *m) {
+        struct bus_body_part *part;
+        unsigned i, n = 0;
+
+        MESSAGE_FOREACH_PART(part, i, m)
+                if (part->memfd >= 0)
+                        n++;
+
+        return n;
+}
+
+static void test_socket(bool server_accepts) {
+        sd_bus_message *m = NULL;
+        sd_bus *a, *b;
+        int pair[2], f;
+        const uint8_t *q;
+        uint8_t *p;
+        uint32_t u32;
+        const char *s;
+        size_t i, l;
+
+        /* On a socket, big memfds are only passed as they are if
+         * both sides asked for it, otherwise their contents are sent
+         * inline as before. Either way the receiver gets the same. */
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0, pair) >= 0);
+
+        assert_se(sd_bus_new(&a) >= 0);
+        assert_se(sd_bus_set_fd(a, pair[0], pair[0]) >= 0);
+        assert_se(sd_bus_set_server(a, true, SD_ID128_NULL) >= 0);
+        assert_se(sd_bus_negotiate_memfd(a, server_accepts) >= 0);
+        assert_se(sd_bus_start(a) >= 0);
+
+        assert_se(sd_bus_new(&b) >= 0);
+        assert_se(sd_bus_set_fd(b, pair[1], pair[1]) >= 0);
+        assert_se(sd_bus_negotiate_memfd(b, true) >= 0);
+        assert_se(sd_bus_start(b) >= 0);
+
+        assert_se(sd_bus_message_new_method_call(b, &m, NULL, "/a/path", "an.inter.face", "AMethod") >= 0);
+
+        assert_se(sd_bus_message_append_array_space(m, 'y', FIRST_ARRAY, (void**) &p) >= 0);
+        memset(p, 'L', FIRST_ARRAY);
+
+        f = memfd_new_and_map(NULL, SOCKET_ARRAY, (void**) &p);
+        assert_se(f >= 0);
+        for (i = 0; i < SOCKET_ARRAY; i++)
+                p[i] = (uint8_t) i;
+        munmap(p, SOCKET_ARRAY);
+
+        assert_se(sd_bus_message_append_array_memfd(m, 'y', f, 0, (uint64_t) -1) >= 0);
+        safe_close(f);
+
+        /* This one is too small to be worth passing */
+        f = memfd_new_and_map(NULL, 6, (void**) &p);
+        assert_se(f >= 0);
+        memcpy(p, "abcd\0", 6);
+        munmap(p, 6);
+
+        assert_se(sd_bus_message_append_string_memfd(m, f, 1, 4) >= 0);
+        safe_close(f);
+
+        assert_se(sd_bus_message_append(m, "u", 4711) >= 0);
+
+        assert_se(sd_bus_send(b, m, NULL) >= 0);
+        m = sd_bus_message_unref(m);
+
+        while (!m) {
+                assert_se(sd_bus_process(b, NULL) >= 0);
+                assert_se(sd_bus_process(a, &m) >= 0);
+
+                if (!m)
+                        assert_se(sd_bus_wait(a, 10 * USEC_PER_MSEC) >= 0);
+        }
+
+        assert_se(a->can_memfd == server_accepts);
+        assert_se(b->can_memfd == server_accepts);
+        assert_se(count_memfd_parts(m) == (server_accepts ? 1 : 0));
+
+        assert_se(sd_bus_message_read_array(m, 'y', (const void**) &q, &l) > 0);
+        assert_se(l == FIRST_ARRAY);
+        for (i = 0; i < l; i++)
+                assert_se(q[i] == 'L');
+
+        assert_se(sd_bus_message_read_array(m, 'y', (const void**) &q, &l) > 0);
+        assert_se(l == SOCKET_ARRAY);
+        for (i = 0; i < l; i++)
+                assert_se(q[i] == (uint8_t) i);
+
+        assert_se(sd_bus_message_read(m, "s", &s) > 0);
+        assert_se(streq(s, "bcd"));
+
+        assert_se(sd_bus_message_read(m, "u", &u32) > 0);
+        assert_se(u32 == 4711);
+
+        sd_bus_message_unref(m);
+
+        sd_bus_unref(a);
+        sd_bus_unref(b);
+}
+
+static void append_message(sd_bus *b, const char *member, int fd, uint64_t cookie, struct iovec *iov) {
+        sd_bus_message *m = NULL;
+
+        assert_se(sd_bus_message_new_method_call(b, &m, NULL, "/a/path", "an.inter.face", member) >= 0);
+        assert_se(sd_bus_message_append(m, "h", fd) >= 0);
+        assert_se(bus_message_seal(m, cookie, 0) >= 0);
+        assert_se(bus_message_get_blob(m, &iov->iov_base, &iov->iov_len) >= 0);
+
+        sd_bus_message_unref(m);
+}
+
+static void check_message_fd(sd_bus_message *m, int fd) {
+        struct stat a, b;
+        int f;
+
+        assert_se(sd_bus_message_read(m, "h", &f) > 0);
+        assert_se(fstat(f, &a) >= 0);
+        assert_se(fstat(fd, &b) >= 0);
+        assert_se(a.st_ino == b.st_ino);
+}
+
+static void test_socket_unknown_field(void) {
+        sd_bus_message *m = NULL, *first = NULL, *second = NULL;
+        union {
+                struct cmsghdr cmsghdr;
+                uint8_t buf[CMSG_SPACE(2 * sizeof(int))];
+        } control = {};
+        struct msghdr mh = {};
+        struct cmsghdr *cmsg;
+        struct iovec iov[2];
+        struct bus_header *h;
+        uint8_t *p;
+        int pair[2], fds[2][2];
+        sd_bus *a, *b;
+        unsigned i;
+
+        /* Without memfds agreed on, the memfd header field is just an
+         * unknown one, and must not change how the fds read ahead are
+         * split between messages */
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0, pair) >= 0);
+        assert_se(pipe2(fds[0], O_CLOEXEC) >= 0);
+        assert_se(pipe2(fds[1], O_CLOEXEC) >= 0);
+
+        assert_se(sd_bus_new(&a) >= 0);
+        assert_se(sd_bus_set_fd(a, pair[0], pair[0]) >= 0);
+        assert_se(sd_bus_set_server(a, true, SD_ID128_NULL) >= 0);
+        assert_se(sd_bus_start(a) >= 0);
+
+        assert_se(sd_bus_new(&b) >= 0);
+        assert_se(sd_bus_set_fd(b, pair[1], pair[1]) >= 0);
+        assert_se(sd_bus_start(b) >= 0);
+
+        /* Get through the authentication first */
+        assert_se(sd_bus_message_new_method_call(b, &m, NULL, "/a/path", "an.inter.face", "Ping") >= 0);
+        assert_se(sd_bus_send(b, m, NULL) >= 0);
+        m = sd_bus_message_unref(m);
+
+        while (!m) {
+                assert_se(sd_bus_process(b, NULL) >= 0);
+                assert_se(sd_bus_process(a, &m) >= 0);
+
+                if (!m)
+                        assert_se(sd_bus_wait(a, 10 * USEC_PER_MSEC) >= 0);
+        }
+        m = sd_bus_message_unref(m);
+
+        assert_se(!a->can_memfd);
+        assert_se(a->can_fds);
+
+        /* Put a memfd field listing one memfd in front of the first
+         * message's fields */
+        append_message(b, "First", fds[0][0], 100, &iov[0]);
+        append_message(b, "Second", fds[1][0], 101, &iov[1]);
+
+        p = malloc0(iov[0].iov_len + 40);
+        assert_se(p);
+        memcpy(p, iov[0].iov_base, sizeof(struct bus_header));
+        p[16] = BUS_MESSAGE_HEADER_SOCKET_MEMFDS;
+        p[17] = 2;
+        p[18] = SD_BUS_TYPE_ARRAY;
+        p[19] = SD_BUS_TYPE_UINT64;
+        *(uint32_t*) (p + 24) = 3 * sizeof(uint64_t);
+        memcpy(p + 56, (uint8_t*) iov[0].iov_base + sizeof(struct bus_header), iov[0].iov_len - sizeof(struct bus_header));
+
+        h = (struct bus_header*) p;
+        h->dbus1.fields_size += 40;
+
+        free(iov[0].iov_base);
+        iov[0].iov_base = p;
+        iov[0].iov_len += 40;
+
+        /* Both messages and their fds in one go, so that they are
+         * read together */
+        mh.msg_iov = iov;
+        mh.msg_iovlen = 2;
+        mh.msg_control = &control;
+        mh.msg_controllen = sizeof(control);
+        cmsg = CMSG_FIRSTHDR(&mh);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+        memcpy(CMSG_DATA(cmsg), (int[]) { fds[0][0], fds[1][0] }, 2 * sizeof(int));
+
+        assert_se(sendmsg(pair[1], &mh, MSG_NOSIGNAL) == (ssize_t) (iov[0].iov_len + iov[1].iov_len));
+
+        while (!second) {
+                assert_se(sd_bus_process(a, &m) >= 0);
+
+                if (!m) {
+                        assert_se(sd_bus_wait(a, 10 * USEC_PER_MSEC) >= 0);
+                        continue;
+                }
+
+                if (!first)
+                        first = m;
+                else
+                        second = m;
+                m = NULL;
+        }
+
+        assert_se(streq(sd_bus_message_get_member(first), "First"));
+        assert_se(first->n_fds == 1);
+        check_message_fd(first, fds[0][0]);
+
+        assert_se(streq(sd_bus_message_get_member(second), "Second"));
+        assert_se(second->n_fds == 1);
+        check_message_fd(second, fds[1][0]);
+
+        sd_bus_message_unref(first);
+        sd_bus_message_unref(second);
+
+        for (i = 0; i < 2; i++) {
+                free(iov[i].iov_base);
+                safe_close_pair(fds[i]);
+        }
+
+        sd_bus_unref(a);
+        sd_bus_unref(b);
+}
+
+static int test_kdbus(void) {
         _cleanup_free_ char *name = NULL, *bus_name = NULL, *address = NULL;
         const char *unique;
         uint8_t *p;
@@ -52,8 +298,6 @@ int main(int argc, char *argv[]) {
         char *s;
         _cleanup_close_ int sfd = -1;
 
-        log_set_max_level(LOG_DEBUG);
-
         assert_se(asprintf(&name, "deine-mutter-%u", (unsigned) getpid()) >= 0);
 
         bus_ref = bus_kernel_create_bus(name, false, &bus_name);
@@ -210,3 +454,14 @@ int main(int argc, char *argv[]) {
 
         return 0;
 }
+
+int main(int argc, char *argv[]) {
+
+        log_set_max_level(LOG_DEBUG);
+
+        test_socket(true);
+        test_socket(false);
+        test_socket_unknown_field();
+
+        return test_kdbus();
+}
@@ -0,0 +1,475 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <endian.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+#include "alloc-util.h"
+#include "event-uring.h"
+#include "fd-util.h"
+#include "missing.h"
+#include "util.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && \
+    HAVE_DECL_IORING_FEAT_NODROP && \
+    HAVE_DECL_IORING_FEAT_EXT_ARG && \
+    HAVE_DECL_IORING_ENTER_EXT_ARG && \
+    HAVE_DECL_IORING_POLL_ADD_MULTI && \
+    HAVE_DECL_IORING_CQE_F_MORE && \
+    defined(HAVE_STRUCT_IO_URING_GETEVENTS_ARG_TS) && \
+    defined(HAVE_STRUCT_IO_URING_SQE_POLL32_EVENTS)
+
+#define URING_ENTRIES 256
+
+/* The completions of POLL_REMOVE requests themselves carry this, which
+ * never matches a registration */
+#define URING_USER_DATA_IGNORE UINT64_MAX
+
+/* One per registered fd, like epoll keeps them. Each registration of
+ * an fd gets a new generation, and completions of earlier ones, which
+ * may still arrive after the fd was removed or changed, are dropped by
+ * comparing it. The inode tells whether the fd still refers to the
+ * file that was registered. */
+struct uring_poll {
+        void *data;
+        uint32_t events;
+        uint32_t generation;
+        dev_t dev;
+        ino_t ino;
+        bool active:1;
+};
+
+struct EventUring {
+        int fd;
+
+        void *sq_ring, *cq_ring;
+        size_t sq_ring_size, cq_ring_size;
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+
+        unsigned *sq_head, *sq_tail, *sq_mask, *sq_entries, *sq_array;
+        unsigned *cq_head, *cq_tail, *cq_mask;
+        struct io_uring_cqe *cqes;
+
+        struct uring_poll *polls;
+        size_t n_polls;
+};
+
+EventUring *event_uring_free(EventUring *u) {
+        if (!u)
+                return NULL;
+
+        if (u->sqes)
+                munmap(u->sqes, u->sqes_size);
+        if (u->cq_ring)
+                munmap(u->cq_ring, u->cq_ring_size);
+        if (u->sq_ring)
+                munmap(u->sq_ring, u->sq_ring_size);
+
+        safe_close(u->fd);
+        free(u->polls);
+        free(u);
+
+        return NULL;
+}
+
+static void *uring_map(int fd, size_t size, off_t offset) {
+        void *p;
+
+        p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, offset);
+        if (p == MAP_FAILED)
+                return NULL;
+
+        return p;
+}
+
+int event_uring_new(EventUring **ret) {
+        _cleanup_(event_uring_freep) EventUring *u = NULL;
+        struct io_uring_params p = {};
+
+        assert(ret);
+
+        u = new0(EventUring, 1);
+        if (!u)
+                return -ENOMEM;
+
+        u->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p);
+        if (u->fd < 0)
+                return -errno;
+
+        /* We need timeouts on the wait, and completions must never
+         * be dropped, or we'd lose events */
+        if ((p.features & (IORING_FEAT_EXT_ARG|IORING_FEAT_NODROP)) != (IORING_FEAT_EXT_ARG|IORING_FEAT_NODROP))
+                return -EOPNOTSUPP;
+
+        u->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        u->sq_ring = uring_map(u->fd, u->sq_ring_size, IORING_OFF_SQ_RING);
+        if (!u->sq_ring)
+                return -errno;
+
+        u->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+        u->cq_ring = uring_map(u->fd, u->cq_ring_size, IORING_OFF_CQ_RING);
+        if (!u->cq_ring)
+                return -errno;
+
+        u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        u->sqes = uring_map(u->fd, u->sqes_size, IORING_OFF_SQES);
+        if (!u->sqes)
+                return -errno;
+
+        u->sq_head = (unsigned*) ((uint8_t*) u->sq_ring + p.sq_off.head);
+        u->sq_tail = (unsigned*) ((uint8_t*) u->sq_ring + p.sq_off.tail);
+        u->sq_mask = (unsigned*) ((uint8_t*) u->sq_ring + p.sq_off.ring_mask);
+        u->sq_entries = (unsigned*) ((uint8_t*) u->sq_ring + p.sq_off.ring_entries);
+        u->sq_array = (unsigned*) ((uint8_t*) u->sq_ring + p.sq_off.array);
+
+        u->cq_head = (unsigned*) ((uint8_t*) u->cq_ring + p.cq_off.head);
+        u->cq_tail = (unsigned*) ((uint8_t*) u->cq_ring + p.cq_off.tail);
+        u->cq_mask = (unsigned*) ((uint8_t*) u->cq_ring + p.cq_off.ring_mask);
+        u->cqes = (struct io_uring_cqe*) ((uint8_t*) u->cq_ring + p.cq_off.cqes);
+
+        *ret = u;
+        u = NULL;
+
+        return 0;
+}
+
+int event_uring_fd(EventUring *u) {
+        assert(u);
+
+        return u->fd;
+}
+
+static unsigned uring_queued(EventUring *u) {
+        return *u->sq_tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+}
+
+static int uring_enter(EventUring *u, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+        int r;
+
+        r = syscall(__NR_io_uring_enter, u->fd, uring_queued(u), min_complete, flags, arg, argsz);
+        if (r < 0)
+                return -errno;
+
+        return 0;
+}
+
+int event_uring_submit(EventUring *u) {
+        assert(u);
+
+        if (uring_queued(u) == 0)
+                return 0;
+
+        return uring_enter(u, 0, 0, NULL, 0);
+}
+
+static int uring_get_sqe(EventUring *u, struct io_uring_sqe **ret) {
+        struct io_uring_sqe *sqe;
+        unsigned tail, idx;
+        int r;
+
+        /* Only if the queue is full we need to submit right away */
+        if (uring_queued(u) >= *u->sq_entries) {
+                r = uring_enter(u, 0, 0, NULL, 0);
+                if (r < 0)
+                        return r;
+
+                if (uring_queued(u) >= *u->sq_entries)
+                        return -EBUSY;
+        }
+
+        tail = *u->sq_tail;
+        idx = tail & *u->sq_mask;
+
+        sqe = &u->sqes[idx];
+        memzero(sqe, sizeof(*sqe));
+
+        u->sq_array[idx] = idx;
+        __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        *ret = sqe;
+        return 0;
+}
+
+static uint64_t uring_user_data(int fd, uint32_t generation) {
+        return (uint64_t) generation << 32 | (uint32_t) fd;
+}
+
+static int uring_queue_poll_add(EventUring *u, int fd, struct uring_poll *p) {
+        struct io_uring_sqe *sqe;
+        uint32_t mask;
+        int r;
+
+        r = uring_get_sqe(u, &sqe);
+        if (r < 0)
+                return r;
+
+        mask = p->events & ~(EPOLLET|EPOLLONESHOT);
+#if __BYTE_ORDER == __BIG_ENDIAN
+        mask = mask << 16 | mask >> 16;
+#endif
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = fd;
+        sqe->poll32_events = mask;
+        sqe->user_data = uring_user_data(fd, p->generation);
+
+        /* A single shot poll that is armed again after each completion
+         * behaves like a level triggered epoll registration, a multishot
+         * one like an edge triggered one */
+        if (p->events & EPOLLET)
+                sqe->len = IORING_POLL_ADD_MULTI;
+
+        return 0;
+}
+
+static int uring_queue_poll_remove(EventUring *u, int fd, struct uring_poll *p) {
+        struct io_uring_sqe *sqe;
+        int r;
+
+        r = uring_get_sqe(u, &sqe);
+        if (r < 0)
+                return r;
+
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = uring_user_data(fd, p->generation);
+        sqe->user_data = URING_USER_DATA_IGNORE;
+
+        return 0;
+}
+
+static int uring_cancel_poll(EventUring *u, int fd, struct uring_poll *p) {
+        int r;
+
+        /* Unlike epoll, a pending poll holds a reference to the file,
+         * so that it stays open, and the peer sees no EOF, even after
+         * the fd was closed. Hence submit the removal right away
+         * instead of with the next wait: it is carried out during the
+         * submission, and the reference is dropped once we return. */
+
+        r = uring_queue_poll_remove(u, fd, p);
+        if (r < 0)
+                return r;
+
+        p->active = false;
+        p->generation++;
+
+        return uring_enter(u, 0, 0, NULL, 0);
+}
+
+int event_uring_ctl(EventUring *u, int op, int fd, const struct epoll_event *ev) {
+        struct uring_poll *p;
+        struct stat st;
+        int r;
+
+        assert(u);
+        assert(fd >= 0);
+        assert(op == EPOLL_CTL_DEL || ev);
+
+        if (op == EPOLL_CTL_ADD) {
+                /* Like epoll, refuse what is always ready */
+                if (fstat(fd, &st) < 0)
+                        return -errno;
+                if (S_ISREG(st.st_mode) || S_ISDIR(st.st_mode))
+                        return -EPERM;
+
+                if (!GREEDY_REALLOC0(u->polls, u->n_polls, (size_t) fd + 1))
+                        return -ENOMEM;
+
+                p = &u->polls[fd];
+                if (p->active) {
+                        if (p->dev == st.st_dev && p->ino == st.st_ino)
+                                return -EEXIST;
+
+                        /* The fd was closed and reused without being
+                         * removed first. epoll forgets about closed
+                         * files by itself, hence so do we. */
+                        r = uring_cancel_poll(u, fd, p);
+                        if (r < 0)
+                                return r;
+                }
+        } else {
+                if ((size_t) fd >= u->n_polls || !u->polls[fd].active)
+                        return -ENOENT;
+
+                p = &u->polls[fd];
+
+                if (op == EPOLL_CTL_DEL)
+                        return uring_cancel_poll(u, fd, p);
+
+                /* The fd stays registered, so the removal of the
+                 * old poll can wait for the next submission */
+                r = uring_queue_poll_remove(u, fd, p);
+                if (r < 0)
+                        return r;
+
+                st.st_dev = p->dev;
+                st.st_ino = p->ino;
+
+                p->active = false;
+                p->generation++;
+        }
+
+        p->data = ev->data.ptr;
+        p->events = ev->events;
+        p->dev = st.st_dev;
+        p->ino = st.st_ino;
+
+        r = uring_queue_poll_add(u, fd, p);
+        if (r < 0)
+                return r;
+
+        p->active = true;
+        return 0;
+}
+
+static int uring_harvest(EventUring *u, struct epoll_event *events, unsigned n_events) {
+        unsigned head, tail, n = 0;
+        int r = 0;
+
+        head = *u->cq_head;
+        tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail && n < n_events) {
+                struct io_uring_cqe *cqe;
+                struct uring_poll *p;
+                uint32_t fd, generation;
+                int res;
+
+                cqe = &u->cqes[head & *u->cq_mask];
+                head++;
+
+                fd = (uint32_t) cqe->user_data;
+                generation = (uint32_t) (cqe->user_data >> 32);
+
+                if (fd >= u->n_polls)
+                        continue;
+
+                p = &u->polls[fd];
+                if (!p->active || p->generation != generation)
+                        continue;
+
+                res = cqe->res;
+                if (res == -ECANCELED)
+                        /* The kernel ended a multishot poll, just
+                         * arm it again below */
+                        res = 0;
+                else if (res < 0)
+                        res = EPOLLERR;
+
+                if (res != 0) {
+                        events[n].events = (uint32_t) res;
+                        events[n].data.ptr = p->data;
+                        n++;
+                }
+
+                if (!(p->events & EPOLLONESHOT) && !(cqe->flags & IORING_CQE_F_MORE)) {
+                        r = uring_queue_poll_add(u, (int) fd, p);
+                        if (r < 0)
+                                break;
+                }
+        }
+
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+        if (r < 0)
+                return r;
+
+        return (int) n;
+}
+
+int event_uring_wait(EventUring *u, struct epoll_event *events, unsigned n_events, usec_t timeout) {
+        int r;
+
+        assert(u);
+        assert(events);
+        assert(n_events > 0);
+
+        /* Whatever completed since the last time is picked up without
+         * entering the kernel at all. Polls armed again meanwhile are
+         * submitted with the next wait. */
+        r = uring_harvest(u, events, n_events);
+        if (r != 0)
+                return r;
+
+        if (timeout == 0) {
+                if (uring_queued(u) == 0)
+                        return 0;
+
+                r = uring_enter(u, 0, 0, NULL, 0);
+        } else if (timeout == USEC_INFINITY)
+                r = uring_enter(u, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+        else {
+                struct __kernel_timespec ts = {
+                        .tv_sec = timeout / USEC_PER_SEC,
+                        .tv_nsec = (timeout % USEC_PER_SEC) * NSEC_PER_USEC,
+                };
+                struct io_uring_getevents_arg arg = {
+                        .ts = (uint64_t) (uintptr_t) &ts,
+                };
+
+                r = uring_enter(u, 1, IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+                if (r == -ETIME)
+                        r = 0;
+        }
+        if (r < 0)
+                return r;
+
+        /* Polls on fds that are ready already complete right on
+         * submission, so even without waiting there may be something */
+        return uring_harvest(u, events, n_events);
+}
+
+#else
+
+int event_uring_new(EventUring **ret) {
+        return -EOPNOTSUPP;
+}
+
+EventUring *event_uring_free(EventUring *u) {
+        assert(!u);
+        return NULL;
+}
+
+int event_uring_fd(EventUring *u) {
+        assert_not_reached("io_uring not supported");
+}
+
+int event_uring_ctl(EventUring *u, int op, int fd, const struct epoll_event *ev) {
+        assert_not_reached("io_uring not supported");
+}
+
+int event_uring_submit(EventUring *u) {
+        assert_not_reached("io_uring not supported");
+}
+
+int event_uring_wait(EventUring *u, struct epoll_event *events, unsigned n_events, usec_t timeout) {
+        assert_not_reached("io_uring not supported");
+}
+
+#endif
@@ -0,0 +1,45 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+#pragma once
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <sys/epoll.h>
+
+#include "macro.h"
+#include "time-util.h"
+
+/* An io_uring based stand-in for an epoll fd: the same ADD/MOD/DEL
+ * operations and the same events come out, but registrations are
+ * queued and submitted together with the next wait, and completions
+ * are picked up from the shared ring without a syscall. Removals are
+ * submitted right away, so that no file is kept open by a poll after
+ * its source was disabled or freed. */
+
+typedef struct EventUring EventUring;
+
+int event_uring_new(EventUring **ret);
+EventUring *event_uring_free(EventUring *u);
+
+DEFINE_TRIVIAL_CLEANUP_FUNC(EventUring*, event_uring_free);
+
+int event_uring_fd(EventUring *u);
+
+int event_uring_ctl(EventUring *u, int op, int fd, const struct epoll_event *ev);
+int event_uring_submit(EventUring *u);
+int event_uring_wait(EventUring *u, struct epoll_event *events, unsigned n_events, usec_t timeout);
@@ -28,6 +28,7 @@
 #include "sd-id128.h"
 
 #include "alloc-util.h"
+#include "event-uring.h"
 #include "fd-util.h"
 #include "hashmap.h"
 #include "list.h"
@@ -40,10 +41,15 @@
 #include "string-table.h"
 #include "string-util.h"
 #include "time-util.h"
+#include "timer-wheel.h"
 #include "util.h"
 
 #define DEFAULT_ACCURACY_USEC (250 * USEC_PER_MSEC)
 
+/* Histogram bucket i > 0 counts durations of [2^(i-1), 2^i) µs, the
+ * last one everything longer */
+#define HISTOGRAM_BUCKETS 32
+
 typedef enum EventSourceType {
         SOURCE_IO,
         SOURCE_TIME_REALTIME,
@@ -113,6 +119,11 @@ struct sd_event_source {
         unsigned prepare_index;
         unsigned pending_iteration;
         unsigned prepare_iteration;
+        unsigned dispatch_iteration;
+
+        /* Only maintained if profiling is on */
+        usec_t pending_timestamp;
+        uint64_t *histograms;
 
         LIST_FIELDS(sd_event_source, sources);
 
@@ -129,6 +140,9 @@ struct sd_event_source {
                         usec_t next, accuracy;
                         unsigned earliest_index;
                         unsigned latest_index;
+                        TimerWheelEntry earliest_entry;
+                        TimerWheelEntry latest_entry;
+                        bool wheel:1;
                 } time;
                 struct {
                         sd_event_signal_handler_t callback;
@@ -140,6 +154,8 @@ struct sd_event_source {
                         siginfo_t siginfo;
                         pid_t pid;
                         int options;
+                        int pidfd;
+                        bool pidfd_registered:1;
                 } child;
                 struct {
                         sd_event_handler_t callback;
@@ -167,6 +183,13 @@ struct clock_data {
 
         Prioq *earliest;
         Prioq *latest;
+
+        /* Sources whose accuracy is at least a tick of the wheel are
+         * kept in a pair of timer wheels instead, which are cheaper to
+         * update. Only enabled, non-pending sources are in there. */
+        TimerWheel *earliest_wheel;
+        TimerWheel *latest_wheel;
+
         usec_t next;
 
         bool needs_rearm:1;
@@ -188,7 +211,9 @@ struct signal_data {
 struct sd_event {
         unsigned n_ref;
 
+        /* Either of the two is used */
         int epoll_fd;
+        EventUring *uring;
         int watchdog_fd;
 
         Prioq *pending;
@@ -211,6 +236,10 @@ struct sd_event {
         Hashmap *child_sources;
         unsigned n_enabled_child_sources;
 
+        /* The enabled child sources without a pidfd, which need a
+         * waitid() each on SIGCHLD */
+        unsigned n_waitid_child_sources;
+
         Set *post_sources;
 
         Prioq *exit;
@@ -225,6 +254,9 @@ struct sd_event {
         bool exit_requested:1;
         bool need_process_child:1;
         bool watchdog:1;
+        bool dispatch_batch:1;
+        bool profile:1;
+        bool fd_exported:1;
 
         int exit_code;
 
@@ -378,6 +410,8 @@ static void free_clock_data(struct clock_data *d) {
         safe_close(d->fd);
         prioq_free(d->earliest);
         prioq_free(d->latest);
+        timer_wheel_free(d->earliest_wheel);
+        timer_wheel_free(d->latest_wheel);
 }
 
 static void event_free(sd_event *e) {
@@ -397,6 +431,7 @@ static void event_free(sd_event *e) {
                 *(e->default_event_ptr) = NULL;
 
         safe_close(e->epoll_fd);
+        event_uring_free(e->uring);
         safe_close(e->watchdog_fd);
 
         free_clock_data(&e->realtime);
@@ -438,10 +473,20 @@ _public_ int sd_event_new(sd_event** ret) {
         if (r < 0)
                 goto fail;
 
-        e->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
-        if (e->epoll_fd < 0) {
-                r = -errno;
-                goto fail;
+        /* The io_uring backend is opt-in, and we silently fall back to
+         * epoll if the kernel can't do it */
+        if (streq_ptr(secure_getenv("SYSTEMD_EVENT_BACKEND"), "io_uring")) {
+                r = event_uring_new(&e->uring);
+                if (r < 0)
+                        log_debug_errno(r, "Failed to set up io_uring, falling back to epoll: %m");
+        }
+
+        if (!e->uring) {
+                e->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+                if (e->epoll_fd < 0) {
+                        r = -errno;
+                        goto fail;
+                }
         }
 
         *ret = e;
@@ -486,6 +531,18 @@ static bool event_pid_changed(sd_event *e) {
         return e->original_pid != getpid();
 }
 
+static int event_ctl(sd_event *e, int op, int fd, struct epoll_event *ev) {
+        assert(e);
+
+        if (e->uring)
+                return event_uring_ctl(e->uring, op, fd, ev);
+
+        if (epoll_ctl(e->epoll_fd, op, fd, ev) < 0)
+                return -errno;
+
+        return 0;
+}
+
 static void source_io_unregister(sd_event_source *s) {
         int r;
 
@@ -498,9 +555,9 @@ static void source_io_unregister(sd_event_source *s) {
         if (!s->io.registered)
                 return;
 
-        r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_DEL, s->io.fd, NULL);
+        r = event_ctl(s->event, EPOLL_CTL_DEL, s->io.fd, NULL);
         if (r < 0)
-                log_debug_errno(errno, "Failed to remove source %s (type %s) from epoll: %m",
+                log_debug_errno(r, "Failed to remove source %s (type %s) from epoll: %m",
                                 strna(s->description), event_source_type_to_string(s->type));
 
         s->io.registered = false;
@@ -524,18 +581,58 @@ static int source_io_register(
         if (enabled == SD_EVENT_ONESHOT)
                 ev.events |= EPOLLONESHOT;
 
-        if (s->io.registered)
-                r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_MOD, s->io.fd, &ev);
-        else
-                r = epoll_ctl(s->event->epoll_fd, EPOLL_CTL_ADD, s->io.fd, &ev);
+        r = event_ctl(s->event, s->io.registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, s->io.fd, &ev);
         if (r < 0)
-                return -errno;
+                return r;
 
         s->io.registered = true;
 
         return 0;
 }
 
+static void source_child_pidfd_unregister(sd_event_source *s) {
+        int r;
+
+        assert(s);
+        assert(s->type == SOURCE_CHILD);
+
+        if (event_pid_changed(s->event))
+                return;
+
+        if (!s->child.pidfd_registered)
+                return;
+
+        r = event_ctl(s->event, EPOLL_CTL_DEL, s->child.pidfd, NULL);
+        if (r < 0)
+                log_debug_errno(r, "Failed to remove source %s (type %s) from epoll: %m",
+                                strna(s->description), event_source_type_to_string(s->type));
+
+        s->child.pidfd_registered = false;
+}
+
+static int source_child_pidfd_register(sd_event_source *s) {
+        struct epoll_event ev = {};
+        int r;
+
+        assert(s);
+        assert(s->type == SOURCE_CHILD);
+        assert(s->child.pidfd >= 0);
+
+        /* A pidfd becomes readable once the process exited and
+         * stays that way, hence we only want to hear about it once,
+         * until the source is enabled again. */
+        ev.events = EPOLLIN|EPOLLONESHOT;
+        ev.data.ptr = s;
+
+        r = event_ctl(s->event, s->child.pidfd_registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, s->child.pidfd, &ev);
+        if (r < 0)
+                return r;
+
+        s->child.pidfd_registered = true;
+
+        return 0;
+}
+
 static clockid_t event_source_type_to_clock(EventSourceType t) {
 
         switch (t) {
@@ -609,6 +706,40 @@ static struct clock_data* event_get_clock_data(sd_event *e, EventSourceType t) {
         }
 }
 
+static usec_t time_source_latest(sd_event_source *s) {
+        assert(s);
+
+        if (s->time.next > USEC_INFINITY - 1 - s->time.accuracy)
+                return USEC_INFINITY - 1;
+
+        return s->time.next + s->time.accuracy;
+}
+
+static void time_source_reshuffle(sd_event_source *s) {
+        struct clock_data *d;
+
+        assert(s);
+        assert(EVENT_SOURCE_IS_TIME(s->type));
+
+        d = event_get_clock_data(s->event, s->type);
+        assert(d);
+
+        if (s->time.wheel) {
+                timer_wheel_remove(d->earliest_wheel, &s->time.earliest_entry);
+                timer_wheel_remove(d->latest_wheel, &s->time.latest_entry);
+
+                if (s->enabled != SD_EVENT_OFF && !s->pending) {
+                        timer_wheel_put(d->earliest_wheel, &s->time.earliest_entry, s->time.next);
+                        timer_wheel_put(d->latest_wheel, &s->time.latest_entry, time_source_latest(s));
+                }
+        } else {
+                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
+                prioq_reshuffle(d->latest, s, &s->time.latest_index);
+        }
+
+        d->needs_rearm = true;
+}
+
 static int event_make_signal_data(
                 sd_event *e,
                 int sig,
@@ -680,11 +811,9 @@ static int event_make_signal_data(
         ev.events = EPOLLIN;
         ev.data.ptr = d;
 
-        r = epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, d->fd, &ev);
-        if (r < 0)  {
-                r = -errno;
+        r = event_ctl(e, EPOLL_CTL_ADD, d->fd, &ev);
+        if (r < 0)
                 goto fail;
-        }
 
         if (ret)
                 *ret = d;
@@ -719,6 +848,8 @@ static void event_unmask_signal_data(sd_event *e, struct signal_data *d, int sig
                 /* If all the mask is all-zero we can get rid of the structure */
                 hashmap_remove(e->signal_data, &d->priority);
                 assert(!d->current);
+                if (d->fd >= 0)
+                        (void) event_ctl(e, EPOLL_CTL_DEL, d->fd, NULL);
                 safe_close(d->fd);
                 free(d);
                 return;
@@ -804,8 +935,13 @@ static void source_disconnect(sd_event_source *s) {
                 d = event_get_clock_data(s->event, s->type);
                 assert(d);
 
-                prioq_remove(d->earliest, s, &s->time.earliest_index);
-                prioq_remove(d->latest, s, &s->time.latest_index);
+                if (s->time.wheel) {
+                        timer_wheel_remove(d->earliest_wheel, &s->time.earliest_entry);
+                        timer_wheel_remove(d->latest_wheel, &s->time.latest_entry);
+                } else {
+                        prioq_remove(d->earliest, s, &s->time.earliest_index);
+                        prioq_remove(d->latest, s, &s->time.latest_index);
+                }
                 d->needs_rearm = true;
                 break;
         }
@@ -826,8 +962,16 @@ static void source_disconnect(sd_event_source *s) {
                         if (s->enabled != SD_EVENT_OFF) {
                                 assert(s->event->n_enabled_child_sources > 0);
                                 s->event->n_enabled_child_sources--;
+
+                                if (s->child.pidfd < 0) {
+                                        assert(s->event->n_waitid_child_sources > 0);
+                                        s->event->n_waitid_child_sources--;
+                                }
                         }
 
+                        source_child_pidfd_unregister(s);
+                        s->child.pidfd = safe_close(s->child.pidfd);
+
                         (void) hashmap_remove(s->event->child_sources, PID_TO_PTR(s->child.pid));
                         event_gc_signal_data(s->event, &s->priority, SIGCHLD);
                 }
@@ -872,6 +1016,7 @@ static void source_free(sd_event_source *s) {
 
         source_disconnect(s);
         free(s->description);
+        free(s->histograms);
         free(s);
 }
 
@@ -889,6 +1034,9 @@ static int source_set_pending(sd_event_source *s, bool b) {
         if (b) {
                 s->pending_iteration = s->event->iteration;
 
+                if (s->event->profile)
+                        s->pending_timestamp = now(CLOCK_MONOTONIC);
+
                 r = prioq_put(s->event->pending, s, &s->pending_index);
                 if (r < 0) {
                         s->pending = false;
@@ -897,16 +1045,8 @@ static int source_set_pending(sd_event_source *s, bool b) {
         } else
                 assert_se(prioq_remove(s->event->pending, s, &s->pending_index));
 
-        if (EVENT_SOURCE_IS_TIME(s->type)) {
-                struct clock_data *d;
-
-                d = event_get_clock_data(s->event, s->type);
-                assert(d);
-
-                prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                d->needs_rearm = true;
-        }
+        if (EVENT_SOURCE_IS_TIME(s->type))
+                time_source_reshuffle(s);
 
         if (s->type == SOURCE_SIGNAL && !b) {
                 struct signal_data *d;
@@ -1024,10 +1164,10 @@ static int event_setup_timer_fd(
         ev.events = EPOLLIN;
         ev.data.ptr = d;
 
-        r = epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        r = event_ctl(e, EPOLL_CTL_ADD, fd, &ev);
         if (r < 0) {
                 safe_close(fd);
-                return -errno;
+                return r;
         }
 
         d->fd = fd;
@@ -1052,6 +1192,7 @@ _public_ int sd_event_add_time(
         EventSourceType type;
         sd_event_source *s;
         struct clock_data *d;
+        bool wheel;
         int r;
 
         assert_return(e, -EINVAL);
@@ -1069,13 +1210,32 @@ _public_ int sd_event_add_time(
         d = event_get_clock_data(e, type);
         assert(d);
 
-        r = prioq_ensure_allocated(&d->earliest, earliest_time_prioq_compare);
-        if (r < 0)
-                return r;
+        if (accuracy == 0)
+                accuracy = DEFAULT_ACCURACY_USEC;
 
-        r = prioq_ensure_allocated(&d->latest, latest_time_prioq_compare);
-        if (r < 0)
-                return r;
+        /* Sources that may be delayed by a tick anyway go into the
+         * timer wheels, the exact ones into the prioqs. This is decided
+         * once, a source stays where it is if its accuracy changes
+         * later on, which is fine since both report exact times. */
+        wheel = accuracy >= TIMER_WHEEL_TICK_USEC;
+
+        if (wheel) {
+                r = timer_wheel_ensure_allocated(&d->earliest_wheel);
+                if (r < 0)
+                        return r;
+
+                r = timer_wheel_ensure_allocated(&d->latest_wheel);
+                if (r < 0)
+                        return r;
+        } else {
+                r = prioq_ensure_allocated(&d->earliest, earliest_time_prioq_compare);
+                if (r < 0)
+                        return r;
+
+                r = prioq_ensure_allocated(&d->latest, latest_time_prioq_compare);
+                if (r < 0)
+                        return r;
+        }
 
         if (d->fd < 0) {
                 r = event_setup_timer_fd(e, d, clock);
@@ -1088,14 +1248,25 @@ _public_ int sd_event_add_time(
                 return -ENOMEM;
 
         s->time.next = usec;
-        s->time.accuracy = accuracy == 0 ? DEFAULT_ACCURACY_USEC : accuracy;
+        s->time.accuracy = accuracy;
         s->time.callback = callback;
         s->time.earliest_index = s->time.latest_index = PRIOQ_IDX_NULL;
+        s->time.earliest_entry.slot = s->time.latest_entry.slot = TIMER_WHEEL_SLOT_NULL;
+        s->time.wheel = wheel;
         s->userdata = userdata;
         s->enabled = SD_EVENT_ONESHOT;
 
         d->needs_rearm = true;
 
+        if (wheel) {
+                time_source_reshuffle(s);
+
+                if (ret)
+                        *ret = s;
+
+                return 0;
+        }
+
         r = prioq_put(d->earliest, s, &s->time.earliest_index);
         if (r < 0)
                 goto fail;
@@ -1214,25 +1385,54 @@ _public_ int sd_event_add_child(
         s->child.pid = pid;
         s->child.options = options;
         s->child.callback = callback;
+        s->child.pidfd = -1;
+        s->wakeup = WAKEUP_EVENT_SOURCE;
         s->userdata = userdata;
         s->enabled = SD_EVENT_ONESHOT;
 
         r = hashmap_put(e->child_sources, PID_TO_PTR(pid), s);
         if (r < 0) {
+                s->enabled = SD_EVENT_OFF;
                 source_free(s);
                 return r;
         }
 
+        /* A pidfd only tells us about the exit, so it is only good
+         * for sources that don't want to see the process stop or
+         * continue. If it is available it is watched by itself, and
+         * SIGCHLD doesn't need to be looked at for this source. If
+         * not, for example on older kernels, we fall back to
+         * checking the PID on every SIGCHLD. */
+        if (options == WEXITED) {
+                s->child.pidfd = pidfd_open(pid, 0);
+                if (s->child.pidfd < 0)
+                        s->child.pidfd = -1;
+                else {
+                        r = source_child_pidfd_register(s);
+                        if (r < 0)
+                                s->child.pidfd = safe_close(s->child.pidfd);
+                }
+        }
+
         e->n_enabled_child_sources ++;
 
+        if (s->child.pidfd < 0)
+                e->n_waitid_child_sources ++;
+
         r = event_make_signal_data(e, SIGCHLD, NULL);
         if (r < 0) {
                 e->n_enabled_child_sources--;
+
+                if (s->child.pidfd < 0)
+                        e->n_waitid_child_sources--;
+
+                s->enabled = SD_EVENT_OFF;
                 source_free(s);
                 return r;
         }
 
-        e->need_process_child = true;
+        if (s->child.pidfd < 0)
+                e->need_process_child = true;
 
         if (ret)
                 *ret = s;
@@ -1461,7 +1661,7 @@ _public_ int sd_event_source_set_io_fd(sd_event_source *s, int fd) {
                         return r;
                 }
 
-                epoll_ctl(s->event->epoll_fd, EPOLL_CTL_DEL, saved_fd, NULL);
+                (void) event_ctl(s->event, EPOLL_CTL_DEL, saved_fd, NULL);
         }
 
         return 0;
@@ -1607,18 +1807,10 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                 case SOURCE_TIME_BOOTTIME:
                 case SOURCE_TIME_MONOTONIC:
                 case SOURCE_TIME_REALTIME_ALARM:
-                case SOURCE_TIME_BOOTTIME_ALARM: {
-                        struct clock_data *d;
-
+                case SOURCE_TIME_BOOTTIME_ALARM:
                         s->enabled = m;
-                        d = event_get_clock_data(s->event, s->type);
-                        assert(d);
-
-                        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                        d->needs_rearm = true;
+                        time_source_reshuffle(s);
                         break;
-                }
 
                 case SOURCE_SIGNAL:
                         s->enabled = m;
@@ -1632,6 +1824,13 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                         assert(s->event->n_enabled_child_sources > 0);
                         s->event->n_enabled_child_sources--;
 
+                        if (s->child.pidfd >= 0)
+                                source_child_pidfd_unregister(s);
+                        else {
+                                assert(s->event->n_waitid_child_sources > 0);
+                                s->event->n_waitid_child_sources--;
+                        }
+
                         event_gc_signal_data(s->event, &s->priority, SIGCHLD);
                         break;
 
@@ -1664,18 +1863,10 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
                 case SOURCE_TIME_BOOTTIME:
                 case SOURCE_TIME_MONOTONIC:
                 case SOURCE_TIME_REALTIME_ALARM:
-                case SOURCE_TIME_BOOTTIME_ALARM: {
-                        struct clock_data *d;
-
+                case SOURCE_TIME_BOOTTIME_ALARM:
                         s->enabled = m;
-                        d = event_get_clock_data(s->event, s->type);
-                        assert(d);
-
-                        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-                        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-                        d->needs_rearm = true;
+                        time_source_reshuffle(s);
                         break;
-                }
 
                 case SOURCE_SIGNAL:
 
@@ -1692,19 +1883,38 @@ _public_ int sd_event_source_set_enabled(sd_event_source *s, int m) {
 
                 case SOURCE_CHILD:
 
-                        if (s->enabled == SD_EVENT_OFF)
+                        if (s->child.pidfd >= 0) {
+                                r = source_child_pidfd_register(s);
+                                if (r < 0)
+                                        return r;
+                        }
+
+                        if (s->enabled == SD_EVENT_OFF) {
                                 s->event->n_enabled_child_sources++;
 
+                                if (s->child.pidfd < 0)
+                                        s->event->n_waitid_child_sources++;
+                        }
+
                         s->enabled = m;
 
                         r = event_make_signal_data(s->event, SIGCHLD, NULL);
                         if (r < 0) {
                                 s->enabled = SD_EVENT_OFF;
                                 s->event->n_enabled_child_sources--;
+
+                                if (s->child.pidfd >= 0)
+                                        source_child_pidfd_unregister(s);
+                                else
+                                        s->event->n_waitid_child_sources--;
+
                                 event_gc_signal_data(s->event, &s->priority, SIGCHLD);
                                 return r;
                         }
 
+                        if (s->child.pidfd < 0)
+                                s->event->need_process_child = true;
+
                         break;
 
                 case SOURCE_EXIT:
@@ -1742,8 +1952,6 @@ _public_ int sd_event_source_get_time(sd_event_source *s, uint64_t *usec) {
 }
 
 _public_ int sd_event_source_set_time(sd_event_source *s, uint64_t usec) {
-        struct clock_data *d;
-
         assert_return(s, -EINVAL);
         assert_return(usec != (uint64_t) -1, -EINVAL);
         assert_return(EVENT_SOURCE_IS_TIME(s->type), -EDOM);
@@ -1753,13 +1961,7 @@ _public_ int sd_event_source_set_time(sd_event_source *s, uint64_t usec) {
         s->time.next = usec;
 
         source_set_pending(s, false);
-
-        d = event_get_clock_data(s->event, s->type);
-        assert(d);
-
-        prioq_reshuffle(d->earliest, s, &s->time.earliest_index);
-        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-        d->needs_rearm = true;
+        time_source_reshuffle(s);
 
         return 0;
 }
@@ -1775,8 +1977,6 @@ _public_ int sd_event_source_get_time_accuracy(sd_event_source *s, uint64_t *use
 }
 
 _public_ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec) {
-        struct clock_data *d;
-
         assert_return(s, -EINVAL);
         assert_return(usec != (uint64_t) -1, -EINVAL);
         assert_return(EVENT_SOURCE_IS_TIME(s->type), -EDOM);
@@ -1789,12 +1989,7 @@ _public_ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec
         s->time.accuracy = usec;
 
         source_set_pending(s, false);
-
-        d = event_get_clock_data(s->event, s->type);
-        assert(d);
-
-        prioq_reshuffle(d->latest, s, &s->time.latest_index);
-        d->needs_rearm = true;
+        time_source_reshuffle(s);
 
         return 0;
 }
@@ -1952,7 +2147,7 @@ static int event_arm_timer(
 
         struct itimerspec its = {};
         sd_event_source *a, *b;
-        usec_t t;
+        usec_t earliest, latest, t;
         int r;
 
         assert(e);
@@ -1964,7 +2159,19 @@ static int event_arm_timer(
                 d->needs_rearm = false;
 
         a = prioq_peek(d->earliest);
-        if (!a || a->enabled == SD_EVENT_OFF) {
+        if (a && a->enabled != SD_EVENT_OFF) {
+                b = prioq_peek(d->latest);
+                assert_se(b && b->enabled != SD_EVENT_OFF);
+
+                earliest = a->time.next;
+                latest = b->time.next + b->time.accuracy;
+        } else
+                earliest = latest = USEC_INFINITY;
+
+        earliest = MIN(earliest, timer_wheel_peek(d->earliest_wheel));
+        latest = MIN(latest, timer_wheel_peek(d->latest_wheel));
+
+        if (earliest == USEC_INFINITY) {
 
                 if (d->fd < 0)
                         return 0;
@@ -1981,10 +2188,7 @@ static int event_arm_timer(
                 return 0;
         }
 
-        b = prioq_peek(d->latest);
-        assert_se(b && b->enabled != SD_EVENT_OFF);
-
-        t = sleep_between(e, a->time.next, b->time.next + b->time.accuracy);
+        t = sleep_between(e, earliest, latest);
         if (d->next == t)
                 return 0;
 
@@ -2078,11 +2282,30 @@ static int process_timer(
                 d->needs_rearm = true;
         }
 
+        /* This gathers everything that is due in the first slot */
+        timer_wheel_advance(d->earliest_wheel, n);
+        timer_wheel_advance(d->latest_wheel, n);
+
+        for (;;) {
+                TimerWheelEntry *w;
+
+                w = timer_wheel_first_due(d->earliest_wheel, n);
+                if (!w)
+                        break;
+
+                /* Takes it off the wheels */
+                s = container_of(w, sd_event_source, time.earliest_entry);
+                r = source_set_pending(s, true);
+                if (r < 0)
+                        return r;
+        }
+
         return 0;
 }
 
 static int process_child(sd_event *e) {
         sd_event_source *s;
+        siginfo_t si = {};
         Iterator i;
         int r;
 
@@ -2090,6 +2313,19 @@ static int process_child(sd_event *e) {
 
         e->need_process_child = false;
 
+        /* Sources with a pidfd are taken care of by
+         * process_pidfd() */
+        if (e->n_waitid_child_sources == 0)
+                return 0;
+
+        /* Before asking for each PID, ask whether there's anything
+         * at all. SIGCHLD is often for a child that has been reaped
+         * already, or that we don't watch at all. We can't use this
+         * to find all of our children in one go however, as without
+         * reaping it the same child would be returned again. */
+        if (waitid(P_ALL, 0, &si, WEXITED|WSTOPPED|WCONTINUED|WNOHANG|WNOWAIT) >= 0 && si.si_pid == 0)
+                return 0;
+
         /*
            So, this is ugly. We iteratively invoke waitid() with P_PID
            + WNOHANG for each PID we wait for, instead of using
@@ -2101,7 +2337,7 @@ static int process_child(sd_event *e) {
            want anything flushed out of the kernel's queue that we
            don't care about. Since this is O(n) this means that if you
            have a lot of processes you probably want to handle SIGCHLD
-           yourself.
+           yourself, or make sure pidfds are available.
 
            We do not reap the children here (by using WNOWAIT), this
            is only done after the event source is dispatched so that
@@ -2117,6 +2353,9 @@ static int process_child(sd_event *e) {
                 if (s->enabled == SD_EVENT_OFF)
                         continue;
 
+                if (s->child.pidfd >= 0)
+                        continue;
+
                 zero(s->child.siginfo);
                 r = waitid(P_PID, s->child.pid, &s->child.siginfo,
                            WNOHANG | (s->child.options & WEXITED ? WNOWAIT : 0) | s->child.options);
@@ -2148,6 +2387,33 @@ static int process_child(sd_event *e) {
         return 0;
 }
 
+static int process_pidfd(sd_event *e, sd_event_source *s) {
+        int r;
+
+        assert(e);
+        assert(s);
+        assert(s->type == SOURCE_CHILD);
+        assert(s->child.options == WEXITED);
+
+        if (s->pending)
+                return 0;
+
+        if (s->enabled == SD_EVENT_OFF)
+                return 0;
+
+        /* The process exited, but leave the zombie for the callback
+         * to see, like process_child() does */
+        zero(s->child.siginfo);
+        r = waitid(P_PID, s->child.pid, &s->child.siginfo, WEXITED|WNOHANG|WNOWAIT);
+        if (r < 0)
+                return -errno;
+
+        if (s->child.siginfo.si_pid == 0)
+                return 0;
+
+        return source_set_pending(s, true);
+}
+
 static int process_signal(sd_event *e, struct signal_data *d, uint32_t events) {
         bool read_one = false;
         int r;
@@ -2209,12 +2475,39 @@ static int process_signal(sd_event *e, struct signal_data *d, uint32_t events) {
         }
 }
 
+static void source_record(sd_event_source *s, int stat, usec_t usec) {
+        unsigned i;
+
+        assert(s);
+        assert(stat >= 0 && stat < _SD_EVENT_SOURCE_STAT_MAX);
+
+        if (!s->histograms) {
+                s->histograms = new0(uint64_t, _SD_EVENT_SOURCE_STAT_MAX * HISTOGRAM_BUCKETS);
+                if (!s->histograms)
+                        return;
+        }
+
+        i = usec == 0 ? 0 : MIN(u64log2(usec) + 1, HISTOGRAM_BUCKETS - 1U);
+        s->histograms[stat * HISTOGRAM_BUCKETS + i]++;
+}
+
 static int source_dispatch(sd_event_source *s) {
+        usec_t start = 0;
         int r = 0;
 
         assert(s);
         assert(s->pending || s->type == SOURCE_EXIT);
 
+        s->dispatch_iteration = s->event->iteration;
+
+        if (s->event->profile) {
+                start = now(CLOCK_MONOTONIC);
+
+                if (s->type != SOURCE_EXIT)
+                        source_record(s, SD_EVENT_SOURCE_STAT_LATENCY,
+                                      start > s->pending_timestamp ? start - s->pending_timestamp : 0);
+        }
+
         if (s->type != SOURCE_DEFER && s->type != SOURCE_EXIT) {
                 r = source_set_pending(s, false);
                 if (r < 0)
@@ -2300,6 +2593,17 @@ static int source_dispatch(sd_event_source *s) {
 
         s->dispatching = false;
 
+        if (start > 0) {
+                usec_t end;
+
+                end = now(CLOCK_MONOTONIC);
+                source_record(s, SD_EVENT_SOURCE_STAT_RUNTIME, end - start);
+
+                /* Defer sources stay pending, they wait from here on */
+                if (s->pending)
+                        s->pending_timestamp = end;
+        }
+
         if (r < 0)
                 log_debug_errno(r, "Event source %s (type %s) returned error, disabling: %m",
                                 strna(s->description), event_source_type_to_string(s->type));
@@ -2471,6 +2775,14 @@ _public_ int sd_event_prepare(sd_event *e) {
         if (event_next_pending(e) || e->need_process_child)
                 goto pending;
 
+        /* If someone else polls our fd, the registrations need to be
+         * in the kernel by now. Otherwise they go in with the wait. */
+        if (e->uring && e->fd_exported) {
+                r = event_uring_submit(e->uring);
+                if (r < 0)
+                        return r;
+        }
+
         e->state = SD_EVENT_ARMED;
 
         return 0;
@@ -2502,15 +2814,21 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
         ev_queue_max = MAX(e->n_sources, 1u);
         ev_queue = newa(struct epoll_event, ev_queue_max);
 
-        m = epoll_wait(e->epoll_fd, ev_queue, ev_queue_max,
-                       timeout == (uint64_t) -1 ? -1 : (int) ((timeout + USEC_PER_MSEC - 1) / USEC_PER_MSEC));
+        if (e->uring)
+                m = event_uring_wait(e->uring, ev_queue, ev_queue_max, timeout);
+        else {
+                m = epoll_wait(e->epoll_fd, ev_queue, ev_queue_max,
+                               timeout == (uint64_t) -1 ? -1 : (int) ((timeout + USEC_PER_MSEC - 1) / USEC_PER_MSEC));
+                if (m < 0)
+                        m = -errno;
+        }
         if (m < 0) {
-                if (errno == EINTR) {
+                if (m == -EINTR) {
                         e->state = SD_EVENT_PENDING;
                         return 1;
                 }
 
-                r = -errno;
+                r = m;
                 goto finish;
         }
 
@@ -2526,9 +2844,15 @@ _public_ int sd_event_wait(sd_event *e, uint64_t timeout) {
 
                         switch (*t) {
 
-                        case WAKEUP_EVENT_SOURCE:
-                                r = process_io(e, ev_queue[i].data.ptr, ev_queue[i].events);
+                        case WAKEUP_EVENT_SOURCE: {
+                                sd_event_source *s = ev_queue[i].data.ptr;
+
+                                if (s->type == SOURCE_CHILD)
+                                        r = process_pidfd(e, s);
+                                else
+                                        r = process_io(e, s, ev_queue[i].events);
                                 break;
+                        }
 
                         case WAKEUP_CLOCK_DATA: {
                                 struct clock_data *d = ev_queue[i].data.ptr;
@@ -2606,10 +2930,32 @@ _public_ int sd_event_dispatch(sd_event *e) {
 
         p = event_next_pending(e);
         if (p) {
+                int64_t priority = p->priority;
+                bool post = p->type == SOURCE_POST;
+
                 sd_event_ref(e);
 
                 e->state = SD_EVENT_RUNNING;
-                r = source_dispatch(p);
+
+                for (;;) {
+                        r = source_dispatch(p);
+                        if (r < 0 || !e->dispatch_batch || e->exit_requested)
+                                break;
+
+                        /* In batch mode go on with whatever else is
+                         * pending at the same priority, instead of
+                         * polling again for each. Post sources still
+                         * only run after the others, and every source
+                         * at most once, so that defer sources, which
+                         * stay pending, don't keep us here forever. */
+                        p = event_next_pending(e);
+                        if (!p ||
+                            p->priority != priority ||
+                            (p->type == SOURCE_POST) != post ||
+                            p->dispatch_iteration == e->iteration)
+                                break;
+                }
+
                 e->state = SD_EVENT_INITIAL;
 
                 sd_event_unref(e);
@@ -2674,6 +3020,11 @@ _public_ int sd_event_get_fd(sd_event *e) {
         assert_return(e, -EINVAL);
         assert_return(!event_pid_changed(e), -ECHILD);
 
+        if (e->uring) {
+                e->fd_exported = true;
+                return event_uring_fd(e->uring);
+        }
+
         return e->epoll_fd;
 }
 
@@ -2809,15 +3160,13 @@ _public_ int sd_event_set_watchdog(sd_event *e, int b) {
                 ev.events = EPOLLIN;
                 ev.data.ptr = INT_TO_PTR(SOURCE_WATCHDOG);
 
-                r = epoll_ctl(e->epoll_fd, EPOLL_CTL_ADD, e->watchdog_fd, &ev);
-                if (r < 0) {
-                        r = -errno;
+                r = event_ctl(e, EPOLL_CTL_ADD, e->watchdog_fd, &ev);
+                if (r < 0)
                         goto fail;
-                }
 
         } else {
                 if (e->watchdog_fd >= 0) {
-                        epoll_ctl(e->epoll_fd, EPOLL_CTL_DEL, e->watchdog_fd, NULL);
+                        (void) event_ctl(e, EPOLL_CTL_DEL, e->watchdog_fd, NULL);
                         e->watchdog_fd = safe_close(e->watchdog_fd);
                 }
         }
@@ -2836,3 +3185,62 @@ _public_ int sd_event_get_watchdog(sd_event *e) {
 
         return e->watchdog;
 }
+
+_public_ int sd_event_set_dispatch_batch(sd_event *e, int b) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        e->dispatch_batch = !!b;
+        return e->dispatch_batch;
+}
+
+_public_ int sd_event_get_dispatch_batch(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return e->dispatch_batch;
+}
+
+_public_ int sd_event_set_profile(sd_event *e, int b) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        if (e->profile == !!b)
+                return e->profile;
+
+        if (b) {
+                sd_event_source *s;
+                usec_t n;
+
+                /* Whatever is pending already counts from now on */
+                n = now(CLOCK_MONOTONIC);
+                LIST_FOREACH(sources, s, e->sources)
+                        s->pending_timestamp = n;
+        }
+
+        e->profile = !!b;
+        return e->profile;
+}
+
+_public_ int sd_event_get_profile(sd_event *e) {
+        assert_return(e, -EINVAL);
+        assert_return(!event_pid_changed(e), -ECHILD);
+
+        return e->profile;
+}
+
+_public_ int sd_event_source_get_histogram(sd_event_source *s, int stat, uint64_t *buckets, size_t n_buckets) {
+        assert_return(s, -EINVAL);
+        assert_return(stat >= 0 && stat < _SD_EVENT_SOURCE_STAT_MAX, -EINVAL);
+        assert_return(buckets || n_buckets == 0, -EINVAL);
+        assert_return(!event_pid_changed(s->event), -ECHILD);
+
+        n_buckets = MIN(n_buckets, (size_t) HISTOGRAM_BUCKETS);
+
+        if (s->histograms)
+                memcpy(buckets, s->histograms + stat * HISTOGRAM_BUCKETS, n_buckets * sizeof(uint64_t));
+        else
+                memzero(buckets, n_buckets * sizeof(uint64_t));
+
+        return HISTOGRAM_BUCKETS;
+}
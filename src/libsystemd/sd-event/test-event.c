@@ -19,12 +19,19 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <sys/socket.h>
+#include <sys/wait.h>
+
 #include "sd-event.h"
 
+#include "alloc-util.h"
 #include "fd-util.h"
+#include "fs-util.h"
 #include "log.h"
 #include "macro.h"
 #include "signal-util.h"
+#include "stdio-util.h"
+#include "string-util.h"
 #include "util.h"
 
 static int prepare_handler(sd_event_source *s, void *userdata) {
@@ -175,6 +182,9 @@ static void test_basic(void) {
         int a[2] = { -1, -1 }, b[2] = { -1, -1}, d[2] = { -1, -1}, k[2] = { -1, -1 };
         uint64_t event_now;
 
+        /* This runs once per backend */
+        do_quit = got_exit = got_post = false;
+
         assert_se(pipe(a) >= 0);
         assert_se(pipe(b) >= 0);
         assert_se(pipe(d) >= 0);
@@ -277,6 +287,8 @@ static void test_rtqueue(void) {
         sd_event_source *u = NULL, *v = NULL, *s = NULL;
         sd_event *e = NULL;
 
+        n_rtqueue = last_rtqueue_sigval = 0;
+
         assert_se(sd_event_default(&e) >= 0);
 
         assert_se(sigprocmask_many(SIG_BLOCK, NULL, SIGRTMIN+2, SIGRTMIN+3, SIGUSR2, -1) >= 0);
@@ -322,10 +334,427 @@ static void test_rtqueue(void) {
         sd_event_unref(e);
 }
 
-int main(int argc, char *argv[]) {
+static unsigned n_batch_defer = 0, n_batch_post = 0, n_batch_on = 0;
+
+static int batch_defer_handler(sd_event_source *s, void *userdata) {
+        n_batch_defer++;
+        return 0;
+}
+
+static int batch_post_handler(sd_event_source *s, void *userdata) {
+        n_batch_post++;
+        return 0;
+}
+
+static int batch_on_handler(sd_event_source *s, void *userdata) {
+        n_batch_on++;
+        return 0;
+}
+
+static void test_dispatch_batch(void) {
+        sd_event_source *a = NULL, *b = NULL, *c = NULL, *d = NULL, *p = NULL;
+        uint64_t buckets[64];
+        sd_event *e = NULL;
+        unsigned i, sum;
+
+        n_batch_defer = n_batch_post = n_batch_on = 0;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_get_dispatch_batch(e) == 0);
+        assert_se(sd_event_set_dispatch_batch(e, true) == 1);
+        assert_se(sd_event_set_profile(e, true) == 1);
+
+        assert_se(sd_event_add_defer(e, &a, batch_defer_handler, NULL) >= 0);
+        assert_se(sd_event_add_defer(e, &b, batch_defer_handler, NULL) >= 0);
+        assert_se(sd_event_add_defer(e, &c, batch_defer_handler, NULL) >= 0);
+        assert_se(sd_event_source_set_priority(c, 1) >= 0);
+        assert_se(sd_event_add_post(e, &p, batch_post_handler, NULL) >= 0);
+        assert_se(sd_event_add_defer(e, &d, batch_on_handler, NULL) >= 0);
+        assert_se(sd_event_source_set_priority(d, -1) >= 0);
+        assert_se(sd_event_source_set_enabled(d, SD_EVENT_ON) >= 0);
+
+        /* A source that stays pending is dispatched only once per batch */
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_batch_on == 1);
+        assert_se(n_batch_defer == 0);
+        assert_se(sd_event_source_set_enabled(d, SD_EVENT_OFF) >= 0);
+
+        /* Both sources at priority 0 in one go, but not the post
+         * source that became pending meanwhile */
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_batch_defer == 2);
+        assert_se(n_batch_post == 0);
+
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_batch_defer == 2);
+        assert_se(n_batch_post == 1);
+
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_batch_defer == 3);
+
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_batch_post == 2);
+
+        /* And one at a time without batching */
+        assert_se(sd_event_set_dispatch_batch(e, false) == 0);
+        assert_se(sd_event_source_set_enabled(a, SD_EVENT_ONESHOT) >= 0);
+        assert_se(sd_event_source_set_enabled(b, SD_EVENT_ONESHOT) >= 0);
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_batch_defer == 4);
+        assert_se(sd_event_run(e, 0) == 1);
+        assert_se(n_batch_defer == 5);
+
+        /* Every dispatch shows up in the histograms */
+        assert_se(sd_event_source_get_histogram(a, SD_EVENT_SOURCE_STAT_LATENCY, NULL, 0) == 32);
+        assert_se(sd_event_source_get_histogram(a, SD_EVENT_SOURCE_STAT_LATENCY, buckets, ELEMENTSOF(buckets)) == 32);
+        for (i = 0, sum = 0; i < 32; i++)
+                sum += buckets[i];
+        assert_se(sum == 2);
+
+        assert_se(sd_event_source_get_histogram(d, SD_EVENT_SOURCE_STAT_RUNTIME, buckets, ELEMENTSOF(buckets)) == 32);
+        for (i = 0, sum = 0; i < 32; i++)
+                sum += buckets[i];
+        assert_se(sum == 1);
+
+        assert_se(sd_event_source_get_histogram(p, _SD_EVENT_SOURCE_STAT_MAX, buckets, ELEMENTSOF(buckets)) == -EINVAL);
+
+        sd_event_source_unref(a);
+        sd_event_source_unref(b);
+        sd_event_source_unref(c);
+        sd_event_source_unref(d);
+        sd_event_source_unref(p);
+
+        sd_event_unref(e);
+}
+
+/* The scheduling tests are small by default, when called with
+ * "bench" they run at the scale they are meant to measure */
+static unsigned arg_timers = 1000;
+
+static unsigned n_timers_fired = 0;
+
+static int timer_bench_handler(sd_event_source *s, uint64_t usec, void *userdata) {
+        assert_se(now(CLOCK_MONOTONIC) >= usec);
+
+        n_timers_fired++;
+        return 0;
+}
+
+static void log_bench(const char *what, uint64_t accuracy, bool batch, usec_t start) {
+        log_info("%-12s accuracy=%-8"PRIu64" batch=%-3s %6"PRIu64" ns/timer",
+                 what, accuracy, yes_no(batch), (now(CLOCK_MONOTONIC) - start) * NSEC_PER_USEC / arg_timers);
+}
+
+static void test_timer_scheduling(uint64_t accuracy, bool batch) {
+        _cleanup_free_ sd_event_source **sources = NULL;
+        sd_event *e = NULL;
+        usec_t base, start;
+        unsigned i;
+
+        /* With the default accuracy the sources end up in the timer
+         * wheels, with an accuracy of 1µs in the prioqs */
+
+        srand(0);
+        n_timers_fired = 0;
+
+        sources = new(sd_event_source*, arg_timers);
+        assert_se(sources);
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_dispatch_batch(e, batch) == batch);
+
+        base = now(CLOCK_MONOTONIC) + USEC_PER_HOUR;
+
+        start = now(CLOCK_MONOTONIC);
+        for (i = 0; i < arg_timers; i++)
+                assert_se(sd_event_add_time(e, &sources[i], CLOCK_MONOTONIC, base + rand() % USEC_PER_HOUR, accuracy, timer_bench_handler, NULL) >= 0);
+        log_bench("add", accuracy, batch, start);
+
+        start = now(CLOCK_MONOTONIC);
+        for (i = 0; i < arg_timers; i++)
+                assert_se(sd_event_source_set_time(sources[i], base + rand() % USEC_PER_HOUR) >= 0);
+        log_bench("set_time", accuracy, batch, start);
+
+        start = now(CLOCK_MONOTONIC);
+        for (i = 0; i < arg_timers; i++) {
+                assert_se(sd_event_source_set_enabled(sources[i], SD_EVENT_OFF) >= 0);
+                assert_se(sd_event_source_set_enabled(sources[i], SD_EVENT_ONESHOT) >= 0);
+        }
+        log_bench("set_enabled", accuracy, batch, start);
+
+        start = now(CLOCK_MONOTONIC);
+        for (i = 0; i < arg_timers; i++) {
+                assert_se(sd_event_source_set_time(sources[i], base + rand() % USEC_PER_HOUR) >= 0);
+                assert_se(sd_event_run(e, 0) == 0);
+        }
+        log_bench("run", accuracy, batch, start);
+
+        /* Now let them all elapse within the next 100ms */
+        base = now(CLOCK_MONOTONIC);
+        for (i = 0; i < arg_timers; i++)
+                assert_se(sd_event_source_set_time(sources[i], base + rand() % (100 * USEC_PER_MSEC)) >= 0);
+
+        start = now(CLOCK_MONOTONIC);
+        while (n_timers_fired < arg_timers)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        log_bench("dispatch", accuracy, batch, start);
+
+        for (i = 0; i < arg_timers; i++)
+                sd_event_source_unref(sources[i]);
+
+        sd_event_unref(e);
+}
+
+#define N_PIPES_MAX 256
+
+static unsigned arg_pipes = 16;
+static unsigned arg_rounds = 10;
+
+static unsigned n_io_ready = 0;
+
+static int io_bench_handler(sd_event_source *s, int fd, uint32_t revents, void *userdata) {
+        char c;
+
+        assert_se(revents & EPOLLIN);
+        assert_se(read(fd, &c, 1) == 1);
+
+        n_io_ready++;
+        return 0;
+}
+
+static const char *event_backend(sd_event *e) {
+        char path[sizeof("/proc/self/fd/") + DECIMAL_STR_MAX(int)];
+        _cleanup_free_ char *target = NULL;
+
+        xsprintf(path, "/proc/self/fd/%i", sd_event_get_fd(e));
+        assert_se(readlink_malloc(path, &target) >= 0);
+
+        return strstr(target, "io_uring") ? "io_uring" : "epoll";
+}
+
+static void test_io_scheduling(int enabled) {
+        sd_event_source *sources[N_PIPES_MAX];
+        int fds[N_PIPES_MAX][2];
+        const char *backend;
+        sd_event *e = NULL;
+        unsigned i, round;
+        usec_t start;
+
+        /* With ONESHOT sources every dispatch removes the fd and every
+         * round adds it back, so this also shows the cost of changing
+         * registrations */
+
+        n_io_ready = 0;
+
+        assert_se(sd_event_new(&e) >= 0);
+        assert_se(sd_event_set_dispatch_batch(e, true) == 1);
+
+        for (i = 0; i < arg_pipes; i++) {
+                assert_se(pipe2(fds[i], O_NONBLOCK|O_CLOEXEC) >= 0);
+                assert_se(sd_event_add_io(e, &sources[i], fds[i][0], EPOLLIN, io_bench_handler, NULL) >= 0);
+                assert_se(sd_event_source_set_enabled(sources[i], enabled) >= 0);
+        }
+
+        start = now(CLOCK_MONOTONIC);
+
+        for (round = 0; round < arg_rounds; round++) {
+                for (i = 0; i < arg_pipes; i++) {
+                        if (enabled == SD_EVENT_ONESHOT)
+                                assert_se(sd_event_source_set_enabled(sources[i], SD_EVENT_ONESHOT) >= 0);
+
+                        assert_se(write(fds[i][1], "x", 1) == 1);
+                }
+
+                while (n_io_ready < (round + 1) * arg_pipes)
+                        assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        }
+
+        backend = event_backend(e);
+        log_info("io %-8s %-8s %6"PRIu64" ns/event",
+                 backend, enabled == SD_EVENT_ONESHOT ? "oneshot" : "on",
+                 (now(CLOCK_MONOTONIC) - start) * NSEC_PER_USEC / (arg_rounds * arg_pipes));
+
+        /* Nothing left over */
+        assert_se(sd_event_run(e, 0) == 0);
+        assert_se(n_io_ready == arg_rounds * arg_pipes);
+
+        for (i = 0; i < arg_pipes; i++) {
+                sd_event_source_unref(sources[i]);
+                safe_close_pair(fds[i]);
+        }
+
+        sd_event_unref(e);
+}
+
+#define N_CHILDREN_MAX 256
+
+static unsigned arg_children = 16;
+
+static unsigned n_children_exited = 0;
+
+static int child_bench_handler(sd_event_source *s, const siginfo_t *si, void *userdata) {
+        siginfo_t zombie = {};
+
+        assert_se(si->si_code == CLD_EXITED);
+        assert_se(si->si_status == 0);
+
+        /* Not reaped yet */
+        assert_se(waitid(P_PID, si->si_pid, &zombie, WEXITED|WNOHANG|WNOWAIT) >= 0);
+        assert_se(zombie.si_pid == si->si_pid);
+
+        n_children_exited++;
+        return 0;
+}
+
+static void test_child_scheduling(int options) {
+        sd_event_source *sources[N_CHILDREN_MAX];
+        siginfo_t si = {};
+        sd_event *e = NULL;
+        int p[2];
+        unsigned i;
+        usec_t start;
+
+        /* WEXITED only sources are watched through pidfds if
+         * possible, the others are looked for on each SIGCHLD */
+
+        n_children_exited = 0;
+
+        assert_se(sigprocmask_many(SIG_BLOCK, NULL, SIGCHLD, -1) >= 0);
+        assert_se(pipe2(p, O_CLOEXEC) >= 0);
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        for (i = 0; i < arg_children; i++) {
+                char c;
+                pid_t pid;
+
+                pid = fork();
+                assert_se(pid >= 0);
+
+                if (pid == 0) {
+                        /* Wait until the parent lets go of us */
+                        safe_close(p[1]);
+                        _exit(read(p[0], &c, 1) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+                }
+
+                assert_se(sd_event_add_child(e, &sources[i], pid, options, child_bench_handler, NULL) >= 0);
+                assert_se(sd_event_source_set_enabled(sources[i], SD_EVENT_ONESHOT) >= 0);
+        }
+
+        start = now(CLOCK_MONOTONIC);
+
+        p[1] = safe_close(p[1]);
+
+        while (n_children_exited < arg_children)
+                assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+
+        log_info("child %-8s %6"PRIu64" ns/child",
+                 options == WEXITED ? "exited" : "stopped",
+                 (now(CLOCK_MONOTONIC) - start) * NSEC_PER_USEC / arg_children);
+
+        /* Everything was reaped */
+        assert_se(waitid(P_ALL, 0, &si, WEXITED|WNOHANG) < 0 && errno == ECHILD);
+
+        for (i = 0; i < arg_children; i++)
+                sd_event_source_unref(sources[i]);
+
+        safe_close(p[0]);
+        sd_event_unref(e);
+}
+
+static void test_io_close(void) {
+        sd_event_source *a = NULL, *b = NULL, *c = NULL;
+        int x[2], y[2], z[2];
+        sd_event *e = NULL;
+
+        /* Once a source is gone, or its fd was closed and is reused,
+         * the file it watched must not be kept open by the event loop,
+         * or the peer would never see the connection closed */
+
+        n_io_ready = 0;
+
+        assert_se(sd_event_new(&e) >= 0);
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, x) >= 0);
+        assert_se(sd_event_add_io(e, &a, x[0], EPOLLIN, io_bench_handler, NULL) >= 0);
+        assert_se(sd_event_run(e, 0) == 0);
+
+        a = sd_event_source_unref(a);
+        x[0] = safe_close(x[0]);
+        assert_se(send(x[1], "x", 1, MSG_NOSIGNAL) < 0 && errno == EPIPE);
+
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, y) >= 0);
+        assert_se(sd_event_add_io(e, &b, y[0], EPOLLIN, io_bench_handler, NULL) >= 0);
+        assert_se(sd_event_run(e, 0) == 0);
+
+        /* Closed behind the back of the source, and the number taken
+         * by a new connection, which may be watched nonetheless */
+        safe_close(y[0]);
+        assert_se(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, z) >= 0);
+        assert_se(z[0] == y[0]);
+        assert_se(sd_event_add_io(e, &c, z[0], EPOLLIN, io_bench_handler, NULL) >= 0);
+
+        assert_se(write(z[1], "x", 1) == 1);
+        assert_se(sd_event_run(e, (uint64_t) -1) >= 0);
+        assert_se(n_io_ready == 1);
+
+        assert_se(send(y[1], "x", 1, MSG_NOSIGNAL) < 0 && errno == EPIPE);
+
+        sd_event_source_unref(c);
+        sd_event_source_unref(b);
+        sd_event_unref(e);
+
+        safe_close(x[1]);
+        safe_close(y[1]);
+        safe_close_pair(z);
+}
+
+static void test_backend(const char *backend) {
+        sd_event *e = NULL;
+
+        if (backend)
+                assert_se(setenv("SYSTEMD_EVENT_BACKEND", backend, 1) >= 0);
+        else
+                assert_se(unsetenv("SYSTEMD_EVENT_BACKEND") >= 0);
+
+        assert_se(sd_event_new(&e) >= 0);
+        if (!streq(event_backend(e), backend ?: "epoll")) {
+                log_info("Event loop backend %s not available, skipping.", backend);
+                sd_event_unref(e);
+                return;
+        }
+        sd_event_unref(e);
 
         test_basic();
         test_rtqueue();
+        test_dispatch_batch();
+        test_io_close();
+
+        test_io_scheduling(SD_EVENT_ON);
+        test_io_scheduling(SD_EVENT_ONESHOT);
+
+        test_child_scheduling(WEXITED);
+        test_child_scheduling(WEXITED|WSTOPPED);
+}
+
+int main(int argc, char *argv[]) {
+
+        log_parse_environment();
+        log_open();
+
+        if (argc > 1 && streq(argv[1], "bench")) {
+                arg_timers = 100000;
+                arg_pipes = N_PIPES_MAX;
+                arg_rounds = 200;
+                arg_children = N_CHILDREN_MAX;
+        }
+
+        test_backend(NULL);
+        test_backend("io_uring");
+
+        test_timer_scheduling(0, false);
+        test_timer_scheduling(1, false);
+        test_timer_scheduling(0, true);
 
         return 0;
 }
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 
 #include "alloc-util.h"
@@ -162,26 +163,28 @@ static int next_assignment(const char *unit,
         return 0;
 }
 
-/* Parse a variable assignment line */
-static int parse_line(const char* unit,
-                      const char *filename,
-                      unsigned line,
-                      const char *sections,
-                      ConfigItemLookup lookup,
-                      const void *table,
-                      bool relaxed,
-                      bool allow_include,
-                      char **section,
-                      unsigned *section_line,
-                      bool *section_ignored,
-                      char *l,
-                      void *userdata) {
+ConfigTokens *config_tokens_free(ConfigTokens *t) {
+        size_t i;
 
-        char *e;
+        if (!t)
+                return NULL;
 
-        assert(filename);
+        if (!t->borrowed)
+                for (i = 0; i < t->n_tokens; i++)
+                        free(t->tokens[i].key);
+
+        free(t->tokens);
+        free(t);
+
+        return NULL;
+}
+
+/* Split a line into a token, without interpreting it */
+static int tokenize_line(ConfigTokens *t, unsigned line, char *l) {
+        ConfigToken *token;
+
+        assert(t);
         assert(line > 0);
-        assert(lookup);
         assert(l);
 
         l = strstrip(l);
@@ -192,7 +195,185 @@ static int parse_line(const char* unit,
         if (strchr(COMMENTS "\n", *l))
                 return 0;
 
+        if (!GREEDY_REALLOC(t->tokens, t->n_allocated, t->n_tokens + 1))
+                return -ENOMEM;
+
+        token = t->tokens + t->n_tokens;
+        *token = (ConfigToken) {
+                .line = line,
+        };
+
         if (startswith(l, ".include ")) {
+                token->type = CONFIG_TOKEN_INCLUDE;
+                token->key = strdup(strstrip(l+9));
+
+        } else if (*l == '[') {
+                size_t k;
+
+                k = strlen(l);
+                assert(k > 0);
+
+                if (l[k-1] != ']') {
+                        token->type = CONFIG_TOKEN_BAD_SECTION;
+                        token->key = strdup(l);
+                } else {
+                        token->type = CONFIG_TOKEN_SECTION;
+                        token->key = strndup(l+1, k-2);
+                }
+
+        } else {
+                char *e;
+
+                token->key = strdup(l);
+                if (token->key) {
+                        e = strchr(token->key, '=');
+                        if (!e)
+                                token->type = CONFIG_TOKEN_BAD_ASSIGNMENT;
+                        else {
+                                *e = 0;
+                                token->type = CONFIG_TOKEN_ASSIGNMENT;
+                                token->value = strstrip(e+1);
+
+                                /* Leading whitespace was stripped off above already */
+                                strstrip(token->key);
+                        }
+                }
+        }
+
+        if (!token->key)
+                return -ENOMEM;
+
+        t->n_tokens++;
+        return 0;
+}
+
+/* Read the file and split it into tokens. This does not log and
+ * does not touch any global state, so that it may be called from
+ * worker threads. */
+int config_tokenize(const char *filename, FILE *f, ConfigTokens **ret) {
+        _cleanup_(config_tokens_freep) ConfigTokens *t = NULL;
+        _cleanup_free_ char *continuation = NULL;
+        _cleanup_fclose_ FILE *ours = NULL;
+        unsigned line = 0;
+        struct stat st;
+        int r;
+
+        assert(filename);
+        assert(ret);
+
+        t = new0(ConfigTokens, 1);
+        if (!t)
+                return -ENOMEM;
+
+        t->timestamp = now(CLOCK_REALTIME);
+
+        if (!f) {
+                f = ours = fopen(filename, "re");
+                if (!f)
+                        return -errno;
+        }
+
+        if (fstat(fileno(f), &st) < 0)
+                return -errno;
+
+        t->dev = st.st_dev;
+        t->ino = st.st_ino;
+        t->size = st.st_size;
+        t->mtime = timespec_load(&st.st_mtim);
+
+        while (!feof(f)) {
+                char l[LINE_MAX], *p, *c = NULL, *e;
+                bool escaped = false;
+
+                if (!fgets(l, sizeof(l), f)) {
+                        if (feof(f))
+                                break;
+
+                        t->error = -errno;
+                        break;
+                }
+
+                truncate_nl(l);
+
+                if (continuation) {
+                        c = strappend(continuation, l);
+                        if (!c)
+                                return -ENOMEM;
+
+                        continuation = mfree(continuation);
+                        p = c;
+                } else
+                        p = l;
+
+                for (e = p; *e; e++) {
+                        if (escaped)
+                                escaped = false;
+                        else if (*e == '\\')
+                                escaped = true;
+                }
+
+                if (escaped) {
+                        *(e-1) = ' ';
+
+                        if (c)
+                                continuation = c;
+                        else {
+                                continuation = strdup(l);
+                                if (!continuation)
+                                        return -ENOMEM;
+                        }
+
+                        continue;
+                }
+
+                r = tokenize_line(t, ++line, p);
+                free(c);
+                if (r < 0)
+                        return r;
+        }
+
+        *ret = t;
+        t = NULL;
+
+        return 0;
+}
+
+static bool config_tokens_current(ConfigTokens *t, int fd) {
+        struct stat st;
+
+        assert(t);
+        assert(fd >= 0);
+
+        if (fstat(fd, &st) < 0)
+                return false;
+
+        return t->dev == st.st_dev &&
+                t->ino == st.st_ino &&
+                t->size == st.st_size &&
+                t->mtime == timespec_load(&st.st_mtim);
+}
+
+/* Interpret a single token */
+static int parse_token(const char* unit,
+                       const char *filename,
+                       const ConfigToken *token,
+                       const char *sections,
+                       ConfigItemLookup lookup,
+                       const void *table,
+                       bool relaxed,
+                       bool allow_include,
+                       char **section,
+                       unsigned *section_line,
+                       bool *section_ignored,
+                       void *userdata) {
+
+        assert(filename);
+        assert(token);
+        assert(lookup);
+
+        switch (token->type) {
+
+        case CONFIG_TOKEN_INCLUDE: {
                 _cleanup_free_ char *fn = NULL;
 
                 /* .includes are a bad idea, we only support them here
@@ -205,78 +386,72 @@ static int parse_line(const char* unit,
                  * Support for them should be eventually removed. */
 
                 if (!allow_include) {
-                        log_syntax(unit, LOG_ERR, filename, line, 0, ".include not allowed here. Ignoring.");
+                        log_syntax(unit, LOG_ERR, filename, token->line, 0, ".include not allowed here. Ignoring.");
                         return 0;
                 }
 
-                fn = file_in_same_dir(filename, strstrip(l+9));
+                fn = file_in_same_dir(filename, token->key);
                 if (!fn)
                         return -ENOMEM;
 
                 return config_parse(unit, fn, NULL, sections, lookup, table, relaxed, false, false, userdata);
         }
 
-        if (*l == '[') {
-                size_t k;
-                char *n;
-
-                k = strlen(l);
-                assert(k > 0);
-
-                if (l[k-1] != ']') {
-                        log_syntax(unit, LOG_ERR, filename, line, 0, "Invalid section header '%s'", l);
-                        return -EBADMSG;
-                }
+        case CONFIG_TOKEN_BAD_SECTION:
+                log_syntax(unit, LOG_ERR, filename, token->line, 0, "Invalid section header '%s'", token->key);
+                return -EBADMSG;
 
-                n = strndup(l+1, k-2);
-                if (!n)
-                        return -ENOMEM;
+        case CONFIG_TOKEN_SECTION: {
+                char *n;
 
-                if (sections && !nulstr_contains(sections, n)) {
+                if (sections && !nulstr_contains(sections, token->key)) {
 
-                        if (!relaxed && !startswith(n, "X-"))
-                                log_syntax(unit, LOG_WARNING, filename, line, 0, "Unknown section '%s'. Ignoring.", n);
+                        if (!relaxed && !startswith(token->key, "X-"))
+                                log_syntax(unit, LOG_WARNING, filename, token->line, 0, "Unknown section '%s'. Ignoring.", token->key);
 
-                        free(n);
                         *section = mfree(*section);
                         *section_line = 0;
                         *section_ignored = true;
                 } else {
+                        n = strdup(token->key);
+                        if (!n)
+                                return -ENOMEM;
+
                         free(*section);
                         *section = n;
-                        *section_line = line;
+                        *section_line = token->line;
                         *section_ignored = false;
                 }
 
                 return 0;
         }
 
+        default:
+                break;
+        }
+
         if (sections && !*section) {
 
                 if (!relaxed && !*section_ignored)
-                        log_syntax(unit, LOG_WARNING, filename, line, 0, "Assignment outside of section. Ignoring.");
+                        log_syntax(unit, LOG_WARNING, filename, token->line, 0, "Assignment outside of section. Ignoring.");
 
                 return 0;
         }
 
-        e = strchr(l, '=');
-        if (!e) {
-                log_syntax(unit, LOG_WARNING, filename, line, 0, "Missing '='.");
+        if (token->type == CONFIG_TOKEN_BAD_ASSIGNMENT) {
+                log_syntax(unit, LOG_WARNING, filename, token->line, 0, "Missing '='.");
                 return -EINVAL;
         }
 
-        *e = 0;
-        e++;
-
         return next_assignment(unit,
                                filename,
-                               line,
+                               token->line,
                                lookup,
                                table,
                                *section,
                                *section_line,
-                               strstrip(l),
-                               strstrip(e),
+                               token->key,
+                               token->value,
                                relaxed,
                                userdata);
 }
@@ -293,13 +468,35 @@ int config_parse(const char *unit,
                  bool warn,
                  void *userdata) {
 
-        _cleanup_free_ char *section = NULL, *continuation = NULL;
+        _cleanup_(config_tokens_freep) ConfigTokens *tokens = NULL;
+
+        return config_parse_tokens(unit, filename, f, &tokens, sections, lookup, table, relaxed, allow_include, warn, userdata);
+}
+
+/* Like config_parse(), but reuses the tokens read from the file
+ * earlier, if the file did not change since. Otherwise they are
+ * replaced by the tokens read now. */
+int config_parse_tokens(const char *unit,
+                        const char *filename,
+                        FILE *f,
+                        ConfigTokens **tokens,
+                        const char *sections,
+                        ConfigItemLookup lookup,
+                        const void *table,
+                        bool relaxed,
+                        bool allow_include,
+                        bool warn,
+                        void *userdata) {
+
+        _cleanup_free_ char *section = NULL;
         _cleanup_fclose_ FILE *ours = NULL;
-        unsigned line = 0, section_line = 0;
+        unsigned section_line = 0;
         bool section_ignored = false;
+        size_t i;
         int r;
 
         assert(filename);
+        assert(tokens);
         assert(lookup);
 
         if (!f) {
@@ -316,72 +513,30 @@ int config_parse(const char *unit,
 
         fd_warn_permissions(filename, fileno(f));
 
-        while (!feof(f)) {
-                char l[LINE_MAX], *p, *c = NULL, *e;
-                bool escaped = false;
-
-                if (!fgets(l, sizeof(l), f)) {
-                        if (feof(f))
-                                break;
+        if (!*tokens || !config_tokens_current(*tokens, fileno(f))) {
+                *tokens = config_tokens_free(*tokens);
 
-                        log_error_errno(errno, "Failed to read configuration file '%s': %m", filename);
-                        return -errno;
-                }
-
-                truncate_nl(l);
-
-                if (continuation) {
-                        c = strappend(continuation, l);
-                        if (!c) {
-                                if (warn)
-                                        log_oom();
-                                return -ENOMEM;
-                        }
-
-                        continuation = mfree(continuation);
-                        p = c;
-                } else
-                        p = l;
-
-                for (e = p; *e; e++) {
-                        if (escaped)
-                                escaped = false;
-                        else if (*e == '\\')
-                                escaped = true;
-                }
-
-                if (escaped) {
-                        *(e-1) = ' ';
-
-                        if (c)
-                                continuation = c;
-                        else {
-                                continuation = strdup(l);
-                                if (!continuation) {
-                                        if (warn)
-                                                log_oom();
-                                        return -ENOMEM;
-                                }
-                        }
-
-                        continue;
+                r = config_tokenize(filename, f, tokens);
+                if (r < 0) {
+                        if (warn)
+                                log_warning_errno(r, "Failed to parse file '%s': %m", filename);
+                        return r;
                 }
+        }
 
-                r = parse_line(unit,
-                               filename,
-                               ++line,
-                               sections,
-                               lookup,
-                               table,
-                               relaxed,
-                               allow_include,
-                               &section,
-                               &section_line,
-                               &section_ignored,
-                               p,
-                               userdata);
-                free(c);
-
+        for (i = 0; i < (*tokens)->n_tokens; i++) {
+                r = parse_token(unit,
+                                filename,
+                                (*tokens)->tokens + i,
+                                sections,
+                                lookup,
+                                table,
+                                relaxed,
+                                allow_include,
+                                &section,
+                                &section_line,
+                                &section_ignored,
+                                userdata);
                 if (r < 0) {
                         if (warn)
                                 log_warning_errno(r, "Failed to parse file '%s': %m",
@@ -390,6 +545,9 @@ int config_parse(const char *unit,
                 }
         }
 
+        if ((*tokens)->error < 0)
+                return log_error_errno((*tokens)->error, "Failed to read configuration file '%s': %m", filename);
+
         return 0;
 }
 
@@ -30,6 +30,7 @@
 #include "alloc-util.h"
 #include "log.h"
 #include "macro.h"
+#include "time-util.h"
 
 /* An abstract parser for simple, line based, shallow configuration
  * files consisting of variable assignments only. */
@@ -97,6 +98,58 @@ int config_parse(const char *unit,
                  bool warn,
                  void *userdata);
 
+/* The lines of a configuration file, split up but not interpreted yet */
+typedef enum ConfigTokenType {
+        CONFIG_TOKEN_ASSIGNMENT,
+        CONFIG_TOKEN_SECTION,
+        CONFIG_TOKEN_INCLUDE,
+        CONFIG_TOKEN_BAD_SECTION,
+        CONFIG_TOKEN_BAD_ASSIGNMENT,
+        _CONFIG_TOKEN_TYPE_MAX,
+} ConfigTokenType;
+
+typedef struct ConfigToken {
+        ConfigTokenType type;
+        unsigned line;
+        char *key;   /* value points into the same allocation */
+        char *value;
+} ConfigToken;
+
+typedef struct ConfigTokens {
+        ConfigToken *tokens;
+        size_t n_tokens, n_allocated;
+
+        /* The strings are owned by someone else */
+        bool borrowed;
+
+        /* Error reading the file after the last token */
+        int error;
+
+        /* Identity of the file the tokens were read from, and when
+         * reading it began */
+        dev_t dev;
+        ino_t ino;
+        off_t size;
+        usec_t mtime;
+        usec_t timestamp;
+} ConfigTokens;
+
+int config_tokenize(const char *filename, FILE *f, ConfigTokens **ret);
+ConfigTokens *config_tokens_free(ConfigTokens *t);
+DEFINE_TRIVIAL_CLEANUP_FUNC(ConfigTokens*, config_tokens_free);
+
+int config_parse_tokens(const char *unit,
+                        const char *filename,
+                        FILE *f,
+                        ConfigTokens **tokens,
+                        const char *sections,      /* nulstr */
+                        ConfigItemLookup lookup,
+                        const void *table,
+                        bool relaxed,
+                        bool allow_include,
+                        bool warn,
+                        void *userdata);
+
 int config_parse_many(const char *conf_file,      /* possibly NULL */
                       const char *conf_file_dirs, /* nulstr */
                       const char *sections,       /* nulstr */
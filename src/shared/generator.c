@@ -35,6 +35,7 @@
 #include "path-util.h"
 #include "special.h"
 #include "string-util.h"
+#include "strv.h"
 #include "time-util.h"
 #include "unit-name.h"
 #include "util.h"
@@ -194,3 +195,27 @@ int generator_write_timeouts(
                                     program_invocation_short_name,
                                     u / USEC_PER_SEC);
 }
+
+int generator_write_inputs(char **paths) {
+        _cleanup_free_ char *s = NULL;
+        const char *p;
+        int r;
+
+        /* Tells the manager which files and directories the output
+         * is based on, so that it may skip running us again as long
+         * as none of them changes */
+
+        p = getenv("SYSTEMD_GENERATOR_INPUTS");
+        if (!p)
+                return 0;
+
+        s = strv_join(paths, "\n");
+        if (!s)
+                return log_oom();
+
+        r = write_string_file(p, s, WRITE_STRING_FILE_CREATE);
+        if (r < 0)
+                return log_warning_errno(r, "Failed to write %s: %m", p);
+
+        return 1;
+}
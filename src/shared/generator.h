@@ -36,3 +36,5 @@ int generator_write_timeouts(
         const char *where,
         const char *opts,
         char **filtered);
+
+int generator_write_inputs(char **paths);
@@ -105,6 +105,7 @@ static bool arg_no_pager = false;
 static bool arg_no_wtmp = false;
 static bool arg_no_wall = false;
 static bool arg_no_reload = false;
+static bool arg_incremental = false;
 static bool arg_show_types = false;
 static bool arg_ignore_inhibitors = false;
 static bool arg_dry = false;
@@ -4935,6 +4936,7 @@ static int daemon_reload(int argc, char *argv[], void *userdata) {
                         streq(argv[0], "reboot")        ? "Reboot" :
                         streq(argv[0], "kexec")         ? "KExec" :
                         streq(argv[0], "exit")          ? "Exit" :
+                        arg_incremental                 ? "ReloadIncremental" :
                                     /* "daemon-reload" */ "Reload";
         }
 
@@ -6232,7 +6234,8 @@ static void systemctl_help(void) {
                "                              short-precise, short-monotonic, verbose,\n"
                "                              export, json, json-pretty, json-sse, cat)\n"
                "     --firmware-setup Tell the firmware to show the setup menu on next boot\n"
-               "     --plain          Print unit dependencies as a list instead of a tree\n\n"
+               "     --plain          Print unit dependencies as a list instead of a tree\n"
+               "     --incremental    When reloading the manager, only reload changed units\n\n"
                "Unit Commands:\n"
                "  list-units [PATTERN...]         List loaded units\n"
                "  list-sockets [PATTERN...]       List loaded sockets ordered by address\n"
@@ -6481,6 +6484,7 @@ static int systemctl_parse_argv(int argc, char *argv[]) {
                 ARG_FIRMWARE_SETUP,
                 ARG_NOW,
                 ARG_MESSAGE,
+                ARG_INCREMENTAL,
         };
 
         static const struct option options[] = {
@@ -6526,6 +6530,7 @@ static int systemctl_parse_argv(int argc, char *argv[]) {
                 { "firmware-setup",      no_argument,       NULL, ARG_FIRMWARE_SETUP      },
                 { "now",                 no_argument,       NULL, ARG_NOW                 },
                 { "message",             required_argument, NULL, ARG_MESSAGE             },
+                { "incremental",         no_argument,       NULL, ARG_INCREMENTAL         },
                 {}
         };
 
@@ -6784,6 +6789,10 @@ static int systemctl_parse_argv(int argc, char *argv[]) {
                         arg_firmware_setup = true;
                         break;
 
+                case ARG_INCREMENTAL:
+                        arg_incremental = true;
+                        break;
+
                 case ARG_STATE: {
                         if (isempty(optarg)) {
                                 log_error("--signal requires arguments.");
@@ -67,6 +67,14 @@ enum {
         SD_EVENT_PRIORITY_IDLE = 100
 };
 
+enum {
+        /* From the source becoming pending to its dispatching */
+        SD_EVENT_SOURCE_STAT_LATENCY,
+        /* The time spent in the handler */
+        SD_EVENT_SOURCE_STAT_RUNTIME,
+        _SD_EVENT_SOURCE_STAT_MAX
+};
+
 typedef int (*sd_event_handler_t)(sd_event_source *s, void *userdata);
 typedef int (*sd_event_io_handler_t)(sd_event_source *s, int fd, uint32_t revents, void *userdata);
 typedef int (*sd_event_time_handler_t)(sd_event_source *s, uint64_t usec, void *userdata);
@@ -102,6 +110,10 @@ int sd_event_get_tid(sd_event *e, pid_t *tid);
 int sd_event_get_exit_code(sd_event *e, int *code);
 int sd_event_set_watchdog(sd_event *e, int b);
 int sd_event_get_watchdog(sd_event *e);
+int sd_event_set_dispatch_batch(sd_event *e, int b);
+int sd_event_get_dispatch_batch(sd_event *e);
+int sd_event_set_profile(sd_event *e, int b);
+int sd_event_get_profile(sd_event *e);
 
 sd_event_source* sd_event_source_ref(sd_event_source *s);
 sd_event_source* sd_event_source_unref(sd_event_source *s);
@@ -130,6 +142,7 @@ int sd_event_source_set_time_accuracy(sd_event_source *s, uint64_t usec);
 int sd_event_source_get_time_clock(sd_event_source *s, clockid_t *clock);
 int sd_event_source_get_signal(sd_event_source *s);
 int sd_event_source_get_child_pid(sd_event_source *s, pid_t *pid);
+int sd_event_source_get_histogram(sd_event_source *s, int stat, uint64_t *buckets, size_t n_buckets);
 
 /* Define helpers so that __attribute__((cleanup(sd_event_unrefp))) and similar may be used. */
 _SD_DEFINE_POINTER_CLEANUP_FUNC(sd_event, sd_event_unref);
@@ -29,6 +29,7 @@
 #include "dirent-util.h"
 #include "fd-util.h"
 #include "fileio.h"
+#include "generator.h"
 #include "hashmap.h"
 #include "hexdecoct.h"
 #include "install.h"
@@ -73,6 +74,7 @@ static const struct {
 };
 
 const char *arg_dest = "/tmp";
+static char **arg_inputs = NULL;
 
 typedef struct SysvStub {
         char *name;
@@ -751,6 +753,9 @@ static int enumerate_sysv(const LookupPaths *lp, Hashmap *all_services) {
                 _cleanup_closedir_ DIR *d = NULL;
                 struct dirent *de;
 
+                if (strv_extend(&arg_inputs, *path) < 0)
+                        return log_oom();
+
                 d = opendir(*path);
                 if (!d) {
                         if (errno != ENOENT)
@@ -794,6 +799,9 @@ static int enumerate_sysv(const LookupPaths *lp, Hashmap *all_services) {
                         if (!fpath)
                                 return log_oom();
 
+                        if (strv_extend(&arg_inputs, fpath) < 0)
+                                return log_oom();
+
                         service = new0(SysvStub, 1);
                         if (!service)
                                 return log_oom();
@@ -838,6 +846,11 @@ static int set_dependencies_from_rcnd(const LookupPaths *lp, Hashmap *all_servic
                                 goto finish;
                         }
 
+                        if (strv_extend(&arg_inputs, path) < 0) {
+                                r = log_oom();
+                                goto finish;
+                        }
+
                         d = opendir(path);
                         if (!d) {
                                 if (errno != ENOENT)
@@ -980,6 +993,14 @@ int main(int argc, char *argv[]) {
                 goto finish;
         }
 
+        /* Scripts are skipped if a native unit exists, hence the unit
+         * directories are inputs too */
+        r = strv_extend_strv(&arg_inputs, lp.unit_path, false);
+        if (r < 0) {
+                log_oom();
+                goto finish;
+        }
+
         all_services = hashmap_new(&string_hash_ops);
         if (!all_services) {
                 r = log_oom();
@@ -1002,8 +1023,12 @@ int main(int argc, char *argv[]) {
                 (void) generate_unit_file(service);
         }
 
+        (void) generator_write_inputs(arg_inputs);
+
         r = 0;
 
 finish:
+        strv_free(arg_inputs);
+
         return r < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
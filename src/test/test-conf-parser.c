@@ -17,7 +17,12 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "conf-parser.h"
+#include "fd-util.h"
+#include "fileio.h"
 #include "log.h"
 #include "macro.h"
 #include "string-util.h"
@@ -215,6 +220,56 @@ static void test_config_parse_nsec(void) {
         test_config_parse_nsec_one("garbage", 0);
 }
 
+static void test_config_parse_tokens(void) {
+        char name[] = "/tmp/test-conf-parser.XXXXXX";
+        _cleanup_(config_tokens_freep) ConfigTokens *tokens = NULL;
+        _cleanup_strv_free_ char **strv = NULL;
+        _cleanup_free_ char *setting1 = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_close_ int fd = -1;
+
+        const ConfigTableItem items[] = {
+                { "Section", "setting1", config_parse_string, 0, &setting1 },
+                { "Section", "setting2", config_parse_strv,   0, &strv     },
+                {}
+        };
+
+        fd = mkostemp_safe(name, O_RDWR|O_CLOEXEC);
+        assert_se(fd >= 0);
+        assert_se(write(fd,
+                        "# comment\n"
+                        "[Section]\n"
+                        "setting1 = 1 \n"
+                        "setting2=a \\\n"
+                        "b\n"
+                        "[Ignored]\n"
+                        "setting1=2\n", 70) == 70);
+
+        assert_se(config_tokenize(name, NULL, &tokens) >= 0);
+
+        assert_se(config_parse_tokens(NULL, name, NULL, &tokens, "Section\0", config_item_table_lookup, items, true, false, true, NULL) >= 0);
+        assert_se(streq(setting1, "1"));
+        assert_se(strv_equal(strv, STRV_MAKE("a", "b")));
+
+        /* Stale tokens are ignored, and the file is read again */
+        assert_se(pwrite(fd, "3", 1, 31) == 1);
+        assert_se(ftruncate(fd, 34) >= 0);
+
+        assert_se(config_parse_tokens(NULL, name, NULL, &tokens, "Section\0", config_item_table_lookup, items, true, false, true, NULL) >= 0);
+        assert_se(streq(setting1, "3"));
+        assert_se(tokens->size == 34);
+
+        assert_se(pwrite(fd, "garbage\n", 8, 34) == 8);
+
+        assert_se(f = fdopen(fd, "re"));
+        fd = -1;
+        rewind(f);
+        assert_se(config_parse(NULL, name, f, "Section\0", config_item_table_lookup, items, true, false, true, NULL) == -EINVAL);
+        assert_se(streq(setting1, "3"));
+
+        unlink(name);
+}
+
 int main(int argc, char **argv) {
         log_parse_environment();
         log_open();
@@ -230,6 +285,7 @@ int main(int argc, char **argv) {
         test_config_parse_mode();
         test_config_parse_sec();
         test_config_parse_nsec();
+        test_config_parse_tokens();
 
         return 0;
 }
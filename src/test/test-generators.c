@@ -0,0 +1,159 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "alloc-util.h"
+#include "fileio.h"
+#include "fs-util.h"
+#include "generators.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "test-helper.h"
+
+static void write_generator(const char *path, const char *contents) {
+        assert_se(write_string_file(path, contents, WRITE_STRING_FILE_CREATE) == 0);
+        assert_se(chmod(path, 0755) >= 0);
+        set_mtime(path, -10);
+}
+
+static void run(Hashmap **generators, const char *dir, char **paths, const char *private, unsigned n) {
+        char normal[strlen(dir) + DECIMAL_STR_MAX(unsigned) + 9];
+        const char *output[3];
+
+        xsprintf(normal, "%s/output%u", dir, n);
+        output[0] = normal;
+        output[1] = strjoina(normal, "-early");
+        output[2] = strjoina(normal, "-late");
+
+        assert_se(generators_run(generators, paths, private, output, 10 * USEC_PER_SEC) >= 0);
+}
+
+static bool exists(const char *dir, const char *path) {
+        return access(strjoina(dir, "/", path), F_OK) >= 0;
+}
+
+static bool links_to(const char *dir, const char *path, const char *target) {
+        _cleanup_free_ char *s = NULL;
+
+        assert_se(readlink_malloc(strjoina(dir, "/", path), &s) >= 0);
+
+        return streq(s, strjoina(dir, "/", target));
+}
+
+static unsigned count_runs(const char *path) {
+        _cleanup_free_ char *s = NULL;
+        int r;
+
+        r = read_full_file(path, &s, NULL);
+        if (r == -ENOENT)
+                return 0;
+        assert_se(r >= 0);
+
+        return strlen(s);
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_(generators_freep) Hashmap *generators = NULL;
+        char dir[] = "/tmp/test-generators.XXXXXX";
+        _cleanup_free_ char *a = NULL, *b = NULL;
+        const char *bin, *private, *input, *counter_a, *counter_b;
+        Generator *g;
+
+        assert_se(mkdtemp(dir));
+
+        bin = strjoina(dir, "/bin");
+        private = strjoina(dir, "/private");
+        input = strjoina(dir, "/input.conf");
+        counter_a = strjoina(dir, "/counter-a");
+        counter_b = strjoina(dir, "/counter-b");
+        assert_se(mkdir(bin, 0755) >= 0);
+
+        assert_se(write_string_file(input, "x", WRITE_STRING_FILE_CREATE) == 0);
+        set_mtime(input, -10);
+
+        /* One generator declares its inputs, the other one does not */
+        assert_se(asprintf(&a,
+                           "#!/bin/sh\n"
+                           "echo %s > \"$SYSTEMD_GENERATOR_INPUTS\"\n"
+                           "printf x >> %s\n"
+                           "touch \"$1/a.service\"\n"
+                           "mkdir \"$1/foo.target.wants\"\n"
+                           "ln -s \"$1/a.service\" \"$1/foo.target.wants/a.service\"\n",
+                           input, counter_a) >= 0);
+        assert_se(asprintf(&b,
+                           "#!/bin/sh\n"
+                           "printf x >> %s\n"
+                           "touch \"$3/b.service\"\n",
+                           counter_b) >= 0);
+        write_generator(strjoina(bin, "/a"), a);
+        write_generator(strjoina(bin, "/b"), b);
+
+        run(&generators, dir, STRV_MAKE(bin), private, 0);
+        assert_se(count_runs(counter_a) == 1);
+        assert_se(count_runs(counter_b) == 1);
+        assert_se(exists(dir, "output0/a.service"));
+        assert_se(exists(dir, "output0-late/b.service"));
+        assert_se(links_to(dir, "output0/foo.target.wants/a.service", "output0/a.service"));
+
+        g = hashmap_get(generators, "a");
+        assert_se(g && !g->reused && g->cacheable && g->duration > 0);
+
+        /* The output of the first one is reused */
+        run(&generators, dir, STRV_MAKE(bin), private, 1);
+        assert_se(count_runs(counter_a) == 1);
+        assert_se(count_runs(counter_b) == 2);
+        assert_se(exists(dir, "output1/a.service"));
+        assert_se(exists(dir, "output1-late/b.service"));
+        assert_se(links_to(dir, "output1/foo.target.wants/a.service", "output1/a.service"));
+
+        g = hashmap_get(generators, "a");
+        assert_se(g && g->reused && g->duration == 0);
+        g = hashmap_get(generators, "b");
+        assert_se(g && !g->reused && !g->cacheable);
+
+        /* Until its input changes */
+        assert_se(write_string_file(input, "yy", WRITE_STRING_FILE_CREATE) == 0);
+        set_mtime(input, -5);
+
+        run(&generators, dir, STRV_MAKE(bin), private, 2);
+        assert_se(count_runs(counter_a) == 2);
+        assert_se(exists(dir, "output2/a.service"));
+
+        g = hashmap_get(generators, "a");
+        assert_se(g && !g->reused);
+
+        /* A removed generator is forgotten, along with its output */
+        assert_se(unlink(strjoina(bin, "/b")) >= 0);
+
+        run(&generators, dir, STRV_MAKE(bin), private, 3);
+        assert_se(count_runs(counter_a) == 2);
+        assert_se(!exists(dir, "output3-late/b.service"));
+        assert_se(!hashmap_get(generators, "b"));
+        assert_se(access(strjoina(private, "/b"), F_OK) < 0);
+
+        (void) rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+
+        return 0;
+}
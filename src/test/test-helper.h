@@ -21,6 +21,10 @@
   along with systemd; If not, see <http://www.gnu.org/licenses/>.
 ***/
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <time.h>
+
 #include "sd-daemon.h"
 
 #include "macro.h"
@@ -41,3 +45,16 @@
                -ENOENT,                                         \
                -ENOMEDIUM /* cannot determine cgroup */         \
                )
+
+/* Sets the timestamps of a file to delta seconds from now. Files
+ * modified right before they are read are not trusted to stay as they
+ * were (see mtime_is_racy()), so tests move them to the past, or to
+ * the future to make a change stand out. */
+static inline void set_mtime(const char *path, int delta) {
+        struct timespec ts[2];
+
+        assert_se(clock_gettime(CLOCK_REALTIME, &ts[0]) >= 0);
+        ts[0].tv_sec += delta;
+        ts[1] = ts[0];
+        assert_se(utimensat(AT_FDCWD, path, ts, 0) >= 0);
+}
@@ -0,0 +1,122 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fileio.h"
+#include "manager.h"
+#include "parse-util.h"
+#include "rm-rf.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "test-helper.h"
+
+#define N_UNITS_DEFAULT 128U
+
+int main(int argc, char *argv[]) {
+        char dir[] = "/tmp/test-load-prefetch.XXXXXX";
+        char path[PATH_MAX], target[PATH_MAX], contents[LINE_MAX];
+        Manager *m = NULL;
+        unsigned n = N_UNITS_DEFAULT, k;
+        Unit *u;
+        int r;
+
+        /* Loads a target pulling in many services with drop-ins, so
+         * that their files are read by the prefetch threads, and
+         * checks that all settings made it, no matter which thread
+         * read which file, optionally with the number of services
+         * as argument. The threads only start after the first 16
+         * units. */
+
+        if (argc > 1)
+                assert_se(safe_atou(argv[1], &n) >= 0 && n > 0);
+
+        assert_se(mkdtemp(dir));
+
+        xsprintf(path, "%s/prefetch.target", dir);
+        assert_se(write_string_file(path, "[Unit]\nDescription=Prefetch\n", WRITE_STRING_FILE_CREATE) == 0);
+
+        xsprintf(path, "%s/prefetch.target.wants", dir);
+        assert_se(mkdir(path, 0755) >= 0);
+
+        for (k = 0; k < n; k++) {
+                xsprintf(path, "%s/prefetch-%u.service", dir, k);
+                xsprintf(contents,
+                         "[Unit]\nDescription=Prefetch %u\n"
+                         "[Service]\nExecStart=/bin/true \\\n    %u\n", k, k);
+                assert_se(write_string_file(path, contents, WRITE_STRING_FILE_CREATE) == 0);
+
+                xsprintf(path, "%s/prefetch-%u.service.d", dir, k);
+                assert_se(mkdir(path, 0755) >= 0);
+
+                xsprintf(path, "%s/prefetch-%u.service.d/override.conf", dir, k);
+                assert_se(write_string_file(path, "[Service]\nRemainAfterExit=yes\n", WRITE_STRING_FILE_CREATE) == 0);
+
+                xsprintf(target, "%s/prefetch-%u.service", dir, k);
+                xsprintf(path, "%s/prefetch.target.wants/prefetch-%u.service", dir, k);
+                assert_se(symlink(target, path) >= 0);
+        }
+
+        assert_se(set_unit_path(dir) >= 0);
+        r = manager_new(MANAGER_USER, true, &m);
+        if (MANAGER_SKIP_TEST(r)) {
+                printf("Skipping test: manager_new: %s\n", strerror(-r));
+                (void) rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+                return EXIT_TEST_SKIP;
+        }
+        assert_se(r >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        assert_se(manager_load_unit(m, "prefetch.target", NULL, NULL, &u) >= 0);
+
+        assert_se(!m->load_prefetch);
+
+        /* With a single CPU everything is read by the main thread.
+         * Otherwise how much the threads got to depends on timing,
+         * but never more than there is: a fragment and a drop-in for
+         * each service. */
+        if (sysconf(_SC_NPROCESSORS_ONLN) > 1)
+                assert_se(m->n_unit_files_prefetched <= 2 * n);
+        else
+                assert_se(m->n_unit_files_prefetched == 0);
+
+        for (k = 0; k < n; k++) {
+                Service *s;
+
+                xsprintf(path, "prefetch-%u.service", k);
+                assert_se(u = manager_get_unit(m, path));
+                assert_se(u->load_state == UNIT_LOADED);
+
+                xsprintf(contents, "Prefetch %u", k);
+                assert_se(streq(u->description, contents));
+
+                s = SERVICE(u);
+                assert_se(s->remain_after_exit);
+                assert_se(s->exec_command[SERVICE_EXEC_START]);
+                assert_se(strv_length(s->exec_command[SERVICE_EXEC_START]->argv) == 2);
+        }
+
+        manager_free(m);
+        (void) rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+
+        return 0;
+}
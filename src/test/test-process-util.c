@@ -37,6 +37,7 @@ static void test_get_process_comm(void) {
         _cleanup_free_ char *a = NULL, *c = NULL, *d = NULL, *f = NULL, *i = NULL, *cwd = NULL, *root = NULL;
         _cleanup_free_ char *env = NULL;
         pid_t e;
+        unsigned long long st1, st2;
         uid_t u;
         gid_t g;
         dev_t h;
@@ -59,6 +60,11 @@ static void test_get_process_comm(void) {
         log_info("pid1 ppid: "PID_FMT, e);
         assert_se(e == 0);
 
+        assert_se(get_process_starttime(1, &st1) >= 0);
+        log_info("pid1 starttime: %llu", st1);
+        assert_se(get_process_starttime(getpid(), &st2) >= 0);
+        assert_se(st1 <= st2);
+
         assert_se(is_kernel_thread(1) == 0);
 
         r = get_process_exe(1, &f);
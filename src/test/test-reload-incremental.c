@@ -0,0 +1,121 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fileio.h"
+#include "manager.h"
+#include "rm-rf.h"
+#include "string-util.h"
+#include "test-helper.h"
+
+static void write_unit(const char *dir, const char *name, const char *contents) {
+        const char *p;
+
+        p = strjoina(dir, "/", name);
+        assert_se(write_string_file(p, contents, WRITE_STRING_FILE_CREATE) == 0);
+
+        /* Make sure the change is noticed even on file systems with
+         * coarse timestamps */
+        set_mtime(p, 10);
+}
+
+int main(int argc, char *argv[]) {
+        char dir[] = "/tmp/test-reload-incremental.XXXXXX";
+        Manager *m = NULL;
+        Unit *a, *b, *c, *d;
+        usec_t t;
+        int r;
+
+        assert_se(mkdtemp(dir));
+
+        write_unit(dir, "a.service",
+                   "[Unit]\nDescription=A1\nWants=b.service\nAfter=b.service\n"
+                   "[Service]\nExecStart=/bin/true\n");
+        write_unit(dir, "b.service",
+                   "[Service]\nExecStart=/bin/true\n");
+        write_unit(dir, "c.service",
+                   "[Unit]\nRequires=a.service\nAfter=a.service\nWants=d.service\n"
+                   "[Service]\nExecStart=/bin/true\n");
+
+        assert_se(set_unit_path(dir) >= 0);
+        r = manager_new(MANAGER_USER, true, &m);
+        if (MANAGER_SKIP_TEST(r)) {
+                printf("Skipping test: manager_new: %s\n", strerror(-r));
+                (void) rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+                return EXIT_TEST_SKIP;
+        }
+        assert_se(r >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        assert_se(manager_load_unit(m, "c.service", NULL, NULL, &c) >= 0);
+        assert_se(a = manager_get_unit(m, "a.service"));
+        assert_se(b = manager_get_unit(m, "b.service"));
+        assert_se(set_contains(a->dependencies[UNIT_WANTS], b));
+        assert_se(set_contains(c->dependencies[UNIT_REQUIRES], a));
+        assert_se(d = manager_get_unit(m, "d.service"));
+        assert_se(d->load_state == UNIT_NOT_FOUND);
+
+        /* Drop a's own dependencies, c's dependency on a has to survive */
+        write_unit(dir, "a.service",
+                   "[Unit]\nDescription=A2\n"
+                   "[Service]\nExecStart=/bin/true\n");
+
+        assert_se(manager_reload_incremental(m) >= 0);
+
+        assert_se(manager_get_unit(m, "b.service") == b);
+        assert_se(manager_get_unit(m, "c.service") == c);
+        assert_se(a = manager_get_unit(m, "a.service"));
+        assert_se(streq(a->description, "A2"));
+
+        assert_se(!set_contains(a->dependencies[UNIT_WANTS], b));
+        assert_se(!set_contains(a->dependencies[UNIT_AFTER], b));
+        assert_se(!set_contains(b->dependencies[UNIT_WANTED_BY], a));
+
+        assert_se(set_contains(c->dependencies[UNIT_REQUIRES], a));
+        assert_se(set_contains(c->dependencies[UNIT_AFTER], a));
+        assert_se(set_contains(a->dependencies[UNIT_REQUIRED_BY], c));
+        assert_se(set_contains(a->dependencies[UNIT_BEFORE], c));
+
+        /* Nothing changed, nothing is loaded again, not even the
+         * unit that doesn't exist */
+        t = d->load_timestamp;
+        assert_se(manager_reload_incremental(m) >= 0);
+        assert_se(manager_get_unit(m, "a.service") == a);
+        assert_se(manager_get_unit(m, "d.service") == d);
+        assert_se(d->load_state == UNIT_NOT_FOUND);
+        assert_se(d->load_timestamp == t);
+
+        /* Until it does */
+        write_unit(dir, "d.service",
+                   "[Unit]\nDescription=D\n"
+                   "[Service]\nExecStart=/bin/true\n");
+
+        assert_se(manager_reload_incremental(m) >= 0);
+        assert_se(d = manager_get_unit(m, "d.service"));
+        assert_se(d->load_state == UNIT_LOADED);
+        assert_se(streq(d->description, "D"));
+        assert_se(set_contains(c->dependencies[UNIT_WANTS], d));
+
+        manager_free(m);
+        (void) rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+
+        return 0;
+}
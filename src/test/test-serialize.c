@@ -0,0 +1,243 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "alloc-util.h"
+#include "cgroup.h"
+#include "fd-util.h"
+#include "fdset.h"
+#include "log.h"
+#include "manager.h"
+#include "parse-util.h"
+#include "stdio-util.h"
+#include "string-util.h"
+#include "strv.h"
+#include "test-helper.h"
+#include "time-util.h"
+
+/* Small by default, when called with "bench" and optionally a number
+ * of units this measures how long a daemon-reload keeps the manager
+ * busy with serializing and deserializing its state */
+static unsigned arg_units = 16;
+static bool arg_bench = false;
+
+static void set_state(Unit **units, unsigned n) {
+        char path[sizeof("/test-serialize.slice/") + UNIT_NAME_MAX];
+        unsigned k;
+
+        for (k = 0; k < n; k++) {
+                units[k]->active_enter_timestamp = (dual_timestamp) { k + 1, k + 2 };
+                units[k]->condition_timestamp = (dual_timestamp) { k + 3, k + 4 };
+                units[k]->condition_result = k % 2;
+                units[k]->transient = k % 3 == 0;
+                units[k]->cgroup_realized = k % 5 == 0;
+                units[k]->cpuacct_usage_base = k;
+
+                xsprintf(path, "/test-serialize.slice/%s", units[k]->id);
+                assert_se(unit_set_cgroup_path(units[k], path) >= 0);
+        }
+}
+
+static void reset_state(Unit **units, unsigned n) {
+        unsigned k;
+
+        for (k = 0; k < n; k++) {
+                units[k]->active_enter_timestamp = (dual_timestamp) {};
+                units[k]->condition_timestamp = (dual_timestamp) {};
+                units[k]->condition_result = false;
+                units[k]->transient = false;
+                units[k]->cgroup_realized = false;
+                units[k]->cpuacct_usage_base = 0;
+
+                assert_se(unit_set_cgroup_path(units[k], NULL) >= 0);
+        }
+}
+
+static bool has_state(Unit *u, unsigned k) {
+        char path[sizeof("/test-serialize.slice/") + UNIT_NAME_MAX];
+
+        xsprintf(path, "/test-serialize.slice/%s", u->id);
+
+        return u->active_enter_timestamp.realtime == k + 1 &&
+               u->active_enter_timestamp.monotonic == k + 2 &&
+               u->condition_timestamp.realtime == k + 3 &&
+               u->condition_timestamp.monotonic == k + 4 &&
+               u->condition_result == (k % 2) &&
+               u->transient == (k % 3 == 0) &&
+               u->cgroup_realized == (k % 5 == 0) &&
+               u->cpuacct_usage_base == k &&
+               streq_ptr(u->cgroup_path, path);
+}
+
+static void serialize(Manager *m, FILE **ret, FDSet **ret_fds, bool binary) {
+        _cleanup_fdset_free_ FDSet *fds = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+
+        assert_se(manager_open_serialization(m, &f) >= 0);
+        assert_se(fds = fdset_new());
+
+        if (binary)
+                assert_se(manager_serialize_binary(m, f, fds) >= 0);
+        else
+                assert_se(manager_serialize(m, f, fds, false) >= 0);
+
+        *ret = f;
+        *ret_fds = fds;
+        f = NULL;
+        fds = NULL;
+}
+
+static void test_round_trip(Manager *m, Unit **units, unsigned n, bool binary) {
+        _cleanup_fdset_free_ FDSet *fds = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        usec_t t0, t1, t2, t3;
+        off_t size;
+        unsigned k;
+
+        set_state(units, n);
+
+        t0 = now(CLOCK_MONOTONIC);
+        serialize(m, &f, &fds, binary);
+        t1 = now(CLOCK_MONOTONIC);
+
+        assert_se((size = ftello(f)) > 0);
+
+        reset_state(units, n);
+
+        assert_se(fseeko(f, 0, SEEK_SET) >= 0);
+
+        t2 = now(CLOCK_MONOTONIC);
+        assert_se(manager_deserialize(m, f, fds) >= 0);
+        t3 = now(CLOCK_MONOTONIC);
+
+        for (k = 0; k < n; k++)
+                assert_se(has_state(units[k], k));
+
+        if (arg_bench)
+                printf("%-6s serialize %6llu ns/unit  deserialize %6llu ns/unit  %8llu bytes\n",
+                       binary ? "binary" : "text",
+                       (unsigned long long) ((t1 - t0) * NSEC_PER_USEC / n),
+                       (unsigned long long) ((t3 - t2) * NSEC_PER_USEC / n),
+                       (unsigned long long) size);
+}
+
+static int deserialize_buffer(Manager *m, const uint8_t *buf, size_t size, FDSet *fds) {
+        _cleanup_fclose_ FILE *f = NULL;
+
+        assert_se(manager_open_serialization(m, &f) >= 0);
+        assert_se(fwrite(buf, 1, size, f) == size);
+        assert_se(fflush(f) == 0);
+        assert_se(fseeko(f, 0, SEEK_SET) >= 0);
+
+        return manager_deserialize(m, f, fds);
+}
+
+static void test_bad_input(Manager *m, Unit **units, unsigned n) {
+        _cleanup_fdset_free_ FDSet *fds = NULL;
+        _cleanup_fclose_ FILE *f = NULL;
+        _cleanup_free_ uint8_t *buf = NULL;
+        size_t size, i;
+        int level;
+
+        /* The binary format locates the unit records through the
+         * index at the end, hence it has to be careful with offsets
+         * and sizes it finds there */
+
+        /* Every cut off env= item would add another variable */
+        m->environment = strv_free(m->environment);
+
+        set_state(units, n);
+        serialize(m, &f, &fds, true);
+
+        size = (size_t) ftello(f);
+        assert_se(buf = malloc(size));
+        assert_se(fseeko(f, 0, SEEK_SET) >= 0);
+        assert_se(fread(buf, 1, size, f) == size);
+
+        level = log_get_max_level();
+        log_set_max_level(LOG_CRIT);
+
+        /* Cut off anywhere, the index is incomplete or missing */
+        for (i = 1; i < size; i++)
+                assert_se(deserialize_buffer(m, buf, i, fds) < 0);
+
+        /* Garbage anywhere is either refused or ignored, never
+         * followed out of the buffer */
+        for (i = 0; i < size; i++) {
+                uint8_t c = buf[i];
+
+                buf[i] = 0xff;
+                (void) deserialize_buffer(m, buf, size, fds);
+                buf[i] = c;
+        }
+
+        log_set_max_level(level);
+
+        /* And the intact state still reads back fine afterwards */
+        reset_state(units, n);
+        assert_se(deserialize_buffer(m, buf, size, fds) >= 0);
+        for (i = 0; i < n; i++)
+                assert_se(has_state(units[i], i));
+}
+
+int main(int argc, char *argv[]) {
+        _cleanup_free_ Unit **units = NULL;
+        Manager *m = NULL;
+        unsigned k;
+        int r;
+
+        if (argc > 1 && streq(argv[1], "bench")) {
+                arg_bench = true;
+                arg_units = 2000;
+
+                if (argc > 2)
+                        assert_se(safe_atou(argv[2], &arg_units) >= 0 && arg_units > 0);
+        }
+
+        assert_se(set_unit_path(TEST_DIR) >= 0);
+        r = manager_new(MANAGER_USER, true, &m);
+        if (MANAGER_SKIP_TEST(r)) {
+                printf("Skipping test: manager_new: %s\n", strerror(-r));
+                return EXIT_TEST_SKIP;
+        }
+        assert_se(r >= 0);
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        assert_se(units = new(Unit*, arg_units));
+
+        for (k = 0; k < arg_units; k++) {
+                char name[UNIT_NAME_MAX];
+
+                xsprintf(name, "bench-%u.service", k);
+                assert_se(manager_load_unit(m, name, NULL, NULL, &units[k]) >= 0);
+        }
+
+        test_round_trip(m, units, arg_units, false);
+        test_round_trip(m, units, arg_units, true);
+
+        if (!arg_bench)
+                test_bad_input(m, units, arg_units);
+
+        manager_free(m);
+
+        return 0;
+}
@@ -0,0 +1,168 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <stdlib.h>
+
+#include "alloc-util.h"
+#include "timer-wheel.h"
+#include "util.h"
+
+#define N_ENTRIES 1024*4
+
+struct test {
+        TimerWheelEntry entry;
+        bool removed;
+        bool fired;
+};
+
+static usec_t random_key(usec_t start) {
+        /* Spread the keys over all levels */
+        return start + (((usec_t) rand() << 31 | (usec_t) rand()) >> (rand() % 62));
+}
+
+static void test_basic(void) {
+        TimerWheelEntry a = { .slot = TIMER_WHEEL_SLOT_NULL }, b = { .slot = TIMER_WHEEL_SLOT_NULL };
+        TimerWheel *w;
+
+        assert_se(timer_wheel_peek(NULL) == USEC_INFINITY);
+        assert_se(timer_wheel_first_due(NULL, USEC_INFINITY) == NULL);
+        assert_se(timer_wheel_size(NULL) == 0);
+
+        w = timer_wheel_new();
+        assert_se(w);
+
+        assert_se(timer_wheel_peek(w) == USEC_INFINITY);
+
+        timer_wheel_put(w, &a, 5 * USEC_PER_SEC);
+        timer_wheel_put(w, &b, 5 * USEC_PER_SEC + 1);
+        assert_se(timer_wheel_size(w) == 2);
+        assert_se(timer_wheel_peek(w) == 5 * USEC_PER_SEC);
+
+        /* Removing the minimum finds the next one */
+        timer_wheel_remove(w, &a);
+        assert_se(a.slot == TIMER_WHEEL_SLOT_NULL);
+        assert_se(timer_wheel_peek(w) == 5 * USEC_PER_SEC + 1);
+
+        /* Removing twice is fine */
+        timer_wheel_remove(w, &a);
+        assert_se(timer_wheel_size(w) == 1);
+
+        assert_se(timer_wheel_first_due(w, 5 * USEC_PER_SEC) == NULL);
+        assert_se(timer_wheel_first_due(w, 5 * USEC_PER_SEC + 1) == &b);
+
+        timer_wheel_advance(w, 6 * USEC_PER_SEC);
+
+        /* Keys before the base are due right away */
+        timer_wheel_put(w, &a, 1);
+        assert_se(timer_wheel_peek(w) == 1);
+        assert_se(timer_wheel_first_due(w, 1) == &a);
+        timer_wheel_remove(w, &a);
+
+        /* Going backwards in time changes nothing */
+        timer_wheel_advance(w, 1);
+        assert_se(timer_wheel_first_due(w, 5 * USEC_PER_SEC + 1) == &b);
+
+        timer_wheel_remove(w, &b);
+        assert_se(timer_wheel_size(w) == 0);
+        assert_se(timer_wheel_peek(w) == USEC_INFINITY);
+
+        timer_wheel_free(w);
+}
+
+static void test_order(usec_t start) {
+        struct test *t;
+        TimerWheel *w;
+        usec_t n, previous = 0;
+        unsigned i, left = N_ENTRIES;
+
+        srand(0);
+
+        t = new0(struct test, N_ENTRIES);
+        assert_se(t);
+
+        w = timer_wheel_new();
+        assert_se(w);
+
+        timer_wheel_advance(w, start);
+
+        for (i = 0; i < N_ENTRIES; i++) {
+                t[i].entry.slot = TIMER_WHEEL_SLOT_NULL;
+                timer_wheel_put(w, &t[i].entry, random_key(start));
+        }
+
+        for (i = 0; i < N_ENTRIES; i += 4) {
+                timer_wheel_remove(w, &t[i].entry);
+                t[i].removed = true;
+                left--;
+        }
+
+        assert_se(timer_wheel_size(w) == left);
+
+        /* Run the clock forward, sometimes exactly to the next key,
+         * sometimes further, like an event loop would, and check that
+         * everything fires exactly once and nothing is left behind */
+        for (;;) {
+                TimerWheelEntry *e;
+
+                n = timer_wheel_peek(w);
+                if (n == USEC_INFINITY)
+                        break;
+
+                assert_se(n >= previous);
+
+                if (rand() % 2)
+                        n = random_key(n);
+
+                timer_wheel_advance(w, n);
+
+                while ((e = timer_wheel_first_due(w, n))) {
+                        struct test *x = container_of(e, struct test, entry);
+
+                        assert_se(!x->removed);
+                        assert_se(!x->fired);
+                        assert_se(e->key <= n);
+                        x->fired = true;
+
+                        timer_wheel_remove(w, e);
+                        left--;
+                }
+
+                assert_se(timer_wheel_peek(w) > n);
+                previous = n;
+        }
+
+        assert_se(left == 0);
+        assert_se(timer_wheel_size(w) == 0);
+
+        for (i = 0; i < N_ENTRIES; i++)
+                assert_se(t[i].removed != t[i].fired);
+
+        timer_wheel_free(w);
+        free(t);
+}
+
+int main(int argc, char* argv[]) {
+
+        test_basic();
+        test_order(0);
+        test_order(now(CLOCK_MONOTONIC));
+        test_order(now(CLOCK_REALTIME));
+
+        return 0;
+}
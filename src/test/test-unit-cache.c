@@ -0,0 +1,170 @@
+/*-*- Mode: C; c-basic-offset: 8; indent-tabs-mode: nil -*-*/
+
+/***
+  This file is part of systemd.
+
+  systemd is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as published by
+  the Free Software Foundation; either version 2.1 of the License, or
+  (at your option) any later version.
+
+  systemd is distributed in the hope that it will be useful, but
+  WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+  Lesser General Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public License
+  along with systemd; If not, see <http://www.gnu.org/licenses/>.
+***/
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+#include "fd-util.h"
+#include "fileio.h"
+#include "manager.h"
+#include "rm-rf.h"
+#include "stat-util.h"
+#include "string-util.h"
+#include "test-helper.h"
+
+static void write_unit(const char *dir, const char *name, const char *contents, int delta) {
+        const char *p;
+
+        p = strjoina(dir, "/", name);
+        assert_se(write_string_file(p, contents, WRITE_STRING_FILE_CREATE) == 0);
+        set_mtime(p, delta);
+}
+
+static bool is_tmpfs(const char *path) {
+        struct statfs sfs;
+
+        return statfs(path, &sfs) >= 0 && is_temporary_fs(&sfs);
+}
+
+static Manager *load(const char *cache, const char *description, bool volatile_units, unsigned *directory_hits, unsigned *file_hits) {
+        Manager *m = NULL;
+        Unit *u;
+
+        assert_se(manager_new(MANAGER_USER, true, &m) >= 0);
+        m->unit_cache_path = cache;
+        assert_se(manager_startup(m, NULL, NULL) >= 0);
+
+        assert_se(manager_load_unit(m, "a.service", NULL, NULL, &u) >= 0);
+        assert_se(u->load_state == UNIT_LOADED);
+        assert_se(streq(u->description, description));
+        assert_se(SERVICE(u)->remain_after_exit);
+
+        if (volatile_units) {
+                assert_se(manager_load_unit(m, "c.service", NULL, NULL, &u) >= 0);
+                assert_se(u->load_state == UNIT_LOADED);
+        }
+
+        unit_cache_hits(m->unit_cache, directory_hits, file_hits);
+
+        assert_se(manager_write_unit_cache(m) >= 0);
+        assert_se(!unit_cache_collecting(m->unit_cache));
+
+        return m;
+}
+
+int main(int argc, char *argv[]) {
+        char dir[] = "/var/tmp/test-unit-cache.XXXXXX";
+        char shm[] = "/dev/shm/test-unit-cache.XXXXXX";
+        const char *units, *cache;
+        bool volatile_units;
+        unsigned directory_hits, file_hits;
+        _cleanup_close_ int fd = -1;
+        struct stat st;
+        Manager *m = NULL;
+        Unit *u;
+        int r;
+
+        assert_se(mkdtemp(dir));
+
+        /* Only files on disk are cached */
+        if (is_tmpfs(dir)) {
+                printf("Skipping test: %s is on tmpfs\n", dir);
+                (void) rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+                return EXIT_TEST_SKIP;
+        }
+
+        /* Units on tmpfs never are, if we can try that */
+        volatile_units = is_tmpfs("/dev/shm") && mkdtemp(shm);
+
+        units = strjoina(dir, "/units");
+        cache = strjoina(dir, "/cache/unit-cache");
+        assert_se(mkdir(units, 0755) >= 0);
+        assert_se(mkdir(strjoina(units, "/a.service.d"), 0755) >= 0);
+
+        write_unit(units, "a.service", "[Unit]\nDescription=A1\n[Service]\nExecStart=/bin/true\n", -10);
+        write_unit(units, "a.service.d/override.conf", "[Service]\nRemainAfterExit=yes\n", -10);
+        set_mtime(units, -10);
+
+        if (volatile_units) {
+                write_unit(shm, "c.service", "[Service]\nExecStart=/bin/true\n", -10);
+                set_mtime(shm, -10);
+        }
+
+        assert_se(set_unit_path(volatile_units ? strjoina(units, ":", shm) : units) >= 0);
+        r = manager_new(MANAGER_USER, true, &m);
+        if (MANAGER_SKIP_TEST(r)) {
+                printf("Skipping test: manager_new: %s\n", strerror(-r));
+                (void) rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+                if (volatile_units)
+                        (void) rm_rf(shm, REMOVE_ROOT|REMOVE_PHYSICAL);
+                return EXIT_TEST_SKIP;
+        }
+        assert_se(r >= 0);
+        manager_free(m);
+
+        /* Nothing cached yet, but afterwards */
+        m = load(cache, "A1", volatile_units, &directory_hits, &file_hits);
+        assert_se(directory_hits == 0 && file_hits == 0);
+        manager_free(m);
+
+        assert_se(stat(cache, &st) >= 0);
+        assert_se((st.st_mode & 0777) == 0600);
+
+        m = load(cache, "A1", volatile_units, &directory_hits, &file_hits);
+        assert_se(directory_hits == 1 && file_hits == 2);
+        manager_free(m);
+
+        /* A changed file is read again, a changed directory too */
+        write_unit(units, "a.service", "[Unit]\nDescription=A2\n[Service]\nExecStart=/bin/true\n", -5);
+        write_unit(units, "b.service", "[Service]\nExecStart=/bin/true\n", -5);
+        set_mtime(units, -5);
+
+        m = load(cache, "A2", volatile_units, &directory_hits, &file_hits);
+        assert_se(directory_hits == 0 && file_hits == 1);
+        assert_se(manager_load_unit(m, "b.service", NULL, NULL, &u) >= 0);
+        assert_se(u->load_state == UNIT_LOADED);
+        manager_free(m);
+
+        /* A cache others can write to is not used */
+        assert_se(chmod(cache, 0666) >= 0);
+        m = load(cache, "A2", volatile_units, &directory_hits, &file_hits);
+        assert_se(directory_hits == 0 && file_hits == 0);
+        manager_free(m);
+
+        /* A corrupted one does no harm */
+        fd = open(cache, O_WRONLY|O_CLOEXEC);
+        assert_se(fd >= 0);
+        assert_se(fstat(fd, &st) >= 0);
+        assert_se(pwrite(fd, "\377\377\377\377\377\377\377\377", 8, st.st_size - 16) == 8);
+        assert_se(pwrite(fd, "\377\377\377\377\377\377\377\377", 8, 40) == 8);
+
+        m = load(cache, "A2", volatile_units, &directory_hits, &file_hits);
+        assert_se(directory_hits == 0 && file_hits == 0);
+        manager_free(m);
+
+        (void) rm_rf(dir, REMOVE_ROOT|REMOVE_PHYSICAL);
+        if (volatile_units)
+                (void) rm_rf(shm, REMOVE_ROOT|REMOVE_PHYSICAL);
+
+        return 0;
+}